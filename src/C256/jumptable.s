@@ -51,6 +51,9 @@
 	.public sjt_txt_set_border_color
 	.public sjt_txt_put
 	.public sjt_txt_print
+	.public sjt_bdev_read_multi
+	.public sjt_bdev_write_multi
+	.public sjt_bdev_stats
 
 	.extern int_enable_all
 	.extern int_disable_all
@@ -105,6 +108,9 @@
 	.extern txt_set_border_color
 	.extern txt_put
 	.extern txt_print
+	.extern bdev_read_multi
+	.extern bdev_write_multi
+	.extern bdev_stats
 
 	.section jumptable
 
@@ -161,3 +167,6 @@ sjt_txt_set_border:           	jmp long:txt_set_border
 sjt_txt_set_border_color:     	jmp long:txt_set_border_color
 sjt_txt_put:                  	jmp long:txt_put
 sjt_txt_print:                	jmp long:txt_print
+sjt_bdev_read_multi:          	jmp long:bdev_read_multi
+sjt_bdev_write_multi:         	jmp long:bdev_write_multi
+sjt_bdev_stats:               	jmp long:bdev_stats
@@ -51,6 +51,9 @@
 	.public sys_txt_set_border_color
 	.public sys_txt_put
 	.public sys_txt_print
+	.public sys_bdev_read_multi
+	.public sys_bdev_write_multi
+	.public sys_bdev_stats
 
 	.extern sjt_int_enable_all
 	.extern sjt_int_disable_all
@@ -105,6 +108,9 @@
 	.extern sjt_txt_set_border_color
 	.extern sjt_txt_put
 	.extern sjt_txt_print
+	.extern sjt_bdev_read_multi
+	.extern sjt_bdev_write_multi
+	.extern sjt_bdev_stats
 
 	.section farcode
 
@@ -161,3 +167,6 @@ sys_txt_set_border:           	jmp long:sjt_txt_set_border
 sys_txt_set_border_color:     	jmp long:sjt_txt_set_border_color
 sys_txt_put:                  	jmp long:sjt_txt_put
 sys_txt_print:                	jmp long:sjt_txt_print
+sys_bdev_read_multi:          	jmp long:sjt_bdev_read_multi
+sys_bdev_write_multi:         	jmp long:sjt_bdev_write_multi
+sys_bdev_stats:               	jmp long:sjt_bdev_stats
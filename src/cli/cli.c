@@ -127,12 +127,13 @@ const t_cli_command g_cli_commands[] = {
     { "CREDITS", "CREDITS : Print out the credits", cmd_credits },
     { "DASM", "DASM <addr> [<count>] : print a memory disassembly", mem_cmd_dasm },
     { "DEL", "DEL <path> : delete a file or directory", cmd_del },
-    { "DIR", "DIR <path> : print directory listing", cmd_dir },
+    { "DIR", "DIR [-n|-s|-d] [-r] [-w] <path> : list directory by name, size, or date", cmd_dir },
     { "DISKFILL", "DISKFILL <drive #> <sector #> <byte value>", cmd_diskfill },
     { "DISKREAD", "DISKREAD <drive #> <sector #>", cmd_diskread },
     { "DUMP", "DUMP <addr> [<count>] : print a memory dump", mem_cmd_dump},
     { "GETJIFFIES", "GETJIFFIES : print the number of jiffies since bootup", cmd_getjiffies },
     { "GETTICKS", "GETTICKS : print number of ticks since reset", cmd_get_ticks },
+    { "IOSTAT", "IOSTAT [-r] [<drive #>] : print (or reset) block device I/O statistics", cmd_iostat },
     { "LABEL", "LABEL <drive#> <label> : set the label of a drive", cmd_label },
     { "LOAD", "LOAD <path> : load a file into memory", cmd_load },
     { "MKBOOT", "MKBOOT <drive #> -r | -b <boot sector path> | -s <start file path> : make a drive bootable", cmd_mkboot },
@@ -7,6 +7,7 @@
 #include "syscalls.h"
 #include "log.h"
 #include "simpleio.h"
+#include "utilities.h"
 #include "cli.h"
 #include "proc.h"
 #include "boot.h"
@@ -90,6 +91,80 @@ short cmd_diskfill(short screen, int argc, const char * argv[]) {
     return cmd_diskread(screen, argc, argv);
 }
 
+/*
+ * Print the statistics for one kind of block device operation
+ */
+static void print_io_stats(short screen, const char * label, p_bdev_io_stats io) {
+    char buffer[128];
+    static const char * bucket_names[BDEV_STATS_BUCKETS] = { "0", "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64+" };
+    short i;
+
+    sprintf(buffer, "  %-5s ops: %lu  sectors: %lu  errors: %lu  jiffies: %lu\n", label, io->ops, io->sectors, io->errors, io->jiffies);
+    print(screen, buffer);
+
+    if (io->ops > 0) {
+        print(screen, "        latency:");
+        for (i = 0; i < BDEV_STATS_BUCKETS; i++) {
+            if (io->latency[i] > 0) {
+                sprintf(buffer, " %s:%lu", bucket_names[i], io->latency[i]);
+                print(screen, buffer);
+            }
+        }
+        print(screen, "\n");
+    }
+}
+
+/*
+ * Print the I/O statistics of the block devices (and the size of any free cluster map)
+ *
+ * IOSTAT [-r] [<drive #>]
+ */
+short cmd_iostat(short screen, int argc, const char * argv[]) {
+    char buffer[80];
+    t_bdev_stats stats;
+    short reset = 0;
+    short first = 0, last = BDEV_DEVICES_MAX - 1;
+    short i, dev;
+    long map_size;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            reset = 1;
+        } else if (isdigit(argv[i][0])) {
+            first = last = (short)cli_eval_number(argv[i]);
+        } else {
+            print(screen, "USAGE: IOSTAT [-r] [<drive #>]\n");
+            return -1;
+        }
+    }
+
+    for (dev = first; dev <= last; dev++) {
+        if (sys_bdev_stats(dev, &stats) != 0) {
+            // No device registered with that number
+            continue;
+        }
+
+        if (reset) {
+            sys_bdev_ioctrl(dev, BDEV_CTRL_STATS_RESET, 0, 0);
+            continue;
+        }
+
+        sprintf(buffer, "#%d %s  retries: %lu\n", dev, stats.name, stats.retries);
+        print(screen, buffer);
+        print_io_stats(screen, "read", &stats.read);
+        print_io_stats(screen, "write", &stats.write);
+        print_io_stats(screen, "flush", &stats.flush);
+
+        map_size = fsys_freemap_size(dev);
+        if (map_size > 0) {
+            sprintf(buffer, "  free cluster map: %ld bytes\n", map_size);
+            print(screen, buffer);
+        }
+    }
+
+    return 0;
+}
+
 
 /*
  * Try to run a command from storage.
@@ -211,55 +286,290 @@ short cmd_rename(short screen, int argc, const char * argv[]) {
 }
 
 /**
- * Structure to hold file and directory information for sorting
+ * Initial size of the arena DIR collects a directory's entries in
+ *
+ * The arena must always have room for one batch holding a name of the longest length.
  */
-typedef struct s_dir_entry {
-    t_file_info info;
-    struct s_dir_entry *next, *prev;
-} t_dir_entry, *p_dir_entry;
+#define DIR_ARENA_SIZE 4096
+
+/** Smallest gap the arena must have left for another batch of entries */
+#define DIR_ARENA_MIN_GAP (sizeof(t_dir_batch_entry) + FF_MAX_LFN + 1)
+
+/** Width of a screen whose size cannot be read */
+#define DIR_DEFAULT_WIDTH 80
 
 /**
- * Add a directory entry to a list of directory entries using simple insertion sort
+ * Arena holding every entry of a directory listing
  *
- * @param list_pointer a pointer to a pointer to a list of directory entries
- * @param entry a pointer to a directory entry to add
+ * The entries form one array at the front of the block, and their names are packed
+ * in from the back. Batches are read straight into the gap between the two, which
+ * leaves the array and the names contiguous, and the whole listing is released with
+ * a single free.
  */
-void dir_entry_insert(p_dir_entry * list_pointer, p_dir_entry entry) {
-    p_dir_entry list = *list_pointer;
+typedef struct s_dir_arena {
+    unsigned char * block;          /* The memory holding the entries and names */
+    unsigned long size;             /* Number of bytes in the block */
+    unsigned long count;            /* Number of entries in the array */
+    char * names;                   /* First byte of the packed names */
+} t_dir_arena, *p_dir_arena;
 
-    if (list == 0) {
-        *list_pointer = entry;
-        entry->next = 0;
-        entry->prev = 0;
+/**
+ * Make sure the arena has room for another batch, doubling it if it does not
+ *
+ * @param arena the arena to check
+ * @return 0 on success, ERR_OUT_OF_MEMORY if the arena could not grow
+ */
+static short dir_arena_reserve(p_dir_arena arena) {
+    p_dir_batch_entry entries = (p_dir_batch_entry)arena->block;
+    p_dir_batch_entry new_entries = 0;
+    unsigned char * new_block = 0;
+    char * new_names = 0;
+    unsigned long new_size = arena->size * 2;
+    unsigned long names_size = (arena->block + arena->size) - (unsigned char *)arena->names;
+    unsigned long i;
+
+    if ((unsigned long)(arena->names - (char *)&entries[arena->count]) >= DIR_ARENA_MIN_GAP) {
+        return 0;
+    }
 
-    } else {
-        p_dir_entry x = list;
-        while (x != 0) {
-            if (strcmp(x->info.name, entry->info.name) >= 0) {
-                if (x->prev == 0) {
-                    *list_pointer = entry;
-                    entry->next = x;
-                    entry->prev = 0;
-                    x->prev = entry;
+    new_block = (unsigned char *)malloc(new_size);
+    if (new_block == 0) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    // Move the array to the front and the names to the back, keeping each name at the same distance from the end
+    new_entries = (p_dir_batch_entry)new_block;
+    new_names = (char *)new_block + new_size - names_size;
+    memcpy(new_entries, entries, arena->count * sizeof(t_dir_batch_entry));
+    memcpy(new_names, arena->names, names_size);
+    for (i = 0; i < arena->count; i++) {
+        new_entries[i].name = new_names + (entries[i].name - arena->names);
+    }
+
+    free(arena->block);
+    arena->block = new_block;
+    arena->size = new_size;
+    arena->names = new_names;
+    return 0;
+}
+
+/**
+ * Read every entry of an open directory into the arena, leaving out hidden entries
+ *
+ * @param arena the arena to fill
+ * @param dir the handle of the open directory
+ * @param pattern the pattern the names must match (0 for all)
+ * @return 0 on success, negative number on error
+ */
+static short dir_arena_fill(p_dir_arena arena, short dir, const char * pattern) {
+    p_dir_batch_entry entries = 0;
+    p_dir_batch_entry batch = 0;
+    char * gap_end = 0;
+    short count = 0, i = 0;
+    short result = 0;
+
+    while (1) {
+        result = dir_arena_reserve(arena);
+        if (result != 0) {
+            return result;
+        }
+
+        // The batch goes into the gap: its entries follow ours, and its names end where ours start
+        entries = (p_dir_batch_entry)arena->block;
+        batch = &entries[arena->count];
+        gap_end = arena->names;
+        count = sys_fsys_readdir_batch(dir, batch, (unsigned long)(gap_end - (char *)batch), pattern, FSYS_SORT_NONE);
+        if (count <= 0) {
+            return count;
+        }
+
+        for (i = 0; i < count; i++) {
+            if (batch[i].name < arena->names) {
+                arena->names = batch[i].name;
+            }
+            if ((batch[i].attributes & AM_HID) == 0) {
+                entries[arena->count++] = batch[i];
+            }
+        }
+    }
+}
+
+/**
+ * Compare two directory entries for DIR's sort
+ *
+ * Directories always go ahead of files, and names break ties in the other keys.
+ *
+ * @param a the first entry
+ * @param b the second entry
+ * @param sort the FSYS_SORT_ key, possibly with FSYS_SORT_DESCENDING
+ * @return negative if a goes before b, positive if a goes after b, 0 if they are equal
+ */
+static short dir_compare(p_dir_batch_entry a, p_dir_batch_entry b, short sort) {
+    short result = (short)(b->attributes & AM_DIR) - (short)(a->attributes & AM_DIR);
+
+    if (result != 0) {
+        return result;
+    }
+
+    switch (sort & FSYS_SORT_KEY) {
+        case FSYS_SORT_SIZE:
+            result = (a->size < b->size) ? -1 : ((a->size > b->size) ? 1 : 0);
+            break;
+
+        case FSYS_SORT_DATE:
+            if (a->date != b->date) {
+                result = (a->date < b->date) ? -1 : 1;
+            } else if (a->time != b->time) {
+                result = (a->time < b->time) ? -1 : 1;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (result == 0) {
+        result = strcicmp(a->name, b->name);
+    }
+
+    return (sort & FSYS_SORT_DESCENDING) ? -result : result;
+}
+
+/**
+ * Sort directory entries with a bottom-up merge sort
+ *
+ * @param entries the entries to sort
+ * @param scratch room for as many entries, used while merging
+ * @param count the number of entries
+ * @param sort the FSYS_SORT_ key, possibly with FSYS_SORT_DESCENDING
+ */
+static void dir_sort(p_dir_batch_entry entries, p_dir_batch_entry scratch, unsigned long count, short sort) {
+    p_dir_batch_entry from = entries, to = scratch, swap = 0;
+    unsigned long width, left, middle, right, i, j, k;
+
+    for (width = 1; width < count; width *= 2) {
+        // Merge each pair of runs of width entries from one array into the other
+        for (left = 0; left < count; left += 2 * width) {
+            middle = (left + width < count) ? left + width : count;
+            right = (middle + width < count) ? middle + width : count;
+
+            i = left;
+            j = middle;
+            k = left;
+            while ((i < middle) && (j < right)) {
+                if (dir_compare(&from[j], &from[i], sort) < 0) {
+                    to[k++] = from[j++];
                 } else {
-                    entry->prev = x->prev;
-                    entry->next = x;
-                    x->prev->next = entry;
-                    x->prev = entry;
+                    to[k++] = from[i++];
                 }
-                return;
+            }
+            while (i < middle) {
+                to[k++] = from[i++];
+            }
+            while (j < right) {
+                to[k++] = from[j++];
+            }
+        }
+
+        swap = from;
+        from = to;
+        to = swap;
+    }
 
+    if (from != entries) {
+        memcpy(entries, from, count * sizeof(t_dir_batch_entry));
+    }
+}
+
+/**
+ * Print directory entries one per line, with their sizes and dates
+ *
+ * @param screen the channel to print to
+ * @param entries the entries to print
+ * @param count the number of entries
+ */
+static void dir_print_long(short screen, p_dir_batch_entry entries, unsigned long count) {
+    char buffer[80];
+    char size[16];
+    unsigned long i;
+
+    for (i = 0; i < count; i++) {
+        if (entries[i].attributes & AM_DIR) {
+            print(screen, entries[i].name);
+            print(screen, "/\n");
+
+        } else {
+            if (entries[i].size < 1024) {
+                sprintf(size, "%d B", (int)entries[i].size);
+            } else if (entries[i].size < 1024*1024) {
+                sprintf(size, "%d KB", (int)(entries[i].size / 1024));
             } else {
-                if (x->next == 0) {
-                    x->next = entry;
-                    entry->prev = x;
-                    entry->next = 0;
-                    return;
-                } else {
-                    x = x->next;
+                sprintf(size, "%d MB", (int)(entries[i].size / (1024*1024)));
+            }
+
+            // FAT dates count years from 1980
+            sprintf(buffer, "%-20.20s %-8s %04d-%02d-%02d %02d:%02d\n", entries[i].name, size,
+                1980 + (entries[i].date >> 9), (entries[i].date >> 5) & 0x0f, entries[i].date & 0x1f,
+                entries[i].time >> 11, (entries[i].time >> 5) & 0x3f);
+            print(screen, buffer);
+        }
+    }
+}
+
+/**
+ * Print the names of directory entries in columns, running down each column in turn
+ *
+ * @param screen the channel to print to
+ * @param entries the entries to print
+ * @param count the number of entries
+ */
+static void dir_print_wide(short screen, p_dir_batch_entry entries, unsigned long count) {
+    t_extent text_size, pixel_size;
+    unsigned long width = 0, columns = 0, rows = 0, row = 0, column = 0, i = 0, length = 0;
+    short screen_width = DIR_DEFAULT_WIDTH;
+
+    text_size.width = 0;
+    sys_txt_get_sizes(sys_chan_device(screen), &text_size, &pixel_size);
+    if (text_size.width > 0) {
+        screen_width = text_size.width;
+    }
+
+    // Each column is as wide as the longest name (with its '/'), plus two spaces
+    for (i = 0; i < count; i++) {
+        length = strlen(entries[i].name) + ((entries[i].attributes & AM_DIR) ? 1 : 0);
+        if (length > width) {
+            width = length;
+        }
+    }
+    width += 2;
+
+    columns = screen_width / width;
+    if (columns == 0) {
+        columns = 1;
+    }
+    rows = (count + columns - 1) / columns;
+
+    for (row = 0; row < rows; row++) {
+        for (column = 0; column < columns; column++) {
+            i = column * rows + row;
+            if (i >= count) {
+                break;
+            }
+
+            print(screen, entries[i].name);
+            length = strlen(entries[i].name);
+            if (entries[i].attributes & AM_DIR) {
+                print_c(screen, '/');
+                length++;
+            }
+
+            if ((column + 1 < columns) && (i + rows < count)) {
+                for (; length < width; length++) {
+                    print_c(screen, ' ');
                 }
             }
         }
+        print(screen, "\n");
     }
 }
 
@@ -296,17 +606,45 @@ void dir_parse_pattern(char * arg, char ** path, char ** pattern) {
     }
 }
 
+/*
+ * List the contents of a directory
+ *
+ * DIR [-n|-s|-d] [-r] [-w] [<path>]
+ */
 short cmd_dir(short screen, int argc, const char * argv[]) {
-    short result = 0, dir = -1;
+    const char * usage = "USAGE: DIR [-n|-s|-d] [-r] [-w] [<path>]\n";
+    short result = 0, dir = -1, i = 0;
+    short sort = FSYS_SORT_NAME, wide = 0;
     char buffer[80];
     char arg[128];
-    t_file_info my_file;
-    p_dir_entry directories = 0, files = 0, entry = 0, prev = 0;
+    t_dir_arena arena;
+    p_dir_batch_entry scratch = 0;
     char *path=0, *pattern = 0;
     char label[40];
+    unsigned long free_kb = 0;
+
+    arg[0] = 0;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0) {
+            sort = (sort & ~FSYS_SORT_KEY) | FSYS_SORT_NAME;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            sort = (sort & ~FSYS_SORT_KEY) | FSYS_SORT_SIZE;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            sort = (sort & ~FSYS_SORT_KEY) | FSYS_SORT_DATE;
+        } else if (strcmp(argv[i], "-r") == 0) {
+            sort |= FSYS_SORT_DESCENDING;
+        } else if (strcmp(argv[i], "-w") == 0) {
+            wide = 1;
+        } else if ((argv[i][0] != '-') && (arg[0] == 0)) {
+            strncpy(arg, argv[i], sizeof(arg) - 1);
+            arg[sizeof(arg) - 1] = 0;
+        } else {
+            print(screen, usage);
+            return -1;
+        }
+    }
 
-    if (argc > 1) {
-        strcpy(arg, argv[1]);
+    if (arg[0] != 0) {
         dir_parse_pattern(arg, &path, &pattern);
     }
 
@@ -315,97 +653,63 @@ short cmd_dir(short screen, int argc, const char * argv[]) {
         path = "";
     }
 
-    if (pattern != 0) {
-        // A pattern was provided
-        dir = sys_fsys_findfirst(path, pattern, &my_file);
+    // Open the path as a directory... any pattern is applied as the entries are read
+    dir = sys_fsys_opendir(path);
+    if (dir < 0) {
+        err_print(screen, "Unable to open directory", dir);
+        return dir;
+    }
 
-    } else {
-        // No pattern... just open the path as a directory
-        dir = sys_fsys_opendir(path);
+    arena.size = DIR_ARENA_SIZE;
+    arena.count = 0;
+    arena.block = (unsigned char *)malloc(arena.size);
+    if (arena.block == 0) {
+        sys_fsys_closedir(dir);
+        print(screen, "Unable to display directory... out of memory.\n");
+        return ERR_OUT_OF_MEMORY;
     }
+    arena.names = (char *)arena.block + arena.size;
 
-    if (dir >= 0) {
-        result = fsys_getlabel(path, label);
-        if ((result == 0) && (strlen(label) > 0)) {
-            sprintf(buffer, "Drive: %s\n", label);
-            chan_write(screen, buffer, strlen(buffer));
-        }
+    result = fsys_getlabel(path, label);
+    if ((result == 0) && (strlen(label) > 0)) {
+        sprintf(buffer, "Drive: %s\n", label);
+        chan_write(screen, buffer, strlen(buffer));
+    }
 
-        while (1) {
-            if (pattern == 0) {
-                result = sys_fsys_readdir(dir, &my_file);
-                if (result != 0) break;
-            }
+    result = dir_arena_fill(&arena, dir, pattern);
+    sys_fsys_closedir(dir);
 
-            if (my_file.name[0] != 0) {
-                if ((my_file.attributes & AM_HID) == 0) {
-                    if (my_file.attributes & AM_DIR) {
-                        entry = (p_dir_entry)malloc(sizeof(t_dir_entry));
-                        if (entry) {
-                            memcpy(&entry->info, &my_file, sizeof(t_file_info));
-                            dir_entry_insert(&directories, entry);
-                        } else {
-                            print(screen, "Unable to display directory... out of memory.\n");
-                            return -1;
-                        }
-
-                    } else {
-                        entry = (p_dir_entry)malloc(sizeof(t_dir_entry));
-                        if (entry) {
-                            memcpy(&entry->info, &my_file, sizeof(t_file_info));
-                            dir_entry_insert(&files, entry);
-                        } else {
-                            print(screen, "Unable to display directory... out of memory.\n");
-                            return -1;
-                        }
-                    }
-                }
+    if (result == 0) {
+        if (arena.count > 1) {
+            scratch = (p_dir_batch_entry)malloc(arena.count * sizeof(t_dir_batch_entry));
+            if (scratch == 0) {
+                result = ERR_OUT_OF_MEMORY;
             } else {
-                break;
-            }
-
-            if (pattern != 0) {
-                result = fsys_findnext(dir, &my_file);
-                if (result != 0) {
-                    break;
-                }
+                dir_sort((p_dir_batch_entry)arena.block, scratch, arena.count, sort);
+                free(scratch);
             }
         }
+    }
 
-        fsys_closedir(dir);
-
-        // Print the directories
-        entry = directories;
-        while (entry != 0) {
-            sprintf(buffer, "%s/\n", entry->info.name);
-            print(screen, buffer);
-            prev = entry;
-            entry = entry->next;
-            free(prev);
+    if (result == 0) {
+        if (wide) {
+            dir_print_wide(screen, (p_dir_batch_entry)arena.block, arena.count);
+        } else {
+            dir_print_long(screen, (p_dir_batch_entry)arena.block, arena.count);
         }
 
-        // Print the files
-        entry = files;
-        while (entry != 0) {
-            if (entry->info.size < 1024) {
-                sprintf(buffer, "%-20.20s %d B\n", entry->info.name, (int)entry->info.size);
-            } else if (my_file.size < 1024*1024) {
-                sprintf(buffer, "%-20.20s %d KB\n", entry->info.name, (int)entry->info.size / 1024);
-            } else {
-                sprintf(buffer, "%-29.20s %d MB\n", entry->info.name, (int)entry->info.size / (1024*1024));
-            }
+        if (sys_fsys_get_free(path, &free_kb, 0) == 0) {
+            sprintf(buffer, "%lu KB free\n", free_kb);
             print(screen, buffer);
-            prev = entry;
-            entry = entry->next;
-            free(prev);
         }
-
+    } else if (result == ERR_OUT_OF_MEMORY) {
+        print(screen, "Unable to display directory... out of memory.\n");
     } else {
-        err_print(screen, "Unable to open directory", dir);
-        return dir;
+        err_print(screen, "Unable to read directory", result);
     }
 
-    return 0;
+    free(arena.block);
+    return result;
 }
 
 /*
@@ -583,19 +887,37 @@ short cmd_mkboot(short screen, int argc, const char * argv[]) {
 /*
  * Format a drive
  *
- * FORMAT <drive #>
+ * FORMAT <drive #> [FAT | FAT32 | EXFAT]
+ *
+ * Without a file system, the one that suits the size of the drive is used.
  */
 short cmd_format(short screen, int argc, const char * argv[]) {
+    short format = FSYS_FORMAT_ANY;
+
+    if (argc > 2) {
+        if (strcicmp(argv[2], "FAT") == 0) {
+            format = FSYS_FORMAT_FAT;
+        } else if (strcicmp(argv[2], "FAT32") == 0) {
+            format = FSYS_FORMAT_FAT32;
+        } else if (strcicmp(argv[2], "EXFAT") == 0) {
+            format = FSYS_FORMAT_EXFAT;
+        } else {
+            argc = 0;
+        }
+    }
+
     if (argc > 1) {
         short drive = cli_eval_number(argv[1]);
-        short result = fsys_mkfs(drive, "");
+        short result = fsys_mkfs(drive, "", format);
         if (result != 0) {
             err_print(screen, "Unable to format volume", result);
             return -1;
         }
 
+        return 0;
+
     } else {
-        print(screen, "USAGE: FORMAT <drive #>\n");
+        print(screen, "USAGE: FORMAT <drive #> [FAT | FAT32 | EXFAT]\n");
         return -1;
     }
 }
@@ -64,6 +64,14 @@ extern short cmd_diskread(short screen, int argc, const char * argv[]);
  */
 extern short cmd_diskfill(short screen, int argc, const char * argv[]);
 
+/*
+ * Print the I/O statistics of the block devices (latency is in jiffies), and the
+ * memory taken by the free cluster map of each mounted volume
+ *
+ * IOSTAT [-r] [<drive #>]
+ */
+extern short cmd_iostat(short screen, int argc, const char * argv[]);
+
 /*
  * Set the label of a drive
  *
@@ -75,7 +83,7 @@ extern short cmd_label(short screen, int argc, const char * argv[]);
 /*
  * Format a drive
  *
- * FORMAT <drive #>
+ * FORMAT <drive #> [FAT | FAT32 | EXFAT]
  */
 extern short cmd_format(short screen, int argc, const char * argv[]);
 
@@ -18,12 +18,17 @@
  * Custom error codes for the COPY command
  */
 
-#define ERR_COPY_SELF           -1000
 #define ERR_COPY_SRC_IS_DIR     -1001
 #define ERR_COPY_DST_IS_DIR     -1002
 #define ERR_COPY_NO_SRC_DIR     -1003
 #define ERR_COPY_NO_DST_DIR     -1004
 
+/*
+ * Size of the buffer the names of the files to copy are read into, a batch at a time
+ */
+
+#define COPY_BATCH_SIZE         2048
+
 /**
  * COPY is a complicated command, hence getting its own file.
  * The command needs to deal with several types of source and destination path types:
@@ -76,19 +81,9 @@ bool is_directory(const char * path) {
  * @param dst_path the path to the destination file (will be deleted if it already exists)
  * @return 0 on success, a negative number on error
  */
-static short fsys_copy(const char * src_path, const char * dst_path) {
-    unsigned char buffer[256];
+static short fsys_copy_file(const char * src_path, const char * dst_path) {
     t_file_info file;
-    short fd_src = -1;
-    short fd_dst = -1;
     short result = 0;
-    short n = 0;
-
-    // Check to make sure the source and destination paths are not the same
-    if (strcicmp(src_path, dst_path) == 0) {
-        // the two paths are the same... this is an error
-        return ERR_COPY_SELF;
-    }
 
     // Check the source to make sure it exists and is not a directory
     result = sys_fsys_stat(src_path, &file);
@@ -108,36 +103,8 @@ static short fsys_copy(const char * src_path, const char * dst_path) {
         return ERR_COPY_DST_IS_DIR;
     }
 
-    // Try to open the source file...
-    fd_src = sys_fsys_open(src_path, FSYS_READ);
-    if (fd_src > 0) {
-        // Ok... now try to open and create the destination file for writing...
-        fd_dst = sys_fsys_open(dst_path, FSYS_WRITE | FSYS_CREATE_ALWAYS);
-        if (fd_dst > 0) {
-            // Copy the file...
-            do {
-                // Try to read a chunk of data from the file
-                n = sys_chan_read(fd_src, buffer, 256);
-                if (n > 0) {
-                    // Try to write what we got
-                    result = sys_chan_write(fd_dst, buffer, n);
-                }
-            } while ((n > 0) && (result >= 0));
-
-            sys_fsys_close(fd_src);
-            sys_fsys_close(fd_dst);
-            return 0;
-
-        } else {
-            // Close the source file and return the error
-            sys_fsys_close(fd_src);
-            return fd_dst;
-        }
-
-    } else {
-        // There was an error... just return it
-        return fd_src;
-    }
+    // Let the kernel move the data, a block of whole clusters at a time
+    return sys_fsys_copy(src_path, dst_path, 0, 0);
 }
 
 /**
@@ -155,13 +122,15 @@ static short fsys_copy_pattern(const char * src_path, const char * src_pattern,
     char dst_file_path[MAX_PATH_LEN];
     char tmp[80];
     t_file_info file;
+    p_dir_batch_entry batch = 0;
     short result = 0;
     short dir = -1;
+    short count = 0, i = 0;
 
     // Make sure the source and destination paths are not the same
     if (strcicmp(src_path, dst_path) == 0) {
         // the two paths are the same... this is an error
-        return ERR_COPY_SELF;
+        return FSYS_ERR_COPY_SELF;
     }
 
     // Make sure the src_path exists and is a directory
@@ -176,35 +145,38 @@ static short fsys_copy_pattern(const char * src_path, const char * src_pattern,
         return ERR_COPY_NO_DST_DIR;
     }
 
-    dir = sys_fsys_findfirst(src_path, src_pattern, &file);
+    batch = (p_dir_batch_entry)malloc(COPY_BATCH_SIZE);
+    if (batch == 0) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    dir = sys_fsys_opendir(src_path);
     if (dir < 0) {
         // Could not open the source directory for some reason
+        free(batch);
         return dir;
     }
 
-    // Try to copy each match...
-    while (strlen(file.name) > 0) {
-        // Figure out the source and destination paths to copy
-        sprintf(src_file_path, "%s%s", src_path, file.name);
-        sprintf(dst_file_path, "%s/%s", dst_path, file.name);
-
-        // Try to actually copy them
-        result = fsys_copy(src_file_path, dst_file_path);
-        if (result < 0) {
-            sys_fsys_closedir(dir);
-            return result;
-        }
-
-        // Try to get the next match
-        result = sys_fsys_findnext(dir, &file);
-        if (result < 0) {
-            sys_fsys_closedir(dir);
-            return result;
+    // Try to copy each match, reading them a buffer full at a time...
+    while ((count = sys_fsys_readdir_batch(dir, batch, COPY_BATCH_SIZE, src_pattern, FSYS_SORT_NONE)) > 0) {
+        for (i = 0; i < count; i++) {
+            // Figure out the source and destination paths to copy
+            sprintf(src_file_path, "%s%s", src_path, batch[i].name);
+            sprintf(dst_file_path, "%s/%s", dst_path, batch[i].name);
+
+            // Try to actually copy them
+            result = fsys_copy_file(src_file_path, dst_file_path);
+            if (result < 0) {
+                free(batch);
+                sys_fsys_closedir(dir);
+                return result;
+            }
         }
     }
 
+    free(batch);
     sys_fsys_closedir(dir);
-    return 0;
+    return count;
 }
 
 /**
@@ -240,7 +212,7 @@ short fsys_copy_path_absolute(char * path) {
 static void fsys_copy_error(short screen, short n) {
     char line[80];
     switch (n) {
-        case ERR_COPY_SELF:
+        case FSYS_ERR_COPY_SELF:
             print(screen, "Unable to copy a file onto itself.\n");
             break;
 
@@ -347,7 +319,7 @@ short cmd_copy(short screen, int argc, const char * argv[]) {
             }
 
             // Attempt to make the copy
-            result = fsys_copy(src_path, dst_path);
+            result = fsys_copy_file(src_path, dst_path);
             if (result) {
                 char line[80];
                 fsys_copy_error(screen, result);
@@ -17,6 +17,9 @@
 #include "syscalls.h"
 #include "interrupt.h"
 #include "rtc_reg.h"
+#include "dev/block.h"
+#include "dev/fsys.h"
+#include "dev/ramdisk.h"
 #include "dev/rtc.h"
 #include "dev/txt_screen.h"
 #include "snd/codec.h"
@@ -634,6 +637,94 @@ short cli_shell_get(short channel, char * value, short size) {
 }
 
 
+/**
+ * Set the size of the RAM disk in KB -- SET RAMDISK <size>
+ *
+ * The RAM disk is cleared and given a fresh file system.
+ */
+short cli_ramdisk_set(short channel, const char * value) {
+    char message[80];
+    unsigned long sectors = (unsigned long)cli_eval_number(value) * 1024 / RAMDISK_SECTOR_SIZE;
+    short result;
+
+    result = sys_bdev_ioctrl(BDEV_RAM, RAMDISK_CTRL_RESIZE, (unsigned char *)&sectors, sizeof(sectors));
+    if (result == ERR_OUT_OF_MEMORY) {
+        print(channel, "Not enough free memory for a RAM disk that size.\n");
+        return result;
+    } else if (result != 0) {
+        sprintf(message, "RAM disk must be 0 or at least %dK.\n", RAMDISK_MIN_SECTORS * RAMDISK_SECTOR_SIZE / 1024);
+        print(channel, message);
+        return result;
+    }
+
+    if (sectors > 0) {
+        // Drop the old volume and put a file system on the new one
+        fsys_mount(BDEV_RAM);
+        result = fsys_mkfs(BDEV_RAM, "RAM", FSYS_FORMAT_ANY);
+        if (result != 0) {
+            err_print(channel, "Unable to format the RAM disk", result);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Get the size of the RAM disk in KB -- GET RAMDISK
+ */
+short cli_ramdisk_get(short channel, char * value, short size) {
+    unsigned long sectors = 0;
+
+    sys_bdev_ioctrl(BDEV_RAM, RAMDISK_GET_SECTOR_COUNT, (unsigned char *)&sectors, sizeof(sectors));
+    sprintf(value, "%ld", (long)(sectors * RAMDISK_SECTOR_SIZE / 1024));
+    return 0;
+}
+
+/**
+ * Set the size of the executable cache in KB -- SET EXECCACHE <size>
+ *
+ * The cache is emptied. 0 turns it off.
+ */
+short cli_execcache_set(short channel, const char * value) {
+    short result = fsys_exec_cache_resize((unsigned long)cli_eval_number(value) * 1024);
+    if (result == ERR_OUT_OF_MEMORY) {
+        print(channel, "Not enough free memory for an executable cache that size.\n");
+    }
+    return result;
+}
+
+/**
+ * Get the size of the executable cache in KB -- GET EXECCACHE
+ */
+short cli_execcache_get(short channel, char * value, short size) {
+    t_exec_cache_stats stats;
+
+    fsys_exec_cache_get_stats(&stats);
+    sprintf(value, "%ld", (long)(stats.budget / 1024));
+    return 0;
+}
+
+/**
+ * Reset the executable cache statistics -- SET EXECSTATS 0
+ */
+short cli_execstats_set(short channel, const char * value) {
+    fsys_exec_cache_reset_stats();
+    return 0;
+}
+
+/**
+ * Get the executable cache statistics -- GET EXECSTATS
+ */
+short cli_execstats_get(short channel, char * value, short size) {
+    t_exec_cache_stats stats;
+
+    fsys_exec_cache_get_stats(&stats);
+    sprintf(value, "%ld cached (%ldK of %ldK), %ld hits, %ld misses, %ld stale, %ld evicted",
+        (long)stats.entries, (long)(stats.used / 1024), (long)(stats.budget / 1024),
+        (long)stats.hits, (long)stats.misses, (long)stats.stale, (long)stats.evictions);
+    return 0;
+}
+
 /*
  * Initialize the settings tables
  */
@@ -654,12 +745,17 @@ void cli_set_init() {
         cli_set_register("FONT@1", "FONT@1 <path> -- set a font for the display #1", cli_font1_set, cli_font1_get);
     }
 
+    cli_set_register("EXECCACHE", "EXECCACHE <size> -- set the size of the executable cache in KB (0 to turn it off)", cli_execcache_set, cli_execcache_get);
+    cli_set_register("EXECSTATS", "EXECSTATS 0 -- reset the executable cache statistics (GET to show them)", cli_execstats_set, cli_execstats_get);
+
     cli_set_register("KEYBOARD", "KEYBOARD <path> -- set the keyboard layout", cli_layout_set, cli_layout_get);
 
 #if MODEL == MODEL_FOENIX_A2560K
     cli_set_register("KEYCOLOR", "KEYCOLOR 0x0RGB -- set the keyboard color", cli_keycolor_set, cli_keycolor_get);
 #endif
 
+    cli_set_register("RAMDISK", "RAMDISK <size> -- set the size of the RAM disk in KB (clears it)", cli_ramdisk_set, cli_ramdisk_get);
+
     if (info.screens > 1) {
         cli_set_register("SCREEN", "SCREEN <0 - 1> -- set the channel number to use for interactions", cli_screen_set, cli_screen_get);
     }
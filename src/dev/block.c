@@ -7,11 +7,394 @@
     #define DEFAULT_LOG_LEVEL LOG_ERROR
 #endif
 
+#include <string.h>
+
 #include "log.h"
+#include "constants.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "timers.h"
 #include "block.h"
 
 t_dev_block g_block_devs[BDEV_DEVICES_MAX];
 
+//
+// Sector cache
+//
+// A fixed pool of sector buffers sits between the file system and the block drivers.
+// Entries are found by hashing (dev, lba), the least recently used entry is recycled
+// when the pool is full, and written sectors are only sent to the device when they are
+// evicted or when the device is flushed.
+//
+
+#define BDEV_CACHE_NONE     -1          // Marks a free entry or the end of a hash chain
+
+typedef struct s_bdev_cache_entry {
+    short dev;                          // The device owning the sector (BDEV_CACHE_NONE if free)
+    short dirty;                        // Non-zero if the sector must be written back to the device
+    long lba;                           // The logical block address of the sector
+    unsigned long stamp;                // Value of the use clock at the last access (for LRU)
+    short next;                         // Next entry in the same hash chain
+    unsigned char * data;               // The sector data
+} t_bdev_cache_entry, *p_bdev_cache_entry;
+
+#if BDEV_CACHE_SECTORS > 0
+static t_bdev_cache_entry g_bdev_cache[BDEV_CACHE_SECTORS];
+static short g_bdev_cache_hash[BDEV_CACHE_BUCKETS];
+#endif
+static unsigned long g_bdev_cache_clock = 0;                // Use clock for the LRU policy
+static short g_bdev_cache_on[BDEV_DEVICES_MAX];             // Is caching enabled for the device?
+static t_bdev_cache_stats g_bdev_cache_stats[BDEV_DEVICES_MAX];
+static t_bdev_stats g_bdev_stats[BDEV_DEVICES_MAX];         // I/O statistics for each device
+
+//
+// Request queue
+//
+// Each device has a queue of requests and at most one request the driver is working on.
+// A request the driver can start on its own goes to it as soon as the device is free.
+// Everything else (single sectors through the cache, and drivers with no start function)
+// is carried out synchronously when the queue is run from bdev_poll or bdev_wait.
+//
+
+static p_bdev_request g_bdev_queue_head[BDEV_DEVICES_MAX];  // First request waiting for the device
+static p_bdev_request g_bdev_queue_tail[BDEV_DEVICES_MAX];  // Last request waiting for the device
+static p_bdev_request volatile g_bdev_active[BDEV_DEVICES_MAX];  // Request the driver is working on
+static short g_bdev_hold[BDEV_DEVICES_MAX];                 // Non-zero while no new request may be started
+
+//
+// Wait for the driver to finish its current request, and keep the queue from starting another
+//
+// Used when a transfer has to go to the driver outside of the queue (such as a cache write-back).
+//
+static void bdev_queue_hold(short dev) {
+    p_dev_block bdev = &g_block_devs[dev];
+
+    g_bdev_hold[dev]++;
+    while (g_bdev_active[dev] != 0) {
+        if (bdev->poll) {
+            bdev->poll();
+        }
+    }
+}
+
+//
+// Let the queue start requests again (they are picked up by the next bdev_poll)
+//
+static void bdev_queue_release(short dev) {
+    g_bdev_hold[dev]--;
+}
+
+#if BDEV_CACHE_SECTORS > 0
+
+//
+// Allocate the sector buffers and mark every entry as free
+//
+static void bdev_cache_init() {
+    unsigned char * pool;
+    short i;
+
+    pool = (unsigned char *)mem_reserve((unsigned long)BDEV_CACHE_SECTORS * FSYS_SECTOR_SZ);
+
+    for (i = 0; i < BDEV_CACHE_SECTORS; i++) {
+        g_bdev_cache[i].dev = BDEV_CACHE_NONE;
+        g_bdev_cache[i].dirty = 0;
+        g_bdev_cache[i].lba = 0;
+        g_bdev_cache[i].stamp = 0;
+        g_bdev_cache[i].next = BDEV_CACHE_NONE;
+        g_bdev_cache[i].data = pool + (unsigned long)i * FSYS_SECTOR_SZ;
+    }
+
+    for (i = 0; i < BDEV_CACHE_BUCKETS; i++) {
+        g_bdev_cache_hash[i] = BDEV_CACHE_NONE;
+    }
+}
+
+//
+// Compute the hash bucket for a sector
+//
+static short bdev_cache_bucket(short dev, long lba) {
+    return (short)(((unsigned long)lba ^ ((unsigned long)dev << 4)) & (BDEV_CACHE_BUCKETS - 1));
+}
+
+//
+// Find the cache entry holding a sector
+//
+// Returns:
+//  the index of the entry, BDEV_CACHE_NONE if the sector is not cached
+//
+static short bdev_cache_find(short dev, long lba) {
+    short i;
+
+    for (i = g_bdev_cache_hash[bdev_cache_bucket(dev, lba)]; i != BDEV_CACHE_NONE; i = g_bdev_cache[i].next) {
+        if ((g_bdev_cache[i].dev == dev) && (g_bdev_cache[i].lba == lba)) {
+            return i;
+        }
+    }
+
+    return BDEV_CACHE_NONE;
+}
+
+//
+// Mark an entry as the most recently used
+//
+static void bdev_cache_touch(short i) {
+    g_bdev_cache[i].stamp = ++g_bdev_cache_clock;
+}
+
+//
+// Release an entry without writing it back
+//
+static void bdev_cache_discard(short i) {
+    p_bdev_cache_entry entry = &g_bdev_cache[i];
+    short * link;
+
+    if (entry->dev != BDEV_CACHE_NONE) {
+        // Unlink the entry from its hash chain
+        link = &g_bdev_cache_hash[bdev_cache_bucket(entry->dev, entry->lba)];
+        while (*link != BDEV_CACHE_NONE) {
+            if (*link == i) {
+                *link = entry->next;
+                break;
+            }
+            link = &g_bdev_cache[*link].next;
+        }
+    }
+
+    entry->dev = BDEV_CACHE_NONE;
+    entry->dirty = 0;
+    entry->stamp = 0;
+    entry->next = BDEV_CACHE_NONE;
+}
+
+//
+// Write an entry back to its device, if it has been changed
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+static short bdev_cache_write_back(short i) {
+    p_bdev_cache_entry entry = &g_bdev_cache[i];
+    short ret;
+
+    if (entry->dirty) {
+        // The sector may belong to a device that is busy with a queued request
+        bdev_queue_hold(entry->dev);
+        ret = g_block_devs[entry->dev].write(entry->lba, entry->data, FSYS_SECTOR_SZ);
+        bdev_queue_release(entry->dev);
+        if (ret < 0) {
+            return ret;
+        }
+
+        entry->dirty = 0;
+        g_bdev_cache_stats[entry->dev].writebacks++;
+    }
+
+    return 0;
+}
+
+//
+// Claim an entry for a sector, recycling the least recently used entry if needed
+//
+// Inputs:
+//  dev = the number of the device
+//  lba = the logical block address of the sector
+//  index = pointer to the short in which to return the index of the entry
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+static short bdev_cache_claim(short dev, long lba, short * index) {
+    short i, victim = 0;
+    short bucket;
+    short ret;
+
+    for (i = 0; i < BDEV_CACHE_SECTORS; i++) {
+        if (g_bdev_cache[i].dev == BDEV_CACHE_NONE) {
+            victim = i;
+            break;
+        } else if (g_bdev_cache[i].stamp < g_bdev_cache[victim].stamp) {
+            victim = i;
+        }
+    }
+
+    if (g_bdev_cache[victim].dev != BDEV_CACHE_NONE) {
+        // Recycle the oldest entry... its sector must reach the device first
+        ret = bdev_cache_write_back(victim);
+        if (ret < 0) {
+            return ret;
+        }
+
+        g_bdev_cache_stats[g_bdev_cache[victim].dev].evictions++;
+        bdev_cache_discard(victim);
+    }
+
+    bucket = bdev_cache_bucket(dev, lba);
+    g_bdev_cache[victim].dev = dev;
+    g_bdev_cache[victim].lba = lba;
+    g_bdev_cache[victim].next = g_bdev_cache_hash[bucket];
+    g_bdev_cache_hash[bucket] = victim;
+    bdev_cache_touch(victim);
+
+    *index = victim;
+    return 0;
+}
+
+//
+// Write back every changed sector of a device
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+static short bdev_cache_sync(short dev) {
+    short i, ret;
+
+    for (i = 0; i < BDEV_CACHE_SECTORS; i++) {
+        if (g_bdev_cache[i].dev == dev) {
+            ret = bdev_cache_write_back(i);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+
+    return 0;
+}
+
+//
+// Drop every sector of a device from the cache, without writing anything back
+//
+static void bdev_cache_invalidate(short dev) {
+    short i;
+
+    for (i = 0; i < BDEV_CACHE_SECTORS; i++) {
+        if (g_bdev_cache[i].dev == dev) {
+            bdev_cache_discard(i);
+        }
+    }
+}
+
+//
+// Read a single sector through the cache
+//
+// Returns:
+//  number of bytes read, any negative number is an error code
+//
+static short bdev_cache_read(p_dev_block bdev, long lba, unsigned char * buffer) {
+    short i, ret;
+
+    i = bdev_cache_find(bdev->number, lba);
+    if (i != BDEV_CACHE_NONE) {
+        g_bdev_cache_stats[bdev->number].hits++;
+
+    } else {
+        g_bdev_cache_stats[bdev->number].misses++;
+
+        ret = bdev_cache_claim(bdev->number, lba, &i);
+        if (ret < 0) {
+            return ret;
+        }
+
+        ret = bdev->read(lba, g_bdev_cache[i].data, FSYS_SECTOR_SZ);
+        if (ret < 0) {
+            bdev_cache_discard(i);
+            return ret;
+        }
+    }
+
+    bdev_cache_touch(i);
+    memcpy(buffer, g_bdev_cache[i].data, FSYS_SECTOR_SZ);
+    return FSYS_SECTOR_SZ;
+}
+
+//
+// Write a single sector into the cache (it will reach the device on eviction or flush)
+//
+// Returns:
+//  number of bytes written, any negative number is an error code
+//
+static short bdev_cache_write(p_dev_block bdev, long lba, const unsigned char * buffer) {
+    short i, ret;
+
+    i = bdev_cache_find(bdev->number, lba);
+    if (i == BDEV_CACHE_NONE) {
+        // The whole sector is replaced, so there is no need to read it in first
+        ret = bdev_cache_claim(bdev->number, lba, &i);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    bdev_cache_touch(i);
+    memcpy(g_bdev_cache[i].data, buffer, FSYS_SECTOR_SZ);
+    g_bdev_cache[i].dirty = 1;
+    return FSYS_SECTOR_SZ;
+}
+
+//
+// Keep the cache coherent with a run of sectors transferred around it
+//
+// On a read, cached copies (which may be newer than the device) are copied over the buffer.
+// On a write, cached copies are refreshed from the buffer and are no longer dirty.
+//
+// Inputs:
+//  dev = the number of the device
+//  lba = the logical block address of the first sector of the run
+//  buffer = the buffer holding the run
+//  count = the number of sectors in the run
+//  writing = non-zero if the run was written to the device, zero if it was read
+//
+static void bdev_cache_overlay(short dev, long lba, unsigned char * buffer, short count, short writing) {
+    short i, n;
+
+    for (n = 0; n < count; n++, buffer += FSYS_SECTOR_SZ) {
+        i = bdev_cache_find(dev, lba + n);
+        if (i != BDEV_CACHE_NONE) {
+            if (writing) {
+                memcpy(g_bdev_cache[i].data, buffer, FSYS_SECTOR_SZ);
+                g_bdev_cache[i].dirty = 0;
+            } else if (g_bdev_cache[i].dirty) {
+                memcpy(buffer, g_bdev_cache[i].data, FSYS_SECTOR_SZ);
+            }
+        }
+    }
+}
+
+//
+// Flush a sector out of the cache before an uncached transfer touches it
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+static short bdev_cache_forget(short dev, long lba) {
+    short i, ret;
+
+    i = bdev_cache_find(dev, lba);
+    if (i != BDEV_CACHE_NONE) {
+        ret = bdev_cache_write_back(i);
+        if (ret < 0) {
+            return ret;
+        }
+        bdev_cache_discard(i);
+    }
+
+    return 0;
+}
+
+#endif
+
+//
+// Clear the I/O statistics for a device
+//
+static void bdev_stats_reset(short dev) {
+    p_bdev_stats stats = &g_bdev_stats[dev];
+    const char * name = g_block_devs[dev].name;
+
+    memset(stats, 0, sizeof(t_bdev_stats));
+    if (name) {
+        strncpy(stats->name, name, BDEV_STATS_NAME - 1);
+    }
+}
+
 //
 // Initialize the block driver system
 //
@@ -21,9 +404,22 @@ void bdev_init_system() {
     TRACE("bdev_init_system");
 
     for (i = 0; i < BDEV_DEVICES_MAX; i++) {
-        g_block_devs[i].number = 0;
+        g_block_devs[i].number = -1;         // Matches no device until a driver registers
         g_block_devs[i].name = 0;
+        g_block_devs[i].read_multi = 0;
+        g_block_devs[i].write_multi = 0;
+        g_block_devs[i].start = 0;
+        g_block_devs[i].poll = 0;
+        g_bdev_cache_on[i] = 0;
+        g_bdev_queue_head[i] = 0;
+        g_bdev_queue_tail[i] = 0;
+        g_bdev_active[i] = 0;
+        g_bdev_hold[i] = 0;
     }
+
+#if BDEV_CACHE_SECTORS > 0
+    bdev_cache_init();
+#endif
 }
 
 //
@@ -47,6 +443,19 @@ short bdev_register(p_dev_block device) {
         bdev->status = device->status;
         bdev->flush = device->flush;
         bdev->ioctrl = device->ioctrl;
+        bdev->read_multi = device->read_multi;
+        bdev->write_multi = device->write_multi;
+        bdev->start = device->start;
+        bdev->poll = device->poll;
+
+        // Start the device with an empty cache and fresh statistics
+#if BDEV_CACHE_SECTORS > 0
+        bdev_cache_invalidate(dev);
+#endif
+        memset(&g_bdev_cache_stats[dev], 0, sizeof(t_bdev_cache_stats));
+        bdev_stats_reset(dev);
+        g_bdev_cache_on[dev] = 1;
+
         TRACE("bdev_register returning 0");
         return 0;
     } else {
@@ -55,9 +464,407 @@ short bdev_register(p_dev_block device) {
     }
 }
 
+//
+// Add an operation to a device's I/O statistics
+//
+// Inputs:
+//  io = the statistics for the kind of operation
+//  sectors = the number of sectors the operation covered
+//  status = the result of the operation (negative for an error)
+//  started = the jiffy count when the operation started
+//
+static void bdev_stats_record(p_bdev_io_stats io, short sectors, short status, long started) {
+    unsigned long elapsed = (unsigned long)(timers_jiffies() - started);
+    unsigned long span = elapsed;
+    short bucket = 0;
+
+    while ((span > 0) && (bucket < BDEV_STATS_BUCKETS - 1)) {
+        span >>= 1;
+        bucket++;
+    }
+
+    io->ops++;
+    if (status < 0) {
+        io->errors++;
+    } else {
+        io->sectors += sectors;
+    }
+    io->jiffies += elapsed;
+    io->latency[bucket]++;
+}
+
+//
+// Carry out a request synchronously
+//
+// A single sector goes through the cache. Longer runs (file data, for the most part) are
+// transferred directly so they do not flush the FAT and directory sectors out of the cache.
+// If the driver does not provide a multi-sector transfer, the sectors are moved one at a time.
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+static short bdev_transfer(p_dev_block bdev, p_bdev_request req) {
+    short dev = bdev->number;
+    unsigned char * cursor = req->buffer;
+    short ret = 0;
+    short i;
+
+#if BDEV_CACHE_SECTORS > 0
+    if (g_bdev_cache_on[dev] && (req->count == 1)) {
+        if (req->op == BDEV_REQ_READ) {
+            ret = bdev_cache_read(bdev, req->lba, req->buffer);
+        } else {
+            ret = bdev_cache_write(bdev, req->lba, req->buffer);
+        }
+
+        return (ret < 0) ? ret : 0;
+    }
+#endif
+
+    if (req->op == BDEV_REQ_READ) {
+        if (bdev->read_multi) {
+            // The driver can transfer the whole run itself
+            ret = bdev->read_multi(req->lba, req->buffer, req->count);
+
+        } else {
+            // Fall back on reading one sector at a time
+            for (i = 0; i < req->count; i++) {
+                ret = bdev->read(req->lba + i, cursor, FSYS_SECTOR_SZ);
+                if (ret < 0) {
+                    break;
+                }
+                cursor += FSYS_SECTOR_SZ;
+            }
+        }
+
+#if BDEV_CACHE_SECTORS > 0
+        if ((ret >= 0) && g_bdev_cache_on[dev]) {
+            // Sectors changed in the cache but not yet written are newer than the device
+            bdev_cache_overlay(dev, req->lba, req->buffer, req->count, 0);
+        }
+#endif
+
+    } else {
+        if (bdev->write_multi) {
+            // The driver can transfer the whole run itself
+            ret = bdev->write_multi(req->lba, req->buffer, req->count);
+
+        } else {
+            // Fall back on writing one sector at a time
+            for (i = 0; i < req->count; i++) {
+                ret = bdev->write(req->lba + i, cursor, FSYS_SECTOR_SZ);
+                if (ret < 0) {
+                    break;
+                }
+                cursor += FSYS_SECTOR_SZ;
+            }
+        }
+
+#if BDEV_CACHE_SECTORS > 0
+        if ((ret >= 0) && g_bdev_cache_on[dev]) {
+            // Cached copies of the run now match the device
+            bdev_cache_overlay(dev, req->lba, req->buffer, req->count, 1);
+        }
+#endif
+    }
+
+    return (ret < 0) ? ret : 0;
+}
+
+//
+// Mark a request as complete and let its submitter know
+//
+static void bdev_finish(p_bdev_request req, short status) {
+    p_bdev_stats stats = &g_bdev_stats[req->dev];
+
+    bdev_stats_record((req->op == BDEV_REQ_READ) ? &stats->read : &stats->write, req->count, status, req->started);
+
+    req->status = (status < 0) ? status : 0;
+    if (req->callback) {
+        req->callback(req);
+    }
+}
+
+//
+// Can the driver take a request on its own, without the cache?
+//
+static short bdev_request_async(short dev, p_bdev_request req) {
+    return (g_block_devs[dev].start != 0) && !(g_bdev_cache_on[dev] && (req->count == 1));
+}
+
+//
+// Start the requests waiting for a device, in order
+//
+// A request the driver can take on its own never touches the cache here: bdev_submit
+// has already made the device hold the newest copy of its sectors. So the driver can
+// be kept busy from its interrupt handler, whether the device is cached or not.
+//
+// Inputs:
+//  dev = the number of the device
+//  from_driver = non-zero if called on behalf of a driver (possibly in an interrupt handler)...
+//                only requests the driver can start on its own are started then.
+//
+static void bdev_queue_run(short dev, short from_driver) {
+    p_dev_block bdev = &g_block_devs[dev];
+    p_bdev_request req;
+    short mask, async, ret;
+
+    while (1) {
+        mask = int_disable_all();
+
+        req = g_bdev_queue_head[dev];
+        if ((req == 0) || (g_bdev_active[dev] != 0) || (g_bdev_hold[dev] != 0)) {
+            int_restore(mask);
+            return;
+        }
+
+        async = bdev_request_async(dev, req);
+        if (from_driver && !async) {
+            // The cache cannot be used here... leave the request for bdev_poll
+            int_restore(mask);
+            return;
+        }
+
+        g_bdev_queue_head[dev] = req->next;
+        if (g_bdev_queue_head[dev] == 0) {
+            g_bdev_queue_tail[dev] = 0;
+        }
+        if (async) {
+            g_bdev_active[dev] = req;
+        }
+
+        int_restore(mask);
+
+        if (async) {
+            ret = bdev->start(req);
+            if (ret < 0) {
+                g_bdev_active[dev] = 0;
+                bdev_finish(req, ret);
+                continue;
+            }
+
+            return;
+
+        } else {
+            bdev_finish(req, bdev_transfer(bdev, req));
+        }
+    }
+}
+
+#if BDEV_CACHE_SECTORS > 0
+
+//
+// Is a request that goes through the cache waiting in a device's queue?
+//
+static short bdev_queue_cached(short dev) {
+    p_bdev_request req;
+    short mask, found = 0;
+
+    mask = int_disable_all();
+    for (req = g_bdev_queue_head[dev]; req != 0; req = req->next) {
+        if (!bdev_request_async(dev, req)) {
+            found = 1;
+            break;
+        }
+    }
+    int_restore(mask);
+
+    return found;
+}
+
+#endif
+
+//
+// Wait until every request queued for a device has completed
+//
+static void bdev_drain(short dev) {
+    while (bdev_poll(dev) > 0) ;
+}
+
+//
+// Queue a request to transfer consecutive sectors, without waiting for it
+//
+// Inputs:
+//  dev = the number of the device
+//  req = the request (op, lba, count, buffer, callback and context must be filled in)
+//
+// Returns:
+//  0 if the request was queued, any negative number is an error code
+//
+short bdev_submit(short dev, p_bdev_request req) {
+    TRACE2("bdev_submit(%d,%p)", (int)dev, req);
+
+    short mask, ret;
+    long n;
+
+    if ((dev < 0) || (dev >= BDEV_DEVICES_MAX) || (g_block_devs[dev].number != dev)) {
+        return DEV_ERR_BADDEV;
+    }
+
+    if ((req->count < 1) || ((req->op != BDEV_REQ_READ) && (req->op != BDEV_REQ_WRITE))) {
+        return ERR_BAD_ARGUMENT;
+    }
+
+#if BDEV_CACHE_SECTORS > 0
+    if (g_bdev_cache_on[dev] && bdev_request_async(dev, req)) {
+        // The run will bypass the cache, and may be started from an interrupt handler, so
+        // the device must hold the newest copy of its sectors before the run is queued.
+        // Single sectors queued ahead of the run go through the cache when they are carried
+        // out, so they are carried out first: otherwise they could put sectors of the run back
+        // in the cache after it was flushed. Those queued later run after the run itself.
+        while (bdev_queue_cached(dev)) {
+            bdev_poll(dev);
+        }
+
+        // This is done before the request is active, so the write-backs do not wait on it.
+        for (n = 0; n < req->count; n++) {
+            ret = bdev_cache_forget(dev, req->lba + n);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+#endif
+
+    req->dev = dev;
+    req->status = BDEV_REQ_PENDING;
+    req->started = timers_jiffies();
+    req->next = 0;
+
+    mask = int_disable_all();
+    if (g_bdev_queue_tail[dev]) {
+        g_bdev_queue_tail[dev]->next = req;
+    } else {
+        g_bdev_queue_head[dev] = req;
+    }
+    g_bdev_queue_tail[dev] = req;
+    int_restore(mask);
+
+    // Get the driver going on it, if it can be started from here
+    bdev_queue_run(dev, 1);
+    return 0;
+}
+
+//
+// Can a device's driver carry out queued requests on its own?
+//
+// Inputs:
+//  dev = the number of the device
+//
+// Returns:
+//  1 if the driver can start requests itself, 0 if bdev_poll carries them out
+//
+short bdev_can_start(short dev) {
+    if ((dev < 0) || (dev >= BDEV_DEVICES_MAX) || (g_block_devs[dev].number != dev)) {
+        return 0;
+    }
+
+    return (g_block_devs[dev].start != 0);
+}
+
+//
+// Move the requests queued for a device along
+//
+// Inputs:
+//  dev = the number of the device
+//
+// Returns:
+//  the number of requests still queued or in progress, any negative number is an error code
+//
+short bdev_poll(short dev) {
+    p_dev_block bdev;
+    p_bdev_request req;
+    short mask, pending = 0;
+
+    if ((dev < 0) || (dev >= BDEV_DEVICES_MAX) || (g_block_devs[dev].number != dev)) {
+        return DEV_ERR_BADDEV;
+    }
+
+    bdev = &g_block_devs[dev];
+    if ((g_bdev_active[dev] != 0) && bdev->poll) {
+        bdev->poll();
+    }
+
+    bdev_queue_run(dev, 0);
+
+    mask = int_disable_all();
+    if (g_bdev_active[dev] != 0) {
+        pending++;
+    }
+    for (req = g_bdev_queue_head[dev]; req != 0; req = req->next) {
+        pending++;
+    }
+    int_restore(mask);
+
+    return pending;
+}
+
+//
+// Wait for a request to complete
+//
+// Inputs:
+//  req = a request passed to bdev_submit
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+short bdev_wait(p_bdev_request req) {
+    while (req->status == BDEV_REQ_PENDING) {
+        bdev_poll(req->dev);
+    }
+
+    return req->status;
+}
+
+//
+// Report that the request a driver was started on has completed
+//
+// Inputs:
+//  dev = the number of the device
+//  status = 0 on success, any negative number is an error code
+//
+void bdev_complete(short dev, short status) {
+    p_bdev_request req = g_bdev_active[dev];
+
+    if (req != 0) {
+        g_bdev_active[dev] = 0;
+        bdev_finish(req, status);
+
+        // Keep the driver busy with the next request, if it can take it from here
+        bdev_queue_run(dev, 1);
+    }
+}
+
+//
+// Submit a transfer and wait for it to complete
+//
+// Returns:
+//  number of sectors transferred, any negative number is an error code
+//
+static short bdev_submit_wait(short dev, short op, long lba, unsigned char * buffer, short count) {
+    t_bdev_request req;
+    short ret;
+
+    req.op = op;
+    req.lba = lba;
+    req.count = count;
+    req.buffer = buffer;
+    req.callback = 0;
+    req.context = 0;
+
+    ret = bdev_submit(dev, &req);
+    if (ret == 0) {
+        ret = bdev_wait(&req);
+    }
+
+    return (ret < 0) ? ret : count;
+}
+
 //
 // Initialize the device
 //
+// Any sectors cached for the device are dropped, since the media may have changed.
+//
 // Inputs:
 //  dev = the number of the device
 //
@@ -71,8 +878,13 @@ short bdev_init(short dev) {
 
     if (dev < BDEV_DEVICES_MAX) {
         p_dev_block bdev = &g_block_devs[dev];
-        if (bdev->number == dev)
+        if (bdev->number == dev) {
+            bdev_drain(dev);
+#if BDEV_CACHE_SECTORS > 0
+            bdev_cache_invalidate(dev);
+#endif
             ret = bdev->init();
+        }
     }
 
     TRACE1("bdev_init returning %d", (int)ret);
@@ -82,6 +894,8 @@ short bdev_init(short dev) {
 //
 // Read a block from the device
 //
+// A whole sector is read through the device's request queue.
+//
 // Inputs:
 //  dev = the number of the device
 //  lba = the logical block address of the block to read
@@ -95,11 +909,35 @@ short bdev_read(short dev, long lba, unsigned char * buffer, short size) {
     TRACE4("bdev_read(%d,%ld,%p,%d)", (int)dev, lba, buffer, (int)size);
 
     short ret = DEV_ERR_BADDEV;
+    long started;
 
-    if (dev < BDEV_DEVICES_MAX) {
+    if ((dev >= 0) && (dev < BDEV_DEVICES_MAX)) {
         p_dev_block bdev = &g_block_devs[dev];
-        if (bdev->number == dev)
+        if (bdev->number == dev) {
+            if (size == FSYS_SECTOR_SZ) {
+                ret = bdev_submit_wait(dev, BDEV_REQ_READ, lba, buffer, 1);
+                if (ret >= 0) {
+                    ret = size;
+                }
+
+                TRACE1("bdev_read returning %d", (int)ret);
+                return ret;
+            }
+
+            // Odd sized transfers go straight to the device, once the queue is empty
+            bdev_drain(dev);
+#if BDEV_CACHE_SECTORS > 0
+            if (g_bdev_cache_on[dev]) {
+                ret = bdev_cache_forget(dev, lba);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+#endif
+            started = timers_jiffies();
             ret = bdev->read(lba, buffer, size);
+            bdev_stats_record(&g_bdev_stats[dev].read, 1, ret, started);
+        }
     }
 
     TRACE1("bdev_read returning %d", (int)ret);
@@ -109,6 +947,8 @@ short bdev_read(short dev, long lba, unsigned char * buffer, short size) {
 //
 // Write a block from the device
 //
+// A whole sector is written through the device's request queue.
+//
 // Inputs:
 //  dev = the number of the device
 //  lba = the logical block address of the block to write
@@ -122,17 +962,87 @@ short bdev_write(short dev, long lba, const unsigned char * buffer, short size)
     TRACE4("bdev_write(%d,%ld,%p,%d)", (int)dev, lba, buffer, (int)size);
 
     short ret = DEV_ERR_BADDEV;
+    long started;
 
-    if (dev < BDEV_DEVICES_MAX) {
+    if ((dev >= 0) && (dev < BDEV_DEVICES_MAX)) {
         p_dev_block bdev = &g_block_devs[dev];
-        if (bdev->number == dev)
+        if (bdev->number == dev) {
+            if (size == FSYS_SECTOR_SZ) {
+                ret = bdev_submit_wait(dev, BDEV_REQ_WRITE, lba, (unsigned char *)buffer, 1);
+                if (ret >= 0) {
+                    ret = size;
+                }
+
+                TRACE1("bdev_write returning %d", (int)ret);
+                return ret;
+            }
+
+            // Odd sized transfers go straight to the device, once the queue is empty
+            bdev_drain(dev);
+#if BDEV_CACHE_SECTORS > 0
+            if (g_bdev_cache_on[dev]) {
+                ret = bdev_cache_forget(dev, lba);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+#endif
+            started = timers_jiffies();
             ret = bdev->write(lba, buffer, size);
+            bdev_stats_record(&g_bdev_stats[dev].write, 1, ret, started);
+        }
     }
 
     TRACE1("bdev_write returning %d", (int)ret);
     return ret;
 }
 
+//
+// Read several consecutive sectors from the device
+//
+// The run is submitted to the device's request queue and waited for.
+//
+// Inputs:
+//  dev = the number of the device
+//  lba = the logical block address of the first sector to read
+//  buffer = the buffer into which to copy the sector data (must hold count sectors)
+//  count = the number of sectors to read
+//
+// Returns:
+//  number of sectors read, any negative number is an error code
+//
+short bdev_read_multi(short dev, long lba, unsigned char * buffer, short count) {
+    TRACE4("bdev_read_multi(%d,%ld,%p,%d)", (int)dev, lba, buffer, (int)count);
+
+    short ret = bdev_submit_wait(dev, BDEV_REQ_READ, lba, buffer, count);
+
+    TRACE1("bdev_read_multi returning %d", (int)ret);
+    return ret;
+}
+
+//
+// Write several consecutive sectors to the device
+//
+// The run is submitted to the device's request queue and waited for.
+//
+// Inputs:
+//  dev = the number of the device
+//  lba = the logical block address of the first sector to write
+//  buffer = the buffer containing the sector data to write (must hold count sectors)
+//  count = the number of sectors to write
+//
+// Returns:
+//  number of sectors written, any negative number is an error code
+//
+short bdev_write_multi(short dev, long lba, const unsigned char * buffer, short count) {
+    TRACE4("bdev_write_multi(%d,%ld,%p,%d)", (int)dev, lba, buffer, (int)count);
+
+    short ret = bdev_submit_wait(dev, BDEV_REQ_WRITE, lba, (unsigned char *)buffer, count);
+
+    TRACE1("bdev_write_multi returning %d", (int)ret);
+    return ret;
+}
+
 //
 // Return the status of the block device
 //
@@ -160,6 +1070,9 @@ short bdev_status(short dev) {
 //
 // Ensure that any pending writes to teh device have been completed
 //
+// Queued requests are completed, then sectors held changed in the cache are written to the
+// device before the driver is flushed.
+//
 // Inputs:
 //  dev = the number of the device
 //
@@ -170,17 +1083,119 @@ short bdev_flush(short dev) {
     TRACE1("bdev_flush(%d)", (int)dev);
 
     short ret = DEV_ERR_BADDEV;
+    long started;
 
     if (dev < BDEV_DEVICES_MAX) {
         p_dev_block bdev = &g_block_devs[dev];
-        if (bdev->number == dev)
-            return bdev->flush();
+        if (bdev->number == dev) {
+            bdev_drain(dev);
+
+            started = timers_jiffies();
+#if BDEV_CACHE_SECTORS > 0
+            ret = bdev_cache_sync(dev);
+            if (ret == 0) {
+                ret = bdev->flush();
+            }
+#else
+            ret = bdev->flush();
+#endif
+            bdev_stats_record(&g_bdev_stats[dev].flush, 0, ret, started);
+        }
     }
 
     TRACE1("bdev_flush returning %d", (int)ret);
     return ret;
 }
 
+//
+// Get the I/O statistics for a device
+//
+// Inputs:
+//  dev = the number of the device
+//  stats = pointer to the t_bdev_stats to fill in
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+short bdev_stats(short dev, p_bdev_stats stats) {
+    short mask;
+
+    if ((dev < 0) || (dev >= BDEV_DEVICES_MAX) || (g_block_devs[dev].number != dev)) {
+        return DEV_ERR_BADDEV;
+    }
+
+    // Requests may complete in an interrupt handler... take a consistent copy
+    mask = int_disable_all();
+    memcpy(stats, &g_bdev_stats[dev], sizeof(t_bdev_stats));
+    int_restore(mask);
+
+    return 0;
+}
+
+//
+// Count a transfer the driver had to retry
+//
+// Inputs:
+//  dev = the number of the device
+//
+void bdev_note_retry(short dev) {
+    if ((dev >= 0) && (dev < BDEV_DEVICES_MAX)) {
+        g_bdev_stats[dev].retries++;
+    }
+}
+
+//
+// Handle the control commands implemented by the block layer itself
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+static short bdev_cache_ioctrl(short dev, short command, unsigned char * buffer, short size) {
+    short ret = 0;
+
+    switch (command) {
+        case BDEV_CTRL_CACHE_STATS:
+            if ((buffer == 0) || (size < (short)sizeof(t_bdev_cache_stats))) {
+                return ERR_BAD_ARGUMENT;
+            }
+            memcpy(buffer, &g_bdev_cache_stats[dev], sizeof(t_bdev_cache_stats));
+            break;
+
+        case BDEV_CTRL_CACHE_RESET_STATS:
+            memset(&g_bdev_cache_stats[dev], 0, sizeof(t_bdev_cache_stats));
+            break;
+
+        case BDEV_CTRL_CACHE_INVALIDATE:
+#if BDEV_CACHE_SECTORS > 0
+            ret = bdev_cache_sync(dev);
+            bdev_cache_invalidate(dev);
+#endif
+            break;
+
+        case BDEV_CTRL_CACHE_ENABLE:
+            g_bdev_cache_on[dev] = 1;
+            break;
+
+        case BDEV_CTRL_CACHE_DISABLE:
+#if BDEV_CACHE_SECTORS > 0
+            ret = bdev_cache_sync(dev);
+            bdev_cache_invalidate(dev);
+#endif
+            g_bdev_cache_on[dev] = 0;
+            break;
+
+        case BDEV_CTRL_STATS_RESET:
+            bdev_stats_reset(dev);
+            break;
+
+        default:
+            ret = ERR_NOT_SUPPORTED;
+            break;
+    }
+
+    return ret;
+}
+
 //
 // Issue a control command to the device
 //
@@ -200,8 +1215,17 @@ short bdev_ioctrl(short dev, short command, unsigned char * buffer, short size)
 
     if (dev < BDEV_DEVICES_MAX) {
         p_dev_block bdev = &g_block_devs[dev];
-        if (bdev->number == dev)
-            ret =  bdev->ioctrl(command, buffer, size);
+        if (bdev->number == dev) {
+            if ((command & BDEV_CTRL_MASK) == BDEV_CTRL_BASE) {
+                // Commands for the block layer itself
+                ret = bdev_cache_ioctrl(dev, command, buffer, size);
+            } else {
+                // Keep the driver from being reconfigured in the middle of a request
+                bdev_queue_hold(dev);
+                ret =  bdev->ioctrl(command, buffer, size);
+                bdev_queue_release(dev);
+            }
+        }
     }
 
     TRACE1("bdev_ioctrl returning %d", (int)ret);
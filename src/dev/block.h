@@ -17,6 +17,87 @@
 #define BDEV_SDC 0
 #define BDEV_FDC 1
 #define BDEV_HDC 2
+#define BDEV_RAM 3
+
+//
+// Sector cache sizing (the buffers are taken from the top of system RAM)
+//
+
+#ifndef BDEV_CACHE_SECTORS
+#define BDEV_CACHE_SECTORS  64          // Number of 512 byte sectors held in the cache (0 to disable)
+#endif
+#define BDEV_CACHE_BUCKETS  32          // Number of hash chains (must be a power of two)
+
+//
+// Control commands implemented by the block layer itself (passed to bdev_ioctrl)
+//
+
+#define BDEV_CTRL_MASK              0x7f00
+#define BDEV_CTRL_BASE              0x7f00
+#define BDEV_CTRL_CACHE_STATS       0x7f00  // Copy the device's t_bdev_cache_stats into the buffer
+#define BDEV_CTRL_CACHE_RESET_STATS 0x7f01  // Clear the device's cache statistics
+#define BDEV_CTRL_CACHE_INVALIDATE  0x7f02  // Write back and drop every sector cached for the device
+#define BDEV_CTRL_CACHE_ENABLE      0x7f03  // Cache sectors for the device (the default)
+#define BDEV_CTRL_CACHE_DISABLE     0x7f04  // Write back the device's sectors and stop caching them
+#define BDEV_CTRL_STATS_RESET       0x7f05  // Clear the device's I/O statistics
+
+//
+// Sector cache statistics for a device
+//
+
+typedef struct s_bdev_cache_stats {
+    unsigned long hits;         // Sector reads satisfied from the cache
+    unsigned long misses;       // Sector reads that had to go to the device
+    unsigned long writebacks;   // Changed sectors written to the device
+    unsigned long evictions;    // Entries recycled to make room for another sector
+} t_bdev_cache_stats, *p_bdev_cache_stats;
+
+//
+// I/O statistics for a device
+//
+
+#define BDEV_STATS_BUCKETS  8           // Latency buckets: 0, 1, 2-3, 4-7 ... 32-63, 64+ jiffies
+#define BDEV_STATS_NAME     8           // Space for the device's name
+
+typedef struct s_bdev_io_stats {
+    unsigned long ops;          // Number of operations
+    unsigned long sectors;      // Number of sectors transferred successfully
+    unsigned long errors;       // Number of operations that failed
+    unsigned long jiffies;      // Total time spent on the operations
+    unsigned long latency[BDEV_STATS_BUCKETS];  // Number of operations by time taken (log2 of jiffies)
+} t_bdev_io_stats, *p_bdev_io_stats;
+
+typedef struct s_bdev_stats {
+    char name[BDEV_STATS_NAME]; // The name of the device
+    t_bdev_io_stats read;       // Sector reads
+    t_bdev_io_stats write;      // Sector writes
+    t_bdev_io_stats flush;      // Flushes
+    unsigned long retries;      // Transfers the driver had to retry
+} t_bdev_stats, *p_bdev_stats;
+
+//
+// An asynchronous block request
+//
+
+#define BDEV_REQ_READ       0           // Read sectors from the device
+#define BDEV_REQ_WRITE      1           // Write sectors to the device
+
+#define BDEV_REQ_PENDING    1           // Status of a request that has not completed yet
+
+typedef struct s_bdev_request {
+    short op;                           // BDEV_REQ_READ or BDEV_REQ_WRITE
+    long lba;                           // Logical block address of the first sector
+    short count;                        // Number of sectors to transfer
+    unsigned char * buffer;             // Buffer to read into or write from (must hold count sectors)
+    void (*callback)(struct s_bdev_request * req);  // Function to call on completion (may be 0)
+    void * context;                     // Free for the use of the submitter
+    volatile short status;              // BDEV_REQ_PENDING, 0 on success, or a negative error code
+    short dev;                          // The device the request was submitted to (set by bdev_submit)
+    long started;                       // Jiffy count when the request was submitted (set by bdev_submit)
+    struct s_bdev_request * next;       // Next request in the device's queue (used by the block layer)
+} t_bdev_request, *p_bdev_request;
+
+typedef short (*FUNC_BREQ_2_S)(p_bdev_request);
 
 //
 // Structure defining a block device's functions
@@ -31,6 +112,10 @@ typedef struct s_dev_block {
     FUNC_V_2_S status;      // short status() -- Get the status of the device
     FUNC_V_2_S flush;       // short flush() -- Ensure that any pending writes to teh device have been completed
     FUNC_SBS_2_S ioctrl;    // short ioctrl(short command, byte * buffer, short size)) -- Issue a control command to the device
+    FUNC_LBS_2_S read_multi;    // short read_multi(long lba, byte * buffer, short count) -- Read consecutive sectors from the device (0 if not supported)
+    FUNC_LcBS_2_S write_multi;  // short write_multi(long lba, byte * buffer, short count) -- Write consecutive sectors to the device (0 if not supported)
+    FUNC_BREQ_2_S start;        // short start(p_bdev_request req) -- Start a request without waiting, ending it with bdev_complete (0 if not supported)
+    FUNC_V_2_S poll;            // short poll() -- Move the started request along, if it is not driven by an interrupt (0 if not needed)
 } t_dev_block, *p_dev_block;
 
 //
@@ -82,6 +167,130 @@ extern short bdev_read(short dev, long lba, unsigned char * buffer, short size);
 //
 extern short bdev_write(short dev, long lba, const unsigned char * buffer, short size);
 
+//
+// Read several consecutive sectors from the device
+//
+// If the driver does not provide a multi-sector read, the sectors are read one at a time.
+//
+// Inputs:
+//  dev = the number of the device
+//  lba = the logical block address of the first sector to read
+//  buffer = the buffer into which to copy the sector data (must hold count sectors)
+//  count = the number of sectors to read
+//
+// Returns:
+//  number of sectors read, any negative number is an error code
+//
+extern short bdev_read_multi(short dev, long lba, unsigned char * buffer, short count);
+
+//
+// Write several consecutive sectors to the device
+//
+// If the driver does not provide a multi-sector write, the sectors are written one at a time.
+//
+// Inputs:
+//  dev = the number of the device
+//  lba = the logical block address of the first sector to write
+//  buffer = the buffer containing the sector data to write (must hold count sectors)
+//  count = the number of sectors to write
+//
+// Returns:
+//  number of sectors written, any negative number is an error code
+//
+extern short bdev_write_multi(short dev, long lba, const unsigned char * buffer, short count);
+
+//
+// Queue a request to transfer consecutive sectors, without waiting for it
+//
+// Requests to a device are carried out in the order they were submitted. A request the
+// driver can start on its own is started right away; anything else is carried out the
+// next time bdev_poll or bdev_wait is called for the device. When the request completes,
+// its status is set and its callback (if any) is called, possibly from an interrupt handler.
+//
+// The request and its buffer must stay untouched until the request completes.
+//
+// If the device is cached, changed sectors the run covers may be written back before
+// the request is queued, so this must not be called from an interrupt handler then.
+//
+// Inputs:
+//  dev = the number of the device
+//  req = the request (op, lba, count, buffer, callback and context must be filled in)
+//
+// Returns:
+//  0 if the request was queued, any negative number is an error code
+//
+extern short bdev_submit(short dev, p_bdev_request req);
+
+//
+// Can a device's driver carry out queued requests on its own?
+//
+// Such a driver is handed a run of sectors as soon as the device is free, and moves it while the
+// caller gets on with other work (or a step at a time on each bdev_poll, if it is polled).
+// Requests to any other device are carried out in full when bdev_poll or bdev_wait is called.
+//
+// Inputs:
+//  dev = the number of the device
+//
+// Returns:
+//  1 if the driver can start requests itself, 0 if not (or if there is no such device)
+//
+extern short bdev_can_start(short dev);
+
+//
+// Move the requests queued for a device along
+//
+// Inputs:
+//  dev = the number of the device
+//
+// Returns:
+//  the number of requests still queued or in progress, any negative number is an error code
+//
+extern short bdev_poll(short dev);
+
+//
+// Wait for a request to complete
+//
+// This must not be called from an interrupt handler (including a request's callback).
+//
+// Inputs:
+//  req = a request passed to bdev_submit
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+extern short bdev_wait(p_bdev_request req);
+
+//
+// Report that the request a driver was started on has completed
+//
+// Called by drivers from their interrupt handler or poll function.
+//
+// Inputs:
+//  dev = the number of the device
+//  status = 0 on success, any negative number is an error code
+//
+extern void bdev_complete(short dev, short status);
+
+//
+// Get the I/O statistics for a device
+//
+// Inputs:
+//  dev = the number of the device
+//  stats = pointer to the t_bdev_stats to fill in
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+extern short bdev_stats(short dev, p_bdev_stats stats);
+
+//
+// Count a transfer the driver had to retry
+//
+// Inputs:
+//  dev = the number of the device
+//
+extern void bdev_note_retry(short dev);
+
 //
 // Return the status of the block device
 //
@@ -96,6 +305,8 @@ extern short bdev_status(short dev);
 //
 // Ensure that any pending writes to teh device have been completed
 //
+// This is the sync point for the sector cache: changed sectors are written to the device.
+//
 // Inputs:
 //  dev = the number of the device
 //
@@ -525,7 +525,7 @@ short chan_swap(short channel1, short channel2) {
     } else {
         uint8_t tmp_data[CHAN_DATA_SIZE];
         p_channel chan1 = 0, chan2 = 0;
-        short i = 0, tmp_dev = 0;
+        short tmp_dev = 0;
 
         chan1 = &g_channels[channel1];
         chan2 = &g_channels[channel2];
@@ -18,6 +18,7 @@
 #include "constants.h"
 #include "dev/channel.h"
 #include "dev/console.h"
+#include "dev/fsys.h"
 #include "dev/ps2.h"
 #include "dev/kbd_mo.h"
 #include "dev/txt_screen.h"
@@ -547,6 +548,11 @@ short con_read_b(p_channel chan) {
 #endif
         }
 
+        if (c == 0) {
+            /* Nothing typed yet... let the file system get on with its background work */
+            fsys_idle();
+        }
+
     } while (c == 0);
 
     if ((con_data->control & CON_CTRL_ECHO) != 0) {
@@ -28,6 +28,8 @@ const long fdc_motor_timeout = 300;     /* The number of jiffies to let the moto
 const long fdc_seek_timeout = 180;      /* 3s timeout for the head to seek */
 const long fdc_timeout = 120;           /* The number of jiffies to allow for basic wait loops */
 
+#define FDC_TRACK_MAX_SECTORS 18        /* Largest track (in sectors) the track buffer can hold */
+
 /*
  * Types
  */
@@ -72,6 +74,91 @@ static short fdc_cylinders = 80;            /* How many cylinders */
 static short fdc_bytes_per_sector = 512;    /* How many bytes are in a sector */
 static short fdc_use_dma = 0;               /* If 0: used polled I/O, if anything else, use DMA */
 
+static unsigned char fdc_track_buffer[FDC_TRACK_MAX_SECTORS * 512];    /* Contents of the most recently read track */
+static short fdc_track_valid = 0;           /* Does the track buffer hold a track? */
+static unsigned char fdc_track_cylinder = 0;    /* Cylinder of the track in the track buffer */
+static unsigned char fdc_track_head = 0;    /* Head of the track in the track buffer */
+static short fdc_track_bad = 0;             /* Has a track failed to read as a whole? */
+static unsigned char fdc_track_bad_cylinder = 0;    /* Cylinder of the track that failed to read */
+static unsigned char fdc_track_bad_head = 0;    /* Head of the track that failed to read */
+
+static short fdc_cylinder = -1;             /* Cylinder the head is over (-1 if unknown) */
+static long fdc_motor_ready_time = 0;       /* The time (in jiffies) when the spindle will be up to speed */
+
+/*
+ * Sector writes held back so they can be written in cylinder order
+ */
+
+#define FDC_QUEUE_MAX 18                    /* Number of sector writes that can be held back */
+
+typedef struct s_fdc_queued_write {
+    long lba;                               /* The sector to write (-1 if the entry has been written) */
+    unsigned char data[512];                /* The data to write */
+} t_fdc_queued_write;
+
+static t_fdc_queued_write fdc_queue[FDC_QUEUE_MAX];
+static short fdc_queue_count = 0;           /* Number of writes waiting in the queue */
+static short fdc_queue_error = 0;           /* Error from queued writes, to be reported by the next flush */
+
+/*
+ * Drop the contents of the track buffer
+ */
+static void fdc_track_invalidate() {
+    fdc_track_valid = 0;
+}
+
+/*
+ * Forget which track failed to read as a whole (the disk has changed, or the track was rewritten)
+ */
+static void fdc_track_bad_clear() {
+    fdc_track_bad = 0;
+}
+
+/*
+ * Find a sector in the write queue
+ *
+ * Returns:
+ * the index of the queue entry, -1 if the sector is not queued
+ */
+static short fdc_queue_find(long lba) {
+    short i;
+
+    for (i = 0; i < fdc_queue_count; i++) {
+        if (fdc_queue[i].lba == lba) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Remember an error from queued writes, so the next flush can report it
+ *
+ * Only the first error is kept until it has been reported.
+ *
+ * Inputs:
+ *  result = the result of writing out queued sectors
+ */
+static void fdc_queue_note_error(short result) {
+    if ((result < 0) && (fdc_queue_error == 0)) {
+        fdc_queue_error = result;
+    }
+}
+
+/*
+ * Drop any queued writes (the disk they were meant for is gone)
+ *
+ * The loss is reported by the next flush.
+ */
+static void fdc_queue_discard() {
+    if (fdc_queue_count > 0) {
+        log_num(LOG_ERROR, "FDC: disk changed, queued sector writes lost: ", fdc_queue_count);
+        fdc_queue_count = 0;
+        fdc_queue_note_error(DEV_CANNOT_WRITE);
+    }
+}
+
 /**
  * Check the current jiffy count and turn off the motor if we've reached the time the motor should be turned off
  * This time gets reset every time we ask for the motor to be turned on
@@ -108,6 +195,9 @@ void fdc_set_dma(short dma) {
 void fdc_media_change() {
     // Indicate that the disk has changed
     g_fdc_stat = FDC_STAT_NOINIT;
+    fdc_track_invalidate();
+    fdc_track_bad_clear();
+    fdc_queue_discard();
 }
 
 /**
@@ -118,6 +208,9 @@ bool fdc_media_check_change() {
     // Check for the a disk change
     if (*FDC_DIR & 0x80) {
         // The disk has changed... recalibrate and set that it's changed
+        fdc_track_invalidate();
+        fdc_track_bad_clear();
+        fdc_queue_discard();
         fdc_recalibrate();
         fdc_seek(1);
         g_fdc_stat = FDC_STAT_NOINIT;
@@ -281,10 +374,12 @@ short fdc_out(unsigned char x) {
 }
 
 /*
- * Spin up the drive's spindle motor
+ * Start the drive's spindle motor without waiting for it to reach speed
+ *
+ * This lets the spin-up overlap with whatever the caller does before its next transfer.
  */
-short fdc_motor_on() {
-    TRACE("fdc_motor_on");
+static short fdc_motor_start() {
+    TRACE("fdc_motor_start");
 
     log_num(LOG_TRACE, "FDC_DOR: ", *FDC_DOR);
 
@@ -300,9 +395,8 @@ short fdc_motor_on() {
             return DEV_TIMEOUT;
         }
 
-        /* Wait a decent time for the motor to spin up */
-        long wait_time = timers_jiffies() + fdc_motor_wait;
-        while (wait_time > timers_jiffies()) ;
+        /* Note when the motor will have had a decent time to spin up */
+        fdc_motor_ready_time = timers_jiffies() + fdc_motor_wait;
     }
 
     short needs_handler = 0;
@@ -326,6 +420,25 @@ short fdc_motor_on() {
     return 0;
 }
 
+/*
+ * Spin up the drive's spindle motor
+ */
+short fdc_motor_on() {
+    short result;
+
+    TRACE("fdc_motor_on");
+
+    result = fdc_motor_start();
+    if (result != 0) {
+        return result;
+    }
+
+    /* Wait for whatever is left of the spin-up time */
+    while (fdc_motor_ready_time > timers_jiffies()) ;
+
+    return 0;
+}
+
 /*
  * Spin down the drive's spindle motor
  */
@@ -361,6 +474,7 @@ void fdc_motor_off() {
 void fdc_motor_watchdog() {
     unsigned char flags = *RTC_FLAGS;
     if (timers_jiffies() >= fdc_motor_off_time) {
+        // Any queued writes stay queued... the next write or flush spins the motor back up
         fdc_motor_off();
     }
 }
@@ -854,17 +968,40 @@ short fdc_command(p_fdc_trans transaction) {
     return result;
 }
 
+/*
+ * Wait for the drive to finish moving its head
+ *
+ * Returns:
+ * 0 on success, DEV_TIMEOUT on timeout
+ */
+static short fdc_wait_seek_end() {
+    long target_jiffies = timers_jiffies() + fdc_seek_timeout;
+
+    while ((*FDC_MSR & FDC_MSR_DRV0BSY) == FDC_MSR_DRV0BSY) {
+        if (timers_jiffies() >= target_jiffies) {
+            return DEV_TIMEOUT;
+        }
+    }
+
+    return 0;
+}
+
 /*
  * Move the read/write head to the indicated cylinder
+ *
+ * Nothing is sent to the drive if the head is already known to be over the cylinder.
  */
 short fdc_seek(unsigned char cylinder) {
-    long target_jiffies;
     t_fdc_trans trans;
     unsigned char st0, pcn, msr;
     short result, i;
 
     TRACE("fdc_seek");
 
+    if (fdc_cylinder == cylinder) {
+        return 0;
+    }
+
     fdc_motor_on();
 
     trans.retries = FDC_DEFAULT_RETRIES;
@@ -895,14 +1032,15 @@ short fdc_seek(unsigned char cylinder) {
         return ERR_GENERAL;
     }
 
-    target_jiffies = timers_jiffies() + fdc_seek_timeout;
-    while (target_jiffies > timers_jiffies());
+    fdc_cylinder = -1;
+    fdc_wait_seek_end();
 
     if (fdc_sense_interrupt_status(&st0, &pcn)) {
         return DEV_TIMEOUT;
     }
 
     if ((pcn == cylinder)) {
+        fdc_cylinder = cylinder;
         return 0;
     } else {
         return ERR_GENERAL;
@@ -913,7 +1051,6 @@ short fdc_seek(unsigned char cylinder) {
  * Recalibrate the read/write head
  */
 short fdc_recalibrate() {
-    long target_jiffies;
     t_fdc_trans trans;
     unsigned char st0, pcn, msr;
     short result, i;
@@ -949,14 +1086,15 @@ short fdc_recalibrate() {
         return ERR_GENERAL;
     }
 
-    target_jiffies = timers_jiffies() + fdc_seek_timeout;
-    while (target_jiffies > timers_jiffies());
+    fdc_cylinder = -1;
+    fdc_wait_seek_end();
 
     if (fdc_sense_interrupt_status(&st0, &pcn)) {
         return DEV_TIMEOUT;
     }
 
     if (pcn == 0) {
+        fdc_cylinder = 0;
         return 0;
     } else {
         return ERR_GENERAL;
@@ -1012,9 +1150,221 @@ extern short fdc_cmd_asm(__reg("d1") short cmd,
                          __reg("a2") uint8_t * buffer,
                          __reg("d3") short resultc, __reg("a3") uint8_t * results);
 
+/*
+ * Check the result bytes of a READ DATA or WRITE DATA for signs the head is not where we think
+ *
+ * Returns:
+ * non-zero if the transfer failed because of a seek error
+ */
+static short fdc_seek_error(p_fdc_trans trans) {
+    return ((trans->results[0] & 0x10) != 0) ||             /* ST0 EC: equipment check */
+           ((trans->results[1] & 0x05) != 0) ||             /* ST1 ND/MA: sector or address mark not found */
+           ((trans->results[2] & 0x12) != 0);               /* ST2 WC/BC: wrong or bad cylinder */
+}
+
+/*
+ * Run a READ DATA or WRITE DATA transaction on one track
+ *
+ * The head is only moved if it is not already over the cylinder. A failed attempt leads to a
+ * recalibration before the next one (or if the head was lost), and only a controller that stops
+ * responding gets a full reset.
+ *
+ * Inputs:
+ *  trans = the transaction (parameters must be set up)
+ *  cylinder = the cylinder of the transfer
+ *  retries = the number of attempts to make
+ *
+ * Returns:
+ *  0 on success, any negative number is an error code
+ */
+static short fdc_transfer(p_fdc_trans trans, unsigned char cylinder, short retries) {
+    short result;
+    char message[80];
+
+    trans->retries = retries;
+    while (trans->retries > 0) {
+        result = fdc_seek(cylinder);
+        if (result != 0) {
+            // Could not get the head there... find track 0 and try again
+            logmsg(LOG_ERROR, "fdc_transfer: seek failed");
+            fdc_recalibrate();
+
+        } else {
+            if (fdc_use_dma) {
+                result = fdc_command_dma(trans);            /* Issue the transaction */
+                log_num(LOG_INFO, "fdc_command_dma: ", result);
+            } else {
+                result = fdc_command(trans);
+                log_num(LOG_INFO, "fdc_cmd: ", result);
+            }
+
+            // The result bytes are only meaningful if the command ran to completion
+            if ((result == 0) && (trans->direction == FDC_TRANS_WRITE) && ((trans->results[1] & 0x02) != 0)) {
+                logmsg(LOG_ERROR, "Disk is write protected");
+                g_fdc_stat |= FDC_STAT_PROTECTED;
+                return DEV_WRITEPROT;
+            }
+
+            if ((result == 0) && !fdc_seek_error(trans)) { //} && ((trans.results[0] & 0xC0) == 0)) {
+                sprintf(message, "fdc_transfer: success? ST0=%02X ST1=%02X ST2=%02X C=%02X H=%02X R=%02X N=%02X",
+                    trans->results[0], trans->results[1], trans->results[2], trans->results[3], trans->results[4], trans->results[5], trans->results[6]);
+                logmsg(LOG_INFO, message);
+                return 0;
+            }
+
+            sprintf(message, "fdc_transfer: retry ST0=%02X ST1=%02X ST2=%02X C=%02X H=%02X R=%02X N=%02X",
+                trans->results[0], trans->results[1], trans->results[2], trans->results[3], trans->results[4], trans->results[5], trans->results[6]);
+            logmsg(LOG_ERROR, message);
+
+            if (result < 0) {
+                // The controller stopped responding... reset it
+                fdc_init();
+            } else if ((trans->retries > 1) || fdc_seek_error(trans)) {
+                // Start the next attempt from track 0, or put the head back where we think it is
+                fdc_recalibrate();
+            }
+        }
+
+        trans->retries--;
+        bdev_note_retry(BDEV_FDC);
+    }
+
+    /* If we got here, we exhausted our retry attempts */
+    return ERR_GENERAL;
+}
+
+/*
+ * Set up the parameters of a READ DATA or WRITE DATA transaction
+ */
+static void fdc_setup_transfer(p_fdc_trans trans, unsigned char command, unsigned char cylinder, unsigned char head, unsigned char sector, unsigned char eot) {
+    trans->command = 0x40 | command;                        /* MFM command */
+    trans->parameters[0] = (head == 1) ? 0x04 : 0x00;       /* Set head and drive # */
+    trans->parameters[1] = cylinder & 0x00ff;
+    trans->parameters[2] = head & 0x0001;
+    trans->parameters[3] = sector & 0x00ff;
+    trans->parameters[4] = 2;
+    trans->parameters[5] = eot & 0x00ff;                    /* End of Track */
+    trans->parameters[6] = 0x1B;                            /* GPL = 0x1B */
+    trans->parameters[7] = 0xFF;                            /* DTL = 0xFF */
+    trans->parameter_count = 8;                             /* Sending 8 parameter bytes */
+
+    trans->result_count = 7;                                /* Expect 7 result bytes */
+}
+
+/*
+ * Read a run of sectors from one track
+ *
+ * Inputs:
+ *  cylinder = the cylinder to read
+ *  head = the head to read
+ *  sector = the number of the first sector to read
+ *  eot = the number of the last sector to read
+ *  buffer = the buffer into which to copy the sector data
+ *  size = the number of bytes to read
+ *  retries = the number of attempts to make
+ *
+ * Returns:
+ *  number of bytes read, any negative number is an error code
+ */
+static short fdc_read_sectors(unsigned char cylinder, unsigned char head, unsigned char sector, unsigned char eot, unsigned char * buffer, short size, short retries) {
+    t_fdc_trans trans;
+
+    fdc_setup_transfer(&trans, FDC_CMD_READ_DATA, cylinder, head, sector, eot);
+    trans.direction = FDC_TRANS_READ;                       /* We're going to read from the drive */
+    trans.data = buffer;                                    /* Transfer sector data to buffer */
+    trans.data_count = size;
+
+    if (fdc_transfer(&trans, cylinder, retries) != 0) {
+        return DEV_CANNOT_READ;
+    }
+
+    return size;
+}
+
+/*
+ * Write a run of sectors to one track
+ *
+ * Inputs:
+ *  cylinder = the cylinder to write
+ *  head = the head to write
+ *  sector = the number of the first sector to write
+ *  eot = the number of the last sector to write
+ *  buffer = the buffer containing the data to write
+ *  size = the number of bytes to write
+ *
+ * Returns:
+ *  number of bytes written, any negative number is an error code
+ */
+static short fdc_write_sectors(unsigned char cylinder, unsigned char head, unsigned char sector, unsigned char eot, const unsigned char * buffer, short size) {
+    t_fdc_trans trans;
+    short result;
+
+    if (fdc_track_valid && (fdc_track_cylinder == cylinder) && (fdc_track_head == head)) {
+        // The track buffer will no longer match the disk
+        fdc_track_invalidate();
+    }
+
+    if (fdc_track_bad && (fdc_track_bad_cylinder == cylinder) && (fdc_track_bad_head == head)) {
+        // Rewriting the track may have cured it... give a whole track read another go
+        fdc_track_bad_clear();
+    }
+
+    fdc_setup_transfer(&trans, FDC_CMD_WRITE_DATA, cylinder, head, sector, eot);
+    trans.direction = FDC_TRANS_WRITE;                      /* We're going to write to the drive */
+    trans.data = (unsigned char *)buffer;                   /* Transfer sector data from buffer */
+    trans.data_count = size;
+
+    result = fdc_transfer(&trans, cylinder, FDC_DEFAULT_RETRIES);
+    if (result == DEV_WRITEPROT) {
+        return result;
+    } else if (result != 0) {
+        return DEV_CANNOT_WRITE;
+    }
+
+    return size;
+}
+
+/*
+ * Read a whole track into the track buffer
+ *
+ * The track gets a single attempt. If it fails (most likely a bad sector), the track is
+ * remembered as bad, so that its sectors are read one at a time until the disk changes
+ * or the track is written, rather than every read trying the whole track again.
+ *
+ * Inputs:
+ *  cylinder = the cylinder to read
+ *  head = the head to read
+ *
+ * Returns:
+ *  0 on success, any negative number is an error code
+ */
+static short fdc_track_load(unsigned char cylinder, unsigned char head) {
+    short size = fdc_sectors_per_track * fdc_bytes_per_sector;
+    short result;
+
+    fdc_track_invalidate();
+
+    result = fdc_read_sectors(cylinder, head, 1, (unsigned char)fdc_sectors_per_track, fdc_track_buffer, size, 1);
+    if (result < 0) {
+        fdc_track_bad = 1;
+        fdc_track_bad_cylinder = cylinder;
+        fdc_track_bad_head = head;
+        return result;
+    }
+
+    fdc_track_cylinder = cylinder;
+    fdc_track_head = head;
+    fdc_track_valid = 1;
+    return 0;
+}
+
 /*
  * Read a block from the FDC
  *
+ * Sectors are read a whole track at a time into the track buffer, and served from
+ * there until the track changes, the disk changes, or the track is written. A track
+ * that failed to read as a whole is read a sector at a time instead.
+ *
  * Inputs:
  *  lba = the logical block address of the block to read
  *  buffer = the buffer into which to copy the block data
@@ -1024,10 +1374,7 @@ extern short fdc_cmd_asm(__reg("d1") short cmd,
  *  number of bytes read, any negative number is an error code
  */
 short fdc_read(long lba, unsigned char * buffer, short size) {
-    t_fdc_trans trans;
     unsigned char head, cylinder, sector;
-    short result, i;
-    char message[80];
 
     TRACE("fdc_read");
 
@@ -1037,54 +1384,154 @@ short fdc_read(long lba, unsigned char * buffer, short size) {
     fdc_motor_on();
     fdc_media_check_change();
 
-    trans.retries = 1; //FDC_DEFAULT_RETRIES;
-    trans.command = 0x40 | FDC_CMD_READ_DATA;               /* MFM read command */
-    trans.direction = FDC_TRANS_READ;                       /* We're going to read from the drive */
-    trans.parameters[0] = (head == 1) ? 0x04 : 0x00;        /* Set head and drive # */
-    trans.parameters[1] = cylinder & 0x00ff;
-    trans.parameters[2] = head & 0x0001;
-    trans.parameters[3] = sector & 0x00ff;
-    trans.parameters[4] = 2;
-    trans.parameters[5] = sector & 0x00ff;                  /* End of Track... fdc_sectors_per_track; */
-    trans.parameters[6] = 0x1B;                             /* GPL = 0x1B */
-    trans.parameters[7] = 0xFF;                             /* DTL = 0xFF */
-    trans.parameter_count = 8;                              /* Sending 8 parameter bytes */
+    if (size == fdc_bytes_per_sector) {
+        short i = fdc_queue_find(lba);
+        if (i >= 0) {
+            // The sector is waiting to be written... the queue has the current data
+            memcpy(buffer, fdc_queue[i].data, size);
+            return size;
+        }
+    }
 
-    trans.data = buffer;                                    /* Transfer sector data to buffer */
-    trans.data_count = size;
+    if ((size == fdc_bytes_per_sector) && !fdc_use_dma && (fdc_sectors_per_track <= FDC_TRACK_MAX_SECTORS)) {
+        if ((!fdc_track_valid || (fdc_track_cylinder != cylinder) || (fdc_track_head != head)) &&
+            !(fdc_track_bad && (fdc_track_bad_cylinder == cylinder) && (fdc_track_bad_head == head))) {
+            // Not in the track buffer, and not known to be bad... read the whole track in one revolution
+            fdc_track_load(cylinder, head);
+        }
 
-    trans.result_count = 7;                                 /* Expect 7 result bytes */
+        if (fdc_track_valid && (fdc_track_cylinder == cylinder) && (fdc_track_head == head)) {
+            memcpy(buffer, fdc_track_buffer + (sector - 1) * fdc_bytes_per_sector, size);
+            return size;
+        }
 
-    while (trans.retries > 0) {
-        if (fdc_use_dma) {
-            result = fdc_command_dma(&trans);               /* Issue the transaction */
-            log_num(LOG_INFO, "fdc_command_dma: ", result);
-        } else {
-            result = fdc_command(&trans);
-            log_num(LOG_INFO, "fdc_cmd: ", result);
+        // The track could not be read as a whole (a bad sector?)... fall back on just the sector we need
+    }
+
+    return fdc_read_sectors(cylinder, head, sector, sector, buffer, size, FDC_DEFAULT_RETRIES);
+}
+
+/*
+ * Write every queued sector to the disk
+ *
+ * The queued sectors are sorted, runs of consecutive sectors on a track are written with a
+ * single command, and the tracks are visited in elevator order: up from the current cylinder,
+ * then back down for whatever lies below it.
+ *
+ * A run that cannot be written is dropped from the queue, so that it does not fail every
+ * later flush as well. Its error is returned, and the remaining runs are still written.
+ *
+ * Returns:
+ *  0 on success, any negative number is an error code
+ */
+static short fdc_queue_flush() {
+    short order[FDC_QUEUE_MAX];             /* Queue entries sorted by LBA */
+    short run_start[FDC_QUEUE_MAX];         /* Index in order[] of the first sector of each run */
+    short run_length[FDC_QUEUE_MAX];        /* Number of sectors in each run */
+    unsigned char run_cylinder[FDC_QUEUE_MAX];
+    short runs, first_up, i, j, k, n, pass;
+    unsigned char cylinder, head, sector, c, h, s;
+    short result = 0;
+
+    if (fdc_queue_count == 0) {
+        return 0;
+    }
+
+    TRACE("fdc_queue_flush");
+
+    fdc_motor_on();
+
+    /* Sort the queue by LBA (insertion sort... the queue is short) */
+    for (i = 0; i < fdc_queue_count; i++) {
+        for (j = i; (j > 0) && (fdc_queue[order[j - 1]].lba > fdc_queue[i].lba); j--) {
+            order[j] = order[j - 1];
         }
+        order[j] = i;
+    }
 
-        if ((result == 0)) { //} && ((trans.results[0] & 0xC0) == 0)) {
-            sprintf(message, "fdc_read: success? ST0=%02X ST1=%02X ST2=%02X C=%02X H=%02X R=%02X N=%02X",
-                trans.results[0], trans.results[1], trans.results[2], trans.results[3], trans.results[4], trans.results[5], trans.results[6]);
-            logmsg(LOG_INFO, message);
-            return size;
-        } else {
-            sprintf(message, "fdc_read: retry ST0=%02X ST1=%02X ST2=%02X C=%02X H=%02X R=%02X N=%02X",
-                trans.results[0], trans.results[1], trans.results[2], trans.results[3], trans.results[4], trans.results[5], trans.results[6]);
-            logmsg(LOG_ERROR, message);
+    /* Break the sorted sectors into runs of consecutive sectors on the same track */
+    runs = 0;
+    for (i = 0; i < fdc_queue_count; i++) {
+        lba_2_chs((unsigned long)fdc_queue[order[i]].lba, &cylinder, &head, &sector);
+        if ((runs > 0) && (fdc_queue[order[i]].lba == fdc_queue[order[i - 1]].lba + 1)) {
+            lba_2_chs((unsigned long)fdc_queue[order[i - 1]].lba, &c, &h, &s);
+            if ((c == cylinder) && (h == head)) {
+                run_length[runs - 1]++;
+                continue;
+            }
         }
-        fdc_init();
-        trans.retries--;
+
+        run_start[runs] = i;
+        run_length[runs] = 1;
+        run_cylinder[runs] = cylinder;
+        runs++;
     }
 
-    /* If we got here, we exhausted our retry attempts */
-    return DEV_CANNOT_READ;
+    /* Find the first run at or above the head */
+    for (first_up = 0; first_up < runs; first_up++) {
+        if ((short)run_cylinder[first_up] >= fdc_cylinder) {
+            break;
+        }
+    }
+
+    /* Sweep up from the head, then down through the runs below it */
+    for (pass = 0; pass < 2; pass++) {
+        for (k = 0; k < runs; k++) {
+            short r = (pass == 0) ? first_up + k : first_up - 1 - k;
+            if ((r < 0) || (r >= runs)) {
+                break;
+            }
+
+            /* Gather the run into the track buffer so it can go out in one command */
+            for (n = 0; n < run_length[r]; n++) {
+                memcpy(fdc_track_buffer + n * fdc_bytes_per_sector, fdc_queue[order[run_start[r] + n]].data, fdc_bytes_per_sector);
+            }
+            fdc_track_invalidate();
+
+            lba_2_chs((unsigned long)fdc_queue[order[run_start[r]]].lba, &cylinder, &head, &sector);
+            n = fdc_write_sectors(cylinder, head, sector, sector + run_length[r] - 1,
+                fdc_track_buffer, run_length[r] * fdc_bytes_per_sector);
+            if (n < 0) {
+                log_num(LOG_ERROR, "FDC: queued sector writes lost: ", run_length[r]);
+                if (result == 0) {
+                    /* Report the first failure */
+                    result = n;
+                }
+            }
+
+            /* Mark the sectors as done (written or dropped) */
+            for (n = 0; n < run_length[r]; n++) {
+                fdc_queue[order[run_start[r] + n]].lba = -1;
+            }
+        }
+    }
+
+    /* Every run has been written or dropped */
+    fdc_queue_count = 0;
+
+    return result;
+}
+
+/*
+ * Return (and clear) the error of a flush that no caller has seen yet
+ *
+ * Returns:
+ *  0 if there is no pending error, any negative number is an error code
+ */
+static short fdc_queue_take_error() {
+    short result = fdc_queue_error;
+    fdc_queue_error = 0;
+    return result;
 }
 
 /*
  * Write a block to the FDC
  *
+ * Whole sectors are queued, so that a batch of writes can go out in cylinder order when the
+ * queue fills up or the device is flushed. The motor is started right away, so that it is
+ * up to speed by then. The result only covers the sector being written: queued sectors that
+ * fail to go out (or are lost to a disk change) are reported by the next flush.
+ *
  * Inputs:
  *  lba = the logical block address of the block to write
  *  buffer = the buffer containing the data to write
@@ -1094,68 +1541,37 @@ short fdc_read(long lba, unsigned char * buffer, short size) {
  *  number of bytes written, any negative number is an error code
  */
 short fdc_write(long lba, const unsigned char * buffer, short size) {
-    t_fdc_trans trans;
     unsigned char head, cylinder, sector;
-    short result, i;
-    char message[80];
-
-    TRACE("fdc_read");
+    short i;
 
-    lba_2_chs((unsigned long)lba, &cylinder, &head, &sector);
+    TRACE("fdc_write");
 
-    // Signal that we need the motor on and check if the media has changed
-    fdc_motor_on();
+    // Check if the media has changed
+    fdc_motor_start();
     fdc_media_check_change();
 
-    trans.retries = 1; //FDC_DEFAULT_RETRIES;
-    trans.command = 0x40 | FDC_CMD_WRITE_DATA;              /* MFM read command */
-    trans.direction = FDC_TRANS_WRITE;                      /* We're going to read from the drive */
-    trans.parameters[0] = (head == 1) ? 0x04 : 0x00;        /* Set head and drive # */
-    trans.parameters[1] = cylinder & 0x00ff;
-    trans.parameters[2] = head & 0x0001;
-    trans.parameters[3] = sector & 0x00ff;
-    trans.parameters[4] = 2;
-    trans.parameters[5] = sector & 0x00ff;                  /* End of Track... fdc_sectors_per_track; */
-    trans.parameters[6] = 0x1B;                             /* GPL = 0x1B */
-    trans.parameters[7] = 0xFF;                             /* DTL = 0xFF */
-    trans.parameter_count = 8;                              /* Sending 8 parameter bytes */
+    if (size != fdc_bytes_per_sector) {
+        // Odd sized writes go straight to the disk, after anything queued
+        fdc_queue_note_error(fdc_queue_flush());
 
-    trans.data = buffer;                                    /* Transfer sector data to buffer */
-    trans.data_count = size;
-
-    trans.result_count = 7;                                 /* Expect 7 result bytes */
-
-    while (trans.retries > 0) {
-        if (fdc_use_dma) {
-            result = fdc_command_dma(&trans);               /* Issue the transaction */
-            log_num(LOG_INFO, "fdc_command_dma: ", result);
-        } else {
-            result = fdc_command(&trans);
-            log_num(LOG_INFO, "fdc_cmd: ", result);
-        }
+        lba_2_chs((unsigned long)lba, &cylinder, &head, &sector);
+        fdc_motor_on();
+        return fdc_write_sectors(cylinder, head, sector, sector, buffer, size);
+    }
 
-        if ((trans.results[1] & 0x02) != 0) {
-            logmsg(LOG_ERROR, "Disk is write protected");
-            g_fdc_stat |= FDC_STAT_PROTECTED;
-            return DEV_WRITEPROT;
+    i = fdc_queue_find(lba);
+    if (i < 0) {
+        if (fdc_queue_count >= FDC_QUEUE_MAX) {
+            // Make room... the failed sectors are dropped, and the error kept for the next flush
+            fdc_queue_note_error(fdc_queue_flush());
         }
 
-        if ((result == 0)) { //} && ((trans.results[0] & 0xC0) == 0)) {
-            sprintf(message, "fdc_write: success? ST0=%02X ST1=%02X ST2=%02X C=%02X H=%02X R=%02X N=%02X",
-                trans.results[0], trans.results[1], trans.results[2], trans.results[3], trans.results[4], trans.results[5], trans.results[6]);
-            logmsg(LOG_INFO, message);
-            return size;
-        } else {
-            sprintf(message, "fdc_write: retry ST0=%02X ST1=%02X ST2=%02X C=%02X H=%02X R=%02X N=%02X",
-                trans.results[0], trans.results[1], trans.results[2], trans.results[3], trans.results[4], trans.results[5], trans.results[6]);
-            logmsg(LOG_ERROR, message);
-        }
-        fdc_init();
-        trans.retries--;
+        i = fdc_queue_count++;
+        fdc_queue[i].lba = lba;
     }
 
-    /* If we got here, we exhausted our retry attempts */
-    return DEV_CANNOT_WRITE;
+    memcpy(fdc_queue[i].data, buffer, size);
+    return size;
 }
 
 /*
@@ -1182,10 +1598,12 @@ short fdc_error() {
  * Ensure that any pending writes to teh device have been completed
  *
  * Returns:
- *  0 on success, any negative number is an error code
+ *  0 on success, any negative number is an error code (including errors from
+ *  queued writes that went out, or were lost, since the last flush)
  */
 short fdc_flush() {
-    return 0;
+    fdc_queue_note_error(fdc_queue_flush());
+    return fdc_queue_take_error();
 }
 
 /*
@@ -1227,6 +1645,10 @@ short fdc_ioctrl(short command, unsigned char * buffer, short size) {
  *  0 on success, any negative number is an error code
  */
 short fdc_init() {
+    fdc_track_invalidate();
+    fdc_track_bad_clear();
+    fdc_cylinder = -1;
+
     if (fdc_reset() < 0) {
         logmsg(LOG_ERROR, "Unable to reset the FDC");
         return DEV_TIMEOUT;
@@ -1257,6 +1679,10 @@ short fdc_install() {
     bdev.status = fdc_status;
     bdev.flush = fdc_flush;
     bdev.ioctrl = fdc_ioctrl;
+    bdev.read_multi = 0;
+    bdev.write_multi = 0;
+    bdev.start = 0;
+    bdev.poll = 0;
 
     g_fdc_stat = FDC_STAT_PRESENT & FDC_STAT_NOINIT;
 
@@ -11,13 +11,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "dev/block.h"
 #include "dev/channel.h"
 #include "dev/fdc.h"
 #include "errors.h"
 #include "elf.h"
 #include "fsys.h"
 #include "fatfs/ff.h"
+#include "fatfs/diskio.h"
 #include "log.h"
+#include "lz4.h"
+#include "memory.h"
 #include "syscalls.h"
 #include "simpleio.h"
 #include "utilities.h"
@@ -27,6 +31,35 @@
 #define MAX_FILES       8       /* Maximum number of open files */
 #define MAX_LOADERS     10      /* Maximum number of file loaders */
 #define MAX_EXT         4
+#define MAX_CLMT        32      /* Longs in each file's cluster link map from the pool (15 fragments) */
+#define FASTSEEK_SIZE   65536   /* Files opened for reading at least this big get a cluster link map */
+#define FIL_MODIFIED    0x40    /* FatFs' FIL flag for a file whose directory entry must be updated */
+#define FIL_DIRTY       0x80    /* FatFs' FIL flag for a sector buffer holding unwritten data */
+#define FILE_BUFFER_SIZE    FF_MAX_SS   /* Bytes in each file's byte I/O buffer from the pool */
+#define FILE_BUFFER_MAX     32768       /* Most bytes a file's byte I/O buffer may have */
+#define FILE_BUFFER_EMPTY   0           /* The byte I/O buffer holds nothing */
+#define FILE_BUFFER_READ    1           /* The byte I/O buffer holds bytes read ahead of the channel's position */
+#define FILE_BUFFER_WRITE   2           /* The byte I/O buffer holds bytes not yet written to the file */
+#define PGC_BLOCK_SIZE  16384   /* Bytes each block of a compressed PGZ segment decompresses to (the last may be short) */
+#define PGC_BLOCK_RAW   0x8000  /* Block header flag: the block is stored uncompressed */
+#define MAX_EXEC_CACHE  8       /* Maximum number of executables in the executable cache */
+#define MAX_EXEC_SEGS   16      /* Maximum number of memory segments cached for an executable */
+#define COPY_BUFFER_SIZE    65536   /* Bytes fsys_copy moves per block (rounded up to whole clusters) */
+#define COPY_READ_RUNS      8       /* Most runs of clusters fsys_copy queues to fill a block between two devices */
+#define IDLE_MAP_SECTORS    4       /* FAT sectors fsys_idle maps into a volume's free cluster map per call */
+#define MAX_ASYNC           8       /* Maximum number of asynchronous transfers (running, or finished but not polled) */
+#define ASYNC_SLICE_SIZE    4096    /* Most bytes an asynchronous transfer moves each time it is worked on in the foreground */
+#define ASYNC_RUN_SECTORS   0x4000  /* Most sectors an asynchronous transfer hands a driver that works in the background */
+#define ASYNC_FREE          0       /* The asynchronous transfer record is not in use */
+#define ASYNC_RUNNING       1       /* The asynchronous transfer still has bytes to move */
+#define ASYNC_FINISHED      2       /* The asynchronous transfer is over, but its token has not been polled */
+
+#if FF_FS_EXFAT
+/* Is the file an exFAT file stored without a FAT chain (one run of clusters)? */
+#define FILE_CONTIGUOUS(f)  (((f)->obj.fs->fs_type == FS_EXFAT) && ((f)->obj.stat == 2))
+#else
+#define FILE_CONTIGUOUS(f)  0
+#endif
 
 static const char *const elf_cpu_desc[] = {
 	"NONE","M32","SPARC","386","68K","88K","IAMCU","860","MIPS","S370",
@@ -42,10 +75,49 @@ static const char *const elf_cpu_desc[] = {
 
 typedef struct s_loader_record {
     unsigned char status;                   /* Is the loader registered or not */
-    char extension[MAX_EXT];                /* The file extension for this file loader */
+    char extension[MAX_EXT + 1];            /* The file extension for this file loader */
     p_file_loader loader;                   /* Pointer to the loader */
 } t_loader_record, *p_loader_record;
 
+typedef struct s_exec_segment {
+    unsigned long address;                  /* First byte of the segment in memory */
+    unsigned long size;                     /* Number of bytes in the segment */
+} t_exec_segment, *p_exec_segment;
+
+typedef struct s_exec_entry {
+    short segment_count;                    /* Number of memory segments (0 if the entry is free) */
+    char path[MAX_PATH_LEN];                /* Absolute path of the executable */
+    DWORD file_size;                        /* Size of the file when it was loaded */
+    WORD file_date;                         /* Date stamp of the file when it was loaded */
+    WORD file_time;                         /* Time stamp of the file when it was loaded */
+    long start;                             /* Entry point */
+    unsigned long offset;                   /* Offset of the segment images in the cache storage */
+    unsigned long length;                   /* Total bytes of the segment images */
+    unsigned long last_used;                /* Value of the use counter when the entry was last loaded */
+    t_exec_segment segment[MAX_EXEC_SEGS];  /* Memory segments, whose images are stored back to back */
+} t_exec_entry, *p_exec_entry;
+
+typedef struct s_file_buffer {
+    unsigned char * data;                   /* Buffer memory (0 if the file is unbuffered) */
+    unsigned short size;                    /* Number of bytes the buffer holds */
+    unsigned short position;                /* Next byte to hand out when reading ahead */
+    unsigned short count;                   /* Bytes read ahead, or bytes waiting to be written */
+    unsigned char mode;                     /* FILE_BUFFER_EMPTY, FILE_BUFFER_READ, or FILE_BUFFER_WRITE */
+} t_file_buffer, *p_file_buffer;
+
+typedef struct s_async_request {
+    unsigned char state;                    /* ASYNC_FREE, ASYNC_RUNNING, or ASYNC_FINISHED */
+    unsigned char write;                    /* Non-zero for a write, 0 for a read */
+    short chan;                             /* The channel of the file */
+    short token;                            /* The token the caller polls the transfer with */
+    short result;                           /* The error that stopped the transfer (0 if none) */
+    unsigned char * buffer;                 /* The next byte to fill or write */
+    unsigned long size;                     /* Bytes still to move */
+    volatile unsigned long done;            /* Bytes moved so far */
+    short io_busy;                          /* Non-zero while a run of sectors is with the block device */
+    t_bdev_request io;                      /* The run of sectors being moved by the block device */
+} t_async_request, *p_async_request;
+
 /**
  * Module variables
  */
@@ -55,9 +127,28 @@ unsigned char g_dir_state[MAX_DIRECTORIES]; /* Whether or not a directory record
 DIR g_directory[MAX_DIRECTORIES];           /* The directory information records */
 unsigned char g_fil_state[MAX_FILES];       /* Whether or not a file descriptor is allocated */
 FIL g_file[MAX_FILES];                      /* The file descriptors */
+DWORD g_file_clmt[MAX_FILES][MAX_CLMT];     /* Pool of cluster link maps for fast seeks, one per file descriptor */
+DWORD * g_file_clmt_big[MAX_FILES];         /* Cluster link maps too big for the pool (allocated on request) */
+t_file_buffer g_file_buffer[MAX_FILES];     /* Byte I/O buffer of each file descriptor */
+unsigned char g_file_buffer_pool[MAX_FILES][FILE_BUFFER_SIZE];  /* Pool of byte I/O buffers, one per file descriptor */
 t_dev_chan g_file_dev;                      /* The descriptor to use for the file channels */
 t_loader_record g_file_loader[MAX_LOADERS]; /* Array of file types the loader will understand */
 char g_current_directory[MAX_PATH_LEN];		/* Our current working directory */
+t_exec_entry g_exec_cache[MAX_EXEC_CACHE];  /* Executables held in the executable cache */
+unsigned char * g_exec_cache_storage = 0;   /* Memory reserved for the executable cache */
+unsigned long g_exec_cache_capacity = 0;    /* Bytes reserved for the executable cache */
+unsigned long g_exec_cache_budget = 0;      /* Bytes the executable cache may use (0 = off) */
+unsigned long g_exec_cache_clock = 0;       /* Use counter for the executable cache */
+t_exec_cache_stats g_exec_cache_stats;      /* Statistics for the executable cache */
+t_exec_segment g_exec_record[MAX_EXEC_SEGS];    /* Memory segments written by the current load */
+short g_exec_record_count = -1;             /* Number of segments recorded (-1 if not recording) */
+t_async_request g_async[MAX_ASYNC];         /* Asynchronous file transfers */
+unsigned short g_async_serial = 0;          /* Counter that gives each asynchronous transfer a new token */
+short g_async_next = 0;                     /* The asynchronous transfer the worker looks at first */
+
+static short fsys_buffer_read(short fd, unsigned char * dest, unsigned long size, unsigned long * total);
+static short fsys_file_write(short fd, const unsigned char * buffer, short size);
+static short fsys_file_run(FIL * file, DWORD cluster, DWORD * first, DWORD * count);
 
 /**
  * Convert a FATFS FRESULT code to the Foenix kernel's internal error codes
@@ -110,699 +201,2905 @@ void fsys_update_stat(const char * path) {
 }
 
 /**
- * Attempt to open a file given the path to the file and the mode.
+ * Drop the cluster link map of an open file, so seeks go back to following the FAT chain
  *
  * Inputs:
- * path = the ASCIIZ string containing the path to the file.
- * mode = the mode (e.g. r/w/create)
+ * fd = the file descriptor number
+ */
+static void fsys_fastseek_release(short fd) {
+    g_file[fd].cltbl = 0;
+    if (g_file_clmt_big[fd]) {
+        free(g_file_clmt_big[fd]);
+        g_file_clmt_big[fd] = 0;
+    }
+}
+
+/**
+ * Build the cluster link map of an open file, so a seek finds its cluster without
+ * walking the FAT chain from the start of the file.
+ *
+ * A map that fits in MAX_CLMT longs comes from the pool. A bigger one is allocated
+ * if it is asked for, either by size or by asking for a map that fits the file.
+ *
+ * Inputs:
+ * fd = the file descriptor number
+ * entries = the size of the map in longs (0 to fit the map to the file)
  *
  * Returns:
- * the channel ID for the open file (negative if error)
+ * 0 on success, negative number on failure (the file is left without a map)
  */
-short fsys_open(const char * path, short mode) {
-    p_channel chan = 0;
-    short i, fd = -1;
+static short fsys_fastseek_build(short fd, unsigned long entries) {
+    FIL * file = &g_file[fd];
+    DWORD * table;
+    FRESULT fres;
+    short fit = (entries == 0);
 
-    TRACE2("fsys_open(\"%s\",%d)", path, (int)mode);
+    fsys_fastseek_release(fd);
 
-	// If the file being opened is on the floppy drive, make sure the FDC status
-	// is updated correctly for disk change by spinning up the motor and checking the DIR register
-	fsys_update_stat(path);
+    if (fit) {
+        entries = MAX_CLMT;
+    } else if (entries < 4) {
+        /* Too small for even one fragment */
+        return ERR_BAD_ARGUMENT;
+    }
 
-    /* Allocate a file handle */
+    while (1) {
+        if (entries <= MAX_CLMT) {
+            table = g_file_clmt[fd];
+        } else {
+            table = (DWORD *)malloc(entries * sizeof(DWORD));
+            if (table == 0) {
+                return ERR_OUT_OF_MEMORY;
+            }
+            g_file_clmt_big[fd] = table;
+        }
 
-    for (i = 0; i < MAX_FILES; i++) {
-        if (g_fil_state[i] == 0) {
-            g_fil_state[i] = 1;
-            fd = i;
-            break;
+        table[0] = entries;
+        file->cltbl = table;
+        fres = f_lseek(file, CREATE_LINKMAP);
+        if ((fres == FR_NOT_ENOUGH_CORE) && fit && (entries <= MAX_CLMT)) {
+            /* FatFs leaves the size the file needs in the first long... try again with that */
+            entries = table[0];
+            fsys_fastseek_release(fd);
+            continue;
         }
+
+        break;
     }
 
-    if (fd < 0) {
-        ERROR("fsys_open out of handles");
-        return ERR_OUT_OF_HANDLES;
+    if (fres != FR_OK) {
+        fsys_fastseek_release(fd);
+        return fatfs_to_foenix(fres);
     }
 
-    /* Allocate a channel */
+    return 0;
+}
 
-    chan = chan_alloc(CDEV_FILE);
-    if (chan) {
-        INFO1("chan_alloc: %d", (int)chan->number);
-        chan->dev = CDEV_FILE;
-        FRESULT result = f_open(&g_file[fd], path, mode);
-        if (result == 0) {
-            chan->data[0] = fd & 0xff;      /* file handle in the channel data block */
-            return chan->number;
-        } else {
-            /* There was an error... deallocate the channel and file descriptor */
-            ERROR1("fsys_open error: %d", result);
-            g_fil_state[fd] = 0;
-            chan_free(chan);
-            return fatfs_to_foenix(result);
+/**
+ * File byte I/O buffers
+ *
+ * Reading or writing a file a byte or a line at a time goes through a buffer for
+ * the file, so that FatFs is called once per buffer load rather than once per byte.
+ * A file being read has the bytes past its channel's position read ahead into the
+ * buffer, and FatFs' position is at the end of them. A file being written collects
+ * bytes in the buffer, and FatFs' position is where they will go. Every other
+ * operation settles the buffer first, so FatFs sees the channel's true position.
+ */
+
+/**
+ * Give a file descriptor a byte I/O buffer of a new size, dropping the old one
+ *
+ * The buffer must have been settled. A buffer that fits in FILE_BUFFER_SIZE comes
+ * from the pool. A bigger one is allocated.
+ *
+ * Inputs:
+ * fd = the file descriptor number
+ * size = the number of bytes in the buffer (0 to read and write without one)
+ *
+ * Returns:
+ * 0 on success, negative number on failure (the file keeps its old buffer)
+ */
+static short fsys_buffer_setup(short fd, unsigned long size) {
+    p_file_buffer buffer = &g_file_buffer[fd];
+    unsigned char * data = 0;
+
+    if (size > FILE_BUFFER_MAX) {
+        return ERR_BAD_ARGUMENT;
+    }
+
+    if (size > FILE_BUFFER_SIZE) {
+        data = (unsigned char *)malloc(size);
+        if (data == 0) {
+            return ERR_OUT_OF_MEMORY;
         }
+    } else if (size > 0) {
+        data = g_file_buffer_pool[fd];
+    }
 
-    } else {
-        /* We couldn't allocate a channel... return our file descriptor */
-        ERROR("fsys_open out of channels");
-        g_fil_state[fd] = 0;
-        return ERR_OUT_OF_HANDLES;
+    if (buffer->data && (buffer->data != g_file_buffer_pool[fd])) {
+        free(buffer->data);
     }
+
+    buffer->data = data;
+    buffer->size = (unsigned short)size;
+    buffer->position = 0;
+    buffer->count = 0;
+    buffer->mode = FILE_BUFFER_EMPTY;
+    return 0;
 }
 
 /**
- * Close access to a previously open file.
+ * Get the position of a file's channel, counting the bytes in its buffer
  *
  * Inputs:
- * c = the channel ID for the file
+ * fd = the file descriptor number
  *
  * Returns:
- * 0 on success, negative number on failure
+ * the offset in the file of the channel's next byte
  */
-short fsys_close(short c) {
-    p_channel chan = 0;
-    short fd = 0;
+static FSIZE_t fsys_buffer_tell(short fd) {
+    p_file_buffer buffer = &g_file_buffer[fd];
 
-    chan = chan_get_record(c);          /* Get the channel record */
-    fd = chan->data[0];                 /* Get the file descriptor number */
+    switch (buffer->mode) {
+        case FILE_BUFFER_READ:
+            return f_tell(&g_file[fd]) - (buffer->count - buffer->position);
 
-    f_close(&g_file[fd]);               /* Close the file in FATFS */
-    chan_free(chan);                    /* Return the channel to the pool */
-    g_fil_state[fd] = 0;                /* Return the file descriptor to the pool. */
+        case FILE_BUFFER_WRITE:
+            return f_tell(&g_file[fd]) + buffer->count;
 
-    return 0;
+        default:
+            return f_tell(&g_file[fd]);
+    }
 }
 
 /**
- * N.B.: fsys_open returns a channel ID, and fsys_close accepts a channel ID.
- * read and write access, seek, eof status, etc. will be handled by the channel
- * calls.
+ * Write out the bytes waiting in a file's buffer, or put back the bytes read ahead
+ *
+ * Afterwards the buffer is empty, and FatFs' position is the channel's position.
+ *
+ * Inputs:
+ * fd = the file descriptor number
+ *
+ * Returns:
+ * 0 on success, negative number on failure
  */
+static short fsys_buffer_settle(short fd) {
+    p_file_buffer buffer = &g_file_buffer[fd];
+    FIL * file = &g_file[fd];
+    FRESULT fres = FR_OK;
+    UINT n;
+    short result = 0;
+
+    switch (buffer->mode) {
+        case FILE_BUFFER_READ:
+            if (buffer->position < buffer->count) {
+                fres = f_lseek(file, fsys_buffer_tell(fd));
+                result = fatfs_to_foenix(fres);
+            }
+            break;
+
+        case FILE_BUFFER_WRITE:
+            if (file->cltbl && (f_tell(file) + buffer->count > f_size(file))) {
+                /* FatFs cannot grow a file through its cluster link map */
+                fsys_fastseek_release(fd);
+            }
+
+            fres = f_write(file, buffer->data, buffer->count, &n);
+            if (fres != FR_OK) {
+                result = fatfs_to_foenix(fres);
+            } else if (n < buffer->count) {
+                /* The volume is full */
+                result = FSYS_ERR_DENIED;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    buffer->position = 0;
+    buffer->count = 0;
+    buffer->mode = FILE_BUFFER_EMPTY;
+    return result;
+}
 
 /**
- * Attempt to open a directory for scanning
+ * Read the next buffer load of a file
+ *
+ * Loads end on a sector boundary, so after the first one, each load is whole
+ * sectors, which FatFs reads straight into the buffer.
  *
  * Inputs:
- * path = the path to the directory to open
+ * fd = the file descriptor number
  *
  * Returns:
- * the handle to the directory if >= 0. An error if < 0
+ * 0 on success (the buffer is left empty at the end of the file), negative number on failure
  */
-short fsys_opendir(const char * path) {
-    short i;
-    short dir = -1;
+static short fsys_buffer_fill(short fd) {
+    p_file_buffer buffer = &g_file_buffer[fd];
+    FIL * file = &g_file[fd];
+    UINT size = buffer->size;
+    UINT n = 0;
     FRESULT fres;
 
-	// Make sure our status is updated for the drive indicated by the path
-	fsys_update_stat(path);
+    if (size >= FF_MAX_SS) {
+        size -= (UINT)(f_tell(file) % FF_MAX_SS);
+    }
 
-    /* Allocate a directory handle */
-    for (i = 0; i < MAX_DIRECTORIES; i++) {
-        if (g_dir_state[i] == 0) {
-			g_dir_state[i] = 1;
-            dir = i;
-            break;
-        }
+    fres = f_read(file, buffer->data, size, &n);
+    buffer->position = 0;
+    buffer->count = (unsigned short)n;
+    buffer->mode = FILE_BUFFER_READ;
+    if (fres != FR_OK) {
+        buffer->count = 0;
+        buffer->mode = FILE_BUFFER_EMPTY;
+        return fatfs_to_foenix(fres);
     }
 
-    if (dir < 0) {
-        return ERR_OUT_OF_HANDLES;
+    return 0;
+}
+
+/**
+ * Executable cache
+ *
+ * When it is turned on, fsys_load keeps the memory images of the executables it has
+ * loaded, along with their entry points, in memory reserved at the top of system RAM.
+ * Loading the same file again, as long as its size and time stamp have not changed,
+ * just copies the images back. The built-in loaders report the memory they fill
+ * through fsys_exec_note. Files handled by other loaders are never cached.
+ */
+
+/**
+ * Make the absolute form of a path, for use as an executable cache key
+ *
+ * Inputs:
+ * path = the path (absolute, or relative to the current directory)
+ * key = the buffer to fill (MAX_PATH_LEN characters)
+ */
+static void fsys_exec_key(const char * path, char * key) {
+    if ((path[0] == '/') || (strlen(g_current_directory) + strlen(path) + 2 > MAX_PATH_LEN)) {
+        strncpy(key, path, MAX_PATH_LEN - 1);
     } else {
-        /* Try to open the directory */
-        if (path[0] == 0) {
-            char cwd[128];
-            fsys_get_cwd(cwd, 128);
-            fres = f_opendir(&g_directory[dir], cwd);
-        } else {
-            fres = f_opendir(&g_directory[dir], path);
-        }
-        if (fres != FR_OK) {
-            /* If there was a problem, return an error number */
-            return fatfs_to_foenix(fres);
-        } else {
-            /* Otherwise, allocate and return the handle */
-            g_dir_state[dir] = 1;
-            return dir;
+        strcpy(key, g_current_directory);
+        if (key[strlen(key) - 1] != '/') {
+            strcat(key, "/");
         }
+        strcat(key, path);
     }
+    key[MAX_PATH_LEN - 1] = 0;
 }
 
 /**
- * Close a previously open directory
+ * Record a block of memory filled by the loader of the current load
  *
  * Inputs:
- * dir = the directory handle to close
+ * address = the first byte filled
+ * size = the number of bytes filled
+ */
+static void fsys_exec_note(unsigned long address, unsigned long size) {
+    p_exec_segment last;
+
+    if ((g_exec_record_count < 0) || (size == 0)) {
+        return;
+    }
+
+    if (g_exec_record_count > 0) {
+        last = &g_exec_record[g_exec_record_count - 1];
+        if (last->address + last->size == address) {
+            /* Carries on from the last block: just extend it */
+            last->size += size;
+            return;
+        }
+    }
+
+    if (g_exec_record_count < MAX_EXEC_SEGS) {
+        g_exec_record[g_exec_record_count].address = address;
+        g_exec_record[g_exec_record_count].size = size;
+        g_exec_record_count++;
+    } else {
+        /* Too scattered to cache */
+        g_exec_record_count = -1;
+    }
+}
+
+/**
+ * Drop executables from the executable cache
  *
- * Returns:
- * 0 on success, negative number on error
+ * Inputs:
+ * path = the path of the executable to drop (0 to empty the cache)
  */
-short fsys_closedir(short dir) {
-    if (g_dir_state[dir]) {
-        /* Close and deallocate the handle */
-        f_closedir(&g_directory[dir]);
-        g_dir_state[dir] = 0;
+static void fsys_exec_invalidate(const char * path) {
+    char key[MAX_PATH_LEN];
+    short i;
+
+    if (g_exec_cache_budget == 0) {
+        return;
     }
 
-    return 0;
+    if (path) {
+        fsys_exec_key(path, key);
+    }
+
+    for (i = 0; i < MAX_EXEC_CACHE; i++) {
+        if (g_exec_cache[i].segment_count && ((path == 0) || (strcicmp(g_exec_cache[i].path, key) == 0))) {
+            g_exec_cache[i].segment_count = 0;
+        }
+    }
 }
 
 /**
- * Attempt to read an entry from an open directory
+ * Look up an executable in the executable cache, and copy it into memory if it is there
  *
  * Inputs:
- * dir = the handle of the open directory
- * file = pointer to the t_file_info structure to fill out.
+ * path = the path of the executable
+ * start = pointer to the long variable to fill with the starting address
  *
  * Returns:
- * 0 on success, negative number on failure
+ * 1 if the executable was restored from the cache, 0 if it must be loaded
  */
-short fsys_readdir(short dir, p_file_info file) {
-    FILINFO finfo;
-
-    if (g_dir_state[dir]) {
-        FRESULT fres = f_readdir(&g_directory[dir], &finfo);
-        if (fres != FR_OK) {
-            return fatfs_to_foenix(fres);
-        } else {
-            int i;
-
-            /* Copy file information into the kernel table */
-            file->size = finfo.fsize;
-            file->date = finfo.fdate;
-            file->time = finfo.ftime;
-            file->attributes = finfo.fattrib;
+static short fsys_exec_restore(const char * path, long * start) {
+    char key[MAX_PATH_LEN];
+    FILINFO info;
+    p_exec_entry entry;
+    unsigned char * image;
+    short i, j;
+
+    fsys_exec_key(path, key);
+    for (i = 0; i < MAX_EXEC_CACHE; i++) {
+        entry = &g_exec_cache[i];
+        if (entry->segment_count && (strcicmp(entry->path, key) == 0)) {
+            if ((f_stat(path, &info) != FR_OK) ||
+                (info.fsize != entry->file_size) || (info.fdate != entry->file_date) || (info.ftime != entry->file_time)) {
+                /* The file has changed since it was cached */
+                entry->segment_count = 0;
+                g_exec_cache_stats.stale++;
+                break;
+            }
 
-            for (i = 0; i < MAX_PATH_LEN; i++) {
-                file->name[i] = finfo.fname[i];
-                if (file->name[i] == 0) {
+            for (j = 0; j < entry->segment_count; j++) {
+                if (entry->segment[j].address + entry->segment[j].size > mem_get_ramtop()) {
+                    /* Memory has been reserved over the executable since it was cached */
                     break;
                 }
             }
 
-            return 0;
+            if (j < entry->segment_count) {
+                entry->segment_count = 0;
+                g_exec_cache_stats.stale++;
+                break;
+            }
+
+            image = g_exec_cache_storage + entry->offset;
+            for (j = 0; j < entry->segment_count; j++) {
+                memcpy((void *)entry->segment[j].address, image, entry->segment[j].size);
+                image += entry->segment[j].size;
+            }
+
+            *start = entry->start;
+            entry->last_used = ++g_exec_cache_clock;
+            g_exec_cache_stats.hits++;
+            return 1;
         }
-    } else {
-        return ERR_BAD_HANDLE;
     }
+
+    g_exec_cache_stats.misses++;
+    return 0;
 }
 
 /**
- * Check to see if the file is present.
- * If it is not, return a file not found error.
- * If it is, populate the file info record
+ * Add the executable just loaded (as recorded by fsys_exec_note) to the executable cache
+ *
+ * Least recently used executables are dropped to make room, and the rest are packed
+ * together at the start of the storage.
  *
  * Inputs:
- * path = the path to the file to check
- * file = pointer to a file info record to fill in, if the file is found.
+ * path = the path of the executable
+ * start = the entry point of the executable
  */
-short fsys_stat(const char * path, p_file_info file) {
-	FRESULT fres;
-	FILINFO finfo;
-	char match1[10], match2[10];
-	short i = 0;
+static void fsys_exec_insert(const char * path, long start) {
+    FILINFO info;
+    p_exec_entry entry, lowest;
+    unsigned long length = 0;
+    unsigned long used = 0;
+    unsigned long next;
+    unsigned char * image;
+    short i, j, free_entry;
+
+    if (g_exec_record_count <= 0) {
+        return;
+    }
 
-	// If the file being checked is on the floppy drive, make sure the FDC status
-	// is updated correctly for disk change by spinning up the motor and checking the DIR register
-	fsys_update_stat(path);
+    for (i = 0; i < g_exec_record_count; i++) {
+        if (g_exec_record[i].address + g_exec_record[i].size > mem_get_ramtop()) {
+            /* Only executables that live in system RAM are cached */
+            return;
+        }
+        length += g_exec_record[i].size;
+    }
 
-	// FatFS's f_stat function does not handle root directories so bodge this in...
-	// For each drive...
-	for (i = 0; i < 3; i++) {
-		// Compute two legitimate paths to it
-		strcpy(match1, "/");
-		strcat(match1, (char *)VolumeStr[i]);
-		strcpy(match2, match1);
-		strcat(match2, "/");
+    if ((length > g_exec_cache_budget) || (f_stat(path, &info) != FR_OK)) {
+        return;
+    }
 
-		// Check to see if the path is the same (barring letter case)
-		if ((strcicmp(path, match1) == 0) || (strcicmp(path, match2) == 0)) {
-			// It's a match... return the record for it
-			file->size = 0;
-			file->date = 0;
-			file->time = 0;
-			file->attributes = FSYS_AM_DIR;
-			strcpy(file->name, (char *)VolumeStr[i]);
-			return 0;
-		}
-	}
+    /* Drop least recently used executables until there is an entry and room for the images */
+    while (1) {
+        used = 0;
+        free_entry = -1;
+        lowest = 0;
+        for (i = 0; i < MAX_EXEC_CACHE; i++) {
+            entry = &g_exec_cache[i];
+            if (entry->segment_count) {
+                used += entry->length;
+                if ((lowest == 0) || (entry->last_used < lowest->last_used)) {
+                    lowest = entry;
+                }
+            } else if (free_entry < 0) {
+                free_entry = i;
+            }
+        }
 
-	fres = f_stat(path, &finfo);
-	if (fres == FR_OK) {
-		int i;
+        if ((free_entry >= 0) && (used + length <= g_exec_cache_budget)) {
+            break;
+        }
 
-		/* Copy file information into the kernel table */
-		file->size = finfo.fsize;
-		file->date = finfo.fdate;
-		file->time = finfo.ftime;
-		file->attributes = finfo.fattrib;
+        lowest->segment_count = 0;
+        g_exec_cache_stats.evictions++;
+    }
 
-		for (i = 0; i < MAX_PATH_LEN; i++) {
-			file->name[i] = finfo.fname[i];
-			if (file->name[i] == 0) {
-				break;
-			}
-		}
+    /* Pack the remaining images together, in storage order */
+    for (next = 0; ; next += lowest->length) {
+        lowest = 0;
+        for (i = 0; i < MAX_EXEC_CACHE; i++) {
+            entry = &g_exec_cache[i];
+            if (entry->segment_count && (entry->offset >= next) && ((lowest == 0) || (entry->offset < lowest->offset))) {
+                lowest = entry;
+            }
+        }
 
-		return 0;
+        if (lowest == 0) {
+            break;
+        }
 
-	} else {
-		/* There was an error... return it to the caller */
-		return fatfs_to_foenix(fres);
-	}
+        if (lowest->offset != next) {
+            memmove(g_exec_cache_storage + next, g_exec_cache_storage + lowest->offset, lowest->length);
+            lowest->offset = next;
+        }
+    }
+
+    entry = &g_exec_cache[free_entry];
+    fsys_exec_key(path, entry->path);
+    entry->file_size = info.fsize;
+    entry->file_date = info.fdate;
+    entry->file_time = info.ftime;
+    entry->start = start;
+    entry->offset = used;
+    entry->length = length;
+    entry->last_used = ++g_exec_cache_clock;
+
+    image = g_exec_cache_storage + used;
+    for (j = 0; j < g_exec_record_count; j++) {
+        entry->segment[j] = g_exec_record[j];
+        memcpy(image, (void *)g_exec_record[j].address, g_exec_record[j].size);
+        image += g_exec_record[j].size;
+    }
+    entry->segment_count = g_exec_record_count;
+    g_exec_cache_stats.insertions++;
 }
 
 /**
- * Open a directory given the path and search for the first file matching the pattern.
+ * Set the amount of memory the executable cache may use
+ *
+ * The cache is emptied. Memory is reserved at the top of system RAM the first time
+ * the cache grows beyond what it has reserved before, and is not given back when it
+ * shrinks (as with the RAM disk). Once something else has been reserved below the
+ * cache's block, the block cannot grow, and the cache can only be resized within it.
  *
  * Inputs:
- * path = the path to the directory to search
- * pattern = the file name pattern to search for
- * file = pointer to the t_file_info structure to fill out
+ * size = the number of bytes the cache may use (0 to turn the cache off)
  *
  * Returns:
- * the directory handle to use for subsequent calls if >= 0, error if negative
+ * 0 on success, ERR_OUT_OF_MEMORY if the memory cannot be reserved (the cache is left as it was)
  */
-short fsys_findfirst(const char * path, const char * pattern, p_file_info file) {
-    FILINFO finfo;
-    FRESULT fres = -1;
-    short dir = 0;
-    short i = 0;
+short fsys_exec_cache_resize(unsigned long size) {
+    unsigned long grow = 0;
+    short i;
 
-	// If the path being queried is on the floppy drive, make sure the FDC status
-	// is updated correctly for disk change by spinning up the motor and checking the DIR register
-	fsys_update_stat(path);
+    if (size > g_exec_cache_capacity) {
+        if (g_exec_cache_storage == 0) {
+            /* No block yet... reserve one */
+            grow = size;
+        } else if ((unsigned long)g_exec_cache_storage == mem_get_ramtop()) {
+            /* Nothing has been reserved below the cache... just extend it downwards */
+            grow = size - g_exec_cache_capacity;
+        } else {
+            /* Something sits below the block... it cannot grow, and a new one would strand it */
+            return ERR_OUT_OF_MEMORY;
+        }
 
-    /* Allocate a directory handle */
-    for (i = 0; i < MAX_DIRECTORIES; i++) {
-        if (g_dir_state[i] == 0) {
-			g_dir_state[i] = 1;
-            dir = i;
-            break;
+        if (grow > mem_get_free()) {
+            return ERR_OUT_OF_MEMORY;
         }
     }
 
-    if (dir < 0) {
-        return ERR_OUT_OF_HANDLES;
-
-    } else {
-		fres = f_findfirst(&g_directory[dir], &finfo, path, pattern);
-        if (fres != FR_OK) {
-            return fatfs_to_foenix(fres);
+    for (i = 0; i < MAX_EXEC_CACHE; i++) {
+        g_exec_cache[i].segment_count = 0;
+    }
 
-        } else {
-            int i;
+    if (grow > 0) {
+        g_exec_cache_storage = (unsigned char *)mem_reserve(grow);
+        g_exec_cache_capacity = size;
+    }
 
-            /* Copy file information into the kernel table */
-            file->size = finfo.fsize;
-            file->date = finfo.fdate;
-            file->time = finfo.ftime;
-            file->attributes = finfo.fattrib;
+    g_exec_cache_budget = size;
+    return 0;
+}
 
-            for (i = 0; i < MAX_PATH_LEN; i++) {
-                file->name[i] = finfo.fname[i];
-                if (file->name[i] == 0) {
-                    break;
-                }
-            }
+/**
+ * Get the statistics for the executable cache
+ *
+ * Inputs:
+ * stats = pointer to the statistics record to fill
+ */
+void fsys_exec_cache_get_stats(p_exec_cache_stats stats) {
+    short i;
 
-            return dir;
+    *stats = g_exec_cache_stats;
+    stats->budget = g_exec_cache_budget;
+    stats->entries = 0;
+    stats->used = 0;
+    for (i = 0; i < MAX_EXEC_CACHE; i++) {
+        if (g_exec_cache[i].segment_count) {
+            stats->entries++;
+            stats->used += g_exec_cache[i].length;
         }
     }
 }
 
 /**
- * Open a directory given the path and search for the first file matching the pattern.
+ * Reset the statistics for the executable cache
+ */
+void fsys_exec_cache_reset_stats() {
+    memset(&g_exec_cache_stats, 0, sizeof(g_exec_cache_stats));
+}
+
+/**
+ * Attempt to open a file given the path to the file and the mode.
  *
  * Inputs:
- * dir = the handle to the directory (returned by fsys_findfirst) to search
- * file = pointer to the t_file_info structure to fill out
+ * path = the ASCIIZ string containing the path to the file.
+ * mode = the mode (e.g. r/w/create)
  *
  * Returns:
- * 0 on success, error if negative
+ * the channel ID for the open file (negative if error)
  */
-short fsys_findnext(short dir, p_file_info file) {
-    FILINFO finfo;
-    FRESULT fres;
+short fsys_open(const char * path, short mode) {
+    p_channel chan = 0;
+    short i, fd = -1;
 
-    if (g_dir_state[dir]) {
-        fres = f_findnext(&g_directory[dir], &finfo);
-        if (fres != FR_OK) {
-            return fatfs_to_foenix(fres);
+    TRACE2("fsys_open(\"%s\",%d)", path, (int)mode);
 
-        } else {
-            int i;
+	// If the file being opened is on the floppy drive, make sure the FDC status
+	// is updated correctly for disk change by spinning up the motor and checking the DIR register
+	fsys_update_stat(path);
 
-            /* Copy file information into the kernel table */
-            file->size = finfo.fsize;
-            file->date = finfo.fdate;
-            file->time = finfo.ftime;
-            file->attributes = finfo.fattrib;
+    /* Allocate a file handle */
 
-            for (i = 0; i < MAX_PATH_LEN; i++) {
-                file->name[i] = finfo.fname[i];
-                if (file->name[i] == 0) {
-                    break;
-                }
+    for (i = 0; i < MAX_FILES; i++) {
+        if (g_fil_state[i] == 0) {
+            g_fil_state[i] = 1;
+            fd = i;
+            break;
+        }
+    }
+
+    if (fd < 0) {
+        ERROR("fsys_open out of handles");
+        return ERR_OUT_OF_HANDLES;
+    }
+
+    if (mode & (FA_WRITE | FA_CREATE_NEW | FA_CREATE_ALWAYS | FA_OPEN_APPEND)) {
+        /* The file may be about to change... don't run an old copy of it */
+        fsys_exec_invalidate(path);
+    }
+
+    /* Start with a byte I/O buffer from the pool */
+    fsys_buffer_setup(fd, FILE_BUFFER_SIZE);
+
+    /* Allocate a channel */
+
+    chan = chan_alloc(CDEV_FILE);
+    if (chan) {
+        INFO1("chan_alloc: %d", (int)chan->number);
+        chan->dev = CDEV_FILE;
+        FRESULT result = f_open(&g_file[fd], path, mode);
+        if (result == 0) {
+            chan->data[0] = fd & 0xff;      /* file handle in the channel data block */
+
+            if (((mode & FA_WRITE) == 0) && (f_size(&g_file[fd]) >= FASTSEEK_SIZE) && !FILE_CONTIGUOUS(&g_file[fd])) {
+                /* Large files being read get a map from the pool, if it is big enough (a contiguous file needs none) */
+                fsys_fastseek_build(fd, MAX_CLMT);
             }
 
-            return 0;
+            return chan->number;
+        } else {
+            /* There was an error... deallocate the channel and file descriptor */
+            if ((result == FR_NO_FILE) || (result == FR_NO_PATH) || (result == FR_EXIST)) {
+                /* Callers ask to find out whether a file is there... not a fault */
+                INFO1("fsys_open: %d", result);
+            } else {
+                ERROR1("fsys_open error: %d", result);
+            }
+            g_fil_state[fd] = 0;
+            chan_free(chan);
+            return fatfs_to_foenix(result);
         }
+
     } else {
-        return ERR_BAD_HANDLE;
+        /* We couldn't allocate a channel... return our file descriptor */
+        ERROR("fsys_open out of channels");
+        g_fil_state[fd] = 0;
+        return ERR_OUT_OF_HANDLES;
     }
 }
 
 /**
- * Create a directory
+ * Note that the block device has finished a run of sectors for an asynchronous transfer
+ *
+ * This may be called from a driver's interrupt handler, so it only counts the bytes
+ * as moved. FatFs is not re-entrant: the file is moved past the run by the worker.
  *
  * Inputs:
- * path = the path of the directory to create.
+ * io = the block device request for the run
+ */
+static void fsys_async_complete(p_bdev_request io) {
+    p_async_request request = (p_async_request)io->context;
+
+    if (io->status == 0) {
+        request->done += (unsigned long)io->count * FF_MAX_SS;
+    }
+}
+
+/**
+ * Take the result of a run of sectors the block device has finished for an asynchronous transfer
  *
- * Returns:
- * 0 on success, negative number on failure.
+ * The file is moved past the run, which does not touch the FAT since the file has a
+ * cluster link map (or is contiguous).
+ *
+ * Inputs:
+ * request = the transfer
  */
-short fsys_mkdir(const char * path) {
-    FRESULT result;
+static void fsys_async_land(p_async_request request) {
+    FIL * file = &g_file[chan_get_record(request->chan)->data[0]];
+    unsigned long n = (unsigned long)request->io.count * FF_MAX_SS;
+    LBA_t sector = (LBA_t)request->io.lba;
+    FRESULT fres;
 
-    TRACE("fsys_mkdir");
+    request->io_busy = 0;
+    if (request->io.status != 0) {
+        request->result = request->io.status;
+        request->state = ASYNC_FINISHED;
+        return;
+    }
 
-	// If the directory being created is on the floppy drive, make sure the FDC status
-	// is updated correctly for disk change by spinning up the motor and checking the DIR register
-	fsys_update_stat(path);
+    if (request->write) {
+        if (file->sect - sector < (LBA_t)request->io.count) {
+            /* The sector buffer holds one of the sectors just written, so refresh it (as f_write does) */
+            memcpy(file->buf, request->buffer + (file->sect - sector) * FF_MAX_SS, FF_MAX_SS);
+        }
+        file->flag |= FIL_MODIFIED;
+    }
 
-    result = f_mkdir(path);
-    if (result == FR_OK) {
-        return 0;
-    } else {
-        log_num(LOG_ERROR, "fsys_mkdir error: ", result);
-        return fatfs_to_foenix(result);
+    fres = f_lseek(file, f_tell(file) + n);
+    request->buffer += n;
+    request->size -= n;
+    if (fres != FR_OK) {
+        request->result = fatfs_to_foenix(fres);
+        request->state = ASYNC_FINISHED;
+    } else if (request->size == 0) {
+        request->state = ASYNC_FINISHED;
     }
 }
 
 /**
- * Delete a file or directory
+ * Hand the next run of whole sectors of an asynchronous transfer to the block device
+ *
+ * This is only possible when the transfer is at a sector boundary, inside the file,
+ * with nothing waiting in the file's buffers, and the file has a cluster link map
+ * (or is contiguous), so that its sectors can be found without FatFs. The run stops
+ * at the end of the clusters holding it. A driver that can carry out the request on
+ * its own gets up to ASYNC_RUN_SECTORS, which it moves in the background; any other
+ * gets a slice, which is moved the next time the device is polled.
  *
  * Inputs:
- * path = the path of the file or directory to delete.
+ * request = the transfer (it must be running, with no run at the block device)
  *
  * Returns:
- * 0 on success, negative number on failure.
+ * 1 if a run was queued (or queueing it failed, which finishes the transfer), 0 if the transfer must take a slice
  */
-short fsys_delete(const char * path) {
-    FRESULT result;
+static short fsys_async_submit(p_async_request request) {
+    short fd = chan_get_record(request->chan)->data[0];
+    FIL * file = &g_file[fd];
+    FATFS * fs = file->obj.fs;
+    p_file_buffer file_buffer = &g_file_buffer[fd];
+    FSIZE_t position;
+    DWORD first, offset, run, count;
+    short result;
+
+    if ((file_buffer->mode == FILE_BUFFER_READ) && (file_buffer->position >= file_buffer->count)) {
+        /* Everything read ahead has been handed out */
+        fsys_buffer_settle(fd);
+    }
 
-	// If the path being deleted is on the floppy drive, make sure the FDC status
-	// is updated correctly for disk change by spinning up the motor and checking the DIR register
-	fsys_update_stat(path);
+    position = f_tell(file);
+    if ((file_buffer->mode != FILE_BUFFER_EMPTY) || (file->flag & FIL_DIRTY) || (position % FF_MAX_SS) ||
+        ((file->cltbl == 0) && !FILE_CONTIGUOUS(file))) {
+        return 0;
+    }
 
-    result = f_unlink(path);
-    if (result == FR_OK) {
+    count = (DWORD)(((request->size < f_size(file) - position) ? request->size : f_size(file) - position) / FF_MAX_SS);
+    if ((count == 0) || !fsys_file_run(file, (DWORD)(position / FF_MAX_SS / fs->csize), &first, &run)) {
         return 0;
+    }
+
+    offset = (DWORD)(position / FF_MAX_SS) & (fs->csize - 1);
+    run = run * fs->csize - offset;
+    if (count > run) {
+        count = run;
+    }
+    if (bdev_can_start(fs->pdrv)) {
+        if (count > ASYNC_RUN_SECTORS) {
+            count = ASYNC_RUN_SECTORS;
+        }
+    } else if (count > ASYNC_SLICE_SIZE / FF_MAX_SS) {
+        count = ASYNC_SLICE_SIZE / FF_MAX_SS;
+    }
+
+    request->io.op = request->write ? BDEV_REQ_WRITE : BDEV_REQ_READ;
+    request->io.lba = (long)(fs->database + (LBA_t)(first - 2) * fs->csize + offset);
+    request->io.count = (short)count;
+    request->io.buffer = request->buffer;
+    request->io.callback = fsys_async_complete;
+    request->io.context = request;
+
+    result = bdev_submit(fs->pdrv, &request->io);
+    if (result != 0) {
+        request->result = result;
+        request->state = ASYNC_FINISHED;
     } else {
-        log_num(LOG_ERROR, "fsys_delete error: ", result);
-        return fatfs_to_foenix(result);
+        request->io_busy = 1;
     }
+
+    return 1;
 }
 
 /**
- * Rename a file or directory
+ * Work on an asynchronous transfer
  *
- * Inputs:
- * old_path = the current path to the file
- * new_path = the new path for the file
+ * If the block device has a run of the transfer, it is moved along, and once it is
+ * done the file is moved past it and the next run is queued straight away, so the
+ * device keeps working between calls. Where the next bytes cannot go to the device
+ * as a run (a partial sector, bytes in the file's buffers, a file without a cluster
+ * link map, or a write that grows the file), a slice is moved through the file's
+ * byte I/O buffer, ending on a sector boundary. The transfer is finished when all
+ * its bytes are moved, when the end of the file (or of the free space) cuts it short,
+ * or on an error.
  *
- * Returns:
- * 0 on success, negative number on failure.
+ * Inputs:
+ * request = the transfer to work on (it must be running)
  */
-short fsys_rename(const char * old_path, const char * new_path) {
-    FRESULT fres;
+static void fsys_async_step(p_async_request request) {
+    unsigned long n, count;
+    short fd, result;
+
+    if (request->io_busy) {
+        if (request->io.status == BDEV_REQ_PENDING) {
+            bdev_poll(request->io.dev);
+            if (request->io.status == BDEV_REQ_PENDING) {
+                return;
+            }
+        }
 
-	// If the path being renamed is on the floppy drive, make sure the FDC status
-	// is updated correctly for disk change by spinning up the motor and checking the DIR register
-	fsys_update_stat(old_path);
+        fsys_async_land(request);
+        if (request->state != ASYNC_RUNNING) {
+            return;
+        }
+    }
 
-    fres = f_rename(old_path, new_path);
-    if (fres != 0) {
-        return fatfs_to_foenix(fres);
+    if (fsys_async_submit(request)) {
+        return;
+    }
+
+    fd = chan_get_record(request->chan)->data[0];
+    n = ASYNC_SLICE_SIZE - (unsigned long)(fsys_buffer_tell(fd) % FF_MAX_SS);
+    if (n > request->size) {
+        n = request->size;
+    }
+
+    /* The channel calls turn the file away while the transfer runs, so go around them */
+    if (request->write) {
+        result = fsys_file_write(fd, request->buffer, (short)n);
+        count = (result < 0) ? 0 : (unsigned long)result;
     } else {
-        return 0;
+        result = fsys_buffer_read(fd, request->buffer, n, &count);
+    }
+
+    if (result < 0) {
+        request->result = result;
+        request->state = ASYNC_FINISHED;
+        return;
+    }
+
+    request->buffer += count;
+    request->size -= count;
+    request->done += count;
+    if ((request->size == 0) || ((unsigned long)count < n)) {
+        request->state = ASYNC_FINISHED;
     }
 }
 
 /**
- * Change the current working directory (and drive)
+ * Move the next asynchronous transfer still running along
  *
- * Inputs:
- * path = the path that should be the new current
+ * The transfers take turns, so that a long one does not hold up the others.
  *
  * Returns:
- * 0 on success, negative number on failure.
+ * 1 if a transfer was worked on, 0 if none were running
  */
-short fsys_set_cwd(const char * path) {
-    FRESULT result;
+static short fsys_async_work() {
+    short i, n;
+
+    for (n = 0; n < MAX_ASYNC; n++) {
+        i = (g_async_next + n) % MAX_ASYNC;
+        if (g_async[i].state == ASYNC_RUNNING) {
+            g_async_next = (i + 1) % MAX_ASYNC;
+            fsys_async_step(&g_async[i]);
+            return 1;
+        }
+    }
 
-	/* Send the path to FatFS */
-    result = f_chdir(path);
-    if (result == FR_OK) {
-		/* Set our copy of the current directory */
-		f_getcwd(g_current_directory, MAX_PATH_LEN);
-        return 0;
-    } else {
-        log_num(LOG_ERROR, "fsys_set_cwd error: ", result);
-        return fatfs_to_foenix(result);
+    return 0;
+}
+
+/**
+ * Drop the asynchronous transfers of a file that is being closed (finished or not)
+ *
+ * Inputs:
+ * chan = the channel ID for the file
+ */
+static void fsys_async_cancel(short chan) {
+    short i;
+
+    for (i = 0; i < MAX_ASYNC; i++) {
+        if ((g_async[i].state != ASYNC_FREE) && (g_async[i].chan == chan)) {
+            if (g_async[i].io_busy) {
+                /* The device still has the caller's buffer... let it finish, and bring the file up to date */
+                bdev_wait(&g_async[i].io);
+                fsys_async_land(&g_async[i]);
+            }
+            g_async[i].state = ASYNC_FREE;
+        }
     }
 }
 
 /**
- * Get the current working drive and directory
+ * Check whether a file has an asynchronous transfer running
+ *
+ * While it does, the transfer owns the file's position, so the file may not be
+ * read, written, moved, or changed in any other way.
  *
  * Inputs:
- * path = the buffer in which to store the directory
- * size = the size of the buffer in bytes
+ * chan = the channel ID for the file
  *
  * Returns:
- * 0 on success, negative number on failure.
+ * 1 if a transfer is running on the file, 0 if not
  */
-short fsys_get_cwd(char * path, short size) {
-    strncpy(path, g_current_directory, size);
-	return 0;
+static short fsys_async_busy(short chan) {
+    short i;
+
+    for (i = 0; i < MAX_ASYNC; i++) {
+        if ((g_async[i].state == ASYNC_RUNNING) && (g_async[i].chan == chan)) {
+            return 1;
+        }
+    }
+
+    return 0;
 }
 
-short fchan_init() {
-    /* Nothing needed here */
+/**
+ * Queue an asynchronous transfer on an open file
+ *
+ * Inputs:
+ * chan = the channel ID for the file
+ * buffer = the memory to fill or to write from
+ * size = the number of bytes to move
+ * write = non-zero to write the file, 0 to read it
+ * token = pointer to the token to poll the transfer with
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+static short fsys_async_start(short chan, unsigned char * buffer, unsigned long size, short write, short * token) {
+    p_async_request request = 0;
+    p_channel record;
+    FIL * file;
+    short i;
+
+    if (token == 0) {
+        return ERR_BAD_ARGUMENT;
+    }
+
+    if ((chan < 0) || (chan >= CHAN_MAX)) {
+        return ERR_BADCHANNEL;
+    }
+
+    record = chan_get_record(chan);
+    if ((record->number != chan) || (record->dev != CDEV_FILE)) {
+        return ERR_BADCHANNEL;
+    }
+
+    if (record->data[0] >= MAX_FILES) {
+        return ERR_BADCHANNEL;
+    }
+
+    file = &g_file[record->data[0]];
+    if (write && ((file->flag & FA_WRITE) == 0)) {
+        return FSYS_ERR_DENIED;
+    }
+
+    if (fsys_async_busy(chan)) {
+        /* One transfer at a time per file, so they cannot fight over its position */
+        return DEV_BUSY;
+    }
+
+    for (i = 0; i < MAX_ASYNC; i++) {
+        if (g_async[i].state == ASYNC_FREE) {
+            request = &g_async[i];
+            break;
+        }
+    }
+
+    if (request == 0) {
+        return ERR_OUT_OF_HANDLES;
+    }
+
+    /* The token names the record, and changes each time the record is used */
+    request->token = (short)((g_async_serial++ % (0x7fff / MAX_ASYNC)) * MAX_ASYNC + (request - g_async));
+    request->state = (size > 0) ? ASYNC_RUNNING : ASYNC_FINISHED;
+    request->write = (write != 0);
+    request->chan = chan;
+    request->result = 0;
+    request->buffer = buffer;
+    request->size = size;
+    request->done = 0;
+    request->io_busy = 0;
+
+    *token = request->token;
     return 0;
 }
 
 /**
- * Channel driver routines for files.
+ * Start reading an open file in the background
+ *
+ * Whole sectors of a mapped (or contiguous) file are queued on the block device in
+ * runs, which a driver that works on its own (the PATA driver in interrupt mode)
+ * moves in the background; each time the transfer is polled, and whenever the kernel
+ * is idle, the next run is queued. Anything else moves a slice at a time on those
+ * calls. Until it is finished, the buffer belongs to the kernel, and
+ * any other use of the file fails with DEV_BUSY.
+ *
+ * Inputs:
+ * chan = the channel ID for the file
+ * buffer = the memory to fill
+ * size = the number of bytes to read
+ * token = pointer to the token to poll the transfer with
+ *
+ * Returns:
+ * 0 on success, negative number on failure
  */
-FIL * fchan_to_file(t_channel * chan) {
-    short fd;
+short fsys_read_async(short chan, unsigned char * buffer, unsigned long size, short * token) {
+    TRACE("fsys_read_async");
+    return fsys_async_start(chan, buffer, size, 0, token);
+}
 
-    fd = chan->data[0];         /* Get the file descriptor number */
-    if (fd < MAX_FILES) {
-        return &g_file[fd];     /* Return the pointer to the file descriptor */
+/**
+ * Start writing an open file in the background
+ *
+ * The write moves like fsys_read_async's read, inside the file's size. Bytes that grow
+ * the file move a slice at a time.
+ *
+ * Inputs:
+ * chan = the channel ID for the file
+ * buffer = the bytes to write
+ * size = the number of bytes to write
+ * token = pointer to the token to poll the transfer with
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+short fsys_write_async(short chan, const unsigned char * buffer, unsigned long size, short * token) {
+    TRACE("fsys_write_async");
+    return fsys_async_start(chan, (unsigned char *)buffer, size, 1, token);
+}
+
+/**
+ * Check on an asynchronous transfer, moving it along if it is still running
+ *
+ * Once the transfer is reported finished (or failed), its token is no longer valid.
+ *
+ * Inputs:
+ * token = the token of the transfer
+ * count = pointer to the number of bytes moved so far (0 if not wanted)
+ *
+ * Returns:
+ * FSYS_ASYNC_PENDING if the transfer is still running, 0 if it is finished, negative number on failure
+ */
+short fsys_poll(short token, unsigned long * count) {
+    p_async_request request;
+    short result;
+
+    if (token < 0) {
+        return ERR_BAD_HANDLE;
+    }
+
+    request = &g_async[token % MAX_ASYNC];
+    if ((request->state == ASYNC_FREE) || (request->token != token)) {
+        return ERR_BAD_HANDLE;
+    }
+
+    if (request->state == ASYNC_RUNNING) {
+        fsys_async_step(request);
+    }
+
+    if (count) {
+        *count = request->done;
+    }
+
+    if (request->state == ASYNC_RUNNING) {
+        return FSYS_ASYNC_PENDING;
+    }
+
+    result = request->result;
+    request->state = ASYNC_FREE;
+    return result;
+}
+
+/**
+ * Close access to a previously open file.
+ *
+ * Inputs:
+ * c = the channel ID for the file
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+short fsys_close(short c) {
+    p_channel chan = 0;
+    short fd = 0;
+    short result = 0;
+
+    chan = chan_get_record(c);          /* Get the channel record */
+    fd = chan->data[0];                 /* Get the file descriptor number */
+
+    fsys_async_cancel(c);               /* Drop any transfers still going on in the background */
+    result = fsys_buffer_settle(fd);    /* Write out any bytes still in the buffer */
+    f_close(&g_file[fd]);               /* Close the file in FATFS */
+    fsys_fastseek_release(fd);          /* Return any cluster link map */
+    fsys_buffer_setup(fd, FILE_BUFFER_SIZE);    /* Return any allocated buffer */
+    chan_free(chan);                    /* Return the channel to the pool */
+    g_fil_state[fd] = 0;                /* Return the file descriptor to the pool. */
+
+    return result;
+}
+
+/**
+ * N.B.: fsys_open returns a channel ID, and fsys_close accepts a channel ID.
+ * read and write access, seek, eof status, etc. will be handled by the channel
+ * calls.
+ */
+
+/**
+ * Attempt to open a directory for scanning
+ *
+ * Inputs:
+ * path = the path to the directory to open
+ *
+ * Returns:
+ * the handle to the directory if >= 0. An error if < 0
+ */
+short fsys_opendir(const char * path) {
+    short i;
+    short dir = -1;
+    FRESULT fres;
+
+	// Make sure our status is updated for the drive indicated by the path
+	fsys_update_stat(path);
+
+    /* Allocate a directory handle */
+    for (i = 0; i < MAX_DIRECTORIES; i++) {
+        if (g_dir_state[i] == 0) {
+			g_dir_state[i] = 1;
+            dir = i;
+            break;
+        }
+    }
+
+    if (dir < 0) {
+        return ERR_OUT_OF_HANDLES;
     } else {
-        return 0;               /* Return NULL if fd is out of range */
+        /* Try to open the directory */
+        if (path[0] == 0) {
+            char cwd[128];
+            fsys_get_cwd(cwd, 128);
+            fres = f_opendir(&g_directory[dir], cwd);
+        } else {
+            fres = f_opendir(&g_directory[dir], path);
+        }
+        if (fres != FR_OK) {
+            /* If there was a problem, return an error number */
+            return fatfs_to_foenix(fres);
+        } else {
+            /* Otherwise, allocate and return the handle (with no pattern left from a past search) */
+            g_directory[dir].pat = 0;
+            g_dir_state[dir] = 1;
+            return dir;
+        }
+    }
+}
+
+/**
+ * Close a previously open directory
+ *
+ * Inputs:
+ * dir = the directory handle to close
+ *
+ * Returns:
+ * 0 on success, negative number on error
+ */
+short fsys_closedir(short dir) {
+    if (g_dir_state[dir]) {
+        /* Close and deallocate the handle */
+        f_closedir(&g_directory[dir]);
+        g_dir_state[dir] = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Attempt to read an entry from an open directory
+ *
+ * Inputs:
+ * dir = the handle of the open directory
+ * file = pointer to the t_file_info structure to fill out.
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+short fsys_readdir(short dir, p_file_info file) {
+    FILINFO finfo;
+
+    if (g_dir_state[dir]) {
+        FRESULT fres = f_readdir(&g_directory[dir], &finfo);
+        if (fres != FR_OK) {
+            return fatfs_to_foenix(fres);
+        } else {
+            int i;
+
+            /* Copy file information into the kernel table */
+            file->size = finfo.fsize;
+            file->date = finfo.fdate;
+            file->time = finfo.ftime;
+            file->attributes = finfo.fattrib;
+
+            for (i = 0; i < MAX_PATH_LEN; i++) {
+                file->name[i] = finfo.fname[i];
+                if (file->name[i] == 0) {
+                    break;
+                }
+            }
+
+            return 0;
+        }
+    } else {
+        return ERR_BAD_HANDLE;
+    }
+}
+
+/**
+ * Check to see if the file is present.
+ * If it is not, return a file not found error.
+ * If it is, populate the file info record
+ *
+ * Inputs:
+ * path = the path to the file to check
+ * file = pointer to a file info record to fill in, if the file is found.
+ */
+short fsys_stat(const char * path, p_file_info file) {
+	FRESULT fres;
+	FILINFO finfo;
+	char match1[10], match2[10];
+	short i = 0;
+
+	// If the file being checked is on the floppy drive, make sure the FDC status
+	// is updated correctly for disk change by spinning up the motor and checking the DIR register
+	fsys_update_stat(path);
+
+	// FatFS's f_stat function does not handle root directories so bodge this in...
+	// For each drive...
+	for (i = 0; i < FF_VOLUMES; i++) {
+		// Compute two legitimate paths to it
+		strcpy(match1, "/");
+		strcat(match1, (char *)VolumeStr[i]);
+		strcpy(match2, match1);
+		strcat(match2, "/");
+
+		// Check to see if the path is the same (barring letter case)
+		if ((strcicmp(path, match1) == 0) || (strcicmp(path, match2) == 0)) {
+			// It's a match... return the record for it
+			file->size = 0;
+			file->date = 0;
+			file->time = 0;
+			file->attributes = FSYS_AM_DIR;
+			strcpy(file->name, (char *)VolumeStr[i]);
+			return 0;
+		}
+	}
+
+	fres = f_stat(path, &finfo);
+	if (fres == FR_OK) {
+		int i;
+
+		/* Copy file information into the kernel table */
+		file->size = finfo.fsize;
+		file->date = finfo.fdate;
+		file->time = finfo.ftime;
+		file->attributes = finfo.fattrib;
+
+		for (i = 0; i < MAX_PATH_LEN; i++) {
+			file->name[i] = finfo.fname[i];
+			if (file->name[i] == 0) {
+				break;
+			}
+		}
+
+		return 0;
+
+	} else {
+		/* There was an error... return it to the caller */
+		return fatfs_to_foenix(fres);
+	}
+}
+
+/**
+ * Open a directory given the path and search for the first file matching the pattern.
+ *
+ * Inputs:
+ * path = the path to the directory to search
+ * pattern = the file name pattern to search for
+ * file = pointer to the t_file_info structure to fill out
+ *
+ * Returns:
+ * the directory handle to use for subsequent calls if >= 0, error if negative
+ */
+short fsys_findfirst(const char * path, const char * pattern, p_file_info file) {
+    FILINFO finfo;
+    FRESULT fres = -1;
+    short dir = 0;
+    short i = 0;
+
+	// If the path being queried is on the floppy drive, make sure the FDC status
+	// is updated correctly for disk change by spinning up the motor and checking the DIR register
+	fsys_update_stat(path);
+
+    /* Allocate a directory handle */
+    for (i = 0; i < MAX_DIRECTORIES; i++) {
+        if (g_dir_state[i] == 0) {
+			g_dir_state[i] = 1;
+            dir = i;
+            break;
+        }
+    }
+
+    if (dir < 0) {
+        return ERR_OUT_OF_HANDLES;
+
+    } else {
+		fres = f_findfirst(&g_directory[dir], &finfo, path, pattern);
+        if (fres != FR_OK) {
+            return fatfs_to_foenix(fres);
+
+        } else {
+            int i;
+
+            /* Copy file information into the kernel table */
+            file->size = finfo.fsize;
+            file->date = finfo.fdate;
+            file->time = finfo.ftime;
+            file->attributes = finfo.fattrib;
+
+            for (i = 0; i < MAX_PATH_LEN; i++) {
+                file->name[i] = finfo.fname[i];
+                if (file->name[i] == 0) {
+                    break;
+                }
+            }
+
+            return dir;
+        }
+    }
+}
+
+/**
+ * Open a directory given the path and search for the first file matching the pattern.
+ *
+ * Inputs:
+ * dir = the handle to the directory (returned by fsys_findfirst) to search
+ * file = pointer to the t_file_info structure to fill out
+ *
+ * Returns:
+ * 0 on success, error if negative
+ */
+short fsys_findnext(short dir, p_file_info file) {
+    FILINFO finfo;
+    FRESULT fres;
+
+    if (g_dir_state[dir]) {
+        fres = f_findnext(&g_directory[dir], &finfo);
+        if (fres != FR_OK) {
+            return fatfs_to_foenix(fres);
+
+        } else {
+            int i;
+
+            /* Copy file information into the kernel table */
+            file->size = finfo.fsize;
+            file->date = finfo.fdate;
+            file->time = finfo.ftime;
+            file->attributes = finfo.fattrib;
+
+            for (i = 0; i < MAX_PATH_LEN; i++) {
+                file->name[i] = finfo.fname[i];
+                if (file->name[i] == 0) {
+                    break;
+                }
+            }
+
+            return 0;
+        }
+    } else {
+        return ERR_BAD_HANDLE;
+    }
+}
+
+/**
+ * Compare two batch entries for fsys_readdir_batch's sort
+ *
+ * Inputs:
+ * a = the first entry
+ * b = the second entry
+ * sort = the FSYS_SORT_ order
+ *
+ * Returns:
+ * negative if a goes before b, positive if a goes after b, 0 if they are equal
+ */
+static short fsys_batch_compare(p_dir_batch_entry a, p_dir_batch_entry b, short sort) {
+    short result = 0;
+
+    if (sort & FSYS_SORT_DIRS_FIRST) {
+        result = (short)(b->attributes & FSYS_AM_DIR) - (short)(a->attributes & FSYS_AM_DIR);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    switch (sort & FSYS_SORT_KEY) {
+        case FSYS_SORT_SIZE:
+            result = (a->size < b->size) ? -1 : ((a->size > b->size) ? 1 : 0);
+            break;
+
+        case FSYS_SORT_DATE:
+            if (a->date != b->date) {
+                result = (a->date < b->date) ? -1 : 1;
+            } else if (a->time != b->time) {
+                result = (a->time < b->time) ? -1 : 1;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (result == 0) {
+        /* Names break any ties, so the order is always the same */
+        result = strcicmp(a->name, b->name);
+    }
+
+    return (sort & FSYS_SORT_DESCENDING) ? -result : result;
+}
+
+/**
+ * Read as many entries from an open directory as fit in a buffer
+ *
+ * The entries are stored as an array of t_dir_batch_entry at the front of the
+ * buffer, with their names packed in from the back. A batch ends when there is
+ * no longer room for an entry with the longest possible name, so the buffer
+ * must be able to hold at least one. Sorting applies within the batch, so a
+ * fully sorted listing needs a buffer that holds the whole directory.
+ *
+ * Inputs:
+ * dir = the handle of the open directory (from fsys_opendir or fsys_findfirst)
+ * buffer = the buffer to fill
+ * size = the number of bytes in the buffer
+ * pattern = file name pattern the entries must match for this call (0 for all
+ *           entries, or the pattern given to fsys_findfirst)
+ * sort = the FSYS_SORT_ order to put the entries of the batch in
+ *
+ * Returns:
+ * the number of entries stored (0 at the end of the directory), negative number on error
+ */
+short fsys_readdir_batch(short dir, p_dir_batch_entry buffer, unsigned long size, const char * pattern, short sort) {
+    FILINFO finfo;
+    FRESULT fres = FR_OK;
+    DIR * dp;
+    const TCHAR * saved_pattern;
+    char * names;
+    unsigned long length;
+    short count = 0, gap, i, j;
+    t_dir_batch_entry entry;
+
+    if ((dir < 0) || (dir >= MAX_DIRECTORIES) || (g_dir_state[dir] == 0)) {
+        return ERR_BAD_HANDLE;
+    }
+
+    if (size < sizeof(t_dir_batch_entry) + FF_MAX_LFN + 1) {
+        return ERR_BAD_ARGUMENT;
+    }
+
+    /* The pattern only applies to this call: a pattern from fsys_findfirst is put back afterwards */
+    dp = &g_directory[dir];
+    saved_pattern = dp->pat;
+    if (pattern) {
+        dp->pat = pattern;
+    }
+
+    names = (char *)buffer + size;
+    while ((count < 0x7fff) && ((long)(names - (char *)&buffer[count + 1]) >= FF_MAX_LFN + 1)) {
+        if (dp->pat) {
+            fres = f_findnext(dp, &finfo);
+        } else {
+            fres = f_readdir(dp, &finfo);
+        }
+
+        if ((fres != FR_OK) || (finfo.fname[0] == 0)) {
+            break;
+        }
+
+        length = strlen(finfo.fname) + 1;
+        names -= length;
+        memcpy(names, finfo.fname, length);
+
+        buffer[count].size = finfo.fsize;
+        buffer[count].date = finfo.fdate;
+        buffer[count].time = finfo.ftime;
+        buffer[count].attributes = finfo.fattrib;
+        buffer[count].name = names;
+        count++;
+    }
+
+    dp->pat = saved_pattern;
+
+    if ((fres != FR_OK) && (count == 0)) {
+        return fatfs_to_foenix(fres);
+    }
+
+    if ((sort & (FSYS_SORT_KEY | FSYS_SORT_DIRS_FIRST)) != FSYS_SORT_NONE) {
+        /* Shell sort: in place, and quick enough for a buffer's worth of entries */
+        for (gap = count / 2; gap > 0; gap /= 2) {
+            for (i = gap; i < count; i++) {
+                entry = buffer[i];
+                for (j = i; (j >= gap) && (fsys_batch_compare(&buffer[j - gap], &entry, sort) > 0); j -= gap) {
+                    buffer[j] = buffer[j - gap];
+                }
+                buffer[j] = entry;
+            }
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Create a directory
+ *
+ * Inputs:
+ * path = the path of the directory to create.
+ *
+ * Returns:
+ * 0 on success, negative number on failure.
+ */
+short fsys_mkdir(const char * path) {
+    FRESULT result;
+
+    TRACE("fsys_mkdir");
+
+	// If the directory being created is on the floppy drive, make sure the FDC status
+	// is updated correctly for disk change by spinning up the motor and checking the DIR register
+	fsys_update_stat(path);
+
+    result = f_mkdir(path);
+    if (result == FR_OK) {
+        return 0;
+    } else {
+        log_num(LOG_ERROR, "fsys_mkdir error: ", result);
+        return fatfs_to_foenix(result);
+    }
+}
+
+/**
+ * Delete a file or directory
+ *
+ * Inputs:
+ * path = the path of the file or directory to delete.
+ *
+ * Returns:
+ * 0 on success, negative number on failure.
+ */
+short fsys_delete(const char * path) {
+    FRESULT result;
+
+	// If the path being deleted is on the floppy drive, make sure the FDC status
+	// is updated correctly for disk change by spinning up the motor and checking the DIR register
+	fsys_update_stat(path);
+
+    fsys_exec_invalidate(path);
+    result = f_unlink(path);
+    if (result == FR_OK) {
+        return 0;
+    } else {
+        log_num(LOG_ERROR, "fsys_delete error: ", result);
+        return fatfs_to_foenix(result);
+    }
+}
+
+/**
+ * Rename a file or directory
+ *
+ * Inputs:
+ * old_path = the current path to the file
+ * new_path = the new path for the file
+ *
+ * Returns:
+ * 0 on success, negative number on failure.
+ */
+short fsys_rename(const char * old_path, const char * new_path) {
+    FRESULT fres;
+
+	// If the path being renamed is on the floppy drive, make sure the FDC status
+	// is updated correctly for disk change by spinning up the motor and checking the DIR register
+	fsys_update_stat(old_path);
+
+    fsys_exec_invalidate(old_path);
+    fsys_exec_invalidate(new_path);
+    fres = f_rename(old_path, new_path);
+    if (fres != 0) {
+        return fatfs_to_foenix(fres);
+    } else {
+        return 0;
+    }
+}
+
+/**
+ * Change the current working directory (and drive)
+ *
+ * Inputs:
+ * path = the path that should be the new current
+ *
+ * Returns:
+ * 0 on success, negative number on failure.
+ */
+short fsys_set_cwd(const char * path) {
+    FRESULT result;
+
+	/* Send the path to FatFS */
+    result = f_chdir(path);
+    if (result == FR_OK) {
+		/* Set our copy of the current directory */
+		f_getcwd(g_current_directory, MAX_PATH_LEN);
+        return 0;
+    } else {
+        log_num(LOG_ERROR, "fsys_set_cwd error: ", result);
+        return fatfs_to_foenix(result);
+    }
+}
+
+/**
+ * Get the current working drive and directory
+ *
+ * Inputs:
+ * path = the buffer in which to store the directory
+ * size = the size of the buffer in bytes
+ *
+ * Returns:
+ * 0 on success, negative number on failure.
+ */
+short fsys_get_cwd(char * path, short size) {
+    strncpy(path, g_current_directory, size);
+	return 0;
+}
+
+short fchan_init() {
+    /* Nothing needed here */
+    return 0;
+}
+
+/**
+ * Channel driver routines for files.
+ */
+FIL * fchan_to_file(t_channel * chan) {
+    short fd;
+
+    fd = chan->data[0];         /* Get the file descriptor number */
+    if (fd < MAX_FILES) {
+        return &g_file[fd];     /* Return the pointer to the file descriptor */
+    } else {
+        return 0;               /* Return NULL if fd is out of range */
+    }
+}
+
+/**
+ * Find the run of contiguous clusters holding one of a file's clusters
+ *
+ * The run comes from the file's cluster link map or, for an exFAT file stored
+ * without a FAT chain, from the file's first cluster: such a file is a single run
+ * as long as the file, so neither a map nor the FAT is needed to find its sectors.
+ *
+ * Inputs:
+ * file = the file
+ * cluster = the number of the cluster in the file (0 for the first)
+ * first = pointer to the cluster on the volume holding that cluster of the file
+ * count = pointer to the number of clusters in the run, starting from that one
+ *
+ * Returns:
+ * 1 if the run was found, 0 if the file has no map or the map does not cover the cluster
+ */
+static short fsys_file_run(FIL * file, DWORD cluster, DWORD * first, DWORD * count) {
+    FATFS * fs = file->obj.fs;
+    DWORD * fragment;
+    DWORD length;
+
+    if (FILE_CONTIGUOUS(file)) {
+        length = (DWORD)((f_size(file) + (FSIZE_t)fs->csize * FF_MAX_SS - 1) / FF_MAX_SS / fs->csize);
+        if (cluster >= length) {
+            return 0;
+        }
+
+        *first = file->obj.sclust + cluster;
+        *count = length - cluster;
+        return 1;
+    }
+
+    if (file->cltbl == 0) {
+        return 0;
+    }
+
+    fragment = file->cltbl + 1;
+    while ((fragment[0] != 0) && (cluster >= fragment[0])) {
+        cluster -= fragment[0];
+        fragment += 2;
+    }
+
+    if (fragment[0] == 0) {
+        return 0;
+    }
+
+    *first = fragment[1] + cluster;
+    *count = fragment[0] - cluster;
+    return 1;
+}
+
+/**
+ * Read from a file, handing whole runs of sectors straight to the block device
+ *
+ * FatFs reads whole sectors directly into the caller's buffer, but no more than a
+ * cluster at a time. When the file has a cluster link map, or is a contiguous
+ * exFAT file, a sector aligned read is split by run instead, so that a single
+ * multi-sector read covers every cluster of a contiguous run. Partial sectors,
+ * and files without a map, go through f_read.
+ *
+ * Inputs:
+ * file = the file to read
+ * buffer = the buffer to fill
+ * size = the number of bytes to read
+ * total = pointer to the number of bytes actually read
+ *
+ * Returns:
+ * the FatFs result code
+ */
+static FRESULT fsys_read_fast(FIL * file, unsigned char * buffer, UINT size, UINT * total) {
+    FATFS * fs = file->obj.fs;
+    FSIZE_t position;
+    DWORD cluster, first, offset, run, count;
+    UINT n;
+    FRESULT fres;
+
+    *total = 0;
+
+    while (size > 0) {
+        position = f_tell(file);
+        if (size > f_size(file) - position) {
+            /* Stop at the end of the file */
+            size = f_size(file) - position;
+            if (size == 0) {
+                break;
+            }
+        }
+
+        if (((file->cltbl == 0) && !FILE_CONTIGUOUS(file)) || (file->flag & FIL_DIRTY)) {
+            /* No map, or the sector buffer holds data the device does not have yet */
+            fres = f_read(file, buffer, size, &n);
+            *total += n;
+            return fres;
+        }
+
+        if ((position % FF_MAX_SS) || (size < FF_MAX_SS)) {
+            /* Bring the file up to a sector boundary, or read the last partial sector */
+            n = FF_MAX_SS - (UINT)(position % FF_MAX_SS);
+            if (n > size) {
+                n = size;
+            }
+
+            fres = f_read(file, buffer, n, &n);
+            if ((fres != FR_OK) || (n == 0)) {
+                return fres;
+            }
+
+        } else {
+            /* Find the run holding the position */
+            cluster = (DWORD)(position / FF_MAX_SS / fs->csize);
+            if (!fsys_file_run(file, cluster, &first, &run)) {
+                /* The map does not cover the position... leave it to FatFs */
+                fres = f_read(file, buffer, size, &n);
+                *total += n;
+                return fres;
+            }
+
+            /* Read as much of the rest of the run as was asked for */
+            offset = (DWORD)(position / FF_MAX_SS) & (fs->csize - 1);
+            run = run * fs->csize - offset;
+            count = size / FF_MAX_SS;
+            if (count > run) {
+                count = run;
+            }
+
+            if (disk_read(fs->pdrv, buffer, fs->database + (LBA_t)(first - 2) * fs->csize + offset, count) != RES_OK) {
+                return FR_DISK_ERR;
+            }
+
+            /* Move the file past the sectors, which the run does without touching the FAT */
+            n = count * FF_MAX_SS;
+            fres = f_lseek(file, position + n);
+            if (fres != FR_OK) {
+                return fres;
+            }
+        }
+
+        buffer += n;
+        size -= n;
+        *total += n;
+    }
+
+    return FR_OK;
+}
+
+/**
+ * Write over a file's reserved space, handing whole runs of sectors straight to the block device
+ *
+ * This is the writing half of fsys_read_fast: when the file has a cluster link map,
+ * or is a contiguous exFAT file, a sector aligned write inside the file's size is
+ * split by run, so that a single multi-sector write covers every cluster of a
+ * contiguous run. Anything else (partial sectors, writes that grow the file, files
+ * without a map) goes through f_write.
+ *
+ * Inputs:
+ * file = the file to write
+ * buffer = the data to write
+ * size = the number of bytes to write
+ * total = pointer to the number of bytes actually written
+ *
+ * Returns:
+ * the FatFs result code
+ */
+static FRESULT fsys_write_fast(FIL * file, const unsigned char * buffer, UINT size, UINT * total) {
+    FATFS * fs = file->obj.fs;
+    FSIZE_t position;
+    DWORD cluster, first, offset, run, count;
+    LBA_t sector;
+    UINT n;
+    FRESULT fres;
+
+    *total = 0;
+
+    while (size > 0) {
+        position = f_tell(file);
+        if (((file->cltbl == 0) && !FILE_CONTIGUOUS(file)) || (file->flag & FIL_DIRTY) || (position % FF_MAX_SS) ||
+            (size < FF_MAX_SS) || (f_size(file) - position < FF_MAX_SS)) {
+            /* No map, a sector buffer the device does not have yet, or not a whole sector inside the file */
+            fres = f_write(file, buffer, size, &n);
+            *total += n;
+            return fres;
+        }
+
+        /* Find the run holding the position */
+        cluster = (DWORD)(position / FF_MAX_SS / fs->csize);
+        if (!fsys_file_run(file, cluster, &first, &run)) {
+            /* The map does not cover the position... leave it to FatFs */
+            fres = f_write(file, buffer, size, &n);
+            *total += n;
+            return fres;
+        }
+
+        /* Write as much of the rest of the run as was given, without passing the end of the file */
+        offset = (DWORD)(position / FF_MAX_SS) & (fs->csize - 1);
+        run = run * fs->csize - offset;
+        count = size / FF_MAX_SS;
+        if (count > run) {
+            count = run;
+        }
+        if (count > (DWORD)((f_size(file) - position) / FF_MAX_SS)) {
+            count = (DWORD)((f_size(file) - position) / FF_MAX_SS);
+        }
+
+        sector = fs->database + (LBA_t)(first - 2) * fs->csize + offset;
+        if (disk_write(fs->pdrv, buffer, sector, count) != RES_OK) {
+            return FR_DISK_ERR;
+        }
+
+        if (file->sect - sector < count) {
+            /* The sector buffer holds one of the sectors just written, so refresh it (as f_write does) */
+            memcpy(file->buf, buffer + (file->sect - sector) * FF_MAX_SS, FF_MAX_SS);
+        }
+        file->flag |= FIL_MODIFIED;
+
+        /* Move the file past the sectors, which the run does without touching the FAT */
+        n = count * FF_MAX_SS;
+        fres = f_lseek(file, position + n);
+        if (fres != FR_OK) {
+            return fres;
+        }
+
+        buffer += n;
+        size -= n;
+        *total += n;
+    }
+
+    return FR_OK;
+}
+
+/**
+ * Read from a file through its byte I/O buffer
+ *
+ * Any bytes read ahead are handed out first, and the rest is read straight into
+ * memory. Bytes waiting to be written are written first.
+ *
+ * Inputs:
+ * fd = the file descriptor number
+ * dest = the memory to fill
+ * size = the number of bytes to read
+ * total = pointer to the number of bytes actually read
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+static short fsys_buffer_read(short fd, unsigned char * dest, unsigned long size, unsigned long * total) {
+    p_file_buffer buffer = &g_file_buffer[fd];
+    unsigned long n = 0;
+    UINT count = 0;
+    FRESULT fres;
+    short result;
+
+    *total = 0;
+    if (buffer->mode == FILE_BUFFER_READ) {
+        n = buffer->count - buffer->position;
+        if (n > size) {
+            n = size;
+        }
+
+        memcpy(dest, buffer->data + buffer->position, n);
+        buffer->position += (unsigned short)n;
+        dest += n;
+        size -= n;
+        *total = n;
+
+        if (buffer->position < buffer->count) {
+            return 0;
+        }
+    }
+
+    /* The buffer is used up (or holds bytes to write), so FatFs takes it from here */
+    result = fsys_buffer_settle(fd);
+    if ((result != 0) || (size == 0)) {
+        return result;
+    }
+
+    fres = fsys_read_fast(&g_file[fd], dest, (UINT)size, &count);
+    *total += count;
+    return fatfs_to_foenix(fres);
+}
+
+/**
+ * Read a span of an open file straight into memory
+ *
+ * Inputs:
+ * chan = the channel ID for the file
+ * buffer = the memory to fill
+ * size = the number of bytes to read (may be more than a channel read can take)
+ * total = pointer to the number of bytes actually read
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+static short fsys_read_direct(short chan, unsigned char * buffer, unsigned long size, unsigned long * total) {
+    p_channel record;
+
+    *total = 0;
+    if ((chan < 0) || (chan >= CHAN_MAX)) {
+        return ERR_BADCHANNEL;
+    }
+
+    record = chan_get_record(chan);
+    if (fchan_to_file(record) == 0) {
+        return ERR_BADCHANNEL;
+    }
+
+    return fsys_buffer_read(record->data[0], buffer, size, total);
+}
+
+/**
+ * Read a a buffer from the device
+ */
+short fchan_read(t_channel * chan, unsigned char * buffer, short size) {
+    FIL * file;
+    short result;
+    unsigned long total_read;
+
+    logmsg(LOG_TRACE, "fchan_read");
+
+    file = fchan_to_file(chan);
+    if (file) {
+        if (fsys_async_busy(chan->number)) {
+            /* A transfer running in the background owns the file */
+            return DEV_BUSY;
+        }
+
+        result = fsys_buffer_read(chan->data[0], buffer, (unsigned long)size, &total_read);
+        if (result == 0) {
+            return (short)total_read;
+        } else {
+            return result;
+        }
+    }
+
+    return ERR_BADCHANNEL;
+}
+
+/**
+ * Read a line of text from the device
+ *
+ * The line is read from the file's buffer, and includes its '\n' if it has one.
+ */
+short fchan_readline(t_channel * chan, unsigned char * buffer, short size) {
+    p_file_buffer file_buffer;
+    FIL * file;
+    char * result;
+    short fd, status;
+    short total_read = 0;
+    unsigned char c;
+
+    file = fchan_to_file(chan);
+    if (file) {
+        if (fsys_async_busy(chan->number)) {
+            /* A transfer running in the background owns the file */
+            return DEV_BUSY;
+        }
+
+        fd = chan->data[0];
+        file_buffer = &g_file_buffer[fd];
+
+        if (file_buffer->data == 0) {
+            /* No buffer... have FatFs read the line a byte at a time */
+            result = f_gets((TCHAR *)buffer, size, file);
+            if (result) {
+                return strlen(result);
+            } else {
+                return fatfs_to_foenix(f_error(file));
+            }
+        }
+
+        if (size < 1) {
+            return ERR_BAD_ARGUMENT;
+        }
+
+        if (file_buffer->mode == FILE_BUFFER_WRITE) {
+            status = fsys_buffer_settle(fd);
+            if (status != 0) {
+                return status;
+            }
+        }
+
+        while (total_read < size - 1) {
+            if ((file_buffer->mode != FILE_BUFFER_READ) || (file_buffer->position >= file_buffer->count)) {
+                status = fsys_buffer_fill(fd);
+                if (status != 0) {
+                    if (total_read == 0) {
+                        return status;
+                    }
+                    break;
+                }
+
+                if (file_buffer->count == 0) {
+                    /* End of the file */
+                    break;
+                }
+            }
+
+            c = file_buffer->data[file_buffer->position++];
+            buffer[total_read++] = c;
+            if (c == '\n') {
+                break;
+            }
+        }
+
+        buffer[total_read] = 0;
+        return total_read;
+    }
+
+    return ERR_BADCHANNEL;
+}
+
+/**
+ * read a single byte from the device
+ *
+ * The byte comes from the file's buffer. At the end of the file, 0 is returned.
+ */
+short fchan_read_b(t_channel * chan) {
+    p_file_buffer file_buffer;
+    FRESULT result;
+    FIL * file;
+    short total_read;
+    short fd, status;
+    char buffer[2];
+
+    logmsg(LOG_TRACE, "fchan_read_b");
+
+    file = fchan_to_file(chan);
+    if (file) {
+        if (fsys_async_busy(chan->number)) {
+            /* A transfer running in the background owns the file */
+            return DEV_BUSY;
+        }
+
+        fd = chan->data[0];
+        file_buffer = &g_file_buffer[fd];
+
+        if (file_buffer->data == 0) {
+            /* No buffer... have FatFs read the byte */
+            buffer[0] = 0;
+            result = f_read(file, buffer, 1, (UINT*)&total_read);
+            if (result == FR_OK) {
+                return (short)(buffer[0] & 0x00ff);
+            } else {
+                return fatfs_to_foenix(result);
+            }
+        }
+
+        if ((file_buffer->mode != FILE_BUFFER_READ) || (file_buffer->position >= file_buffer->count)) {
+            status = fsys_buffer_settle(fd);
+            if (status == 0) {
+                status = fsys_buffer_fill(fd);
+            }
+            if (status != 0) {
+                return status;
+            }
+
+            if (file_buffer->count == 0) {
+                /* End of the file */
+                return 0;
+            }
+        }
+
+        return (short)file_buffer->data[file_buffer->position++];
+    }
+
+    return ERR_BADCHANNEL;
+}
+
+/**
+ * Write a buffer to the device
+ *
+ * Writes smaller than the file's buffer are collected in it. Bigger ones go
+ * straight to FatFs, after anything already in the buffer.
+ */
+static short fsys_file_write(short fd, const unsigned char * buffer, short size) {
+    p_file_buffer file_buffer = &g_file_buffer[fd];
+    FIL * file = &g_file[fd];
+    FRESULT result;
+    UINT total_written;
+    short status;
+
+    if ((file->flag & FA_WRITE) == 0) {
+        return FSYS_ERR_DENIED;
+    }
+
+    if ((size > 0) && (size < file_buffer->size)) {
+        if ((file_buffer->mode != FILE_BUFFER_WRITE) || (file_buffer->count + size > file_buffer->size)) {
+            status = fsys_buffer_settle(fd);
+            if (status != 0) {
+                return status;
+            }
+        }
+
+        memcpy(file_buffer->data + file_buffer->count, buffer, size);
+        file_buffer->count += size;
+        file_buffer->mode = FILE_BUFFER_WRITE;
+        return size;
+    }
+
+    status = fsys_buffer_settle(fd);
+    if (status != 0) {
+        return status;
+    }
+
+    if (file->cltbl && (f_tell(file) + size > f_size(file))) {
+        /* FatFs cannot grow a file through its cluster link map */
+        fsys_fastseek_release(fd);
+    }
+
+    result = f_write(file, buffer, size, &total_written);
+    if (result == FR_OK) {
+        return (short)total_written;
+    } else {
+        log_num(LOG_ERROR, "fchan_write error: ", result);
+        return fatfs_to_foenix(result);
+    }
+}
+
+/**
+ * Write a buffer to the file
+ */
+short fchan_write(p_channel chan, const unsigned char * buffer, short size) {
+    if (fchan_to_file(chan)) {
+        if (fsys_async_busy(chan->number)) {
+            /* A transfer running in the background owns the file */
+            return DEV_BUSY;
+        }
+
+        return fsys_file_write(chan->data[0], buffer, size);
+    }
+
+    return ERR_BADCHANNEL;
+}
+
+/**
+ * Write a single unsigned char to the device
+ *
+ * The byte is collected in the file's buffer, which is written out when it fills.
+ */
+short fchan_write_b(t_channel * chan, const unsigned char b) {
+    p_file_buffer file_buffer;
+    FIL * file;
+    FRESULT result;
+    UINT total_written;
+    short fd, status;
+    unsigned char buffer[1];
+
+    file = fchan_to_file(chan);
+    if (file) {
+        if (fsys_async_busy(chan->number)) {
+            /* A transfer running in the background owns the file */
+            return DEV_BUSY;
+        }
+
+        fd = chan->data[0];
+        file_buffer = &g_file_buffer[fd];
+
+        if (file_buffer->data == 0) {
+            /* No buffer... have FatFs write the byte */
+            if (file->cltbl && (f_tell(file) + 1 > f_size(file))) {
+                /* FatFs cannot grow a file through its cluster link map */
+                fsys_fastseek_release(fd);
+            }
+
+            buffer[0] = b;
+            result = f_write(file, buffer, 1, &total_written);
+            if (result == FR_OK) {
+                return (short)total_written;
+            } else {
+                return fatfs_to_foenix(result);
+            }
+        }
+
+        if ((file->flag & FA_WRITE) == 0) {
+            return FSYS_ERR_DENIED;
+        }
+
+        if ((file_buffer->mode != FILE_BUFFER_WRITE) || (file_buffer->count >= file_buffer->size)) {
+            status = fsys_buffer_settle(fd);
+            if (status != 0) {
+                return status;
+            }
+        }
+
+        file_buffer->data[file_buffer->count++] = b;
+        file_buffer->mode = FILE_BUFFER_WRITE;
+        return 1;
     }
+
+    return ERR_BADCHANNEL;
 }
 
 /**
- * Read a a buffer from the device
+ * Get the status of the device
  */
-short fchan_read(t_channel * chan, unsigned char * buffer, short size) {
+short fchan_status(t_channel * chan) {
     FIL * file;
-    FRESULT result;
-    int total_read;
-
-    logmsg(LOG_TRACE, "fchan_read");
+    FSIZE_t position;
+    FSIZE_t size;
+    short fd;
 
     file = fchan_to_file(chan);
     if (file) {
-        result = f_read(file, buffer, size, &total_read);
-        if (result == FR_OK) {
-            return (short)total_read;
-        } else {
-            return fatfs_to_foenix(result);
+        short status = 0;
+
+        /* The buffer may hold bytes read ahead or still to be written */
+        fd = chan->data[0];
+        position = fsys_buffer_tell(fd);
+        size = f_size(file);
+        if ((g_file_buffer[fd].mode == FILE_BUFFER_WRITE) && (position > size)) {
+            size = position;
         }
+
+        if (position >= size) {
+            status |= CDEV_STAT_EOF;
+        }
+
+        if (f_error(file) != FR_OK) {
+            status |= CDEV_STAT_ERROR;
+        }
+
+        return status;
     }
 
     return ERR_BADCHANNEL;
 }
 
 /**
- * Read a line of text from the device
+ * Ensure that any pending writes to the device have been completed
  */
-short fchan_readline(t_channel * chan, unsigned char * buffer, short size) {
+short fchan_flush(t_channel * chan) {
     FIL * file;
-    char * result;
-    int total_read;
+    FRESULT result;
+    short status;
 
     file = fchan_to_file(chan);
     if (file) {
-        result = f_gets(buffer, size, file);
-        if (result) {
-            return strlen(buffer);
-        } else {
-            return fatfs_to_foenix(f_error(file));
+        if (fsys_async_busy(chan->number)) {
+            /* A transfer running in the background owns the file */
+            return DEV_BUSY;
         }
+
+        status = fsys_buffer_settle(chan->data[0]);
+        if (status != 0) {
+            return status;
+        }
+
+        result = f_sync(file);
+        return fatfs_to_foenix(result);
     }
 
     return ERR_BADCHANNEL;
 }
 
 /**
- * read a single byte from the device
+ * Attempt to move the "cursor" position in the channel
+ *
+ * A move within the bytes read ahead into the file's buffer just moves through
+ * the buffer.
  */
-short fchan_read_b(t_channel * chan) {
-    FRESULT result;
+short fchan_seek(t_channel * chan, long position, short base) {
+    p_file_buffer file_buffer;
     FIL * file;
-    short total_read;
-    char buffer[2];
-
-    logmsg(LOG_TRACE, "fchan_read_b");
+    FSIZE_t start;
+    long target;
+    short fd, status;
 
     file = fchan_to_file(chan);
     if (file) {
-        result = f_read(file, buffer, 1, (UINT*)&total_read);
-        if (result == FR_OK) {
-            return (short)(buffer[0] & 0x00ff);
+        if (fsys_async_busy(chan->number)) {
+            /* A transfer running in the background owns the file */
+            return DEV_BUSY;
+        }
+
+        fd = chan->data[0];
+        file_buffer = &g_file_buffer[fd];
+
+        if (base == CDEV_SEEK_START) {
+			/* Position relative to the start of the file */
+            target = position;
+
+        } else if (base == CDEV_SEEK_RELATIVE) {
+			/* Position relative to the current position */
+            target = fsys_buffer_tell(fd) + position;
+
+        } else if (base == CDEV_SEEK_END) {
+			/* Position relative to the end of the file (which bytes still to be written may move) */
+            if (file_buffer->mode == FILE_BUFFER_WRITE) {
+                status = fsys_buffer_settle(fd);
+                if (status != 0) {
+                    return status;
+                }
+            }
+            target = f_size(file) + position;
+
         } else {
-            return fatfs_to_foenix(result);
+            return ERR_BAD_ARGUMENT;
+        }
+
+        if (file_buffer->mode == FILE_BUFFER_READ) {
+            start = f_tell(file) - file_buffer->count;
+            if ((target >= 0) && ((FSIZE_t)target >= start) && ((FSIZE_t)target <= f_tell(file))) {
+                file_buffer->position = (unsigned short)((FSIZE_t)target - start);
+                return 0;
+            }
+
+            /* FatFs is about to be moved anyway, so the bytes read ahead can just be dropped */
+            file_buffer->mode = FILE_BUFFER_EMPTY;
+            file_buffer->position = 0;
+            file_buffer->count = 0;
+
+        } else {
+            status = fsys_buffer_settle(fd);
+            if (status != 0) {
+                return status;
+            }
         }
+
+        if (file->cltbl && (file->flag & FA_WRITE) && (target > f_size(file))) {
+            /* Seeking past the end grows the file, which FatFs cannot do through the cluster link map */
+            fsys_fastseek_release(fd);
+        }
+
+        return fatfs_to_foenix(f_lseek(file, target));
     }
 
     return ERR_BADCHANNEL;
+}
 
-    return 0;
+/**
+ * Issue a control command to the device
+ *
+ * The commands manage the file's cluster link map and its byte I/O buffer (see
+ * FSYS_IOCTRL_* in fsys.h)
+ */
+short fchan_ioctrl(t_channel * chan, short command, unsigned char * buffer, short size) {
+    short fd = chan->data[0];
+    unsigned long entries = 0;
+    short result;
+
+    if (fd >= MAX_FILES) {
+        return ERR_BADCHANNEL;
+    }
+
+    if (fsys_async_busy(chan->number)) {
+        /* A transfer running in the background owns the file */
+        return DEV_BUSY;
+    }
+
+    switch (command) {
+        case FSYS_IOCTRL_FASTSEEK:
+            if ((buffer != 0) && (size >= sizeof(unsigned long))) {
+                entries = *(unsigned long *)buffer;
+            }
+            return fsys_fastseek_build(fd, entries);
+
+        case FSYS_IOCTRL_FASTSEEK_OFF:
+            fsys_fastseek_release(fd);
+            return 0;
+
+        case FSYS_IOCTRL_FASTSEEK_SIZE:
+            if ((buffer == 0) || (size < sizeof(unsigned long))) {
+                return ERR_BAD_ARGUMENT;
+            }
+            *(unsigned long *)buffer = g_file[fd].cltbl ? g_file[fd].cltbl[0] : 0;
+            return 0;
+
+        case FSYS_IOCTRL_BUFFER:
+            if ((buffer == 0) || (size < sizeof(unsigned long))) {
+                return ERR_BAD_ARGUMENT;
+            }
+            result = fsys_buffer_settle(fd);
+            if (result != 0) {
+                return result;
+            }
+            return fsys_buffer_setup(fd, *(unsigned long *)buffer);
+
+        case FSYS_IOCTRL_BUFFER_SIZE:
+            if ((buffer == 0) || (size < sizeof(unsigned long))) {
+                return ERR_BAD_ARGUMENT;
+            }
+            *(unsigned long *)buffer = g_file_buffer[fd].size;
+            return 0;
+
+        default:
+            return 0;
+    }
 }
 
 /**
- * Write a buffer to the device
+ * Reserve space for a file opened for writing, so that writing it does not have
+ * to grow its FAT chain one cluster at a time.
+ *
+ * The file's size becomes the requested size, and the file position is left where
+ * it was. A file that ends up shorter than its reservation should be truncated.
+ * If the space cannot be reserved, the file keeps its old size and clusters.
+ *
+ * Inputs:
+ * fd = the channel ID for the file
+ * size = the number of bytes to reserve
+ * contiguous = if non-zero, the space must be one run of clusters (the file must be empty)
+ *
+ * Returns:
+ * 0 on success, negative number on failure
  */
-short fchan_write(p_channel chan, const unsigned char * buffer, short size) {
+short fsys_preallocate(short fd, long size, short contiguous) {
+    p_channel chan;
     FIL * file;
-    FRESULT result;
-    int total_written;
+    FSIZE_t position, old_size;
+    FRESULT fres, seek_fres;
+    short result;
+
+    TRACE("fsys_preallocate");
+
+    if ((fd < 0) || (fd >= CHAN_MAX)) {
+        return ERR_BADCHANNEL;
+    }
+
+    chan = chan_get_record(fd);
+    if ((chan->number != fd) || (chan->dev != CDEV_FILE)) {
+        return ERR_BADCHANNEL;
+    }
 
     file = fchan_to_file(chan);
-    if (file) {
-        result = f_write(file, buffer, size, &total_written);
-        if (result == FR_OK) {
-            return (short)total_written;
-        } else {
-            log_num(LOG_ERROR, "fchan_write error: ", result);
-            return fatfs_to_foenix(result);
+    if (file == 0) {
+        return ERR_BADCHANNEL;
+    }
+
+    if (fsys_async_busy(fd)) {
+        /* A transfer running in the background owns the file */
+        return DEV_BUSY;
+    }
+
+    if (size < 0) {
+        return ERR_BAD_ARGUMENT;
+    }
+
+    /* Bytes still in the buffer must reach the file first */
+    result = fsys_buffer_settle(chan->data[0]);
+    if (result != 0) {
+        return result;
+    }
+
+    /* The cluster link map would not cover the new clusters */
+    fsys_fastseek_release(chan->data[0]);
+
+    if (contiguous) {
+        /* Find a run of free clusters big enough and give it to the file */
+        fres = f_expand(file, (FSIZE_t)size, 1);
+
+    } else if ((FSIZE_t)size > f_size(file)) {
+        /* Seeking past the end of a file being written grows its chain to fit */
+        position = f_tell(file);
+        old_size = f_size(file);
+        fres = f_lseek(file, (FSIZE_t)size);
+        if ((fres == FR_OK) && (f_tell(file) != (FSIZE_t)size)) {
+            /* The volume ran out of clusters */
+            fres = FR_DENIED;
+        }
+
+        if (fres != FR_OK) {
+            /* Give back the clusters added so far, so the file is as it was */
+            if (f_lseek(file, old_size) == FR_OK) {
+                f_truncate(file);
+            }
         }
+
+        seek_fres = f_lseek(file, position);
+        if (fres == FR_OK) {
+            fres = seek_fres;
+        }
+
+    } else {
+        fres = FR_OK;
     }
 
-    return ERR_BADCHANNEL;
+    return fatfs_to_foenix(fres);
 }
 
-/**
- * Write a single unsigned char to the device
+/*
+ * Check whether a path names a file that is already open
+ *
+ * A file can be named by more than one path (letter case, relative paths, ".."), so the
+ * directory entries are compared rather than the paths.
+ *
+ * Inputs:
+ * file = the open file
+ * path = the path to check
+ *
+ * Returns:
+ * 1 if the path names the file, 0 if not (or if it names no file), negative number on error
  */
-short fchan_write_b(t_channel * chan, const unsigned char b) {
-    FIL * file;
-    FRESULT result;
-    int total_written;
-    unsigned char buffer[1];
+static short fsys_is_same_file(FIL * file, const char * path) {
+    FIL * probe;
+    short same = 0;
 
-    file = fchan_to_file(chan);
-    if (file) {
-        buffer[0] = b;
-        result = f_write(file, buffer, 1, &total_written);
-        if (result == FR_OK) {
-            return (short)total_written;
-        } else {
-            return fatfs_to_foenix(result);
+    probe = (FIL *)malloc(sizeof(FIL));
+    if (probe == 0) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    if (f_open(probe, path, FA_READ) == FR_OK) {
+        same = (probe->obj.fs == file->obj.fs) && (probe->dir_sect == file->dir_sect) && (probe->dir_ptr == file->dir_ptr);
+        f_close(probe);
+    }
+
+    free(probe);
+    return same;
+}
+
+/*
+ * Copy a file a block at a time, reading each block and then writing it
+ *
+ * Inputs:
+ * src = the channel of the source
+ * dst_file = the destination, with its clusters reserved
+ * buffer = the buffer to copy through
+ * size = the number of bytes in the buffer
+ * total = the number of bytes to copy
+ * progress = function to call after each block is copied (0 for none)
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+static short fsys_copy_serial(short src, FIL * dst_file, unsigned char * buffer, unsigned long size, unsigned long total, p_copy_progress progress) {
+    unsigned long done = 0, n = 0;
+    UINT written;
+    FRESULT fres;
+    short result = 0;
+
+    while ((result == 0) && (done < total)) {
+        result = fsys_read_direct(src, buffer, (total - done < size) ? total - done : size, &n);
+        if ((result == 0) && (n == 0)) {
+            /* The file ended early */
+            result = FSYS_ERR_DISK_ERR;
+        }
+        if (result != 0) {
+            break;
+        }
+
+        fres = fsys_write_fast(dst_file, buffer, (UINT)n, &written);
+        if (fres != FR_OK) {
+            result = fatfs_to_foenix(fres);
+        } else if (written < n) {
+            /* The volume is full */
+            result = FSYS_ERR_DENIED;
+        }
+
+        done += n;
+        if ((result == 0) && progress) {
+            result = progress(done, total);
+            if (result > 0) {
+                result = 0;
+            }
         }
     }
 
-    return ERR_BADCHANNEL;
+    return result;
 }
 
-/**
- * Get the status of the device
+/*
+ * Queue the reads that fill the next block of a file being copied
+ *
+ * The block is read in whole sectors, one request to the block device for each run
+ * of clusters it covers, up to COPY_READ_RUNS runs.
+ *
+ * Inputs:
+ * file = the source, which must have a cluster link map or be a contiguous exFAT file
+ * position = the offset of the block in the file (a multiple of the sector size)
+ * buffer = the buffer to read into
+ * size = the most bytes to read (a multiple of the sector size)
+ * req = the COPY_READ_RUNS block device requests to use
+ * runs = pointer to the number of requests queued
+ * count = pointer to the number of bytes of the file the block holds
+ *
+ * Returns:
+ * 0 if the reads were queued, negative number on failure (the requests in *runs were queued even so)
  */
-short fchan_status(t_channel * chan) {
-    FIL * file;
-    FRESULT result;
-    int total_written;
+static short fsys_copy_read_start(FIL * file, unsigned long position, unsigned char * buffer, unsigned long size, t_bdev_request req[], short * runs, unsigned long * count) {
+    FATFS * fs = file->obj.fs;
+    DWORD first, run, offset, sectors;
+    unsigned long end;
+    short result;
+
+    end = position + size;
+    if (end > f_size(file)) {
+        end = f_size(file);
+    }
 
-    file = fchan_to_file(chan);
-    if (file) {
-        short status = 0;
+    *runs = 0;
+    *count = 0;
+    while ((position < end) && (*runs < COPY_READ_RUNS)) {
+        if (!fsys_file_run(file, (DWORD)(position / FF_MAX_SS / fs->csize), &first, &run)) {
+            return FSYS_ERR_INT_ERR;
+        }
 
-        if (f_eof(file)) {
-            status |= CDEV_STAT_EOF;
+        offset = (DWORD)(position / FF_MAX_SS) & (fs->csize - 1);
+        run = run * fs->csize - offset;
+        sectors = (DWORD)((end - position + FF_MAX_SS - 1) / FF_MAX_SS);
+        if (sectors > run) {
+            sectors = run;
+        }
+
+        req[*runs].op = BDEV_REQ_READ;
+        req[*runs].lba = (long)(fs->database + (LBA_t)(first - 2) * fs->csize + offset);
+        req[*runs].count = (short)sectors;
+        req[*runs].buffer = buffer;
+        req[*runs].callback = 0;
+        req[*runs].context = 0;
+
+        result = bdev_submit(fs->pdrv, &req[*runs]);
+        if (result != 0) {
+            return result;
+        }
+
+        (*runs)++;
+        buffer += sectors * FF_MAX_SS;
+        position += sectors * FF_MAX_SS;
+        *count += sectors * FF_MAX_SS;
+    }
+
+    if (position > end) {
+        /* The last sector runs past the end of the file */
+        *count -= position - end;
+    }
+
+    return 0;
+}
+
+/*
+ * Wait for the reads filling a block to complete
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+static short fsys_copy_read_wait(t_bdev_request req[], short runs) {
+    short i, status, result = 0;
+
+    for (i = 0; i < runs; i++) {
+        status = bdev_wait(&req[i]);
+        if (result == 0) {
+            result = status;
+        }
+    }
+
+    return result;
+}
+
+/*
+ * Copy a file between two devices, reading the next block while the current one is written
+ *
+ * The source's sectors are read through the block device's request queue into one
+ * buffer, while the other buffer is written to the destination. A driver that can
+ * carry out a request on its own (such as the PATA driver in interrupt mode) reads
+ * the next block while the destination's device is busy with the current one.
+ *
+ * Inputs:
+ * src_file = the source, which must have a cluster link map or be a contiguous exFAT file
+ * dst_file = the destination, with its clusters reserved
+ * buffers = the two buffers to copy through
+ * size = the number of bytes in each buffer (a multiple of the sector size)
+ * total = the number of bytes to copy
+ * progress = function to call after each block is copied (0 for none)
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+static short fsys_copy_overlapped(FIL * src_file, FIL * dst_file, unsigned char * buffers[2], unsigned long size, unsigned long total, p_copy_progress progress) {
+    t_bdev_request req[2][COPY_READ_RUNS];
+    short runs[2];
+    unsigned long count[2];
+    unsigned long done = 0;
+    UINT written;
+    FRESULT fres;
+    short current = 0, result, next;
+
+    result = fsys_copy_read_start(src_file, 0, buffers[0], size, req[0], &runs[0], &count[0]);
+
+    while ((result == 0) && (done < total)) {
+        result = fsys_copy_read_wait(req[current], runs[current]);
+        runs[current] = 0;
+        if (result != 0) {
+            break;
+        }
+
+        next = 1 - current;
+        if (done + count[current] < total) {
+            /* Get the next block coming while this one is written */
+            result = fsys_copy_read_start(src_file, done + count[current], buffers[next], size, req[next], &runs[next], &count[next]);
+            if (result != 0) {
+                break;
+            }
+        }
+
+        fres = fsys_write_fast(dst_file, buffers[current], (UINT)count[current], &written);
+        if (fres != FR_OK) {
+            result = fatfs_to_foenix(fres);
+        } else if (written < count[current]) {
+            /* The volume is full */
+            result = FSYS_ERR_DENIED;
+        }
+
+        done += count[current];
+        if ((result == 0) && progress) {
+            result = progress(done, total);
+            if (result > 0) {
+                result = 0;
+            }
         }
 
-        if (f_error(file) != FR_OK) {
-            status |= CDEV_STAT_ERROR;
-        }
+        current = next;
+    }
+
+    /* The buffers are about to be freed... let the device finish with them */
+    fsys_copy_read_wait(req[current], runs[current]);
+
+    return result;
+}
+
+/**
+ * Copy a file
+ *
+ * The data moves through a buffer of whole clusters of the larger of the two
+ * volumes' clusters. The destination's clusters are reserved and mapped before
+ * anything is written, so its FAT chain is built in one pass, and both files are
+ * then moved with multi-sector transfers that run across cluster boundaries
+ * wherever the clusters are contiguous. Between two devices, a second buffer lets
+ * the next block be read while the current one is written. A copy that fails
+ * leaves no destination file behind. A file cannot be copied onto itself.
+ *
+ * Inputs:
+ * src_path = the path of the file to copy
+ * dst_path = the path of the copy (replaced if it exists, unless FSYS_COPY_NO_OVERWRITE is given)
+ * flags = FSYS_COPY_* flags
+ * progress = function to call after each block is copied (0 for none)
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+short fsys_copy(const char * src_path, const char * dst_path, short flags, p_copy_progress progress) {
+    FIL * src_file;
+    FIL * dst_file;
+    FATFS * fs;
+    unsigned char * buffers[2] = { 0, 0 };
+    unsigned long cluster, size, total;
+    short src, dst, result = 0, close_result;
+
+    TRACE("fsys_copy");
+
+    src = fsys_open(src_path, FSYS_READ);
+    if (src < 0) {
+        return src;
+    }
+    src_file = fchan_to_file(chan_get_record(src));
+
+    /* Opening the destination would truncate the source if they are the same file */
+    result = fsys_is_same_file(src_file, dst_path);
+    if (result != 0) {
+        fsys_close(src);
+        return (result < 0) ? result : FSYS_ERR_COPY_SELF;
+    }
 
-        return status;
+    dst = fsys_open(dst_path, FSYS_WRITE | ((flags & FSYS_COPY_NO_OVERWRITE) ? FSYS_CREATE_NEW : FSYS_CREATE_ALWAYS));
+    if (dst < 0) {
+        fsys_close(src);
+        return dst;
     }
+    dst_file = fchan_to_file(chan_get_record(dst));
 
-    return ERR_BADCHANNEL;
-}
+    /* Size the buffer in whole clusters, but no bigger than the file needs */
+    total = f_size(src_file);
+    cluster = (unsigned long)src_file->obj.fs->csize * FF_MAX_SS;
+    if ((unsigned long)dst_file->obj.fs->csize * FF_MAX_SS > cluster) {
+        cluster = (unsigned long)dst_file->obj.fs->csize * FF_MAX_SS;
+    }
 
-/**
- * Ensure that any pending writes to the device have been completed
- */
-short fchan_flush(t_channel * chan) {
-    FIL * file;
-    FRESULT result;
-    int total_written;
+    size = (COPY_BUFFER_SIZE + cluster - 1) / cluster * cluster;
+    if (size > total) {
+        size = (total + FF_MAX_SS - 1) / FF_MAX_SS * FF_MAX_SS;
+    }
+    if (size < FF_MAX_SS) {
+        size = FF_MAX_SS;
+    }
 
-    file = fchan_to_file(chan);
-    if (file) {
-        result = f_sync(file);
-        return fatfs_to_foenix(result);
+    /* If memory is short, make do with a smaller buffer */
+    while ((buffers[0] = (unsigned char *)malloc(size)) == 0) {
+        if (size <= FF_MAX_SS) {
+            result = ERR_OUT_OF_MEMORY;
+            break;
+        }
+        size /= 2;
     }
 
-    return ERR_BADCHANNEL;
-}
+    fs = dst_file->obj.fs;
+    if ((result == 0) && (fs->free_clst <= fs->n_fatent - 2)) {
+        /* The free space on the destination is known without reading the FAT, so refuse a copy that cannot fit */
+        cluster = (unsigned long)fs->csize * FF_MAX_SS;
+        if ((total + cluster - 1) / cluster > fs->free_clst) {
+            result = FSYS_ERR_DENIED;
+        }
+    }
 
-/**
- * Attempt to move the "cursor" position in the channel
- */
-short fchan_seek(t_channel * chan, long position, short base) {
-    FIL * file;
-    FRESULT result;
-    FSIZE_t new_position;
+    if ((result == 0) && (total > 0)) {
+        /* Reserve the destination's clusters, in one run if that was asked for and can be found */
+        result = ERR_GENERAL;
+        if (flags & FSYS_COPY_CONTIGUOUS) {
+            result = fsys_preallocate(dst, (long)total, 1);
+        }
+        if (result != 0) {
+            result = fsys_preallocate(dst, (long)total, 0);
+        }
 
-    file = fchan_to_file(chan);
-    if (file) {
-        if (base == CDEV_SEEK_START) {
-			/* Position relative to the start of the file */
-            result = f_lseek(file, position);
-            return fatfs_to_foenix(result);
+        if ((result == 0) && !FILE_CONTIGUOUS(dst_file)) {
+            /* Map the reserved clusters, so each block can be written a fragment at a time */
+            fsys_fastseek_build(chan_get_record(dst)->data[0], 0);
+        }
+    }
 
-        } else if (base == CDEV_SEEK_RELATIVE) {
-			/* Position relative to the current position */
-            long current = f_tell(file);
-            result = f_lseek(file, current + position);
-            return fatfs_to_foenix(result);
+    if ((result == 0) && (total > size) && (src_file->obj.fs != dst_file->obj.fs)) {
+        /* Between two devices, the source is read by run into a second buffer while the first is written */
+        if ((src_file->cltbl == 0) && !FILE_CONTIGUOUS(src_file)) {
+            fsys_fastseek_build(chan_get_record(src)->data[0], 0);
+        }
+        if ((src_file->cltbl != 0) || FILE_CONTIGUOUS(src_file)) {
+            buffers[1] = (unsigned char *)malloc(size);
+        }
+    }
 
-        } else if (base == CDEV_SEEK_END) {
-			/* Position relative to the end of the file */
-            result = f_lseek(file, f_size(file) + position);
-            return fatfs_to_foenix(result);
+    if (result == 0) {
+        if (buffers[1]) {
+            result = fsys_copy_overlapped(src_file, dst_file, buffers, size, total, progress);
+        } else {
+            result = fsys_copy_serial(src, dst_file, buffers[0], size, total, progress);
         }
+    }
 
-        return fatfs_to_foenix(f_lseek(file, new_position));
+    if (buffers[0]) {
+        free(buffers[0]);
+    }
+    if (buffers[1]) {
+        free(buffers[1]);
     }
 
-    return ERR_BADCHANNEL;
-}
+    fsys_close(src);
+    close_result = fsys_close(dst);
+    if (result == 0) {
+        result = close_result;
+    }
 
-/**
- * Issue a control command to the device
- */
-short fchan_ioctrl(t_channel * chan, short command, unsigned char * buffer, short size) {
-    return 0;
+    if (result != 0) {
+        /* Don't leave a partial copy behind */
+        f_unlink(dst_path);
+    }
+
+    return result;
 }
 
 /*
@@ -824,6 +3121,9 @@ short fsys_mount(short bdev) {
     drive[1] = ':';
     drive[2] = 0;
 
+    /* The media may have changed */
+    fsys_exec_invalidate(0);
+
     fres = f_mount(&g_drive[bdev], drive, 0);
     if (fres != FR_OK) {
         DEBUG1("Unable to mount drive: %s", drive);        
@@ -855,6 +3155,104 @@ short fsys_getlabel(char * path, char * label) {
     }
 }
 
+/**
+ * Get the free space on the volume holding the path
+ *
+ * Once the volume's free cluster map is built (or if its FSInfo sector can be
+ * trusted), this does not read the FAT. Otherwise the whole FAT is mapped first.
+ *
+ * Inputs:
+ * path = path to the volume (or to anything on it)
+ * free = pointer to the number of KB free on the volume
+ * total = pointer to the number of KB the volume can hold (0 if not wanted)
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+short fsys_get_free(const char * path, unsigned long * free, unsigned long * total) {
+    FATFS * fs;
+    DWORD clusters;
+    FRESULT fres;
+
+    TRACE("fsys_get_free");
+
+    fsys_update_stat(path);
+
+    fres = f_getfree(path, &clusters, &fs);
+    if (fres != FR_OK) {
+        return fatfs_to_foenix(fres);
+    }
+
+    /* Count in KB, so the sizes of big volumes fit in a long */
+    *free = (unsigned long)clusters * fs->csize / (1024 / FF_MAX_SS);
+    if (total) {
+        *total = (unsigned long)(fs->n_fatent - 2) * fs->csize / (1024 / FF_MAX_SS);
+    }
+
+    return 0;
+}
+
+/**
+ * Get the memory taken by the free cluster map of a mounted volume
+ *
+ * Inputs:
+ * drive = the number of the drive (same as its block device)
+ *
+ * Returns:
+ * the number of bytes allocated to the map (0 if the drive has none)
+ */
+long fsys_freemap_size(short drive) {
+#if FF_USE_FREEMAP
+    FATFS * fs;
+
+    if ((drive >= 0) && (drive < MAX_DRIVES)) {
+        fs = &g_drive[drive];
+        if ((fs->fs_type != 0) && (fs->fmap != 0)) {
+            return (long)((fs->n_fatent + 7) / 8);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * Do some of the file system's background work
+ *
+ * Asynchronous transfers come first: the next one still running is moved along
+ * (its run at the block device checked on, or a slice moved). With none running, this maps a few more sectors of the FAT of a mounted
+ * volume whose free cluster map is not complete yet, so that by the time the volume
+ * needs free clusters (or is asked how much space it has), it can find them without
+ * reading the FAT. Each call does very little, so it can be made every time a
+ * polling loop finds nothing to do. The floppy drive is left alone, so that its
+ * motor is not started behind the user's back (its FAT is small enough to map when
+ * it is needed).
+ */
+void fsys_idle() {
+#if FF_USE_FREEMAP
+    char drive[3];
+    FATFS * fs;
+    short i;
+#endif
+
+    if (fsys_async_work()) {
+        return;
+    }
+
+#if FF_USE_FREEMAP
+    for (i = 0; i < MAX_DRIVES; i++) {
+        fs = &g_drive[i];
+        if ((i != BDEV_FDC) && (fs->fs_type != 0) && (fs->fmap_next != 1) && (fs->fmap_next < fs->n_fatent)) {
+            drive[0] = '0' + (char)i;
+            drive[1] = ':';
+            drive[2] = 0;
+            f_buildmap(drive, IDLE_MAP_SECTORS);
+            return;
+        }
+    }
+#endif
+}
+
 /*
  * Set the label for the drive holding the path
  *
@@ -887,19 +3285,32 @@ unsigned char workspace[FF_MAX_SS * 4];
 /*
  * Format a drive
  *
+ * Given more than one file system, FatFs picks the one that suits the size of the
+ * drive: FAT12 or FAT16 for small drives, FAT32, and exFAT from 32GB (SDXC cards).
+ *
  * Inputs:
  * drive = drive number
- * label = the label to apply to the drive
+ * label = the label to apply to the drive (empty for no label)
+ * format = the file systems that may be used (FSYS_FORMAT_ANY to let the size of the drive decide)
  */
-short fsys_mkfs(short drive, char * label) {
+short fsys_mkfs(short drive, char * label, short format) {
     char buffer[80];
+    MKFS_PARM options;
     FRESULT fres;
 
+    options.fmt = (BYTE)(format & FSYS_FORMAT_ANY);
+    options.n_fat = 0;          /* Defaults for everything else */
+    options.align = 0;
+    options.n_root = 0;
+    options.au_size = 0;
+
     sprintf(buffer, "%d:", drive);
-    fres = f_mkfs(buffer, 0, workspace, FF_MAX_SS * 4);
+    fres = f_mkfs(buffer, &options, workspace, FF_MAX_SS * 4);
     if (fres != FR_OK) {
         log_num(LOG_ERROR, "fsys_mkfs: ", fres);
         return fatfs_to_foenix(fres);
+    } else if ((label != 0) && (label[0] != 0)) {
+        return fsys_setlabel(drive, label);
     } else {
         return 0;
     }
@@ -923,6 +3334,7 @@ short fsys_mkfs(short drive, char * label) {
 short fsys_default_loader(short chan, long destination, long * start) {
     short n = ERR_GENERAL;
     unsigned char * dest = (unsigned char *)destination;
+    unsigned long total;
 
     TRACE("fsys_default_loader");
     log_num(LOG_DEBUG, "Channel: ", chan);
@@ -930,16 +3342,8 @@ short fsys_default_loader(short chan, long destination, long * start) {
     /* The default loader cannot be used to load executable files, so clear the start address */
     *start = 0;
 
-    while (1) {
-        n = sys_chan_read(chan, dest, DEFAULT_CHUNK_SIZE);
-        if (n > 0) {
-            /* If we transferred some bytes, keep going */
-            dest += n;
-        } else {
-            /* If we got back nothing or an error, stop and return */
-            break;
-        }
-    }
+    /* Read the whole file straight into place */
+    n = fsys_read_direct(chan, dest, 0xffffffff, &total);
     return n;
 }
 
@@ -967,6 +3371,36 @@ unsigned short atoi_hex(char * hex) {
     return (atoi_hex_1(hex[0]) << 4 | atoi_hex_1(hex[1]));
 }
 
+/*
+ * Check that a loadable segment does not overwrite memory reserved for the kernel
+ *
+ * Only the reserved part of system RAM, [ramtop, end of system RAM), is off limits. Segments
+ * may go anywhere else, including video RAM and the A2560K's DRAM.
+ *
+ * Inputs:
+ * address = the address of the first byte of the segment
+ * count = the number of bytes in the segment (must not be 0)
+ *
+ * Returns:
+ * 0 if the segment may be loaded, ERR_BAD_BINARY if not
+ */
+static short fsys_segment_check(unsigned long address, unsigned long count) {
+    unsigned long ramtop = mem_get_ramtop();
+    unsigned long ramend = mem_get_ramend();
+
+    if (address + (count - 1) < address) {
+        /* The segment wraps around the end of the address space */
+        return ERR_BAD_BINARY;
+    }
+
+    if ((address < ramend) && (address + count > ramtop)) {
+        /* The segment overlaps the reserved memory */
+        return ERR_BAD_BINARY;
+    }
+
+    return 0;
+}
+
 /* Loader for the PGZ binary file format
  * Supports both the original 24-bit PGZ format and the new 32-bit PGZ format
  *
@@ -999,122 +3433,254 @@ unsigned short atoi_hex(char * hex) {
  * 0 on success, negative number on error
  */
 short fsys_pgz_loader(short chan, long destination, long * start) {
-    unsigned char * chunk = 0;
-    unsigned char * dest = 0;
-    long file_idx = 0;          /* Offset within the file */
-    long segment_idx = 0;       /* Offset within a segment */
-    long address = -1;          /* Current segment address */
-    long count = -1;            /* Current segment size */
-    short use_32bits = 0;       /* File format is either 24-bit or 32-bit */
-    short size_idx = 0;         /* Expected offset for first byte of the size */
-    short data_idx = 0;         /* Expected offset for the first byte of the data */
-    short result = 0;
+    unsigned char header[8];    /* Segment header: address and size */
+    unsigned long address;      /* Current segment address */
+    unsigned long count;        /* Current segment size */
+    unsigned long total;
+    short field_size;           /* Size of the address and size fields (3 or 4 bytes) */
+    short i, n;
 
     TRACE("fsys_pgz_loader");
 
-    /* Allocate the buffer we'll use for reading the file */
-    chunk = malloc(DEFAULT_CHUNK_SIZE);
-    if (chunk == 0) {
-        result = ERR_OUT_OF_MEMORY;
-
+    /* Signature byte... must be either "Z", or "z" */
+    n = chan_read(chan, header, 1);
+    if (n < 0) {
+        return n;
+    } else if ((n == 1) && (header[0] == 'Z')) {
+        /* PGZ 24-bit signature byte */
+        field_size = 3;
+    } else if ((n == 1) && (header[0] == 'z')) {
+        /* PGZ 32-bit signature byte */
+        field_size = 4;
     } else {
-        /* We have our buffer... start reading chunks into it */
-        while (result == 0) {
-            /* Try to read a chunk of data */
-            short n = chan_read(chan, chunk, DEFAULT_CHUNK_SIZE);
-            if (n > 0) {
-                int i;
-                for (i = 0; i < n; i++, file_idx++) {
-                    if (file_idx == 0) {
-                        /* Signature byte... must be either "Z", or "z" */
-                        if (chunk[i] == 'Z') {
-                            /* PGZ 24-bit signature byte */
-                            use_32bits = 0;
-                            size_idx = 3;
-                            data_idx = 6;
-
-                        } else if (chunk[i] == 'z') {
-                            /* PGZ 32-bit signature byte */
-                            use_32bits = 1;
-                            size_idx = 4;
-                            data_idx = 8;
-
-                        } else {
-                            /* Signature byte does not match expectation */
-                            return ERR_BAD_BINARY;
-                        }
-
-                    } else {
-                        /* We're in the segments... */
-                        if ((segment_idx >= 0) && (segment_idx < size_idx)) {
-                            /* We're in the address bytes */
-                            switch (segment_idx) {
-                                case 0:
-                                    address = chunk[i];
-                                    count = -1;
-                                    break;
-                                case 1:
-                                    address = address | chunk[i] << 8;
-                                    break;
-                                case 2:
-                                    address = address | chunk[i] << 16;
-                                    log_num(LOG_INFO, "PGZ 24-bit address: ", address);
-                                    break;
-                                case 3:
-                                    address = address | chunk[i] << 24;
-                                    log_num(LOG_INFO, "PGZ 32-bit address: ", address);
-                                    break;
-                            }
-
-                        } else if ((segment_idx >= size_idx) && (segment_idx < data_idx)) {
-                            /* We're in the size bytes */
-                            switch (segment_idx - size_idx) {
-                                case 0:
-                                    dest = (unsigned char *)address;
-                                    count = chunk[i];
-                                    break;
-                                case 1:
-                                    count = count | chunk[i] << 8;
-                                    break;
-                                case 2:
-                                    count = count | chunk[i] << 16;
-                                    if (!use_32bits && count == 0) {
-                                        *start = address;
-                                    }
-                                    log_num(LOG_INFO, "PGZ 24-bit count: ", count);
-                                    break;
-                                case 3:
-                                    count = count | chunk[i] << 24;
-                                    if (use_32bits && count == 0) {
-                                        *start = address;
-                                    }
-                                    log_num(LOG_INFO, "PGZ 32-bit count: ", count);
-                                    break;
-                            }
-                        } else {
-                            /* We're in the data bytes */
-                            if (segment_idx - data_idx < count) {
-                                *dest++ = chunk[i];
-                            }
-                        }
-
-                        segment_idx++;
-                        if (count >= 0) {
-                            if (segment_idx >= data_idx + count) {
-                                /* If we've reached the end of the segment, start the next */
-                                segment_idx = 0;
-                                address = -1;
-                                count = -1;
-                            }
-                        }
-                    }
+        /* Signature byte does not match expectation */
+        return ERR_BAD_BINARY;
+    }
+
+    /* Not an executable unless the file has a start segment */
+    *start = 0;
+
+    while (1) {
+        /* Read the whole segment header in one go (the file system handles any sector boundary) */
+        n = chan_read(chan, header, 2 * field_size);
+        if (n == 0) {
+            /* We've reached the end of the file */
+            break;
+        } else if (n < 0) {
+            return n;
+        } else if (n < 2 * field_size) {
+            log_num(LOG_ERROR, "PGZ truncated segment header: ", n);
+            return ERR_BAD_BINARY;
+        }
+
+        address = 0;
+        count = 0;
+        for (i = field_size - 1; i >= 0; i--) {
+            address = (address << 8) | header[i];
+            count = (count << 8) | header[field_size + i];
+        }
+
+        log_num(LOG_INFO, "PGZ address: ", address);
+        log_num(LOG_INFO, "PGZ count: ", count);
+
+        if (count == 0) {
+            /* Start segment */
+            *start = address;
+            continue;
+        }
+
+        /* The segment must not overwrite the memory reserved for the kernel */
+        if (fsys_segment_check(address, count) != 0) {
+            log_num(LOG_ERROR, "PGZ segment overlaps reserved memory: ", address);
+            return ERR_BAD_BINARY;
+        }
+
+        /* Stream the data straight to its address */
+        n = fsys_read_direct(chan, (unsigned char *)address, count, &total);
+        if (n < 0) {
+            return n;
+        } else if (total < count) {
+            log_num(LOG_ERROR, "PGZ truncated segment: ", address);
+            return ERR_BAD_BINARY;
+        }
+
+        fsys_exec_note(address, count);
+    }
+
+    return 0;
+}
+
+/* Loader for the compressed PGZ binary file format (PGC)
+ *
+ * The format follows 32-bit PGZ, but the data in a segment may be compressed:
+ * First byte: ASCII "c"
+ * Remaining bytes are segments, each with a 12 byte header of three little-endian longs:
+ * the address of the segment, the number of bytes it fills in memory, and the number
+ * of bytes stored for it in the file.
+ *
+ * 1) Start segment: size and stored size are both 0. The address is the starting address.
+ * 2) Zero-fill (BSS) segment: the stored size is 0. The memory is cleared and nothing is read.
+ * 3) Data segment: the stored bytes are a series of blocks, each of which fills the next
+ *    PGC_BLOCK_SIZE bytes of the segment (the last block fills whatever is left). Each block
+ *    starts with a little-endian word: the number of bytes stored for the block, with
+ *    PGC_BLOCK_RAW set if the bytes are stored as they are. Otherwise the block is an LZ4
+ *    block, whose matches may reach back into the earlier blocks of the same segment.
+ *
+ * Stored blocks are read straight to their address. Compressed blocks are read into a
+ * single block buffer and decompressed straight to their address.
+ *
+ * Inputs:
+ * path = the path to the file to load
+ * destination = the destination address (ignored for PGC)
+ * start = pointer to the long variable to fill with the starting address
+ *         (0 if not an executable, any other number if file is executable
+ *         with a known starting address)
+ *
+ * Returns:
+ * 0 on success, negative number on error
+ */
+short fsys_pgc_loader(short chan, long destination, long * start) {
+    unsigned char header[12];   /* Segment header: address, size, and stored size */
+    unsigned char * block = 0;  /* Buffer for a compressed block */
+    unsigned char * dest;
+    unsigned long address;      /* Current segment address */
+    unsigned long count;        /* Current segment size in memory */
+    unsigned long stored;       /* Current segment size in the file */
+    unsigned long done;         /* Bytes of the segment filled so far */
+    unsigned long size;         /* Bytes the current block fills */
+    unsigned long packed;       /* Bytes stored for the current block */
+    unsigned long total;
+    short i, n;
+    short result = 0;
+
+    TRACE("fsys_pgc_loader");
+
+    n = chan_read(chan, header, 1);
+    if (n < 0) {
+        return n;
+    } else if ((n != 1) || (header[0] != 'c')) {
+        return ERR_BAD_BINARY;
+    }
+
+    /* Not an executable unless the file has a start segment */
+    *start = 0;
+
+    while (result == 0) {
+        n = chan_read(chan, header, sizeof(header));
+        if (n == 0) {
+            /* We've reached the end of the file */
+            break;
+        } else if (n < 0) {
+            result = n;
+            break;
+        } else if (n < sizeof(header)) {
+            result = ERR_BAD_BINARY;
+            break;
+        }
+
+        address = 0;
+        count = 0;
+        stored = 0;
+        for (i = 3; i >= 0; i--) {
+            address = (address << 8) | header[i];
+            count = (count << 8) | header[4 + i];
+            stored = (stored << 8) | header[8 + i];
+        }
+
+        if (count == 0) {
+            if (stored != 0) {
+                result = ERR_BAD_BINARY;
+            } else {
+                /* Start segment */
+                *start = address;
+            }
+            continue;
+        }
+
+        /* The segment must not overwrite the memory reserved for the kernel */
+        if (fsys_segment_check(address, count) != 0) {
+            log_num(LOG_ERROR, "PGC segment overlaps reserved memory: ", address);
+            result = ERR_BAD_BINARY;
+            break;
+        }
+
+        dest = (unsigned char *)address;
+        fsys_exec_note(address, count);
+        if (stored == 0) {
+            /* Zero-fill segment */
+            memset(dest, 0, count);
+            continue;
+        }
+
+        for (done = 0; done < count; done += size) {
+            size = (count - done < PGC_BLOCK_SIZE) ? count - done : PGC_BLOCK_SIZE;
+
+            /* The blocks must not run past the bytes stored for the segment */
+            if (stored < 2) {
+                result = ERR_BAD_BINARY;
+                break;
+            }
+
+            n = chan_read(chan, header, 2);
+            if (n != 2) {
+                result = (n < 0) ? n : ERR_BAD_BINARY;
+                break;
+            }
+
+            packed = (unsigned long)header[0] | ((unsigned long)header[1] << 8);
+            if ((packed & ~PGC_BLOCK_RAW) > stored - 2) {
+                result = ERR_BAD_BINARY;
+                break;
+            }
+            stored -= 2 + (packed & ~PGC_BLOCK_RAW);
+
+            if (packed & PGC_BLOCK_RAW) {
+                /* Stored block: read it straight to its address */
+                if ((packed & ~PGC_BLOCK_RAW) != size) {
+                    result = ERR_BAD_BINARY;
+                    break;
+                }
+
+                result = fsys_read_direct(chan, dest + done, size, &total);
+                if ((result == 0) && (total < size)) {
+                    result = ERR_BAD_BINARY;
                 }
 
             } else {
-                /* We've reached the end of the file */
+                /* Compressed block: read it into the block buffer and decompress it into place */
+                if ((packed == 0) || (packed > PGC_BLOCK_SIZE)) {
+                    result = ERR_BAD_BINARY;
+                    break;
+                }
+
+                if (block == 0) {
+                    block = malloc(PGC_BLOCK_SIZE);
+                    if (block == 0) {
+                        result = ERR_OUT_OF_MEMORY;
+                        break;
+                    }
+                }
+
+                result = fsys_read_direct(chan, block, packed, &total);
+                if ((result == 0) && ((total < packed) || (lz4_decompress(block, packed, dest + done, size, dest) != size))) {
+                    log_num(LOG_ERROR, "PGC corrupt block: ", address + done);
+                    result = ERR_BAD_BINARY;
+                }
+            }
+
+            if (result != 0) {
                 break;
             }
         }
+
+        if ((result == 0) && (stored != 0)) {
+            /* The blocks must account for all the bytes stored for the segment */
+            result = ERR_BAD_BINARY;
+        }
+    }
+
+    if (block) {
+        free(block);
     }
 
     return result;
@@ -1125,9 +3691,15 @@ short fsys_elf_loader(short chan, long destination, long * start) {
 	size_t numBytes, highMem = 0, progIndex = 0, lowMem = ~0;
 	elf32_header header;
 	elf32_program_header progHeader;
+	unsigned long loaded;
+	short result;
 
     chan_seek(chan, 0, 0);
     numBytes = chan_read(chan, (uint8_t*)&header, sizeof(header));
+    if (numBytes != sizeof(header)) {
+        DEBUG("[!] Truncated ELF header");
+        return ERR_BAD_BINARY;
+    }
 
 	if (header.ident.magic[0] != 0x7F ||
 		header.ident.magic[1] != 'E' ||
@@ -1173,9 +3745,13 @@ short fsys_elf_loader(short chan, long destination, long * start) {
 			case PT_LOAD:
                 chan_seek(chan, progHeader.offset, 0);
                 uint8_t * write_buffer = (uint8_t *) progHeader.physAddr;
-				numBytes = chan_read(chan, write_buffer, progHeader.fileSize);
+				result = fsys_read_direct(chan, write_buffer, progHeader.fileSize, &loaded);
+				if (result != 0) {
+					return result;
+				}
 				if (progHeader.fileSize < progHeader.memSize)
 					memset((uint8_t*)progHeader.physAddr + progHeader.fileSize, 0, progHeader.memSize - progHeader.fileSize);
+				fsys_exec_note(progHeader.physAddr, (progHeader.fileSize < progHeader.memSize) ? progHeader.memSize : progHeader.fileSize);
 				if (progHeader.physAddr + progHeader.fileSize > highMem) highMem = progHeader.physAddr + progHeader.fileSize;
 				if (progHeader.physAddr < lowMem) lowMem = progHeader.physAddr + progHeader.align;
 				break;
@@ -1206,70 +3782,38 @@ short fsys_elf_loader(short chan, long destination, long * start) {
  */
 short fsys_pgx_loader(short chan, long destination, long * start) {
     const char signature[] = "PGX\x02";
-    unsigned char * chunk = 0;
-    unsigned char * dest = 0;
-    long file_idx = 0;
+    unsigned char header[8];
+    unsigned long total;
     long address = 0;
-    short result = 0;
+    short i, n;
 
     TRACE("fsys_pgx_loader");
 
-    chunk = malloc(DEFAULT_CHUNK_SIZE);
-    if (chunk == 0) {
-        result = ERR_OUT_OF_MEMORY;
+    /* The header is the signature for this CPU and the big-endian target address */
+    n = chan_read(chan, header, sizeof(header));
+    if (n < 0) {
+        return n;
+    } else if (n < sizeof(header)) {
+        return ERR_BAD_BINARY;
+    }
 
-    } else {
-        /* We have our buffer... start reading chunks into it */
-        short n = 1;
-
-        while (result == 0) {
-            /* Try to read a chunk of data */
-            n = chan_read(chan, chunk, DEFAULT_CHUNK_SIZE);
-            if (n > 0) {
-                short i;
-
-                /* Loop through all the bytes of the chunk that we read */
-                for (i = 0; i < n; i++, file_idx++) {
-                    if (file_idx < 4) {
-                        /* Check that the first four bytes match the signature for this CPU */
-                        if (chunk[i] != signature[i]) {
-                            /* If signature does not match, quit */
-                            result = ERR_BAD_BINARY;
-                            break;
-                        }
-
-                    } else if (file_idx < 8) {
-                        /* Parse the next four bytes as the target address */
-                        address = (address << 8) + chunk[i];
-
-                    } else {
-                        /* Treat the remaining bytes as data */
-                        if (file_idx == 8) {
-                            /* For the first data byte, set our destination pointer */
-                            dest = (unsigned char *)address;
-                        }
-
-                        /* Store the data in the destination address */
-                        *dest++ = chunk[i];
-                    }
-                }
-            } else if (n < 0) {
-                /* We got an error while reading... pass it to the caller */
-                result = n;
-                break;
-            } else if (n == 0) {
-                break;
-            }
+    for (i = 0; i < 4; i++) {
+        if (header[i] != (unsigned char)signature[i]) {
+            return ERR_BAD_BINARY;
         }
     }
 
+    for (i = 4; i < 8; i++) {
+        address = (address << 8) + header[i];
+    }
+
     /* Start address is the first byte of the data */
     *start = address;
 
-    if (chunk != 0) {
-        free(chunk);
-    }
-    return result;
+    /* Everything after the header is the data, which goes straight to its address */
+    n = fsys_read_direct(chan, (unsigned char *)address, 0xffffffff, &total);
+    fsys_exec_note(address, total);
+    return n;
 }
 
 static bool loader_exists(const char * extension) {
@@ -1298,6 +3842,8 @@ static bool get_app_ext(const char * path, char * extension) {
                 return true;
             }
         }
+        extension[MAX_EXT] = 0;
+        return true;
     } else {
         return false;
     }
@@ -1355,6 +3901,16 @@ static short fsys_load_ext(const char * path, const char * extension, long desti
         TRACE("another loader");
     }
 
+    if ((destination == 0) && g_exec_cache_budget) {
+        /* An executable in the executable cache is copied back without reading the file */
+        if (fsys_exec_restore(path, start)) {
+            return 0;
+        }
+
+        /* Otherwise, have the loader record what it fills, so it can be cached */
+        g_exec_record_count = 0;
+    }
+
     /* Open the file for reading */
     chan = fsys_open(path, FA_READ);
     if (chan >= 0) {
@@ -1364,12 +3920,16 @@ static short fsys_load_ext(const char * path, const char * extension, long desti
 
         if (result != 0) {
             log_num(LOG_ERROR, "Could not load file: ", result);
+        } else if (*start != 0) {
+            fsys_exec_insert(path, *start);
         }
 
+        g_exec_record_count = -1;
         return result;
     } else {
         /* File open returned an error... pass it along */
         log_num(LOG_ERROR, "Could not open file: ", chan);
+        g_exec_record_count = -1;
         return chan;
     }
 }
@@ -1393,10 +3953,8 @@ static short fsys_load_ext(const char * path, const char * extension, long desti
  */
 short fsys_load(const char * path, long destination, long * start) {
     int i;
-    char extension[MAX_EXT];
+    char extension[MAX_EXT + 1];
     char spath[MAX_PATH_LEN];
-    short chan = -1;
-    p_file_loader loader = 0;
     int found_extension = 0;
     int found_loader = 0;
 
@@ -1415,7 +3973,7 @@ short fsys_load(const char * path, long destination, long * start) {
 
     if (found_extension || destination != 0) {
         // extension provided, pass to loader
-        fsys_load_ext(path, extension, destination, start);
+        return fsys_load_ext(path, extension, destination, start);
     } else {
         // extension not provided, search for a matching file.
         strcpy(spath, path);
@@ -1441,7 +3999,7 @@ short fsys_load(const char * path, long destination, long * start) {
 
         if(found_loader) {
             // Found path with valid loader
-            fsys_load_ext(spath, extension, destination, start);
+            return fsys_load_ext(spath, extension, destination, start);
         } else {
             logmsg(LOG_ERROR, "Command not found.");
             return ERR_NOT_FOUND;
@@ -1514,7 +4072,23 @@ short fsys_init() {
     /* Mark all file descriptors as available */
     for (i = 0; i < MAX_FILES; i++) {
         g_fil_state[i] = 0;
+        g_file_clmt_big[i] = 0;
+        g_file_buffer[i].data = 0;
+        g_file_buffer[i].size = 0;
+        g_file_buffer[i].mode = FILE_BUFFER_EMPTY;
+    }
+
+    /* No asynchronous transfers are running */
+    for (i = 0; i < MAX_ASYNC; i++) {
+        g_async[i].state = ASYNC_FREE;
+        g_async[i].io_busy = 0;
+    }
+
+    /* The executable cache starts out empty */
+    for (i = 0; i < MAX_EXEC_CACHE; i++) {
+        g_exec_cache[i].segment_count = 0;
     }
+    fsys_exec_cache_reset_stats();
 
     /* Mount all logical drives that are present */
 
@@ -1525,6 +4099,13 @@ short fsys_init() {
         }
     }
 
+    /* The RAM disk starts out blank... give it a file system */
+    if (sys_bdev_status(BDEV_RAM) == 0) {
+        if (f_mount(&g_drive[BDEV_RAM], "3:", 1) == FR_NO_FILESYSTEM) {
+            fsys_mkfs(BDEV_RAM, "RAM", FSYS_FORMAT_ANY);
+        }
+    }
+
     for (i = 0; i < MAX_LOADERS; i++) {
         g_file_loader[i].status = 0;
         g_file_loader[i].loader = 0;
@@ -1536,6 +4117,7 @@ short fsys_init() {
     /* Register the built-in binary file loaders */
     fsys_register_loader("PGZ", fsys_pgz_loader);
     fsys_register_loader("PGX", fsys_pgx_loader);
+    fsys_register_loader("PGC", fsys_pgc_loader);
     fsys_register_loader("ELF", fsys_elf_loader);
 
     /* Register the channel driver for files. */
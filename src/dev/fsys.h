@@ -10,6 +10,34 @@
 
 #define DEFAULT_CHUNK_SIZE  256
 
+/*
+ * Control commands for file channels
+ */
+#define FSYS_IOCTRL_FASTSEEK        0x01    /* Build a cluster link map (buffer: unsigned long table size in longs, 0 or none to fit the file) */
+#define FSYS_IOCTRL_FASTSEEK_OFF    0x02    /* Drop the file's cluster link map */
+#define FSYS_IOCTRL_FASTSEEK_SIZE   0x03    /* Get the longs used by the cluster link map (buffer: unsigned long, 0 if none) */
+#define FSYS_IOCTRL_BUFFER          0x04    /* Resize the byte I/O buffer (buffer: unsigned long bytes, up to 32768, 0 for none) */
+#define FSYS_IOCTRL_BUFFER_SIZE     0x05    /* Get the size of the byte I/O buffer (buffer: unsigned long) */
+
+/*
+ * Flags for fsys_copy
+ */
+#define FSYS_COPY_NO_OVERWRITE      0x01    /* Fail if the destination file already exists */
+#define FSYS_COPY_CONTIGUOUS        0x02    /* Try to give the destination one run of clusters */
+
+/*
+ * File systems for fsys_mkfs
+ */
+#define FSYS_FORMAT_FAT             0x01    /* FAT12 or FAT16 */
+#define FSYS_FORMAT_FAT32           0x02    /* FAT32 */
+#define FSYS_FORMAT_EXFAT           0x04    /* exFAT (files without FAT chains, and files over 4GB) */
+#define FSYS_FORMAT_ANY             0x07    /* Whichever suits the size of the drive (exFAT from 32GB) */
+
+/*
+ * Result of fsys_poll for an asynchronous transfer that is still running
+ */
+#define FSYS_ASYNC_PENDING          1
+
 /**
  * Type for directory information about a file
  */
@@ -21,6 +49,56 @@ typedef struct s_file_info {
     char name[MAX_PATH_LEN];
 } t_file_info, * p_file_info;
 
+/*
+ * Sort orders for fsys_readdir_batch (one key, optionally with flags)
+ */
+#define FSYS_SORT_NONE              0x00    /* Leave the entries in directory order */
+#define FSYS_SORT_NAME              0x01    /* Sort by name (ignoring case) */
+#define FSYS_SORT_SIZE              0x02    /* Sort by size */
+#define FSYS_SORT_DATE              0x03    /* Sort by date and time */
+#define FSYS_SORT_KEY               0x0F    /* Mask for the sort key */
+#define FSYS_SORT_DIRS_FIRST        0x10    /* Put the directories ahead of the files */
+#define FSYS_SORT_DESCENDING        0x20    /* Reverse the order of the sort key */
+
+/**
+ * Type for an entry returned by fsys_readdir_batch
+ *
+ * The entries fill the front of the caller's buffer, and their names are
+ * packed into the back of it, so a batch takes only the room its names need.
+ */
+typedef struct s_dir_batch_entry {
+    long size;
+    unsigned short date;
+    unsigned short time;
+    unsigned char attributes;
+    char * name;                /* Points into the caller's buffer */
+} t_dir_batch_entry, * p_dir_batch_entry;
+
+/**
+ * Statistics for the executable cache
+ */
+typedef struct s_exec_cache_stats {
+    unsigned long budget;       /* Bytes the cache may use (0 = off) */
+    unsigned long used;         /* Bytes used by the cached executables */
+    unsigned long entries;      /* Number of executables in the cache */
+    unsigned long hits;         /* Loads copied from the cache */
+    unsigned long misses;       /* Loads that had to read the file */
+    unsigned long stale;        /* Cached executables dropped because the file changed */
+    unsigned long insertions;   /* Executables added to the cache */
+    unsigned long evictions;    /* Executables dropped to make room for others */
+} t_exec_cache_stats, * p_exec_cache_stats;
+
+/*
+ * Pointer type for fsys_copy progress callbacks
+ *
+ * short progress(done, total);
+ *
+ * Called after each block is copied, with the number of bytes copied so far and the
+ * size of the file. Returning a negative number stops the copy.
+ */
+
+typedef short (*p_copy_progress)(unsigned long done, unsigned long total);
+
 /*
  * Pointer type for file loaders
  *
@@ -60,6 +138,93 @@ extern short fsys_open(const char * path, short mode);
  */
 extern short fsys_close(short fd);
 
+/**
+ * Reserve space for a file opened for writing, so that writing it does not have
+ * to grow its FAT chain one cluster at a time.
+ *
+ * The file's size becomes the requested size, and the file position is left where
+ * it was. A file that ends up shorter than its reservation should be truncated.
+ *
+ * Inputs:
+ * fd = the channel ID for the file
+ * size = the number of bytes to reserve
+ * contiguous = if non-zero, the space must be one run of clusters (the file must be empty)
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+extern short fsys_preallocate(short fd, long size, short contiguous);
+
+/**
+ * Copy a file
+ *
+ * The data moves through a buffer of whole clusters, read and written with
+ * multi-sector transfers, and the destination's clusters are reserved before
+ * anything is written. Between two devices, the next block is read while the
+ * current one is written. A copy that fails leaves no destination file behind.
+ * Copying a file onto itself fails with FSYS_ERR_COPY_SELF.
+ *
+ * Inputs:
+ * src_path = the path of the file to copy
+ * dst_path = the path of the copy (replaced if it exists, unless FSYS_COPY_NO_OVERWRITE is given)
+ * flags = FSYS_COPY_* flags
+ * progress = function to call after each block is copied (0 for none)
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+extern short fsys_copy(const char * src_path, const char * dst_path, short flags, p_copy_progress progress);
+
+/**
+ * Start reading an open file in the background
+ *
+ * Whole sectors of a mapped (or contiguous) file are queued on the block device in
+ * runs, which a driver that works on its own (the PATA driver in interrupt mode)
+ * moves in the background; each time the transfer is polled, and whenever the kernel
+ * is idle, the next run is queued. Anything else moves a slice at a time on those
+ * calls. Until it is finished, the buffer belongs to the kernel, and
+ * any other use of the file fails with DEV_BUSY. Closing the file drops the
+ * transfer.
+ *
+ * Inputs:
+ * chan = the channel ID for the file
+ * buffer = the memory to fill
+ * size = the number of bytes to read
+ * token = pointer to the token to poll the transfer with
+ *
+ * Returns:
+ * 0 on success, negative number on failure (DEV_BUSY if the file already has a transfer running)
+ */
+extern short fsys_read_async(short chan, unsigned char * buffer, unsigned long size, short * token);
+
+/**
+ * Start writing an open file in the background
+ *
+ * Inputs:
+ * chan = the channel ID for the file
+ * buffer = the bytes to write
+ * size = the number of bytes to write
+ * token = pointer to the token to poll the transfer with
+ *
+ * Returns:
+ * 0 on success, negative number on failure (DEV_BUSY if the file already has a transfer running)
+ */
+extern short fsys_write_async(short chan, const unsigned char * buffer, unsigned long size, short * token);
+
+/**
+ * Check on an asynchronous transfer, moving it along if it is still running
+ *
+ * Once the transfer is reported finished (or failed), its token is no longer valid.
+ *
+ * Inputs:
+ * token = the token of the transfer
+ * count = pointer to the number of bytes moved so far (0 if not wanted)
+ *
+ * Returns:
+ * FSYS_ASYNC_PENDING if the transfer is still running, 0 if it is finished, negative number on failure
+ */
+extern short fsys_poll(short token, unsigned long * count);
+
 /**
  * N.B.: fsys_open returns a channel ID, and fsys_close accepts a channel ID.
  * read and write access, seek, eof status, etc. will be handled by the channel
@@ -125,6 +290,28 @@ extern short fsys_findfirst(const char * path, const char * pattern, p_file_info
  */
 extern short fsys_findnext(short dir, p_file_info file);
 
+/**
+ * Read as many entries from an open directory as fit in a buffer
+ *
+ * The entries are stored as an array of t_dir_batch_entry at the front of the
+ * buffer, with their names packed in from the back. A batch ends when there is
+ * no longer room for an entry with the longest possible name, so the buffer
+ * must be able to hold at least one. Sorting applies within the batch, so a
+ * fully sorted listing needs a buffer that holds the whole directory.
+ *
+ * Inputs:
+ * dir = the handle of the open directory (from fsys_opendir or fsys_findfirst)
+ * buffer = the buffer to fill
+ * size = the number of bytes in the buffer
+ * pattern = file name pattern the entries must match for this call (0 for all
+ *           entries, or the pattern given to fsys_findfirst)
+ * sort = the FSYS_SORT_ order to put the entries of the batch in
+ *
+ * Returns:
+ * the number of entries stored (0 at the end of the directory), negative number on error
+ */
+extern short fsys_readdir_batch(short dir, p_dir_batch_entry buffer, unsigned long size, const char * pattern, short sort);
+
 /**
  * Check to see if the file is present.
  * If it is not, return a file not found error.
@@ -145,6 +332,37 @@ extern short fsys_stat(const char * path, p_file_info file);
  */
 extern short fsys_getlabel(char * path, char * label);
 
+/**
+ * Get the free space on the volume holding the path
+ *
+ * Inputs:
+ * path = path to the volume (or to anything on it)
+ * free = pointer to the number of KB free on the volume
+ * total = pointer to the number of KB the volume can hold (0 if not wanted)
+ *
+ * Returns:
+ * 0 on success, negative number on failure
+ */
+extern short fsys_get_free(const char * path, unsigned long * free, unsigned long * total);
+
+/**
+ * Get the memory taken by the free cluster map of a mounted volume
+ *
+ * Inputs:
+ * drive = the number of the drive (same as its block device)
+ *
+ * Returns:
+ * the number of bytes allocated to the map (0 if the drive has none)
+ */
+extern long fsys_freemap_size(short drive);
+
+/**
+ * Do some of the file system's background work (moving asynchronous transfers along,
+ * and building the free cluster maps of mounted volumes). Each call does very little,
+ * so it can be made every time a polling loop finds nothing to do.
+ */
+extern void fsys_idle();
+
 /*
  * Set the label for the drive holding the path
  *
@@ -154,14 +372,26 @@ extern short fsys_getlabel(char * path, char * label);
  */
 extern short fsys_setlabel(short drive, const char * label);
 
+/*
+ * Mount, or remount, the file system on a block device
+ *
+ * Inputs:
+ * bdev = the number of the block device to mount or re-mount
+ *
+ * Returns:
+ * 0 on success, any other number is an error
+ */
+extern short fsys_mount(short bdev);
+
 /*
  * Format a drive
  *
  * Inputs:
  * drive = drive number
- * label = the label to apply to the drive
+ * label = the label to apply to the drive (empty for no label)
+ * format = the file systems that may be used (FSYS_FORMAT_ANY to let the size of the drive decide)
  */
-extern short fsys_mkfs(short drive, char * label);
+extern short fsys_mkfs(short drive, char * label, short format);
 
 /**
  * Create a directory
@@ -253,4 +483,32 @@ extern short fsys_load(const char * path, long destination, long * start);
  */
 extern short fsys_register_loader(const char * extension, p_file_loader loader);
 
+/**
+ * Set the amount of memory the executable cache may use
+ *
+ * The cache keeps the memory images of recently loaded executables, so loading one
+ * again just copies it back (as long as the file has not changed). The cache is
+ * emptied, and memory is reserved at the top of system RAM if it needs to grow.
+ *
+ * Inputs:
+ * size = the number of bytes the cache may use (0 to turn the cache off)
+ *
+ * Returns:
+ * 0 on success, ERR_OUT_OF_MEMORY if the memory cannot be reserved (the cache is left as it was)
+ */
+extern short fsys_exec_cache_resize(unsigned long size);
+
+/**
+ * Get the statistics for the executable cache
+ *
+ * Inputs:
+ * stats = pointer to the statistics record to fill
+ */
+extern void fsys_exec_cache_get_stats(p_exec_cache_stats stats);
+
+/**
+ * Reset the statistics for the executable cache
+ */
+extern void fsys_exec_cache_reset_stats();
+
 #endif
@@ -199,6 +199,19 @@ short int_disable_all() {
 	return status;
 }
 
+/*
+ * Restore interrupt masking state returned by a previous call to int_enable_all/int_disable_all
+ *
+ * Inputs:
+ * int_mask = machine dependent representation of the interrupt masking
+ */
+void int_restore(short int_mask) {
+	// NOTE: this code uses Calypsi specific intrinsic functions
+	//       and does a cast that may not be valid
+
+	__restore_interrupt_state((__interrupt_state_t)int_mask);
+}
+
 /*
  * Disable an interrupt by masking it
  *
@@ -11,6 +11,7 @@
 #include "dev/pata.h"
 #include "dev/txt_screen.h"
 #include "dev/rtc.h"
+#include "interrupt.h"
 #include "pata_reg.h"
 
 //
@@ -26,6 +27,14 @@
 
 short g_pata_error = 0;                     // Most recent error code received from the PATA drive
 short g_pata_status = PATA_STAT_NOINIT;     // Status of the PATA interface
+short g_pata_multiple = 0;                  // Sectors per DRQ block in multiple mode (0 if multiple mode is not in use)
+short g_pata_use_irq = 0;                   // Non-zero if requests are completed by the PATA interrupt rather than polling
+p_pata_request g_pata_active = 0;           // The request the drive is currently working on
+
+static t_pata_request g_pata_bdev_req;      // Transfer carrying the block layer's current request
+static p_bdev_request g_pata_bdev_active = 0;   // The block layer request being worked on
+static short g_pata_bdev_done = 0;          // Number of sectors of that request already transferred
+static short g_pata_in_handler = 0;         // Non-zero while pata_handler is running
 
 //
 // Code
@@ -151,6 +160,8 @@ short pata_wait_data_request() {
 
 char g_buffer[512];
 
+#define PATA_ID_MULTIPLE_MAX    94          // Offset in the identity data of word 47: maximum sectors per READ/WRITE MULTIPLE block
+
 //
 // Identify the PATA drive
 //
@@ -215,6 +226,55 @@ short pata_identity(p_drive_info drive_info) {
     return 0;
 }
 
+//
+// Put the drive into multiple mode, so that READ/WRITE MULTIPLE can move a block of
+// sectors per DRQ handshake
+//
+// Inputs:
+//  max = the maximum number of sectors per block reported by the drive
+//
+// Returns:
+//  the number of sectors per block selected (0 if multiple mode is not used)
+//
+static short pata_set_multiple(unsigned short max) {
+    unsigned short block = PATA_MAX_MULTIPLE;
+
+    TRACE("pata_set_multiple");
+
+    g_pata_multiple = 0;
+
+    // Pick the largest power of two the drive can handle
+    while (block > max) {
+        block >>= 1;
+    }
+
+    if (block < 2) {
+        // Not supported, or no better than READ/WRITE SECTORS
+        return 0;
+    }
+
+    if (pata_wait_ready_not_busy()) {
+        return 0;
+    }
+
+    *PATA_HEAD = 0xe0;                              // Drive 0, LBA mode
+    *PATA_SECT_CNT = (unsigned char)block;          // Sectors per block
+    *PATA_CMD_STAT = PATA_CMD_SET_MULTIPLE;
+
+    if (pata_wait_not_busy()) {
+        return 0;
+    }
+
+    if ((*PATA_CMD_STAT & PATA_STAT_ERR) != 0) {
+        // The drive refused the block size... stick to READ/WRITE SECTORS
+        logmsg(LOG_ERROR, "pata_set_multiple: drive rejected SET MULTIPLE MODE");
+        return 0;
+    }
+
+    g_pata_multiple = block;
+    return block;
+}
+
 //
 // Initialize the PATA hard drive
 //
@@ -223,6 +283,7 @@ short pata_identity(p_drive_info drive_info) {
 //
 short pata_init() {
     short result;
+    t_drive_info drive_info;
 
     TRACE("pata_init");
 
@@ -242,6 +303,12 @@ short pata_init() {
         return DEV_TIMEOUT;
     }
 
+    // Use multiple mode for multi-sector transfers, if the drive supports it
+    g_pata_multiple = 0;
+    if (pata_identity(&drive_info) == 0) {
+        pata_set_multiple((unsigned char)g_buffer[PATA_ID_MULTIPLE_MAX]);
+    }
+
     // Mark that the drive is initialized and present
     g_pata_status = PATA_STAT_PRESENT;
 
@@ -265,6 +332,16 @@ short pata_read(long lba, unsigned char * buffer, short size) {
     TRACE("pata_read");
     log_num(LOG_VERBOSE, "pata_read lba: ", lba);
 
+    if (g_pata_active) {
+        return DEV_BUSY;
+    }
+
+    if (g_pata_use_irq && (size == PATA_SECTOR_SIZE)) {
+        // Let the interrupt handler complete the transfer
+        i = pata_read_multi(lba, buffer, 1);
+        return (i < 0) ? i : size;
+    }
+
     /* Turn on the HDD LED */
     ind_set(IND_HDC, IND_ON);
 
@@ -317,6 +394,460 @@ short pata_read(long lba, unsigned char * buffer, short size) {
     return i;
 }
 
+//
+// Give the drive the 400ns it needs to bring its status up to date after a command or a data block
+//
+// The boards do not map the alternate status register, so the status register itself is read,
+// each read being a PATA bus cycle of at least 100ns. The drive raises the interrupt for the next
+// block long after that, so these reads cannot acknowledge it by mistake.
+//
+static void pata_status_delay() {
+    short i;
+
+    for (i = 0; i < 4; i++) {
+        (void)*PATA_CMD_STAT;
+    }
+}
+
+//
+// Load the task file and issue a sector transfer command
+//
+// The drive must already be ready and not busy.
+//
+static void pata_issue_command(long lba, short count, unsigned char command) {
+    *PATA_HEAD = ((lba >> 24) & 0x0f) | 0xe0;       // Upper 4 bits of LBA, Drive 0, LBA mode.
+    *PATA_SECT_CNT = (unsigned char)(count & 0xff); // Number of sectors (0 means 256)
+    *PATA_SECT_SRT = lba & 0xff;                    // Set the rest of the LBA
+    *PATA_CLDR_LO = (lba >> 8) & 0xff;
+    *PATA_CLDR_HI = (lba >> 16) & 0xff;
+
+    *PATA_CMD_STAT = command;
+    pata_status_delay();
+}
+
+//
+// Set up the task file and issue a sector transfer command
+//
+// Inputs:
+//  lba = the logical block address of the first sector
+//  count = the number of sectors to transfer (1 to PATA_MAX_SECTORS)
+//  command = the command to issue
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+static short pata_start_transfer(long lba, short count, unsigned char command) {
+    if (pata_wait_ready_not_busy()) {
+        return DEV_TIMEOUT;
+    }
+
+    *PATA_HEAD = ((lba >> 24) & 0x0f) | 0xe0;       // Upper 4 bits of LBA, Drive 0, LBA mode.
+    if (pata_wait_ready_not_busy()) {
+        return DEV_TIMEOUT;
+    }
+
+    pata_issue_command(lba, count, command);
+    return 0;
+}
+
+//
+// Move the next block of a request between the drive and the request's buffer
+//
+static void pata_request_block(p_pata_request req) {
+    unsigned short *wptr;
+    short sectors;
+    long words;
+
+    sectors = req->count - req->done;
+    if (sectors > req->block) {
+        sectors = req->block;
+    }
+
+    wptr = (unsigned short *)(req->buffer + (long)req->done * PATA_SECTOR_SIZE);
+    words = (long)sectors * (PATA_SECTOR_SIZE / 2);
+
+    // Copy the data... let the compiler and the FPGA worry about endianess
+    if (req->op == PATA_REQ_READ) {
+        while (words-- > 0) {
+            *wptr++ = *PATA_DATA_16;
+        }
+    } else {
+        while (words-- > 0) {
+            *PATA_DATA_16 = *wptr++;
+        }
+    }
+
+    req->done += sectors;
+
+    // Until the drive has taken the block, the status still shows DRQ for it
+    pata_status_delay();
+}
+
+//
+// Complete the active request and notify its owner
+//
+static void pata_request_finish(p_pata_request req, short result) {
+    g_pata_active = 0;
+    req->status = result;
+
+    /* Turn off the HDD LED */
+    ind_set(IND_HDC, IND_OFF);
+
+    if (req->callback) {
+        req->callback(req);
+    }
+}
+
+//
+// Advance a request according to the drive's status
+//
+// This is called from the interrupt handler in interrupt mode, and from pata_poll in polling mode.
+//
+// Inputs:
+//  req = the request being processed
+//  status = the value of the drive's status register
+//
+static void pata_request_step(p_pata_request req, unsigned char status) {
+    if (!req->issued || ((status & PATA_STAT_BSY) != 0)) {
+        // The command has not gone out yet, or the drive is still working
+        return;
+    }
+
+    if ((status & (PATA_STAT_ERR | PATA_STAT_DF)) != 0) {
+        g_pata_error = *PATA_ERROR;
+        pata_request_finish(req, (req->op == PATA_REQ_READ) ? DEV_CANNOT_READ : DEV_CANNOT_WRITE);
+        return;
+    }
+
+    if (req->done < req->count) {
+        if ((status & PATA_STAT_DRQ) != 0) {
+            // One DRQ handshake moves a whole block of sectors
+            pata_request_block(req);
+            req->deadline = rtc_get_jiffies() + PATA_TIMEOUT_JF;
+
+            if ((req->op == PATA_REQ_READ) && (req->done >= req->count)) {
+                pata_request_finish(req, 0);
+            }
+        }
+
+    } else if ((status & PATA_STAT_DRQ) == 0) {
+        // Every block of a write has been sent and the drive has committed them
+        pata_request_finish(req, 0);
+    }
+}
+
+//
+// Handle the PATA interrupt: the drive wants the next block, or has finished the command
+//
+void pata_handler() {
+    unsigned char status;
+
+    status = *PATA_CMD_STAT;        // Reading the status acknowledges the drive's interrupt
+    if (g_pata_active) {
+        // Anything started from here must not wait on the drive
+        g_pata_in_handler = 1;
+        pata_request_step(g_pata_active, status);
+        g_pata_in_handler = 0;
+    }
+}
+
+//
+// Send a request's command to the drive
+//
+// Outside of the interrupt handler, this waits for the drive to be ready and, for a write,
+// sends the first block (the drive does not interrupt for it). Inside the handler, the drive's
+// status is checked once: the command is only issued if the drive is ready, and the first block
+// of a write is left for the next interrupt or pata_poll. A request that could not be issued
+// stays active and is issued by pata_poll.
+//
+// Returns:
+//  0 on success (or if the request was left for later), any negative number is an error code
+//
+static short pata_request_issue(p_pata_request req) {
+    unsigned char command;
+    short result;
+
+    if (req->op == PATA_REQ_READ) {
+        command = (g_pata_multiple > 1) ? PATA_CMD_READ_MULTIPLE : PATA_CMD_READ_SECTOR;
+    } else {
+        command = (g_pata_multiple > 1) ? PATA_CMD_WRITE_MULTIPLE : PATA_CMD_WRITE_SECTOR;
+    }
+
+    if (g_pata_in_handler) {
+        if ((*PATA_CMD_STAT & (PATA_STAT_BSY | PATA_STAT_DRDY)) == PATA_STAT_DRDY) {
+            pata_issue_command(req->lba, req->count, command);
+            req->issued = 1;
+        }
+        return 0;
+    }
+
+    result = pata_start_transfer(req->lba, req->count, command);
+    if (result == 0) {
+        req->issued = 1;
+        if (req->op == PATA_REQ_WRITE) {
+            // The drive does not interrupt for the first block of a write
+            result = pata_wait_data_request();
+            if (result == 0) {
+                pata_request_block(req);
+            }
+        }
+        req->deadline = rtc_get_jiffies() + PATA_TIMEOUT_JF;
+    }
+
+    return result;
+}
+
+//
+// Start a transfer without waiting for it to complete
+//
+// Inputs:
+//  req = the request to start (op, lba, count, buffer and callback must be filled in)
+//
+// Returns:
+//  0 if the request was started, any negative number is an error code
+//
+short pata_submit(p_pata_request req) {
+    short result;
+
+    TRACE("pata_submit");
+
+    if (g_pata_active) {
+        return DEV_BUSY;
+    }
+
+    if ((req->count < 1) || (req->count > PATA_MAX_SECTORS)) {
+        return ERR_BAD_ARGUMENT;
+    }
+
+    req->done = 0;
+    req->issued = 0;
+    req->block = (g_pata_multiple > 1) ? g_pata_multiple : 1;
+    req->status = PATA_REQ_PENDING;
+    req->deadline = rtc_get_jiffies() + PATA_TIMEOUT_JF;
+
+    /* Turn on the HDD LED */
+    ind_set(IND_HDC, IND_ON);
+
+    if (g_pata_use_irq && !g_pata_in_handler) {
+        // Keep the handler out until the request is fully set up
+        int_disable(INT_PATA);
+    }
+
+    g_pata_active = req;
+    result = pata_request_issue(req);
+    if (result != 0) {
+        g_pata_active = 0;
+        req->status = result;
+
+        /* Turn off the HDD LED */
+        ind_set(IND_HDC, IND_OFF);
+    }
+
+    if (g_pata_use_irq && !g_pata_in_handler) {
+        int_enable(INT_PATA);
+    }
+
+    return result;
+}
+
+//
+// Check on the progress of a request
+//
+// In polling mode, this is also what moves the data, so it must be called until the request completes.
+//
+// Inputs:
+//  req = the request to check
+//
+// Returns:
+//  PATA_REQ_PENDING if the request is still running, 0 if it completed, any negative number is an error code
+//
+short pata_poll(p_pata_request req) {
+    short result;
+
+    if (req->status == PATA_REQ_PENDING) {
+        if (g_pata_use_irq) {
+            if ((g_pata_active == req) && (!req->issued || ((req->op == PATA_REQ_WRITE) && (req->done == 0)))) {
+                // Started from the interrupt handler: issue the command, or send the write's first block
+                int_disable(INT_PATA);
+                if ((req->status == PATA_REQ_PENDING) && (g_pata_active == req)) {
+                    if (!req->issued) {
+                        result = pata_request_issue(req);
+                        if (result != 0) {
+                            pata_request_finish(req, result);
+                        }
+                    } else {
+                        pata_request_step(req, *PATA_CMD_STAT);
+                    }
+                }
+                int_enable(INT_PATA);
+            }
+
+        } else if (g_pata_active == req) {
+            pata_request_step(req, *PATA_CMD_STAT);
+        }
+
+        if ((req->status == PATA_REQ_PENDING) && (rtc_get_jiffies() > req->deadline)) {
+            if (g_pata_use_irq) {
+                int_disable(INT_PATA);
+            }
+
+            // Check again, now that the handler cannot complete the request behind our back
+            if (req->status == PATA_REQ_PENDING) {
+                logmsg(LOG_ERROR, "pata_poll: timeout");
+                pata_request_finish(req, DEV_TIMEOUT);
+            }
+
+            if (g_pata_use_irq) {
+                int_enable(INT_PATA);
+            }
+        }
+    }
+
+    return req->status;
+}
+
+//
+// Transfer a run of sectors, waiting for each request to complete
+//
+// Returns:
+//  number of sectors transferred, any negative number is an error code
+//
+static short pata_transfer(short op, long lba, unsigned char * buffer, short count) {
+    t_pata_request req;
+    short done, chunk, result;
+
+    for (done = 0; done < count; done += chunk) {
+        chunk = count - done;
+        if (chunk > PATA_MAX_SECTORS) {
+            chunk = PATA_MAX_SECTORS;
+        }
+
+        req.op = op;
+        req.lba = lba + done;
+        req.count = chunk;
+        req.buffer = buffer + (long)done * PATA_SECTOR_SIZE;
+        req.callback = 0;
+
+        result = pata_submit(&req);
+        if (result == 0) {
+            while ((result = pata_poll(&req)) == PATA_REQ_PENDING) ;
+        }
+
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    return count;
+}
+
+//
+// Start the next chunk of the block layer's request
+//
+// Returns:
+//  0 if the chunk was started, any negative number is an error code
+//
+static short pata_bdev_next() {
+    p_bdev_request breq = g_pata_bdev_active;
+    short chunk = breq->count - g_pata_bdev_done;
+
+    if (chunk > PATA_MAX_SECTORS) {
+        chunk = PATA_MAX_SECTORS;
+    }
+
+    g_pata_bdev_req.op = (breq->op == BDEV_REQ_READ) ? PATA_REQ_READ : PATA_REQ_WRITE;
+    g_pata_bdev_req.lba = breq->lba + g_pata_bdev_done;
+    g_pata_bdev_req.count = chunk;
+    g_pata_bdev_req.buffer = breq->buffer + (long)g_pata_bdev_done * PATA_SECTOR_SIZE;
+
+    return pata_submit(&g_pata_bdev_req);
+}
+
+//
+// Called when a chunk of the block layer's request completes
+//
+static void pata_bdev_callback(p_pata_request req) {
+    short result = req->status;
+
+    if (result == 0) {
+        g_pata_bdev_done += req->count;
+        if (g_pata_bdev_done < g_pata_bdev_active->count) {
+            // More to go... keep the drive busy (if it is not ready, pata_bdev_poll issues the chunk)
+            result = pata_bdev_next();
+            if (result == 0) {
+                return;
+            }
+        }
+    }
+
+    g_pata_bdev_active = 0;
+    bdev_complete(BDEV_HDC, result);
+}
+
+//
+// Start a block layer request without waiting for it
+//
+// Inputs:
+//  breq = the request to start
+//
+// Returns:
+//  0 if the request was started, any negative number is an error code
+//
+short pata_bdev_start(p_bdev_request breq) {
+    short result;
+
+    TRACE("pata_bdev_start");
+
+    if (g_pata_bdev_active) {
+        return DEV_BUSY;
+    }
+
+    g_pata_bdev_active = breq;
+    g_pata_bdev_done = 0;
+    g_pata_bdev_req.callback = pata_bdev_callback;
+
+    result = pata_bdev_next();
+    if (result != 0) {
+        g_pata_bdev_active = 0;
+    }
+
+    return result;
+}
+
+//
+// Move the block layer's request along (and catch time outs)
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+short pata_bdev_poll() {
+    if (g_pata_bdev_active) {
+        pata_poll(&g_pata_bdev_req);
+    }
+
+    return 0;
+}
+
+//
+// Read consecutive sectors from the PATA hard drive
+//
+// Uses READ MULTIPLE when the drive supports it, READ SECTORS otherwise
+//
+// Inputs:
+//  lba = the logical block address of the first sector to read
+//  buffer = the buffer into which to copy the sector data
+//  count = the number of sectors to read
+//
+// Returns:
+//  number of sectors read, any negative number is an error code
+//
+short pata_read_multi(long lba, unsigned char * buffer, short count) {
+    TRACE("pata_read_multi");
+    log_num(LOG_VERBOSE, "pata_read_multi lba: ", lba);
+
+    return pata_transfer(PATA_REQ_READ, lba, buffer, count);
+}
+
 short pata_flush_cache() {
     long target_ticks;
     short i;
@@ -384,6 +915,16 @@ short pata_write(long lba, const unsigned char * buffer, short size) {
     unsigned char status;
     TRACE("pata_write");
 
+    if (g_pata_active) {
+        return DEV_BUSY;
+    }
+
+    if (g_pata_use_irq && (size == PATA_SECTOR_SIZE)) {
+        // Let the interrupt handler complete the transfer
+        i = pata_write_multi(lba, buffer, 1);
+        return (i < 0) ? i : size;
+    }
+
     /* Turn on the HDD LED */
     ind_set(IND_HDC, IND_ON);
 
@@ -464,6 +1005,25 @@ short pata_write(long lba, const unsigned char * buffer, short size) {
     return size;
 }
 
+//
+// Write consecutive sectors to the PATA hard drive
+//
+// Uses WRITE MULTIPLE when the drive supports it, WRITE SECTORS otherwise
+//
+// Inputs:
+//  lba = the logical block address of the first sector to write
+//  buffer = the buffer containing the sector data to write
+//  count = the number of sectors to write
+//
+// Returns:
+//  number of sectors written, any negative number is an error code
+//
+short pata_write_multi(long lba, const unsigned char * buffer, short count) {
+    TRACE("pata_write_multi");
+
+    return pata_transfer(PATA_REQ_WRITE, lba, (unsigned char *)buffer, count);
+}
+
 //
 // Return the status of the PATA hard drive
 //
@@ -549,6 +1109,35 @@ short pata_ioctrl(short command, unsigned char * buffer, short size) {
             }
             break;
 
+        case PATA_GET_MULTIPLE_MAX:
+            // The block size limit is not part of t_drive_info, which callers already size
+            p_word = (unsigned short *)buffer;
+            result = pata_identity(&drive_info);
+            if (result != 0) {
+                return result;
+            }
+
+            *p_word = (unsigned char)g_buffer[PATA_ID_MULTIPLE_MAX];
+            break;
+
+        case PATA_CTRL_USE_IRQ:
+            // Complete transfers from the PATA interrupt
+            if (g_pata_active) {
+                return DEV_BUSY;
+            }
+            g_pata_use_irq = 1;
+            int_enable(INT_PATA);
+            break;
+
+        case PATA_CTRL_USE_POLLING:
+            // Complete transfers by polling the drive's status
+            if (g_pata_active) {
+                return DEV_BUSY;
+            }
+            int_disable(INT_PATA);
+            g_pata_use_irq = 0;
+            break;
+
         default:
             return 0;
     }
@@ -569,6 +1158,13 @@ short pata_install() {
 
     g_pata_error = 0;
     g_pata_status = PATA_STAT_NOINIT;
+    g_pata_multiple = 0;
+    g_pata_use_irq = 0;
+    g_pata_active = 0;
+    g_pata_bdev_active = 0;
+
+    // Install the handler for the drive's interrupt... it stays masked until PATA_CTRL_USE_IRQ
+    int_register(INT_PATA, pata_handler);
 
     // Check if drive is installed
     // if ((*DIP_BOOTMODE & HD_INSTALLED) == 0) {
@@ -580,6 +1176,10 @@ short pata_install() {
         bdev.status = pata_status;
         bdev.flush = pata_flush;
         bdev.ioctrl = pata_ioctrl;
+        bdev.read_multi = pata_read_multi;
+        bdev.write_multi = pata_write_multi;
+        bdev.start = pata_bdev_start;
+        bdev.poll = pata_bdev_poll;
 
         g_pata_status = PATA_STAT_PRESENT & PATA_STAT_NOINIT;
 
@@ -7,13 +7,19 @@
 
 #include <stdint.h>
 #include "types.h"
+#include "dev/block.h"
 
 #define PATA_GET_SECTOR_COUNT   1
 #define PATA_GET_SECTOR_SIZE    2
 #define PATA_GET_BLOCK_SIZE     3
 #define PATA_GET_DRIVE_INFO     4
+#define PATA_CTRL_USE_IRQ       5           // Complete transfers from the PATA interrupt
+#define PATA_CTRL_USE_POLLING   6           // Complete transfers by polling the drive (the default)
+#define PATA_GET_MULTIPLE_MAX   7           // Get the drive's maximum sectors per READ/WRITE MULTIPLE block (unsigned short, 0 if not supported)
 
 #define PATA_SECTOR_SIZE        512         // Size of a block on the PATA
+#define PATA_MAX_SECTORS        256         // Maximum number of sectors a single READ/WRITE command can transfer
+#define PATA_MAX_MULTIPLE       128         // Largest DRQ block size we will ask for with SET MULTIPLE MODE
 
 #define PATA_STAT_NOINIT        0x01        // PATA hard drive has not been initialized
 #define PATA_STAT_PRESENT       0x02        // PATA hard drive is present
@@ -37,6 +43,28 @@ typedef struct s_drive_info {
     } l;
 } t_drive_info, *p_drive_info;
 
+//
+// An asynchronous transfer request
+//
+
+#define PATA_REQ_READ           0           // Read sectors from the drive
+#define PATA_REQ_WRITE          1           // Write sectors to the drive
+
+#define PATA_REQ_PENDING        1           // Status of a request that has not completed yet
+
+typedef struct s_pata_request {
+    short op;                               // PATA_REQ_READ or PATA_REQ_WRITE
+    long lba;                               // Logical block address of the first sector
+    short count;                            // Number of sectors to transfer (1 to PATA_MAX_SECTORS)
+    unsigned char * buffer;                 // Buffer to read into or write from
+    void (*callback)(struct s_pata_request * req);  // Function to call on completion (may be 0)
+    volatile short done;                    // Number of sectors transferred so far
+    volatile short status;                  // PATA_REQ_PENDING, 0 on success, or a negative error code
+    short block;                            // Sectors moved per DRQ handshake (set by pata_submit)
+    volatile short issued;                  // Non-zero once the command has gone to the drive (set by pata_submit)
+    long deadline;                          // Jiffy count at which the request times out (set by pata_submit)
+} t_pata_request, *p_pata_request;
+
 //
 // Install the PATA driver
 //
@@ -79,6 +107,86 @@ extern short pata_read(long lba, unsigned char * buffer, short size);
 //
 extern short pata_write(long lba, const unsigned char * buffer, short size);
 
+//
+// Read consecutive sectors from the PATA hard drive
+//
+// Uses READ MULTIPLE when the drive supports it, READ SECTORS otherwise
+//
+// Inputs:
+//  lba = the logical block address of the first sector to read
+//  buffer = the buffer into which to copy the sector data
+//  count = the number of sectors to read
+//
+// Returns:
+//  number of sectors read, any negative number is an error code
+//
+extern short pata_read_multi(long lba, unsigned char * buffer, short count);
+
+//
+// Write consecutive sectors to the PATA hard drive
+//
+// Uses WRITE MULTIPLE when the drive supports it, WRITE SECTORS otherwise
+//
+// Inputs:
+//  lba = the logical block address of the first sector to write
+//  buffer = the buffer containing the sector data to write
+//  count = the number of sectors to write
+//
+// Returns:
+//  number of sectors written, any negative number is an error code
+//
+extern short pata_write_multi(long lba, const unsigned char * buffer, short count);
+
+//
+// Start a transfer without waiting for it to complete
+//
+// The callback (if any) is called when the request completes. In interrupt mode, this
+// happens inside the interrupt handler. A request submitted from the callback is not waited
+// on there: if the drive is not ready for it, or it is a write, pata_poll finishes starting it.
+//
+// Inputs:
+//  req = the request to start (op, lba, count, buffer and callback must be filled in)
+//
+// Returns:
+//  0 if the request was started, any negative number is an error code
+//
+extern short pata_submit(p_pata_request req);
+
+//
+// Check on the progress of a request
+//
+// In polling mode, this is also what moves the data, so it must be called until the request completes.
+//
+// Inputs:
+//  req = the request to check
+//
+// Returns:
+//  PATA_REQ_PENDING if the request is still running, 0 if it completed, any negative number is an error code
+//
+extern short pata_poll(p_pata_request req);
+
+//
+// Start a block layer request without waiting for it
+//
+// The request is carried out in chunks of up to PATA_MAX_SECTORS, and reported to the
+// block layer through bdev_complete when the last chunk is done.
+//
+// Inputs:
+//  breq = the request to start
+//
+// Returns:
+//  0 if the request was started, any negative number is an error code
+//
+extern short pata_bdev_start(p_bdev_request breq);
+
+//
+// Move the block layer's request along (and catch time outs)
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+extern short pata_bdev_poll();
+
 //
 // Return the status of the PATA hard drive
 //
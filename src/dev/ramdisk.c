@@ -0,0 +1,301 @@
+/**
+ * Implementation of the RAM disk block device driver
+ *
+ * The RAM disk keeps its sectors in a block of memory reserved from the top of system RAM.
+ * The memory system cannot give memory back, so shrinking the RAM disk keeps its storage
+ * for later, and growing it reserves more.
+ */
+
+#include "log_level.h"
+#ifndef DEFAULT_LOG_LEVEL
+    #define DEFAULT_LOG_LEVEL LOG_INFO
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "errors.h"
+#include "memory.h"
+#include "dev/block.h"
+#include "dev/ramdisk.h"
+
+//
+// Variables
+//
+
+static unsigned char * ramdisk_storage = 0;     // First byte of the RAM disk's storage
+static unsigned long ramdisk_sectors = 0;       // Number of sectors on the RAM disk
+static unsigned long ramdisk_capacity = 0;      // Number of sectors the storage can hold
+
+//
+// Check that a run of sectors lies on the RAM disk
+//
+// Returns:
+//  0 if the sectors are all on the disk, any negative number is an error code
+//
+static short ramdisk_check(long lba, short count) {
+    if (ramdisk_sectors == 0) {
+        return DEV_NOMEDIA;
+    }
+
+    if ((lba < 0) || (count < 0) || ((unsigned long)lba + (unsigned long)count > ramdisk_sectors)) {
+        return DEV_BOUNDS_ERR;
+    }
+
+    return 0;
+}
+
+//
+// Set the size of the RAM disk
+//
+// The contents of the disk are cleared. If there is not enough free system RAM for the
+// new size, the disk is left as it was.
+//
+// Inputs:
+//  sectors = the number of sectors the RAM disk should have (0 to remove the disk)
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+static short ramdisk_resize(unsigned long sectors) {
+    unsigned long grow;
+
+    TRACE("ramdisk_resize");
+
+    if ((sectors > 0) && (sectors < RAMDISK_MIN_SECTORS)) {
+        return ERR_BAD_ARGUMENT;
+    }
+
+    if (sectors > ramdisk_capacity) {
+        if ((ramdisk_storage != 0) && ((unsigned long)ramdisk_storage == mem_get_ramtop())) {
+            // Nothing has been reserved below the RAM disk... just extend it downwards
+            grow = sectors - ramdisk_capacity;
+        } else {
+            // Something sits below the old storage... take a new block
+            grow = sectors;
+        }
+
+        if (grow > mem_get_free() / RAMDISK_SECTOR_SIZE) {
+            return ERR_OUT_OF_MEMORY;
+        }
+
+        ramdisk_storage = (unsigned char *)mem_reserve(grow * RAMDISK_SECTOR_SIZE);
+
+        ramdisk_capacity = sectors;
+    }
+
+    ramdisk_sectors = sectors;
+    if (sectors > 0) {
+        memset(ramdisk_storage, 0, sectors * RAMDISK_SECTOR_SIZE);
+    }
+
+    return 0;
+}
+
+//
+// Initialize the RAM disk
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+short ramdisk_init() {
+    return (ramdisk_sectors > 0) ? 0 : DEV_NOMEDIA;
+}
+
+//
+// Read a block from the RAM disk
+//
+// Inputs:
+//  lba = the logical block address of the block to read
+//  buffer = the buffer into which to copy the block data
+//  size = the size of the buffer (must be RAMDISK_SECTOR_SIZE)
+//
+// Returns:
+//  number of bytes read, any negative number is an error code
+//
+short ramdisk_read(long lba, unsigned char * buffer, short size) {
+    short result = ramdisk_check(lba, 1);
+    if (result < 0) {
+        return result;
+    }
+
+    if (size != RAMDISK_SECTOR_SIZE) {
+        return ERR_BAD_ARGUMENT;
+    }
+
+    memcpy(buffer, ramdisk_storage + (unsigned long)lba * RAMDISK_SECTOR_SIZE, size);
+    return size;
+}
+
+//
+// Write a block to the RAM disk
+//
+// Inputs:
+//  lba = the logical block address of the block to write
+//  buffer = the buffer containing the data to write
+//  size = the size of the buffer (must be RAMDISK_SECTOR_SIZE)
+//
+// Returns:
+//  number of bytes written, any negative number is an error code
+//
+short ramdisk_write(long lba, const unsigned char * buffer, short size) {
+    short result = ramdisk_check(lba, 1);
+    if (result < 0) {
+        return result;
+    }
+
+    if (size != RAMDISK_SECTOR_SIZE) {
+        return ERR_BAD_ARGUMENT;
+    }
+
+    memcpy(ramdisk_storage + (unsigned long)lba * RAMDISK_SECTOR_SIZE, buffer, size);
+    return size;
+}
+
+//
+// Read consecutive blocks from the RAM disk
+//
+// Inputs:
+//  lba = the logical block address of the first block to read
+//  buffer = the buffer into which to copy the block data
+//  count = the number of blocks to read
+//
+// Returns:
+//  number of blocks read, any negative number is an error code
+//
+short ramdisk_read_multi(long lba, unsigned char * buffer, short count) {
+    short result = ramdisk_check(lba, count);
+    if (result < 0) {
+        return result;
+    }
+
+    memcpy(buffer, ramdisk_storage + (unsigned long)lba * RAMDISK_SECTOR_SIZE, (unsigned long)count * RAMDISK_SECTOR_SIZE);
+    return count;
+}
+
+//
+// Write consecutive blocks to the RAM disk
+//
+// Inputs:
+//  lba = the logical block address of the first block to write
+//  buffer = the buffer containing the data to write
+//  count = the number of blocks to write
+//
+// Returns:
+//  number of blocks written, any negative number is an error code
+//
+short ramdisk_write_multi(long lba, const unsigned char * buffer, short count) {
+    short result = ramdisk_check(lba, count);
+    if (result < 0) {
+        return result;
+    }
+
+    memcpy(ramdisk_storage + (unsigned long)lba * RAMDISK_SECTOR_SIZE, buffer, (unsigned long)count * RAMDISK_SECTOR_SIZE);
+    return count;
+}
+
+//
+// Return the status of the RAM disk
+//
+// Returns:
+//  the status of the device
+//
+short ramdisk_status() {
+    return (ramdisk_sectors > 0) ? 0 : RAMDISK_STAT_NOINIT;
+}
+
+//
+// Ensure that any pending writes to the RAM disk have been completed
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+short ramdisk_flush() {
+    // Writes go straight to memory... nothing to do
+    return 0;
+}
+
+//
+// Issue a control command to the RAM disk
+//
+// Inputs:
+//  command = the number of the command to send
+//  buffer = pointer to bytes of additional data for the command
+//  size = the size of the buffer
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+short ramdisk_ioctrl(short command, unsigned char * buffer, short size) {
+    uint32_t *p_dword;      // FatFs hands over a DWORD, which is 32 bits wherever the kernel is built
+    unsigned short *p_word;
+
+    switch (command) {
+        case RAMDISK_GET_SECTOR_COUNT:
+            p_dword = (uint32_t *)buffer;
+            *p_dword = ramdisk_sectors;
+            break;
+
+        case RAMDISK_GET_SECTOR_SIZE:
+            p_word = (unsigned short *)buffer;
+            *p_word = RAMDISK_SECTOR_SIZE;
+            break;
+
+        case RAMDISK_GET_BLOCK_SIZE:
+            // There is no erase block... return 1
+            p_dword = (uint32_t *)buffer;
+            *p_dword = 1;
+            break;
+
+        case RAMDISK_CTRL_RESIZE:
+            return ramdisk_resize(*(unsigned long *)buffer);
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+//
+// Install the RAM disk driver
+//
+short ramdisk_install() {
+    t_dev_block dev;                    // bdev_register copies the data, so we'll allocate this on the stack
+    short result;
+
+    TRACE("ramdisk_install");
+
+    ramdisk_storage = 0;
+    ramdisk_sectors = 0;
+    ramdisk_capacity = 0;
+    if (RAMDISK_SECTORS > 0) {
+        result = ramdisk_resize(RAMDISK_SECTORS);
+        if (result != 0) {
+            // Carry on without storage... SET RAMDISK can try again
+            log_num(LOG_ERROR, "ramdisk_install: unable to reserve the RAM disk: ", result);
+        }
+    }
+
+    dev.number = BDEV_RAM;
+    dev.name = "RAM";
+    dev.init = ramdisk_init;
+    dev.read = ramdisk_read;
+    dev.write = ramdisk_write;
+    dev.flush = ramdisk_flush;
+    dev.status = ramdisk_status;
+    dev.ioctrl = ramdisk_ioctrl;
+    dev.read_multi = ramdisk_read_multi;
+    dev.write_multi = ramdisk_write_multi;
+    dev.start = 0;
+    dev.poll = 0;
+
+    result = bdev_register(&dev);
+    if (result == 0) {
+        // Caching sectors that are already in RAM would only cost a copy
+        bdev_ioctrl(BDEV_RAM, BDEV_CTRL_CACHE_DISABLE, 0, 0);
+    }
+
+    return result;
+}
@@ -0,0 +1,133 @@
+/**
+ * Definitions support the RAM disk block device driver
+ */
+
+#ifndef __RAMDISK_H
+#define __RAMDISK_H
+
+#include "sys_general.h"
+#include "types.h"
+
+//
+// Sizing for the RAM disk (the storage is taken from the top of system RAM)
+//
+
+#ifndef RAMDISK_SECTORS
+#if MODEL == MODEL_FOENIX_A2560U || MODEL == MODEL_FOENIX_A2560U_PLUS
+#define RAMDISK_SECTORS         0           // System RAM is too tight to give any up at boot (SET RAMDISK makes one)
+#else
+#define RAMDISK_SECTORS         256         // Number of 512 byte sectors reserved at boot (0 for no RAM disk)
+#endif
+#endif
+#define RAMDISK_MIN_SECTORS     128         // Smallest volume FatFs is willing to format
+
+#define RAMDISK_SECTOR_SIZE     512         // Size of a block on the RAM disk
+
+#define RAMDISK_STAT_NOINIT     0x01        // RAM disk has no storage
+
+//
+// Control commands for the RAM disk
+//
+
+#define RAMDISK_GET_SECTOR_COUNT    1
+#define RAMDISK_GET_SECTOR_SIZE     2
+#define RAMDISK_GET_BLOCK_SIZE      3
+#define RAMDISK_CTRL_RESIZE         5       // Resize the RAM disk (buffer points to the new sector count as an unsigned long)
+
+//
+// Install the RAM disk driver
+//
+// The RAM disk is given RAMDISK_SECTORS sectors of storage (none on the A2560U).
+//
+extern short ramdisk_install();
+
+//
+// Initialize the RAM disk
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+extern short ramdisk_init();
+
+//
+// Read a block from the RAM disk
+//
+// Inputs:
+//  lba = the logical block address of the block to read
+//  buffer = the buffer into which to copy the block data
+//  size = the size of the buffer (must be RAMDISK_SECTOR_SIZE)
+//
+// Returns:
+//  number of bytes read, any negative number is an error code
+//
+extern short ramdisk_read(long lba, unsigned char * buffer, short size);
+
+//
+// Write a block to the RAM disk
+//
+// Inputs:
+//  lba = the logical block address of the block to write
+//  buffer = the buffer containing the data to write
+//  size = the size of the buffer (must be RAMDISK_SECTOR_SIZE)
+//
+// Returns:
+//  number of bytes written, any negative number is an error code
+//
+extern short ramdisk_write(long lba, const unsigned char * buffer, short size);
+
+//
+// Read consecutive blocks from the RAM disk
+//
+// Inputs:
+//  lba = the logical block address of the first block to read
+//  buffer = the buffer into which to copy the block data
+//  count = the number of blocks to read
+//
+// Returns:
+//  number of blocks read, any negative number is an error code
+//
+extern short ramdisk_read_multi(long lba, unsigned char * buffer, short count);
+
+//
+// Write consecutive blocks to the RAM disk
+//
+// Inputs:
+//  lba = the logical block address of the first block to write
+//  buffer = the buffer containing the data to write
+//  count = the number of blocks to write
+//
+// Returns:
+//  number of blocks written, any negative number is an error code
+//
+extern short ramdisk_write_multi(long lba, const unsigned char * buffer, short count);
+
+//
+// Return the status of the RAM disk
+//
+// Returns:
+//  the status of the device
+//
+extern short ramdisk_status();
+
+//
+// Ensure that any pending writes to the RAM disk have been completed
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+extern short ramdisk_flush();
+
+//
+// Issue a control command to the RAM disk
+//
+// Inputs:
+//  command = the number of the command to send
+//  buffer = pointer to bytes of additional data for the command
+//  size = the size of the buffer
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+extern short ramdisk_ioctrl(short command, unsigned char * buffer, short size);
+
+#endif
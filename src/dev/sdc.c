@@ -98,6 +98,80 @@ short sdc_wait_busy() {
     return 0;
 }
 
+//
+// Set the card address for the next block transaction
+//
+// Inputs:
+//  lba = the logical block address of the block
+//
+static void sdc_set_address(long lba) {
+    long adjusted_lba;
+
+    adjusted_lba = lba << 9;
+    *SDC_SD_ADDR_7_0_REG = adjusted_lba & 0xff;
+    *SDC_SD_ADDR_15_8_REG = (adjusted_lba >> 8) & 0xff;
+    *SDC_SD_ADDR_23_16_REG = (adjusted_lba >> 16) & 0xff;
+    *SDC_SD_ADDR_31_24_REG = (adjusted_lba >> 24) & 0xff;
+}
+
+//
+// Copy bytes out of the receive FIFO
+//
+// The FIFO is a byte wide port, so the copy is unrolled to move eight bytes per pass
+//
+// Inputs:
+//  buffer = the buffer into which to copy the data
+//  count = the number of bytes to copy
+//
+static void sdc_fifo_drain(unsigned char * buffer, short count) {
+    volatile unsigned char * fifo = (volatile unsigned char *)SDC_RX_FIFO_DATA_REG;
+    short n;
+
+    for (n = count >> 3; n > 0; n--) {
+        *buffer++ = *fifo;
+        *buffer++ = *fifo;
+        *buffer++ = *fifo;
+        *buffer++ = *fifo;
+        *buffer++ = *fifo;
+        *buffer++ = *fifo;
+        *buffer++ = *fifo;
+        *buffer++ = *fifo;
+    }
+
+    for (n = count & 0x07; n > 0; n--) {
+        *buffer++ = *fifo;
+    }
+}
+
+//
+// Copy bytes into the transmit FIFO
+//
+// The FIFO is a byte wide port, so the copy is unrolled to move eight bytes per pass
+//
+// Inputs:
+//  buffer = the buffer containing the data to send
+//  count = the number of bytes to copy
+//
+static void sdc_fifo_fill(const unsigned char * buffer, short count) {
+    volatile unsigned char * fifo = (volatile unsigned char *)SDC_TX_FIFO_DATA_REG;
+    short n;
+
+    for (n = count >> 3; n > 0; n--) {
+        *fifo = *buffer++;
+        *fifo = *buffer++;
+        *fifo = *buffer++;
+        *fifo = *buffer++;
+        *fifo = *buffer++;
+        *fifo = *buffer++;
+        *fifo = *buffer++;
+        *fifo = *buffer++;
+    }
+
+    for (n = count & 0x07; n > 0; n--) {
+        *fifo = *buffer++;
+    }
+}
+
 //
 // Initialize the SDC
 //
@@ -150,7 +224,6 @@ short sdc_init() {
 //  number of bytes read, any negative number is an error code
 //
 short sdc_read(long lba, unsigned char * buffer, short size) {
-    long adjusted_lba;
 
     TRACE3("sdc_read(%ld,%p,%d)", lba, buffer, (int)size);
 
@@ -168,11 +241,7 @@ short sdc_read(long lba, unsigned char * buffer, short size) {
 
     // Send the LBA to the SDC
 
-    adjusted_lba = lba << 9;
-    *SDC_SD_ADDR_7_0_REG = adjusted_lba & 0xff;
-    *SDC_SD_ADDR_15_8_REG = (adjusted_lba >> 8) & 0xff;
-    *SDC_SD_ADDR_23_16_REG = (adjusted_lba >> 16) & 0xff;
-    *SDC_SD_ADDR_31_24_REG = (adjusted_lba >> 24) & 0xff;
+    sdc_set_address(lba);
 
     // Start the READ transaction
 
@@ -190,7 +259,6 @@ short sdc_read(long lba, unsigned char * buffer, short size) {
 
         } else {
             short count;
-            short i;
 
             // Get the number of bytes to be read and make sure there is room
             count = *SDC_RX_FIFO_DATA_CNT_HI << 8 | *SDC_RX_FIFO_DATA_CNT_LO;
@@ -201,9 +269,7 @@ short sdc_read(long lba, unsigned char * buffer, short size) {
                 return DEV_BOUNDS_ERR;
             }
 
-            for (i = 0; i < count; i++) {        // Fetch the bytes from the SDC
-                buffer[i] = *SDC_RX_FIFO_DATA_REG;
-            }
+            sdc_fifo_drain(buffer, count);      // Fetch the bytes from the SDC
 
             sdc_set_led(0);                     // Turn off the SDC LED
 
@@ -243,7 +309,6 @@ short sdc_read(long lba, unsigned char * buffer, short size) {
 //  number of bytes written, any negative number is an error code
 //
 short sdc_write(long lba, const unsigned char * buffer, short size) {
-    long adjusted_lba;
     short i;
 
     TRACE("sdc_write");
@@ -261,9 +326,7 @@ short sdc_write(long lba, const unsigned char * buffer, short size) {
 
     if (size <= SDC_SECTOR_SIZE) {
         // Copy the data to the SDC, if there isn't too much...
-        for (i = 0; i < size; i++) {
-            *SDC_TX_FIFO_DATA_REG = buffer[i];
-        }
+        sdc_fifo_fill(buffer, size);
 
         if (size < SDC_SECTOR_SIZE) {
             // If we copied less than a block's worth, pad the rest with 0s...
@@ -282,11 +345,7 @@ short sdc_write(long lba, const unsigned char * buffer, short size) {
 
     // Send the LBA to the SDC
 
-    adjusted_lba = lba << 9;
-    *SDC_SD_ADDR_7_0_REG = adjusted_lba & 0xff;
-    *SDC_SD_ADDR_15_8_REG = (adjusted_lba >> 8) & 0xff;
-    *SDC_SD_ADDR_23_16_REG = (adjusted_lba >> 16) & 0xff;
-    *SDC_SD_ADDR_31_24_REG = (adjusted_lba >> 24) & 0xff;
+    sdc_set_address(lba);
 
     // Start the WRITE transaction
 
@@ -317,6 +376,131 @@ short sdc_write(long lba, const unsigned char * buffer, short size) {
     }
 }
 
+//
+// Read consecutive blocks from the SDC
+//
+// The controller only runs single block transactions, so the blocks are fetched back to
+// back, with the card check and LED handling done once for the whole run.
+//
+// Inputs:
+//  lba = the logical block address of the first block to read
+//  buffer = the buffer into which to copy the block data
+//  count = the number of blocks to read
+//
+// Returns:
+//  number of blocks read, any negative number is an error code
+//
+short sdc_read_multi(long lba, unsigned char * buffer, short count) {
+    short i, fifo_count;
+    short result = 0;
+
+    TRACE3("sdc_read_multi(%ld,%p,%d)", lba, buffer, (int)count);
+
+    if (!sdc_detected()) {
+        // SDC_DETECTED is active 0... 1 means there is no card
+        g_sdc_status = SDC_STAT_NOINIT;
+        TRACE("sdc_read_multi: DEV_NOMEDIA");
+        return DEV_NOMEDIA;
+    }
+
+    /* Turn on the SDC LED */
+    ind_set(IND_SDC, IND_ON);
+
+    for (i = 0; i < count; i++, buffer += SDC_SECTOR_SIZE) {
+        sdc_set_address(lba + i);
+
+        *SDC_TRANS_TYPE_REG = SDC_TRANS_READ_BLK;   // Set the transaction type to READ
+        *SDC_TRANS_CONTROL_REG = SDC_TRANS_START;   // Start the transaction
+
+        if (sdc_wait_busy() != 0) {
+            result = DEV_TIMEOUT;
+            break;
+        }
+
+        g_sdc_error = *SDC_TRANS_ERROR_REG;
+        if (g_sdc_error != 0) {
+            result = DEV_CANNOT_READ;
+            break;
+        }
+
+        fifo_count = *SDC_RX_FIFO_DATA_CNT_HI << 8 | *SDC_RX_FIFO_DATA_CNT_LO;
+        if (fifo_count != SDC_SECTOR_SIZE) {
+            result = DEV_CANNOT_READ;
+            break;
+        }
+
+        sdc_fifo_drain(buffer, SDC_SECTOR_SIZE);
+    }
+
+    /* Turn off the SDC LED */
+    ind_set(IND_SDC, IND_OFF);
+
+    if (result != 0) {
+        TRACE1("sdc_read_multi: returning %d", result);
+        return result;
+    }
+
+    return count;
+}
+
+//
+// Write consecutive blocks to the SDC
+//
+// The controller only runs single block transactions, so the blocks are sent back to
+// back, with the card check and LED handling done once for the whole run.
+//
+// Inputs:
+//  lba = the logical block address of the first block to write
+//  buffer = the buffer containing the data to write
+//  count = the number of blocks to write
+//
+// Returns:
+//  number of blocks written, any negative number is an error code
+//
+short sdc_write_multi(long lba, const unsigned char * buffer, short count) {
+    short i;
+    short result = 0;
+
+    TRACE3("sdc_write_multi(%ld,%p,%d)", lba, buffer, (int)count);
+
+    if (!sdc_detected()) {
+        // SDC_DETECTED is active 0... 1 means there is no card
+        g_sdc_status = SDC_STAT_NOINIT;
+        return DEV_NOMEDIA;
+    }
+
+    /* Turn on the SDC LED */
+    ind_set(IND_SDC, IND_ON);
+
+    for (i = 0; i < count; i++, buffer += SDC_SECTOR_SIZE) {
+        sdc_fifo_fill(buffer, SDC_SECTOR_SIZE);
+        sdc_set_address(lba + i);
+
+        *SDC_TRANS_TYPE_REG = SDC_TRANS_WRITE_BLK;  // Set the transaction type to WRITE
+        *SDC_TRANS_CONTROL_REG = SDC_TRANS_START;   // Start the transaction
+
+        if (sdc_wait_busy() != 0) {
+            result = DEV_TIMEOUT;
+            break;
+        }
+
+        g_sdc_error = *SDC_TRANS_ERROR_REG;
+        if (g_sdc_error != 0) {
+            result = DEV_CANNOT_WRITE;
+            break;
+        }
+    }
+
+    /* Turn off the SDC LED */
+    ind_set(IND_SDC, IND_OFF);
+
+    if (result != 0) {
+        return result;
+    }
+
+    return count;
+}
+
 //
 // Return the status of the SDC
 //
@@ -437,6 +621,10 @@ short sdc_install() {
     dev.flush = sdc_flush;
     dev.status = sdc_status;
     dev.ioctrl = sdc_ioctrl;
+    dev.read_multi = sdc_read_multi;
+    dev.write_multi = sdc_write_multi;
+    dev.start = 0;
+    dev.poll = 0;
 
     return bdev_register(&dev);
 }
@@ -56,6 +56,32 @@ extern short sdc_read(long lba, unsigned char * buffer, short size);
 //
 extern short sdc_write(long lba, const unsigned char * buffer, short size);
 
+//
+// Read consecutive blocks from the SDC
+//
+// Inputs:
+//  lba = the logical block address of the first block to read
+//  buffer = the buffer into which to copy the block data
+//  count = the number of blocks to read
+//
+// Returns:
+//  number of blocks read, any negative number is an error code
+//
+extern short sdc_read_multi(long lba, unsigned char * buffer, short count);
+
+//
+// Write consecutive blocks to the SDC
+//
+// Inputs:
+//  lba = the logical block address of the first block to write
+//  buffer = the buffer containing the data to write
+//  count = the number of blocks to write
+//
+// Returns:
+//  number of blocks written, any negative number is an error code
+//
+extern short sdc_write_multi(long lba, const unsigned char * buffer, short count);
+
 //
 // Return the status of the SDC
 //
@@ -17,6 +17,10 @@
 #define DEV_SDC		0	/* Example: Map Ramdisk to physical drive 0 */
 #define DEV_FDC		1
 #define DEV_HDC 	2
+#define DEV_RAM		3
+
+/* Largest run of sectors handed to the block layer in one call */
+#define DISK_MAX_RUN	128
 
 
 /*-----------------------------------------------------------------------*/
@@ -28,7 +32,6 @@ DSTATUS disk_status (
 )
 {
 	DSTATUS stat;
-	int result;
 
 	TRACE("disk_status");
 
@@ -46,9 +49,6 @@ DSTATUS disk_initialize (
 	BYTE pdrv				/* Physical drive nmuber to identify the drive */
 )
 {
-	DSTATUS stat;
-	int result;
-
 	TRACE("disk_initialize");
 
 	return bdev_init(pdrv);
@@ -67,14 +67,15 @@ DRESULT disk_read (
 	UINT count		/* Number of sectors to read */
 )
 {
-	DRESULT res;
 	int result;
-	int i;
+	UINT run;
 
 	TRACE("disk_read");
 
-	for (i = 0; i < count; i++) {
-		result = bdev_read(pdrv, sector, buff, 512);
+	while (count > 0) {
+		/* Hand the whole run to the block layer, in chunks it can count in a short */
+		run = (count > DISK_MAX_RUN) ? DISK_MAX_RUN : count;
+		result = bdev_read_multi(pdrv, sector, buff, (short)run);
 		if (result < 0) {
 			log_num(LOG_ERROR, "disk_read error: ", result);
 			if (result == ERR_MEDIA_CHANGE) {
@@ -84,9 +85,11 @@ DRESULT disk_read (
 				logmsg(LOG_ERROR, "gerneral error");
 				return RES_PARERR;
 			}
-		} else {
-			sector++;
 		}
+
+		sector += run;
+		buff += run * FF_MIN_SS;
+		count -= run;
 	}
 
 	return RES_OK;
@@ -107,19 +110,26 @@ DRESULT disk_write (
 	UINT count			/* Number of sectors to write */
 )
 {
-	DRESULT res;
-	int i;
 	int result;
+	UINT run;
 
 	TRACE("disk_write");
 
-	for (i = 0; i < count; i++) {
-		result = bdev_write(pdrv, sector, buff, 512);
+	while (count > 0) {
+		run = (count > DISK_MAX_RUN) ? DISK_MAX_RUN : count;
+		result = bdev_write_multi(pdrv, sector, buff, (short)run);
 		if (result < 0) {
-			return RES_PARERR;
-		} else {
-			sector += result;
+			log_num(LOG_ERROR, "disk_write error: ", result);
+			if (result == ERR_MEDIA_CHANGE) {
+				return RES_NOTRDY;
+			} else {
+				return RES_PARERR;
+			}
 		}
+
+		sector += run;
+		buff += run * FF_MIN_SS;
+		count -= run;
 	}
 
 	return RES_OK;
@@ -138,12 +148,16 @@ DRESULT disk_ioctl (
 	void *buff		/* Buffer to send/receive control data */
 )
 {
-	DRESULT res;
 	int result;
 
 	TRACE("disk_ioctl");
 
-	result = bdev_ioctrl(pdrv, cmd, buff, 0);
+	if (cmd == CTRL_SYNC) {
+		/* Push any sectors still held in the block cache out to the device */
+		result = bdev_flush(pdrv);
+	} else {
+		result = bdev_ioctrl(pdrv, cmd, buff, 0);
+	}
 	if (result < 0) {
 		return RES_PARERR;
 	} else {
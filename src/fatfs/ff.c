@@ -491,10 +491,17 @@ static const BYTE GUID_MS_Basic[16] = {0xA2,0xA0,0xD0,0xEB,0xE5,0xB9,0x33,0x44,0
 /* LFN/Directory working buffer   */
 /*--------------------------------*/
 
+#if (FF_USE_DIRCACHE & (FF_USE_DIRCACHE - 1)) || FF_USE_DIRCACHE == 1
+#error FF_USE_DIRCACHE must be 0 or a power of 2 (2 or more)
+#endif
+
 #if FF_USE_LFN == 0		/* Non-LFN configuration */
 #if FF_FS_EXFAT
 #error LFN must be enabled when enable exFAT
 #endif
+#if FF_USE_DIRCACHE
+#error LFN must be enabled when enable the directory lookup cache
+#endif
 #define DEF_NAMBUF
 #define INIT_NAMBUF(fs)
 #define FREE_NAMBUF()
@@ -1201,6 +1208,167 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 
 
 
+#if FF_USE_FREEMAP && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* FAT access - Free cluster map                                         */
+/*-----------------------------------------------------------------------*/
+/* The map holds a bit for each cluster of a FAT12/16/32 volume, set while the
+/  cluster is in use. It is built from the FAT in cluster order (fmap_next is
+/  the next cluster to map), and put_fat() copies every change below that point
+/  into it, so the mapped part always matches the FAT. Once the whole FAT is
+/  mapped, free clusters are found without reading the FAT at all.
+*/
+
+#define FREEMAP_READY(fs)	((fs)->fmap && (fs)->fmap_next >= (fs)->n_fatent)
+
+
+/*-----------------------------*/
+/* Discard the free cluster map */
+/*-----------------------------*/
+
+static void freemap_release (
+	FATFS* fs		/* Filesystem object */
+)
+{
+	if (fs->fmap) ff_memfree(fs->fmap);
+	fs->fmap = 0;
+	fs->fmap_next = 0;	/* Map the FAT again after the volume is mounted */
+}
+
+
+/*------------------------------------------*/
+/* Copy a change of an FAT entry to the map */
+/*------------------------------------------*/
+
+static void freemap_put (
+	FATFS* fs,		/* Filesystem object */
+	DWORD clst,		/* Cluster number whose FAT entry was changed */
+	DWORD val		/* New value of the entry */
+)
+{
+	BYTE *p, bm;
+
+
+	if (fs->fmap && clst < fs->fmap_next) {	/* Is the cluster in the mapped part? */
+		p = fs->fmap + clst / 8; bm = (BYTE)(1 << (clst % 8));
+		if (val != 0 && !(*p & bm)) {	/* Free cluster taken */
+			*p |= bm; fs->fmap_free--;
+		}
+		if (val == 0 && (*p & bm)) {	/* Cluster freed */
+			*p &= (BYTE)~bm; fs->fmap_free++;
+		}
+	}
+}
+
+
+/*----------------------------------*/
+/* Map (more of) the FAT            */
+/*----------------------------------*/
+
+static FRESULT freemap_scan (	/* FR_OK(0):succeeded (the map may be incomplete or not exist), !=0:error */
+	FATFS* fs,		/* Filesystem object */
+	UINT nsect		/* Number of FAT sectors to map (0:all of the rest) */
+)
+{
+	FRESULT res = FR_OK;
+	DWORD clst, stat, n;
+	UINT i, sz;
+	FFOBJID obj;
+
+
+	if (fs->fmap_next == 1 || FREEMAP_READY(fs)) return FR_OK;	/* Going without, or complete */
+
+	if (!fs->fmap) {	/* Start a new map */
+		n = (fs->n_fatent + 7) / 8;
+		if (fs->fs_type == FS_EXFAT || n > FF_USE_FREEMAP || (DWORD)(UINT)n != n
+			|| (fs->fmap = ff_memalloc((UINT)n)) == 0) {
+			fs->fmap_next = 1;		/* Too many clusters or not enough core: go without */
+			return FR_OK;
+		}
+		memset(fs->fmap, 0, (UINT)n);
+		fs->fmap[0] = 0x03;			/* Clusters 0 and 1 do not exist */
+		fs->fmap_next = 2;
+		fs->fmap_free = 0;
+	}
+
+	clst = fs->fmap_next;
+	if (fs->fs_type == FS_FAT12) {	/* FAT12: map it in one go (it is small, and its entries straddle sectors) */
+		obj.fs = fs;
+		do {
+			stat = get_fat(&obj, clst);
+			if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+			if (stat == 1) { res = FR_INT_ERR; break; }
+			if (stat != 0) fs->fmap[clst / 8] |= (BYTE)(1 << (clst % 8)); else fs->fmap_free++;
+		} while (++clst < fs->n_fatent);
+	} else {						/* FAT16/32: map a sector of WORD/DWORD entries at a time */
+		sz = (fs->fs_type == FS_FAT16) ? 2 : 4;
+		do {
+			res = move_window(fs, fs->fatbase + clst / (SS(fs) / sz));
+			if (res != FR_OK) break;
+			i = (UINT)(clst * sz % SS(fs));
+			do {
+				stat = (sz == 2) ? ld_word(fs->win + i) : (ld_dword(fs->win + i) & 0x0FFFFFFF);
+				if (stat != 0) fs->fmap[clst / 8] |= (BYTE)(1 << (clst % 8)); else fs->fmap_free++;
+				i += sz;
+			} while (++clst < fs->n_fatent && i < SS(fs));
+			fs->fmap_next = clst;
+		} while (clst < fs->n_fatent && (nsect == 0 || --nsect != 0));
+	}
+
+	if (res != FR_OK) {		/* Give up the map on an error */
+		freemap_release(fs);
+		fs->fmap_next = 1;
+		return res;
+	}
+
+	fs->fmap_next = clst;
+	if (clst >= fs->n_fatent && fs->free_clst != fs->fmap_free) {	/* The whole FAT is mapped, so the free space is known for certain */
+		fs->free_clst = fs->fmap_free;
+		fs->fsi_flag |= 1;
+	}
+	return FR_OK;
+}
+
+
+/*-------------------------------------------------*/
+/* Find a contiguous free cluster block in the map */
+/*-------------------------------------------------*/
+
+static DWORD freemap_find (	/* 0:Not found, 2..:Cluster block found */
+	FATFS* fs,	/* Filesystem object (its map must be complete) */
+	DWORD clst,	/* Cluster number to scan from */
+	DWORD ncl	/* Number of contiguous clusters to find (1..) */
+)
+{
+	DWORD val, scl, ctr;
+
+
+	if (clst < 2 || clst >= fs->n_fatent) clst = 2;
+	while (clst > 2 && !(fs->fmap[(clst - 1) / 8] & (1 << ((clst - 1) % 8)))) clst--;	/* Back up to the head of the free run clst is in, so the run is seen whole */
+	scl = val = clst; ctr = 0;
+	for (;;) {
+		if (val % 8 == 0 && fs->fmap[val / 8] == 0xFF && val + 8 < fs->n_fatent && clst - val - 1 >= 7) {
+			val += 8;				/* Skip a byte of clusters in use */
+			scl = val; ctr = 0;
+		} else {
+			if (!(fs->fmap[val / 8] & (1 << (val % 8)))) {	/* Is it a free cluster? */
+				if (++ctr == ncl) return scl;	/* Check if run length is sufficient for required */
+			} else {
+				scl = val + 1; ctr = 0;		/* Encountered a cluster in-use, restart to scan */
+			}
+			if (++val >= fs->n_fatent) {	/* Next cluster (with wrap-around) */
+				scl = val = 2; ctr = 0;
+			}
+		}
+		if (val == clst) return 0;	/* All cluster scanned? */
+	}
+}
+
+#endif /* FF_USE_FREEMAP && !FF_FS_READONLY */
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* FAT access - Change value of an FAT entry                             */
@@ -1253,6 +1421,9 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 			fs->wflag = 1;
 			break;
 		}
+#if FF_USE_FREEMAP
+		if (res == FR_OK) freemap_put(fs, clst, val);	/* Keep the free cluster map in step */
+#endif
 	}
 	return res;
 }
@@ -1284,6 +1455,11 @@ static DWORD find_bitmap (	/* 0:Not found, 2..:Cluster block found, 0xFFFFFFFF:D
 
 	clst -= 2;	/* The first bit in the bitmap corresponds to cluster #2 */
 	if (clst >= fs->n_fatent - 2) clst = 0;
+	while (clst > 0) {	/* Back up to the head of the free run clst is in, so the run is seen whole */
+		if (move_window(fs, fs->bitbase + (clst - 1) / 8 / SS(fs)) != FR_OK) return 0xFFFFFFFF;
+		if (fs->win[(clst - 1) / 8 % SS(fs)] & (1 << ((clst - 1) % 8))) break;
+		clst--;
+	}
 	scl = val = clst; ctr = 0;
 	for (;;) {
 		if (move_window(fs, fs->bitbase + val / 8 / SS(fs)) != FR_OK) return 0xFFFFFFFF;
@@ -1299,6 +1475,9 @@ static DWORD find_bitmap (	/* 0:Not found, 2..:Cluster block found, 0xFFFFFFFF:D
 				} else {
 					scl = val; ctr = 0;		/* Encountered a cluster in-use, restart to scan */
 				}
+				if (val == 0) {		/* A run does not wrap around the end of the volume */
+					scl = 0; ctr = 0;
+				}
 				if (val == clst) return 0;	/* All cluster scanned? */
 			} while (bm != 0);
 			bm = 1;
@@ -1542,29 +1721,48 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 #endif
 	{	/* On the FAT/FAT32 volume */
 		ncl = 0;
-		if (scl == clst) {						/* Stretching an existing chain? */
-			ncl = scl + 1;						/* Test if next cluster is free */
-			if (ncl >= fs->n_fatent) ncl = 2;
-			cs = get_fat(obj, ncl);				/* Get next cluster status */
-			if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
-			if (cs != 0) {						/* Not free? */
-				cs = fs->last_clst;				/* Start at suggested cluster if it is valid */
-				if (cs >= 2 && cs < fs->n_fatent) scl = cs;
-				ncl = 0;
-			}
-		}
-		if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
-			ncl = scl;	/* Start cluster */
-			for (;;) {
-				ncl++;							/* Next cluster */
-				if (ncl >= fs->n_fatent) {		/* Check wrap-around */
-					ncl = 2;
-					if (ncl > scl) return 0;	/* No free cluster found? */
+#if FF_USE_FREEMAP
+		if (FREEMAP_READY(fs)) {				/* Find the free cluster in the map */
+			if (scl == clst) {					/* Stretching an existing chain? */
+				ncl = scl + 1;					/* Test if next cluster is free */
+				if (ncl >= fs->n_fatent) ncl = 2;
+				if (fs->fmap[ncl / 8] & (1 << (ncl % 8))) {	/* Not free? */
+					cs = fs->last_clst;			/* Start at suggested cluster if it is valid */
+					if (cs >= 2 && cs < fs->n_fatent) scl = cs;
+					ncl = 0;
 				}
-				cs = get_fat(obj, ncl);			/* Get the cluster status */
-				if (cs == 0) break;				/* Found a free cluster? */
+			}
+			if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
+				ncl = freemap_find(fs, scl + 1, 1);
+				if (ncl == 0) return 0;			/* No free cluster found? */
+			}
+		} else
+#endif
+		{
+			if (scl == clst) {						/* Stretching an existing chain? */
+				ncl = scl + 1;						/* Test if next cluster is free */
+				if (ncl >= fs->n_fatent) ncl = 2;
+				cs = get_fat(obj, ncl);				/* Get next cluster status */
 				if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
-				if (ncl == scl) return 0;		/* No free cluster found? */
+				if (cs != 0) {						/* Not free? */
+					cs = fs->last_clst;				/* Start at suggested cluster if it is valid */
+					if (cs >= 2 && cs < fs->n_fatent) scl = cs;
+					ncl = 0;
+				}
+			}
+			if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
+				ncl = scl;	/* Start cluster */
+				for (;;) {
+					ncl++;							/* Next cluster */
+					if (ncl >= fs->n_fatent) {		/* Check wrap-around */
+						ncl = 2;
+						if (ncl > scl) return 0;	/* No free cluster found? */
+					}
+					cs = get_fat(obj, ncl);			/* Get the cluster status */
+					if (cs == 0) break;				/* Found a free cluster? */
+					if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
+					if (ncl == scl) return 0;		/* No free cluster found? */
+				}
 			}
 		}
 		res = put_fat(fs, ncl, 0xFFFFFFFF);		/* Mark the new cluster 'EOC' */
@@ -2346,6 +2544,27 @@ static FRESULT dir_read (
 
 
 
+#if FF_USE_DIRCACHE
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Hash the name to find for the lookup cache       */
+/*-----------------------------------------------------------------------*/
+
+static DWORD dircache_hash (	/* Hash value of the name (FNV-1a over the up-cased LFN) */
+	FATFS* fs					/* Filesystem object holding the name in its LFN working buffer */
+)
+{
+	DWORD hash = 2166136261UL;
+	UINT i;
+
+	for (i = 0; fs->lfnbuf[i]; i++) {
+		hash = (hash ^ ff_wtoupper(fs->lfnbuf[i])) * 16777619UL;
+	}
+	return hash;
+}
+#endif
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Find an object in the directory                  */
 /*-----------------------------------------------------------------------*/
@@ -2360,6 +2579,10 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 #if FF_USE_LFN
 	BYTE a, ord, sum;
 #endif
+#if FF_USE_DIRCACHE
+	DWORD nhash = 0, hint;
+	UINT left = 0;			/* Entries left to check from the cached offset (0: scanning the whole directory) */
+#endif
 
 	res = dir_sdi(dp, 0);			/* Rewind directory object */
 	if (res != FR_OK) return res;
@@ -2384,6 +2607,21 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	}
 #endif
 	/* On the FAT/FAT32 volume */
+#if FF_USE_DIRCACHE
+	if (!(dp->fn[NSFLAG] & NS_NOLFN)) {		/* Not a probe for a numbered SFN */
+		nhash = dircache_hash(fs);
+		hint = ff_dircache_find(fs, dp->obj.sclust, nhash);
+		if (hint != 0xFFFFFFFF && hint != 0) {
+			if (dir_sdi(dp, hint) == FR_OK) {
+				left = 21;	/* The name's entry block (up to 20 LFN entries and the SFN entry) starts at the hint */
+			} else {
+				res = dir_sdi(dp, 0);
+				if (res != FR_OK) return res;
+			}
+		}
+	}
+	for (;;) {
+#endif
 #if FF_USE_LFN
 	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 #endif
@@ -2418,7 +2656,22 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 		if (!(dp->dir[DIR_Attr] & AM_VOL) && !memcmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
 #endif
 		res = dir_next(dp, 0);	/* Next entry */
+#if FF_USE_DIRCACHE
+		if (res == FR_OK && left && --left == 0) res = FR_NO_FILE;	/* Not at the cached offset */
+#endif
 	} while (res == FR_OK);
+#if FF_USE_DIRCACHE
+	if (res == FR_NO_FILE && left) {	/* The cached offset is stale: scan the whole directory */
+		left = 0;
+		res = dir_sdi(dp, 0);
+		if (res == FR_OK) continue;
+	}
+	break;
+	}
+	if (res == FR_OK && nhash) {		/* Remember where the name was found */
+		ff_dircache_store(fs, dp->obj.sclust, nhash, (dp->blk_ofs != 0xFFFFFFFF) ? dp->blk_ofs : dp->dptr);
+	}
+#endif
 
 	return res;
 }
@@ -2545,6 +2798,12 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 	FATFS *fs = dp->obj.fs;
 #if FF_USE_LFN		/* LFN configuration */
 	DWORD last = dp->dptr;
+#endif
+
+#if FF_USE_DIRCACHE
+	ff_dircache_forget(fs, dp->obj.sclust);	/* Offsets cached for the directory may no longer hold their names */
+#endif
+#if FF_USE_LFN		/* LFN configuration */
 
 	res = (dp->blk_ofs == 0xFFFFFFFF) ? FR_OK : dir_sdi(dp, dp->blk_ofs);	/* Goto top of the entry block if LFN is exist */
 	if (res == FR_OK) {
@@ -3371,6 +3630,9 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	/* The filesystem object is not valid. */
 	/* Following code attempts to mount the volume. (find an FAT volume, analyze the BPB and initialize the filesystem object) */
 
+#if FF_USE_FREEMAP && !FF_FS_READONLY
+	freemap_release(fs);				/* The map belongs to the volume mounted before */
+#endif
 	fs->fs_type = 0;					/* Clear the filesystem object */
 	fs->pdrv = LD2PD(vol);				/* Volume hosting physical drive */
 	stat = disk_initialize(fs->pdrv);	/* Initialize the physical drive */
@@ -3627,10 +3889,18 @@ FRESULT f_mount (
 		if (!ff_del_syncobj(cfs->sobj)) return FR_INT_ERR;
 #endif
 		cfs->fs_type = 0;				/* Clear old fs object */
+#if FF_USE_FREEMAP && !FF_FS_READONLY
+		freemap_release(cfs);			/* Discard its free cluster map */
+#endif
 	}
 
 	if (fs) {
 		fs->fs_type = 0;				/* Clear new fs object */
+#if FF_USE_FREEMAP && !FF_FS_READONLY
+		if (fs != cfs) {				/* It has no free cluster map yet */
+			fs->fmap = 0; fs->fmap_next = 0;
+		}
+#endif
 #if FF_FS_REENTRANT						/* Create sync object for the new volume */
 		if (!ff_cre_syncobj((BYTE)vol, &fs->sobj)) return FR_INT_ERR;
 #endif
@@ -4769,6 +5039,13 @@ FRESULT f_getfree (
 		if (fs->free_clst <= fs->n_fatent - 2) {
 			*nclst = fs->free_clst;
 		} else {
+#if FF_USE_FREEMAP
+			res = freemap_scan(fs, 0);	/* Mapping the free clusters counts them too */
+			if (res != FR_OK || FREEMAP_READY(fs)) {
+				*nclst = fs->free_clst;
+				LEAVE_FF(fs, res);
+			}
+#endif
 			/* Scan FAT to obtain number of free clusters */
 			nfree = 0;
 			if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries */
@@ -4835,6 +5112,33 @@ FRESULT f_getfree (
 
 
 
+#if FF_USE_FREEMAP
+/*-----------------------------------------------------------------------*/
+/* Build the Free Cluster Map                                            */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_buildmap (
+	const TCHAR* path,	/* Logical drive number */
+	UINT nsect			/* Number of FAT sectors to map (0:all of the rest) */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	/* Get logical drive */
+	res = mount_volume(&path, &fs, 0);
+	if (res == FR_OK) {
+		res = freemap_scan(fs, nsect);	/* Map the next part of the FAT */
+	}
+
+	LEAVE_FF(fs, res);
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Truncate File                                                         */
 /*-----------------------------------------------------------------------*/
@@ -5526,18 +5830,30 @@ FRESULT f_expand (
 	} else
 #endif
 	{
-		scl = clst = stcl; ncl = 0;
-		for (;;) {	/* Find a contiguous cluster block */
-			n = get_fat(&fp->obj, clst);
-			if (++clst >= fs->n_fatent) clst = 2;
-			if (n == 1) { res = FR_INT_ERR; break; }
-			if (n == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
-			if (n == 0) {	/* Is it a free cluster? */
-				if (++ncl == tcl) break;	/* Break if a contiguous cluster block is found */
-			} else {
-				scl = clst; ncl = 0;		/* Not a free cluster */
+#if FF_USE_FREEMAP
+		if (FREEMAP_READY(fs)) {
+			scl = freemap_find(fs, stcl, tcl);	/* Find a contiguous cluster block in the map */
+			if (scl == 0) res = FR_DENIED;
+		} else
+#endif
+		{
+			while (stcl > 2 && get_fat(&fp->obj, stcl - 1) == 0) stcl--;	/* Back up to the head of the free run stcl is in, so the run is seen whole */
+			scl = clst = stcl; ncl = 0;
+			for (;;) {	/* Find a contiguous cluster block */
+				n = get_fat(&fp->obj, clst);
+				if (n == 1) { res = FR_INT_ERR; break; }
+				if (n == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+				if (n == 0) {	/* Is it a free cluster? */
+					if (++ncl == tcl) break;	/* Break if a contiguous cluster block is found */
+				}
+				if (++clst >= fs->n_fatent) {	/* Next cluster (a run does not wrap around the end of the volume) */
+					clst = 2; n = 1;
+				}
+				if (n != 0) {
+					scl = clst; ncl = 0;		/* Not a free cluster: restart the run at the next one */
+				}
+				if (clst == stcl) { res = FR_DENIED; break; }	/* No contiguous cluster? */
 			}
-			if (clst == stcl) { res = FR_DENIED; break; }	/* No contiguous cluster? */
 		}
 		if (res == FR_OK) {	/* A contiguous free area is found */
 			if (opt) {		/* Allocate it now */
@@ -5824,7 +6140,12 @@ FRESULT f_mkfs (
 	/* Check mounted drive and clear work area */
 	vol = get_ldnumber(&path);					/* Get target logical drive */
 	if (vol < 0) return FR_INVALID_DRIVE;
-	if (FatFs[vol]) FatFs[vol]->fs_type = 0;	/* Clear the fs object if mounted */
+	if (FatFs[vol]) {
+		FatFs[vol]->fs_type = 0;				/* Clear the fs object if mounted */
+#if FF_USE_FREEMAP
+		freemap_release(FatFs[vol]);			/* Its free cluster map is about to be wrong */
+#endif
+	}
 	pdrv = LD2PD(vol);			/* Physical drive */
 	ipart = LD2PT(vol);			/* Partition (0:create as new, 1..:get from partition table) */
 	if (!opt) opt = &defopt;	/* Use default parameter if it is not given */
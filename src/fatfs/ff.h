@@ -54,7 +54,12 @@ typedef uint64_t		QWORD;	/* 64-bit unsigned integer */
 typedef WORD			WCHAR;	/* UTF-16 character type */
 
 #else  	/* Earlier than C99 */
+#if FF_FS_EXFAT		/* vbcc has a 64-bit long long without being put in C99 mode */
+#define FF_INTDEF 2
+typedef unsigned long long QWORD;	/* 64-bit unsigned integer */
+#else
 #define FF_INTDEF 1
+#endif
 typedef unsigned int	UINT;	/* int must be 16-bit or 32-bit */
 typedef unsigned char	BYTE;	/* char must be 8-bit */
 typedef unsigned short	WORD;	/* 16-bit unsigned integer */
@@ -154,6 +159,11 @@ typedef struct {
 	DWORD	last_clst;		/* Last allocated cluster */
 	DWORD	free_clst;		/* Number of free clusters */
 #endif
+#if FF_USE_FREEMAP && !FF_FS_READONLY
+	BYTE*	fmap;			/* Free cluster map (bit set: cluster in use) */
+	DWORD	fmap_next;		/* Next cluster to be mapped (0:not started, n_fatent:complete, 1:no map) */
+	DWORD	fmap_free;		/* Number of free clusters in the mapped part */
+#endif
 #if FF_FS_RPATH
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
 #if FF_FS_EXFAT
@@ -327,6 +337,7 @@ FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn);	/* Get volume
 FRESULT f_setlabel (const TCHAR* label);							/* Set volume label */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf);	/* Forward data to the stream */
 FRESULT f_expand (FIL* fp, FSIZE_t fsz, BYTE opt);					/* Allocate a contiguous block to the file */
+FRESULT f_buildmap (const TCHAR* path, UINT nsect);					/* Build the free cluster map of the drive */
 FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);			/* Mount/Unmount a logical drive */
 FRESULT f_mkfs (const TCHAR* path, const MKFS_PARM* opt, void* work, UINT len);	/* Create a FAT volume */
 FRESULT f_fdisk (BYTE pdrv, const LBA_t ptbl[], void* work);		/* Divide a physical drive into some partitions */
@@ -362,11 +373,18 @@ WCHAR ff_oem2uni (WCHAR oem, WORD cp);	/* OEM code to Unicode conversion */
 WCHAR ff_uni2oem (DWORD uni, WORD cp);	/* Unicode to OEM code conversion */
 DWORD ff_wtoupper (DWORD uni);			/* Unicode upper-case conversion */
 #endif
-#if FF_USE_LFN == 3						/* Dynamic memory allocation */
+#if FF_USE_LFN == 3 || FF_USE_FREEMAP	/* Dynamic memory allocation */
 void* ff_memalloc (UINT msize);			/* Allocate memory block */
 void ff_memfree (void* mblock);			/* Free memory block */
 #endif
 
+/* Directory lookup cache */
+#if FF_USE_DIRCACHE
+DWORD ff_dircache_find (FATFS* fs, DWORD dclust, DWORD hash);	/* Get the offset a name was last found at */
+void ff_dircache_store (FATFS* fs, DWORD dclust, DWORD hash, DWORD ofs);	/* Remember the offset a name was found at */
+void ff_dircache_forget (FATFS* fs, DWORD dclust);	/* Forget the names found in a directory */
+#endif
+
 /* Sync functions */
 #if FF_FS_REENTRANT
 int ff_cre_syncobj (BYTE vol, FF_SYNC_t* sobj);	/* Create a sync object */
@@ -34,14 +34,46 @@
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FASTSEEK	0
+#define FF_USE_FASTSEEK	1
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
 
+#define FF_USE_DIRCACHE	256
+/* This option sets the number of entries in the directory lookup cache, which
+/  remembers where names were last found in their directories so a path lookup can
+/  go straight to the entry instead of scanning the directory from the top. It must
+/  be 0 (disable) or a power of 2 of at least 2, and needs LFN (FF_USE_LFN >= 1).
+/  Each entry takes 20 bytes (32 on 64-bit hosts). The cache itself is implemented by ff_dircache_find(), ff_dircache_store() and ff_dircache_forget()
+/  in ffsystem.c. */
+
+
+#include "sys_general.h"
+
+#ifndef FF_USE_FREEMAP
+#if MODEL == MODEL_FOENIX_A2560U || MODEL == MODEL_FOENIX_A2560U_PLUS
+#define FF_USE_FREEMAP	16384
+#else
+#define FF_USE_FREEMAP	131072
+#endif
+#endif
+/* This option sets the size in bytes of the largest free cluster map, which keeps
+/  one bit per cluster of a FAT12/16/32 volume in RAM so that finding a free
+/  cluster, a contiguous block of them (f_expand) or the free space (f_getfree)
+/  does not read the FAT. The map is built a few FAT sectors at a time by
+/  f_buildmap() (while the system is idle), or all at once by an f_getfree() that
+/  has to count the free clusters anyway, and every change to the FAT is copied
+/  into it. Until it is complete, free clusters are found in the FAT as before.
+/  A volume with more clusters than the map can hold goes without. (0:Disable)
+/  The memory comes from ff_memalloc(), one map per mounted volume, so the limit is
+/  kept small on the models with little system RAM (16KB covers 131072 clusters).
+/  IOSTAT shows how much each volume's map takes. exFAT volumes have their own
+/  allocation bitmap and do not use it. */
+
+
 #define FF_USE_CHMOD	0
 /* This option switches attribute manipulation functions, f_chmod() and f_utime().
 /  (0:Disable or 1:Enable) Also FF_FS_READONLY needs to be 0 to enable this option. */
@@ -166,7 +198,7 @@
 / Drive/Volume Configurations
 /---------------------------------------------------------------------------*/
 
-#define FF_VOLUMES		3
+#define FF_VOLUMES		4
 /* Number of volumes (logical drives) to be used. (1-10) */
 
 
@@ -230,7 +262,7 @@
 /  buffer in the filesystem object (FATFS) is used for the file data transfer. */
 
 
-#define FF_FS_EXFAT		0
+#define FF_FS_EXFAT		1
 /* This option switches support for exFAT filesystem. (0:Disable or 1:Enable)
 /  To enable exFAT, also LFN needs to be enabled. (FF_USE_LFN >= 1)
 /  Note that enabling exFAT discards ANSI C (C89) compatibility. */
@@ -7,7 +7,8 @@
 #include "ff.h"
 
 
-#if FF_USE_LFN == 3	/* Dynamic memory allocation */
+#if FF_USE_LFN == 3 || FF_USE_FREEMAP	/* Dynamic memory allocation */
+#include <stdlib.h>
 
 /*------------------------------------------------------------------------*/
 /* Allocate a memory block                                                */
@@ -168,3 +169,117 @@ void ff_rel_grant (
 
 #endif
 
+
+
+
+#if FF_USE_DIRCACHE	/* Directory lookup cache */
+
+/*------------------------------------------------------------------------*/
+/* Directory lookup cache                                                 */
+/*------------------------------------------------------------------------*/
+/* The cache remembers the offset in its directory where a name was last
+/  found, keyed by the volume (and its mount ID, so a remount or media change
+/  drops everything), the start cluster of the directory and a hash of the
+/  name. dir_find() still checks the entry at that offset against the name,
+/  so a stale offset only costs a full scan of the directory.
+/
+/  The cache is two-way set associative: each set holds its most recently
+/  used entry first, so a new name pushes out the older of the two.
+*/
+
+typedef struct {
+	FATFS* fs;		/* Volume the directory is on (0: free slot) */
+	WORD id;		/* Mount ID of the volume */
+	DWORD dclust;	/* Start cluster of the directory */
+	DWORD hash;		/* Hash of the up-cased name */
+	DWORD ofs;		/* Offset of the name's entry block in the directory */
+} DIRCACHE;
+
+static DIRCACHE DirCache[FF_USE_DIRCACHE];
+
+
+static DIRCACHE* dircache_set (FATFS* fs, DWORD dclust, DWORD hash)
+{
+	return &DirCache[((hash ^ (dclust * 2654435761UL) ^ (DWORD)fs->pdrv) & (FF_USE_DIRCACHE / 2 - 1)) * 2];
+}
+
+
+static int dircache_match (DIRCACHE* slot, FATFS* fs, DWORD dclust, DWORD hash)
+{
+	return slot->fs == fs && slot->id == fs->id && slot->dclust == dclust && slot->hash == hash;
+}
+
+
+/*------------------------------------------------------------------------*/
+/* Get the offset a name was last found at                                */
+/*------------------------------------------------------------------------*/
+
+DWORD ff_dircache_find (	/* Offset of the entry block, 0xFFFFFFFF if not cached */
+	FATFS* fs,		/* Volume holding the directory */
+	DWORD dclust,	/* Start cluster of the directory */
+	DWORD hash		/* Hash of the name */
+)
+{
+	DIRCACHE* set = dircache_set(fs, dclust, hash);
+	DIRCACHE hit;
+
+	if (dircache_match(&set[0], fs, dclust, hash)) {
+		return set[0].ofs;
+	}
+	if (dircache_match(&set[1], fs, dclust, hash)) {
+		hit = set[1];		/* Make it the most recently used of the set */
+		set[1] = set[0];
+		set[0] = hit;
+		return hit.ofs;
+	}
+	return 0xFFFFFFFF;
+}
+
+
+/*------------------------------------------------------------------------*/
+/* Remember the offset a name was found at                                */
+/*------------------------------------------------------------------------*/
+
+void ff_dircache_store (
+	FATFS* fs,		/* Volume holding the directory */
+	DWORD dclust,	/* Start cluster of the directory */
+	DWORD hash,		/* Hash of the name */
+	DWORD ofs		/* Offset of the name's entry block */
+)
+{
+	DIRCACHE* set = dircache_set(fs, dclust, hash);
+
+	if (!dircache_match(&set[0], fs, dclust, hash)) {
+		if (!dircache_match(&set[1], fs, dclust, hash)) {
+			set[1] = set[0];	/* Push out the least recently used entry */
+		}
+		set[0].fs = fs;
+		set[0].id = fs->id;
+		set[0].dclust = dclust;
+		set[0].hash = hash;
+	}
+	set[0].ofs = ofs;
+}
+
+
+/*------------------------------------------------------------------------*/
+/* Forget the names found in a directory                                  */
+/*------------------------------------------------------------------------*/
+/* This function is called when entries are removed from a directory.
+*/
+
+void ff_dircache_forget (
+	FATFS* fs,		/* Volume holding the directory */
+	DWORD dclust	/* Start cluster of the directory */
+)
+{
+	UINT i;
+
+	for (i = 0; i < FF_USE_DIRCACHE; i++) {
+		if (DirCache[i].fs == fs && DirCache[i].dclust == dclust) {
+			DirCache[i].fs = 0;
+		}
+	}
+}
+
+#endif
@@ -49,6 +49,7 @@
 #include "dev/pata.h"
 #include "dev/ps2.h"
 #include "dev/rtc.h"
+#include "dev/ramdisk.h"
 #include "dev/sdc.h"
 #include "dev/txt_screen.h"
 
@@ -141,7 +142,7 @@ TRACE1("Booting from device %d",boot_dev);
 }
 
 
-const char* VolumeStr[FF_VOLUMES] = { "sd", "fd", "hd" };
+const char* VolumeStr[FF_VOLUMES] = { "sd", "fd", "hd", "ram" };
 
 t_sys_info info;
 
@@ -340,6 +341,12 @@ static void os_devices_initialize(void) {
     }
 #endif
 
+    if ((res = ramdisk_install())) {
+        ERROR1("FAILED: RAM disk installation (%d)", res);
+    } else {
+        INFO("RAM disk installed.");
+    }
+
     if ((res = fsys_init())) {
         ERROR1("FAILED: file system initialization (%d)", res);
     } else {
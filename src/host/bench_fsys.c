@@ -0,0 +1,1291 @@
+/**
+ * bench_fsys -- measure the file system, block layer and loaders on the host
+ *
+ * The portable kernel core runs against a disk image (or the RAM disk), and the
+ * benchmark times the same calls the CLI makes: sequential writes and reads
+ * through a file channel, copying a file, reading and writing a file in the
+ * background, byte and line I/O, listing a directory,
+ * finding free space, and loading PGX and PGZ binaries.
+ *
+ * USAGE: bench_fsys [-i <image>] [-m <MB>] [-a <cluster bytes>] [-t <file system>] [-f] [-r] [-x] [-c]
+ *                   [-s <KB>] [-b <bytes>] [-n <files>] [-p <passes>] [-k <seeks>] [-l <binary>]
+ *                   [-e <KB>] [-u <bytes>]
+ *
+ *  -i  disk image to use (default bench.img)
+ *  -m  size of the image or RAM disk in MB (default 64 for an image, 2 for the RAM disk)
+ *  -a  cluster size to format with (default: FatFs' choice for the volume size)
+ *  -t  file system to format with: fat, fat32 or exfat (default: FatFs' choice for the volume size)
+ *  -f  format the volume even if it already has a file system
+ *  -r  run on the RAM disk instead of the image
+ *  -x  turn off the block cache for the device
+ *  -c  reserve the sequential test file as one run of clusters before writing it
+ *  -s  size of the sequential test file in KB (default 4096, or a quarter of the free space if that is less)
+ *  -b  size of each read or write call in bytes (default 16384)
+ *  -n  number of files in the directory listing test (default 256)
+ *  -p  number of passes over the directory (default 10)
+ *  -k  number of random seeks into the test file (default 2000)
+ *  -l  binary on the host (PGX, PGZ, PGC, ELF) to copy to the volume and time loading
+ *  -e  size of the executable cache in KB: the -l binary is loaded a second time from it
+ *  -u  size of the byte I/O buffer for the byte and line test (0 for none, default: the kernel's)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "errors.h"
+#include "log.h"
+#include "memory.h"
+#include "dev/block.h"
+#include "dev/channel.h"
+#include "dev/fsys.h"
+#include "dev/ramdisk.h"
+#include "fatfs/ff.h"
+#include "host/host.h"
+#include "host/imgdisk.h"
+
+#define BENCH_LOAD_ADDRESS  0x00020000      // Where the PGX and PGZ test binaries are loaded
+#define BENCH_PGZ_SEGMENT   0x00010000      // Size of the data segments in the PGZ test binary
+#define BENCH_MAX_TRANSFER  0x7e00          // Largest transfer a channel call can take (a short, in whole sectors)
+#define BENCH_LINE_LENGTH   32              // Bytes in each line of the byte I/O test file (with its newline)
+
+//
+// Settings for the run
+//
+
+static const char * bench_image = "bench.img";
+static unsigned long bench_volume_mb = 0;
+static unsigned long bench_cluster = 0;
+static short bench_format = 0;
+static short bench_fs_type = FSYS_FORMAT_ANY;
+static short bench_ramdisk = 0;
+static short bench_nocache = 0;
+static short bench_contiguous = 0;
+static short bench_fixed_ram = 0;
+static unsigned long bench_file_kb = 0;
+static short bench_file_set = 0;           // Was the size of the test file given (-s)?
+static unsigned long bench_transfer = 16384;
+static unsigned long bench_files = 256;
+static unsigned long bench_passes = 10;
+static unsigned long bench_seeks = 2000;
+static const char * bench_binary = 0;
+static unsigned long bench_exec_cache_kb = 0;
+static long bench_byte_buffer = -1;         // Byte I/O buffer for the byte test (-1: leave the default)
+
+static short bench_dev = BDEV_SDC;          // Block device under test
+static const char * bench_root = "/sd";     // Path to the volume under test
+static unsigned char * bench_buffer = 0;    // Transfer buffer
+
+static unsigned char bench_work[FF_MAX_SS * 4];
+
+//
+// Print a line of results
+//
+static void bench_report(const char * label, unsigned long long bytes, unsigned long long usec) {
+    double seconds = (double)usec / 1000000.0;
+    double mb = (double)bytes / (1024.0 * 1024.0);
+
+    printf("%-12s %10llu KB %10.4f s %10.2f MB/s\n", label, bytes / 1024, seconds, (seconds > 0) ? mb / seconds : 0.0);
+}
+
+//
+// Print one direction of a device's I/O statistics
+//
+static void bench_print_io(const char * label, p_bdev_io_stats io) {
+    printf("  %-5s ops: %lu  sectors: %lu  errors: %lu  jiffies: %lu\n", label, io->ops, io->sectors, io->errors, io->jiffies);
+}
+
+//
+// Print the block layer's view of the run, then clear it for the next test
+//
+static void bench_print_stats(const char * label) {
+    t_bdev_stats stats;
+    t_bdev_cache_stats cache;
+
+    if (bdev_stats(bench_dev, &stats) == 0) {
+        printf("%s (%s):\n", label, stats.name);
+        bench_print_io("read", &stats.read);
+        bench_print_io("write", &stats.write);
+        bench_print_io("flush", &stats.flush);
+    }
+
+    if (bdev_ioctrl(bench_dev, BDEV_CTRL_CACHE_STATS, (unsigned char *)&cache, sizeof(cache)) == 0) {
+        printf("  cache hits: %lu  misses: %lu  writebacks: %lu  evictions: %lu\n", cache.hits, cache.misses, cache.writebacks, cache.evictions);
+    }
+
+    bdev_ioctrl(bench_dev, BDEV_CTRL_STATS_RESET, 0, 0);
+    bdev_ioctrl(bench_dev, BDEV_CTRL_CACHE_RESET_STATS, 0, 0);
+}
+
+//
+// Start a test with nothing of the volume in the block cache
+//
+static void bench_cold() {
+    bdev_ioctrl(bench_dev, BDEV_CTRL_CACHE_INVALIDATE, 0, 0);
+    bdev_ioctrl(bench_dev, BDEV_CTRL_STATS_RESET, 0, 0);
+    bdev_ioctrl(bench_dev, BDEV_CTRL_CACHE_RESET_STATS, 0, 0);
+}
+
+//
+// Fill a buffer with a pattern that depends on its position in the file
+//
+static void bench_fill(unsigned char * buffer, unsigned long size, unsigned long offset) {
+    unsigned long i;
+
+    for (i = 0; i < size; i++) {
+        buffer[i] = (unsigned char)(((offset + i) * 7) ^ ((offset + i) >> 9));
+    }
+}
+
+//
+// Report a chan_write that did not write everything it was given
+//
+static void bench_write_failed(unsigned long offset, short n, unsigned long size) {
+    if (n < 0) {
+        printf("Write failed at %lu: %s\n", offset, err_message(n));
+    } else {
+        printf("Write failed at %lu: wrote %d of %lu bytes\n", offset, (int)n, size);
+    }
+}
+
+//
+// Bring up the kernel core with the device under test
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+static short bench_setup() {
+    char drive[4];
+    unsigned long sectors;
+    FATFS * fs;
+    DWORD free_clusters;
+    MKFS_PARM opt;
+    short result;
+
+    bench_fixed_ram = host_init();
+    if (!bench_fixed_ram) {
+        printf("System RAM could not be placed at its target addresses: the load test will be skipped\n");
+    }
+
+    bdev_init_system();
+    cdev_init_system();
+
+    if (bench_ramdisk) {
+        bench_dev = BDEV_RAM;
+        bench_root = "/ram";
+        bench_format = 1;
+        if (bench_volume_mb == 0) {
+            bench_volume_mb = 2;
+        }
+
+        if ((result = ramdisk_install())) {
+            printf("Unable to install the RAM disk: %s\n", err_message(result));
+            return result;
+        }
+
+        sectors = bench_volume_mb * 1024 * 1024 / RAMDISK_SECTOR_SIZE;
+        if (sectors * RAMDISK_SECTOR_SIZE > mem_get_ramtop() - host_ram_base() - BENCH_LOAD_ADDRESS) {
+            printf("The RAM disk does not fit in system RAM\n");
+            return ERR_BAD_ARGUMENT;
+        }
+
+        if ((result = bdev_ioctrl(BDEV_RAM, RAMDISK_CTRL_RESIZE, (unsigned char *)&sectors, sizeof(sectors)))) {
+            printf("Unable to resize the RAM disk: %s\n", err_message(result));
+            return result;
+        }
+
+    } else {
+        if (bench_volume_mb == 0) {
+            bench_volume_mb = 64;
+        }
+
+        sectors = bench_volume_mb * 1024 * 1024 / IMGDISK_SECTOR_SIZE;
+        if ((result = imgdisk_install(BDEV_SDC, bench_image, sectors))) {
+            printf("Unable to open the image %s: %s\n", bench_image, err_message(result));
+            return result;
+        }
+    }
+
+    if (bench_nocache) {
+        bdev_ioctrl(bench_dev, BDEV_CTRL_CACHE_DISABLE, 0, 0);
+    }
+
+    if ((result = fsys_init())) {
+        printf("Unable to start the file system: %s\n", err_message(result));
+        return result;
+    }
+
+    sprintf(drive, "%d:", bench_dev);
+    if (!bench_format && (f_getfree(drive, &free_clusters, &fs) == FR_NO_FILESYSTEM)) {
+        bench_format = 1;
+    }
+
+    if (bench_format) {
+        memset(&opt, 0, sizeof(opt));
+        opt.fmt = (BYTE)bench_fs_type;
+        opt.au_size = bench_cluster;
+        if (f_mkfs(drive, &opt, bench_work, sizeof(bench_work)) != FR_OK) {
+            printf("Unable to format the volume\n");
+            return ERR_GENERAL;
+        }
+    }
+
+    if (f_getfree(drive, &free_clusters, &fs) != FR_OK) {
+        printf("Unable to mount the volume\n");
+        return ERR_GENERAL;
+    }
+
+    printf("Volume: %s  %s  %lu KB  cluster: %u bytes  free: %lu KB\n",
+        bench_root,
+        (fs->fs_type == FS_FAT12) ? "FAT12" : ((fs->fs_type == FS_FAT16) ? "FAT16" : ((fs->fs_type == FS_FAT32) ? "FAT32" : "exFAT")),
+        (unsigned long)((fs->n_fatent - 2) * fs->csize / 2),
+        fs->csize * FF_MIN_SS,
+        (unsigned long)(free_clusters * fs->csize / 2));
+
+    if (!bench_file_set) {
+        // Leave room for the copy of the test file, and for the other tests' files
+        bench_file_kb = (unsigned long)(free_clusters * fs->csize / 2) / 4;
+        if (bench_file_kb > 4096) {
+            bench_file_kb = 4096;
+        }
+    }
+    printf("Block cache: %s  transfer size: %lu bytes\n\n", bench_nocache ? "off" : "on", bench_transfer);
+
+    bdev_ioctrl(bench_dev, BDEV_CTRL_STATS_RESET, 0, 0);
+    bdev_ioctrl(bench_dev, BDEV_CTRL_CACHE_RESET_STATS, 0, 0);
+    return 0;
+}
+
+//
+// Write and then read back a file in bench_transfer sized pieces
+//
+static short bench_sequential() {
+    char path[MAX_PATH_LEN];
+    unsigned long long started;
+    unsigned long total = bench_file_kb * 1024;
+    unsigned long done, size;
+    short chan, n;
+
+    sprintf(path, "%s/bench.dat", bench_root);
+
+    bench_cold();
+    started = host_microseconds();
+    chan = fsys_open(path, FSYS_WRITE | FSYS_CREATE_ALWAYS);
+    if (chan < 0) {
+        printf("Unable to create %s: %s\n", path, err_message(chan));
+        return chan;
+    }
+
+    if (bench_contiguous) {
+        n = fsys_preallocate(chan, (long)total, 1);
+        if (n != 0) {
+            printf("Unable to reserve %lu contiguous bytes: %s\n", total, err_message(n));
+            fsys_close(chan);
+            return n;
+        }
+    }
+
+    for (done = 0; done < total; done += size) {
+        size = (total - done < bench_transfer) ? total - done : bench_transfer;
+        bench_fill(bench_buffer, size, done);
+        n = chan_write(chan, bench_buffer, (short)size);
+        if (n != (short)size) {
+            bench_write_failed(done, n, size);
+            fsys_close(chan);
+            return ERR_GENERAL;
+        }
+    }
+    fsys_close(chan);
+    bench_report(bench_contiguous ? "write (res)" : "write", total, host_microseconds() - started);
+    bench_print_stats("  write");
+
+    bench_cold();
+    started = host_microseconds();
+    chan = fsys_open(path, FSYS_READ);
+    if (chan < 0) {
+        printf("Unable to open %s: %s\n", path, err_message(chan));
+        return chan;
+    }
+
+    for (done = 0; done < total; done += n) {
+        n = chan_read(chan, bench_buffer, (short)bench_transfer);
+        if (n <= 0) {
+            break;
+        }
+    }
+    fsys_close(chan);
+    bench_report("read", done, host_microseconds() - started);
+    bench_print_stats("  read");
+
+    if (done != total) {
+        printf("Read back %lu bytes of %lu\n", done, total);
+        return ERR_GENERAL;
+    }
+
+    return 0;
+}
+
+//
+// Set the byte I/O buffer of a file channel, if one was asked for
+//
+static short bench_set_buffer(short chan) {
+    unsigned long size = bench_byte_buffer;
+    short result;
+
+    if (bench_byte_buffer < 0) {
+        return 0;
+    }
+
+    result = chan_ioctrl(chan, FSYS_IOCTRL_BUFFER, (unsigned char *)&size, sizeof(size));
+    if (result != 0) {
+        printf("Unable to set the byte I/O buffer: %s\n", err_message(result));
+    }
+    return result;
+}
+
+//
+// Write a text file a byte at a time, then read it back a byte and a line at a time
+//
+static short bench_bytes() {
+    char path[MAX_PATH_LEN];
+    char line[BENCH_LINE_LENGTH + 2];
+    char expected[BENCH_LINE_LENGTH + 2];
+    unsigned long long started;
+    unsigned long lines = bench_file_kb * 1024 / BENCH_LINE_LENGTH;
+    unsigned long i, j, done = 0;
+    short chan, c, n;
+
+    sprintf(path, "%s/bench.txt", bench_root);
+
+    bench_cold();
+    started = host_microseconds();
+    chan = fsys_open(path, FSYS_WRITE | FSYS_CREATE_ALWAYS);
+    if (chan < 0) {
+        printf("Unable to create %s: %s\n", path, err_message(chan));
+        return chan;
+    }
+
+    if (bench_set_buffer(chan) != 0) {
+        fsys_close(chan);
+        return ERR_GENERAL;
+    }
+
+    for (i = 0; i < lines; i++) {
+        sprintf(line, "%0*lu\n", BENCH_LINE_LENGTH - 1, i);
+        for (j = 0; j < BENCH_LINE_LENGTH; j++) {
+            n = chan_write_b(chan, line[j]);
+            if (n < 0) {
+                printf("Byte write failed at %lu: %s\n", i * BENCH_LINE_LENGTH + j, err_message(n));
+                fsys_close(chan);
+                return n;
+            }
+        }
+    }
+    n = fsys_close(chan);
+    if (n != 0) {
+        printf("Unable to close %s: %s\n", path, err_message(n));
+        return n;
+    }
+    bench_report("write_b", lines * BENCH_LINE_LENGTH, host_microseconds() - started);
+
+    bench_cold();
+    started = host_microseconds();
+    chan = fsys_open(path, FSYS_READ);
+    if ((chan < 0) || (bench_set_buffer(chan) != 0)) {
+        printf("Unable to open %s\n", path);
+        return ERR_GENERAL;
+    }
+
+    for (i = 0; i < lines; i++) {
+        sprintf(expected, "%0*lu\n", BENCH_LINE_LENGTH - 1, i);
+        for (j = 0; j < BENCH_LINE_LENGTH; j++) {
+            c = chan_read_b(chan);
+            if (c != (unsigned char)expected[j]) {
+                printf("Byte read mismatch at %lu\n", i * BENCH_LINE_LENGTH + j);
+                fsys_close(chan);
+                return ERR_GENERAL;
+            }
+        }
+    }
+    if ((chan_status(chan) & CDEV_STAT_EOF) == 0) {
+        printf("Byte read did not end at the end of the file\n");
+        fsys_close(chan);
+        return ERR_GENERAL;
+    }
+    fsys_close(chan);
+    bench_report("read_b", lines * BENCH_LINE_LENGTH, host_microseconds() - started);
+
+    bench_cold();
+    started = host_microseconds();
+    chan = fsys_open(path, FSYS_READ);
+    if ((chan < 0) || (bench_set_buffer(chan) != 0)) {
+        printf("Unable to open %s\n", path);
+        return ERR_GENERAL;
+    }
+
+    for (i = 0; ; i++) {
+        n = chan_readline(chan, (unsigned char *)line, sizeof(line));
+        if (n <= 0) {
+            break;
+        }
+
+        sprintf(expected, "%0*lu\n", BENCH_LINE_LENGTH - 1, i);
+        if (strcmp(line, expected) != 0) {
+            printf("Line %lu read back wrong\n", i);
+            fsys_close(chan);
+            return ERR_GENERAL;
+        }
+        done += n;
+    }
+    fsys_close(chan);
+    bench_report("readline", done, host_microseconds() - started);
+    bench_print_stats("  readline");
+
+    if (i != lines) {
+        printf("Read back %lu lines of %lu\n", i, lines);
+        return ERR_GENERAL;
+    }
+
+    return 0;
+}
+
+//
+// Read a sector's worth at bench_seeks random places in the test file
+//
+static short bench_seek_pass(short chan, const char * label) {
+    unsigned long long started;
+    unsigned long total = bench_file_kb * 1024;
+    unsigned long position = 0;
+    unsigned long i;
+    short n;
+
+    bench_cold();
+    started = host_microseconds();
+    for (i = 0; i < bench_seeks; i++) {
+        // The same positions on every run, scattered over the whole file
+        position = (position * 1103515245 + 12345) & 0x7fffffff;
+        n = chan_seek(chan, (long)((position % (total / IMGDISK_SECTOR_SIZE)) * IMGDISK_SECTOR_SIZE), CDEV_SEEK_START);
+        if (n == 0) {
+            n = chan_read(chan, bench_buffer, IMGDISK_SECTOR_SIZE);
+        }
+        if (n < 0) {
+            printf("Seek failed: %s\n", err_message(n));
+            return n;
+        }
+    }
+    bench_report(label, (unsigned long long)bench_seeks * IMGDISK_SECTOR_SIZE, host_microseconds() - started);
+    bench_print_stats("  seek");
+
+    return 0;
+}
+
+//
+// Time random access into the test file with and without a cluster link map
+//
+static short bench_seek() {
+    char path[MAX_PATH_LEN];
+    unsigned long entries = 0;
+    short chan, result;
+
+    if (bench_file_kb == 0) {
+        return 0;
+    }
+
+    sprintf(path, "%s/bench.dat", bench_root);
+    chan = fsys_open(path, FSYS_READ);
+    if (chan < 0) {
+        printf("Unable to open %s: %s\n", path, err_message(chan));
+        return chan;
+    }
+
+    result = chan_ioctrl(chan, FSYS_IOCTRL_FASTSEEK, 0, 0);
+    if (result == 0) {
+        chan_ioctrl(chan, FSYS_IOCTRL_FASTSEEK_SIZE, (unsigned char *)&entries, sizeof(entries));
+        printf("Cluster link map: %lu longs\n", entries);
+        result = bench_seek_pass(chan, "seek (map)");
+    }
+
+    if (result == 0) {
+        chan_ioctrl(chan, FSYS_IOCTRL_FASTSEEK_OFF, 0, 0);
+        result = bench_seek_pass(chan, "seek (FAT)");
+    }
+
+    fsys_close(chan);
+    return result;
+}
+
+//
+// Count the blocks fsys_copy reports
+//
+static unsigned long bench_copy_blocks = 0;
+
+static short bench_copy_progress(unsigned long done, unsigned long total) {
+    bench_copy_blocks++;
+    return 0;
+}
+
+//
+// Check that the copy of the test file holds what bench_sequential wrote
+//
+static short bench_check_copy(const char * path) {
+    unsigned long total = bench_file_kb * 1024;
+    unsigned long done, i;
+    short chan, n;
+
+    chan = fsys_open(path, FSYS_READ);
+    if (chan < 0) {
+        printf("Unable to open %s: %s\n", path, err_message(chan));
+        return chan;
+    }
+
+    for (done = 0; done < total; done += n) {
+        n = chan_read(chan, bench_buffer, (short)bench_transfer);
+        if (n <= 0) {
+            break;
+        }
+
+        for (i = 0; i < (unsigned long)n; i++) {
+            bench_fill(bench_work, 1, done + i);
+            if (bench_buffer[i] != bench_work[0]) {
+                printf("Copy differs at %lu\n", done + i);
+                fsys_close(chan);
+                return ERR_GENERAL;
+            }
+        }
+    }
+    fsys_close(chan);
+
+    if (done != total) {
+        printf("Copy has %lu bytes of %lu\n", done, total);
+        return ERR_GENERAL;
+    }
+
+    return 0;
+}
+
+//
+// Copy the test file with the CLI's old channel loop, and then with fsys_copy
+//
+static short bench_copy() {
+    char src_path[MAX_PATH_LEN];
+    char dst_path[MAX_PATH_LEN];
+    unsigned char buffer[256];
+    unsigned long long started;
+    unsigned long total = bench_file_kb * 1024;
+    short src, dst, n, result = 0;
+
+    if (bench_file_kb == 0) {
+        return 0;
+    }
+
+    sprintf(src_path, "%s/bench.dat", bench_root);
+    sprintf(dst_path, "%s/bench.cpy", bench_root);
+
+    bench_cold();
+    started = host_microseconds();
+    src = fsys_open(src_path, FSYS_READ);
+    dst = fsys_open(dst_path, FSYS_WRITE | FSYS_CREATE_ALWAYS);
+    if ((src < 0) || (dst < 0)) {
+        printf("Unable to open the files to copy\n");
+        return ERR_GENERAL;
+    }
+    do {
+        n = chan_read(src, buffer, sizeof(buffer));
+        if (n > 0) {
+            result = chan_write(dst, buffer, n);
+        }
+    } while ((n > 0) && (result >= 0));
+    fsys_close(src);
+    fsys_close(dst);
+    bench_report("copy (256)", total, host_microseconds() - started);
+    bench_print_stats("  copy (256)");
+
+    result = bench_check_copy(dst_path);
+    if (result != 0) {
+        return result;
+    }
+
+    bench_cold();
+    bench_copy_blocks = 0;
+    started = host_microseconds();
+    result = fsys_copy(src_path, dst_path, 0, bench_copy_progress);
+    if (result != 0) {
+        printf("Unable to copy %s: %s\n", src_path, err_message(result));
+        return result;
+    }
+    bench_report("fsys_copy", total, host_microseconds() - started);
+    bench_print_stats("  fsys_copy");
+    printf("  fsys_copy: %lu blocks\n", bench_copy_blocks);
+
+    result = bench_check_copy(dst_path);
+    if (result != 0) {
+        return result;
+    }
+
+    result = fsys_copy(src_path, dst_path, FSYS_COPY_NO_OVERWRITE, 0);
+    if (result != FSYS_ERR_EXIST) {
+        printf("fsys_copy replaced a file it was told not to: %s\n", err_message(result));
+        return ERR_GENERAL;
+    }
+
+    return fsys_delete(dst_path);
+}
+
+//
+// Poll an asynchronous transfer once per pass of a pretend main loop until it is over
+//
+// Inputs:
+//  token = the token of the transfer
+//  label = the label for the results
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+static short bench_async_poll(short token, const char * label) {
+    unsigned long long started, took, longest = 0;
+    unsigned long count = 0, polls = 0;
+    short result;
+
+    do {
+        started = host_microseconds();
+        result = fsys_poll(token, &count);
+        took = host_microseconds() - started;
+        if (took > longest) {
+            longest = took;
+        }
+        polls++;
+    } while (result == FSYS_ASYNC_PENDING);
+
+    printf("  %s: %lu bytes in %lu polls, longest poll %llu us\n", label, count, polls, longest);
+    if (result != 0) {
+        printf("%s failed: %s\n", label, err_message(result));
+    }
+    return result;
+}
+
+//
+// Read the test file in the background, then write a copy of it the same way
+//
+static short bench_async() {
+    char src_path[MAX_PATH_LEN];
+    char dst_path[MAX_PATH_LEN];
+    unsigned long long started;
+    unsigned long total = bench_file_kb * 1024;
+    unsigned long i;
+    unsigned char * data;
+    short chan, token, result;
+
+    if (bench_file_kb == 0) {
+        return 0;
+    }
+
+    data = malloc(total);
+    if (data == 0) {
+        printf("Unable to allocate %lu bytes for the background transfers\n", total);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    sprintf(src_path, "%s/bench.dat", bench_root);
+    sprintf(dst_path, "%s/bench.asy", bench_root);
+
+    bench_cold();
+    started = host_microseconds();
+    chan = fsys_open(src_path, FSYS_READ);
+    if (chan < 0) {
+        printf("Unable to open %s: %s\n", src_path, err_message(chan));
+        free(data);
+        return chan;
+    }
+    result = fsys_read_async(chan, data, total, &token);
+    if (result == 0) {
+        result = bench_async_poll(token, "read async");
+    }
+    fsys_close(chan);
+    bench_report("read async", total, host_microseconds() - started);
+    bench_print_stats("  read async");
+
+    for (i = 0; (result == 0) && (i < total); i++) {
+        bench_fill(bench_work, 1, i);
+        if (data[i] != bench_work[0]) {
+            printf("Background read differs at %lu\n", i);
+            result = ERR_GENERAL;
+        }
+    }
+
+    if (result == 0) {
+        bench_cold();
+        started = host_microseconds();
+        chan = fsys_open(dst_path, FSYS_WRITE | FSYS_CREATE_ALWAYS);
+        if (chan < 0) {
+            printf("Unable to create %s: %s\n", dst_path, err_message(chan));
+            free(data);
+            return chan;
+        }
+        result = fsys_write_async(chan, data, total, &token);
+        if (result == 0) {
+            result = bench_async_poll(token, "write async");
+        }
+        fsys_close(chan);
+        bench_report("write async", total, host_microseconds() - started);
+        bench_print_stats("  write async");
+    }
+
+    free(data);
+
+    if (result == 0) {
+        result = bench_check_copy(dst_path);
+    }
+    if (result == 0) {
+        result = fsys_delete(dst_path);
+    }
+    return result;
+}
+
+//
+// Call fsys_idle, as the console does while it waits for a key, until the volume's
+// free cluster map is complete
+//
+static short bench_idle() {
+#if FF_USE_FREEMAP
+    char drive[4];
+    unsigned long long started;
+    unsigned long calls = 0;
+    DWORD free_clusters;
+    FATFS * fs;
+
+    sprintf(drive, "%d:", bench_dev);
+    if (f_getfree(drive, &free_clusters, &fs) != FR_OK) {
+        printf("Unable to find the volume\n");
+        return ERR_GENERAL;
+    }
+
+    bench_cold();
+    started = host_microseconds();
+    while ((fs->fmap_next != 1) && (fs->fmap_next < fs->n_fatent)) {
+        fsys_idle();
+        calls++;
+    }
+    printf("%-12s %10lu    %10.4f s  (%s)\n", "idle", calls, (host_microseconds() - started) / 1000000.0,
+        fs->fmap ? "free cluster map built" : "no free cluster map");
+    bench_print_stats("  idle");
+#endif
+    return 0;
+}
+
+//
+// Remount the volume, then time asking for its free space and reserving a contiguous
+// file on it, before and after the free cluster map is built in idle time
+//
+static short bench_free() {
+    char path[MAX_PATH_LEN];
+    unsigned long long elapsed, started;
+    unsigned long free_kb = 0, total_kb = 0;
+    short chan, pass, result;
+
+    if (bench_file_kb == 0) {
+        return 0;
+    }
+
+    sprintf(path, "%s/bench.res", bench_root);
+    fsys_mount(bench_dev);
+
+    for (pass = 0; pass < 2; pass++) {
+        bench_cold();
+        started = host_microseconds();
+        result = fsys_get_free(bench_root, &free_kb, &total_kb);
+        elapsed = host_microseconds() - started;
+        if (result != 0) {
+            printf("Unable to get the free space: %s\n", err_message(result));
+            return result;
+        }
+        printf("%-12s %10lu KB %10.4f s  (of %lu KB)\n", pass ? "free (map)" : "free", free_kb, elapsed / 1000000.0, total_kb);
+        bench_print_stats(pass ? "  free (map)" : "  free");
+
+        bench_cold();
+        started = host_microseconds();
+        chan = fsys_open(path, FSYS_WRITE | FSYS_CREATE_ALWAYS);
+        if (chan < 0) {
+            printf("Unable to create %s: %s\n", path, err_message(chan));
+            return chan;
+        }
+        result = fsys_preallocate(chan, (long)(bench_file_kb * 1024), 1);
+        fsys_close(chan);
+        elapsed = host_microseconds() - started;
+        if (result != 0) {
+            printf("Unable to reserve %lu contiguous KB: %s\n", bench_file_kb, err_message(result));
+            return result;
+        }
+        printf("%-12s %10lu KB %10.4f s\n", pass ? "reserve (map)" : "reserve", bench_file_kb, elapsed / 1000000.0);
+        bench_print_stats(pass ? "  reserve (map)" : "  reserve");
+
+        result = fsys_delete(path);
+        if (result != 0) {
+            return result;
+        }
+
+        if (pass == 0) {
+            result = bench_idle();
+            if (result != 0) {
+                return result;
+            }
+        }
+    }
+
+    return 0;
+}
+
+//
+// Fill a directory with files, then list it and look up each file bench_passes times
+//
+static short bench_directory() {
+    char path[MAX_PATH_LEN];
+    char dir_path[MAX_PATH_LEN];
+    t_file_info info;
+    unsigned long long started, elapsed;
+    unsigned long i, pass, entries = 0, calls = 0;
+    short chan, dir, count, result;
+
+    sprintf(dir_path, "%s/benchdir", bench_root);
+    if (fsys_stat(dir_path, &info) < 0) {
+        result = fsys_mkdir(dir_path);
+        if (result < 0) {
+            printf("Unable to create %s: %s\n", dir_path, err_message(result));
+            return result;
+        }
+    }
+
+    bench_cold();
+    started = host_microseconds();
+    for (i = 0; i < bench_files; i++) {
+        sprintf(path, "%s/F%05lu.DAT", dir_path, i);
+        chan = fsys_open(path, FSYS_WRITE | FSYS_CREATE_ALWAYS);
+        if (chan < 0) {
+            printf("Unable to create %s: %s\n", path, err_message(chan));
+            return chan;
+        }
+        fsys_close(chan);
+    }
+    elapsed = host_microseconds() - started;
+    printf("%-12s %10lu    %10.4f s %10.0f files/s\n", "create", bench_files, elapsed / 1000000.0,
+        elapsed ? bench_files * 1000000.0 / elapsed : 0.0);
+
+    bench_cold();
+    started = host_microseconds();
+    for (pass = 0; pass < bench_passes; pass++) {
+        dir = fsys_opendir(dir_path);
+        if (dir < 0) {
+            printf("Unable to open %s: %s\n", dir_path, err_message(dir));
+            return dir;
+        }
+
+        while ((fsys_readdir(dir, &info) == 0) && (info.name[0] != 0)) {
+            entries++;
+        }
+
+        fsys_closedir(dir);
+    }
+    elapsed = host_microseconds() - started;
+
+    // Each short name entry is 32 bytes of directory data
+    bench_report("list", (unsigned long long)entries * 32, elapsed);
+    printf("%-12s %10lu    %10.4f s %10.0f entries/s\n", "", entries, elapsed / 1000000.0,
+        elapsed ? entries * 1000000.0 / elapsed : 0.0);
+    bench_print_stats("  list");
+
+    // The same listing, a buffer full of entries per call
+    entries = 0;
+    bench_cold();
+    started = host_microseconds();
+    for (pass = 0; pass < bench_passes; pass++) {
+        dir = fsys_opendir(dir_path);
+        if (dir < 0) {
+            printf("Unable to open %s: %s\n", dir_path, err_message(dir));
+            return dir;
+        }
+
+        while ((count = fsys_readdir_batch(dir, (p_dir_batch_entry)bench_buffer, bench_transfer, 0, FSYS_SORT_NONE)) > 0) {
+            entries += count;
+            calls++;
+        }
+
+        fsys_closedir(dir);
+    }
+    elapsed = host_microseconds() - started;
+
+    bench_report("list batch", (unsigned long long)entries * 32, elapsed);
+    printf("%-12s %10lu    %10.4f s %10.0f entries/s %lu calls\n", "", entries, elapsed / 1000000.0,
+        elapsed ? entries * 1000000.0 / elapsed : 0.0, calls);
+    bench_print_stats("  list batch");
+
+    // Look up every file by name, as opening or loading by path does
+    bench_cold();
+    started = host_microseconds();
+    for (pass = 0; pass < bench_passes; pass++) {
+        for (i = 0; i < bench_files; i++) {
+            sprintf(path, "%s/F%05lu.DAT", dir_path, i);
+            result = fsys_stat(path, &info);
+            if (result < 0) {
+                printf("Unable to find %s: %s\n", path, err_message(result));
+                return result;
+            }
+        }
+    }
+    elapsed = host_microseconds() - started;
+    printf("%-12s %10lu    %10.4f s %10.0f lookups/s\n", "lookup", bench_files * bench_passes, elapsed / 1000000.0,
+        elapsed ? bench_files * bench_passes * 1000000.0 / elapsed : 0.0);
+    bench_print_stats("  lookup");
+
+    for (i = 0; i < bench_files; i++) {
+        sprintf(path, "%s/F%05lu.DAT", dir_path, i);
+        fsys_delete(path);
+    }
+
+    return 0;
+}
+
+//
+// Check that a loaded test binary landed where it belongs
+//
+static short bench_check_load(long start, unsigned long total) {
+    unsigned long done, size;
+
+    for (done = 0; done < total; done += size) {
+        size = (total - done < bench_transfer) ? total - done : bench_transfer;
+        bench_fill(bench_buffer, size, done);
+        if ((start != BENCH_LOAD_ADDRESS) || memcmp((unsigned char *)BENCH_LOAD_ADDRESS + done, bench_buffer, size)) {
+            printf("Loaded image does not match the file at %lu\n", done);
+            return ERR_BAD_BINARY;
+        }
+    }
+
+    return 0;
+}
+
+//
+// Write a PGX binary and time loading it through fsys_load
+//
+static short bench_load() {
+    char path[MAX_PATH_LEN];
+    unsigned char header[8];
+    unsigned long long started;
+    unsigned long total = bench_file_kb * 1024;
+    unsigned long room = mem_get_ramtop() - BENCH_LOAD_ADDRESS;
+    unsigned long done, size;
+    long start = 0;
+    short chan, n, result;
+
+    if (total > room) {
+        total = room & ~(IMGDISK_SECTOR_SIZE - 1);
+    }
+
+    sprintf(path, "%s/bench.pgx", bench_root);
+    chan = fsys_open(path, FSYS_WRITE | FSYS_CREATE_ALWAYS);
+    if (chan < 0) {
+        printf("Unable to create %s: %s\n", path, err_message(chan));
+        return chan;
+    }
+
+    memcpy(header, "PGX\x02", 4);
+    header[4] = (BENCH_LOAD_ADDRESS >> 24) & 0xff;
+    header[5] = (BENCH_LOAD_ADDRESS >> 16) & 0xff;
+    header[6] = (BENCH_LOAD_ADDRESS >> 8) & 0xff;
+    header[7] = BENCH_LOAD_ADDRESS & 0xff;
+    chan_write(chan, header, sizeof(header));
+
+    for (done = 0; done < total; done += size) {
+        size = (total - done < bench_transfer) ? total - done : bench_transfer;
+        bench_fill(bench_buffer, size, done);
+        n = chan_write(chan, bench_buffer, (short)size);
+        if (n != (short)size) {
+            bench_write_failed(done, n, size);
+            fsys_close(chan);
+            return ERR_GENERAL;
+        }
+    }
+    fsys_close(chan);
+
+    memset((void *)BENCH_LOAD_ADDRESS, 0, total);
+
+    bench_cold();
+    started = host_microseconds();
+    result = fsys_load(path, 0, &start);
+    bench_report("load (PGX)", total + sizeof(header), host_microseconds() - started);
+    bench_print_stats("  load");
+
+    if (result != 0) {
+        printf("Load failed: %s\n", err_message(result));
+        return result;
+    }
+
+    result = bench_check_load(start, total);
+    if (result != 0) {
+        return result;
+    }
+
+    // Give the space back for the tests that follow
+    return fsys_delete(path);
+}
+
+//
+// Write a 32-bit PGZ binary, one segment per BENCH_PGZ_SEGMENT bytes, and time loading it
+//
+static short bench_load_pgz() {
+    char path[MAX_PATH_LEN];
+    unsigned char header[8];
+    unsigned long long started;
+    unsigned long total = bench_file_kb * 1024;
+    unsigned long room = mem_get_ramtop() - BENCH_LOAD_ADDRESS;
+    unsigned long done, size, segment, length, address, written = 1;
+    long start = 0;
+    short chan, i, n, result;
+
+    if (total > room) {
+        total = room & ~(IMGDISK_SECTOR_SIZE - 1);
+    }
+
+    sprintf(path, "%s/bench.pgz", bench_root);
+    chan = fsys_open(path, FSYS_WRITE | FSYS_CREATE_ALWAYS);
+    if (chan < 0) {
+        printf("Unable to create %s: %s\n", path, err_message(chan));
+        return chan;
+    }
+
+    chan_write(chan, (unsigned char *)"z", 1);
+
+    for (segment = 0; ; segment += length) {
+        length = (total - segment < BENCH_PGZ_SEGMENT) ? total - segment : BENCH_PGZ_SEGMENT;
+
+        // The last segment is the start segment, which has no data
+        address = BENCH_LOAD_ADDRESS + ((length > 0) ? segment : 0);
+        for (i = 0; i < 4; i++) {
+            header[i] = (address >> (8 * i)) & 0xff;
+            header[4 + i] = (length >> (8 * i)) & 0xff;
+        }
+        chan_write(chan, header, sizeof(header));
+        written += sizeof(header);
+
+        for (done = segment; done < segment + length; done += size) {
+            size = (segment + length - done < bench_transfer) ? segment + length - done : bench_transfer;
+            bench_fill(bench_buffer, size, done);
+            n = chan_write(chan, bench_buffer, (short)size);
+            if (n != (short)size) {
+                bench_write_failed(done, n, size);
+                fsys_close(chan);
+                return ERR_GENERAL;
+            }
+            written += size;
+        }
+
+        if (length == 0) {
+            break;
+        }
+    }
+    fsys_close(chan);
+
+    memset((void *)BENCH_LOAD_ADDRESS, 0, total);
+
+    bench_cold();
+    started = host_microseconds();
+    result = fsys_load(path, 0, &start);
+    bench_report("load (PGZ)", written, host_microseconds() - started);
+    bench_print_stats("  load");
+
+    if (result != 0) {
+        printf("Load failed: %s\n", err_message(result));
+        return result;
+    }
+
+    result = bench_check_load(start, total);
+    if (result != 0) {
+        return result;
+    }
+
+    // Give the space back for the tests that follow
+    return fsys_delete(path);
+}
+
+//
+// Copy a binary from the host onto the volume and time loading it through fsys_load
+//
+static short bench_load_file() {
+    char path[MAX_PATH_LEN];
+    const char * name = strrchr(bench_binary, '/');
+    unsigned long long started;
+    unsigned long total = 0;
+    long start = 0;
+    FILE * host_file;
+    size_t size;
+    short chan, n, result;
+
+    sprintf(path, "%s/%s", bench_root, (name != 0) ? name + 1 : bench_binary);
+
+    host_file = fopen(bench_binary, "rb");
+    if (host_file == 0) {
+        printf("Unable to open %s\n", bench_binary);
+        return ERR_NOT_FOUND;
+    }
+
+    chan = fsys_open(path, FSYS_WRITE | FSYS_CREATE_ALWAYS);
+    if (chan < 0) {
+        printf("Unable to create %s: %s\n", path, err_message(chan));
+        fclose(host_file);
+        return chan;
+    }
+
+    while ((size = fread(bench_buffer, 1, bench_transfer, host_file)) > 0) {
+        n = chan_write(chan, bench_buffer, (short)size);
+        if (n != (short)size) {
+            bench_write_failed(total, n, size);
+            fsys_close(chan);
+            fclose(host_file);
+            return ERR_GENERAL;
+        }
+        total += size;
+    }
+    fsys_close(chan);
+    fclose(host_file);
+
+    if (bench_exec_cache_kb > 0) {
+        result = fsys_exec_cache_resize(bench_exec_cache_kb * 1024);
+        if (result != 0) {
+            printf("Unable to size the executable cache: %s\n", err_message(result));
+            return result;
+        }
+    }
+
+    bench_cold();
+    started = host_microseconds();
+    result = fsys_load(path, 0, &start);
+    bench_report("load (file)", total, host_microseconds() - started);
+    bench_print_stats("  load");
+
+    if (result != 0) {
+        printf("Load failed: %s\n", err_message(result));
+        return result;
+    }
+
+    printf("Loaded %s, start address %08lx\n", path, (unsigned long)start);
+
+    if (bench_exec_cache_kb > 0) {
+        t_exec_cache_stats stats;
+
+        // Load it again: this time it should come from the executable cache
+        memset((void *)BENCH_LOAD_ADDRESS, 0, total);
+        bench_cold();
+        started = host_microseconds();
+        result = fsys_load(path, 0, &start);
+        bench_report("load (cache)", total, host_microseconds() - started);
+        bench_print_stats("  load");
+
+        fsys_exec_cache_get_stats(&stats);
+        printf("Executable cache: %lu cached, %lu KB used, %lu hits, %lu misses, %lu stale, %lu evicted\n",
+            stats.entries, stats.used / 1024, stats.hits, stats.misses, stats.stale, stats.evictions);
+
+        if (result != 0) {
+            printf("Load failed: %s\n", err_message(result));
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static void bench_usage() {
+    printf("USAGE: bench_fsys [-i <image>] [-m <MB>] [-a <cluster bytes>] [-t <file system>] [-f] [-r] [-x] [-c]\n");
+    printf("                  [-s <KB>] [-b <bytes>] [-n <files>] [-p <passes>] [-k <seeks>] [-l <binary>]\n");
+    printf("                  [-e <KB>] [-u <bytes>]\n");
+}
+
+int main(int argc, char * argv[]) {
+    short result = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:m:a:t:frxcs:b:n:p:k:l:e:u:h")) != -1) {
+        switch (opt) {
+            case 'i': bench_image = optarg; break;
+            case 'm': bench_volume_mb = strtoul(optarg, 0, 0); break;
+            case 'a': bench_cluster = strtoul(optarg, 0, 0); break;
+            case 't':
+                if (strcasecmp(optarg, "fat") == 0) {
+                    bench_fs_type = FSYS_FORMAT_FAT;
+                } else if (strcasecmp(optarg, "fat32") == 0) {
+                    bench_fs_type = FSYS_FORMAT_FAT32;
+                } else if (strcasecmp(optarg, "exfat") == 0) {
+                    bench_fs_type = FSYS_FORMAT_EXFAT;
+                } else {
+                    bench_usage();
+                    return 1;
+                }
+                bench_format = 1;
+                break;
+            case 'f': bench_format = 1; break;
+            case 'r': bench_ramdisk = 1; break;
+            case 'x': bench_nocache = 1; break;
+            case 'c': bench_contiguous = 1; break;
+            case 's': bench_file_kb = strtoul(optarg, 0, 0); bench_file_set = 1; break;
+            case 'b': bench_transfer = strtoul(optarg, 0, 0); break;
+            case 'n': bench_files = strtoul(optarg, 0, 0); break;
+            case 'p': bench_passes = strtoul(optarg, 0, 0); break;
+            case 'k': bench_seeks = strtoul(optarg, 0, 0); break;
+            case 'l': bench_binary = optarg; break;
+            case 'e': bench_exec_cache_kb = strtoul(optarg, 0, 0); break;
+            case 'u': bench_byte_buffer = strtol(optarg, 0, 0); break;
+            default:
+                bench_usage();
+                return 1;
+        }
+    }
+
+    if ((bench_transfer == 0) || (bench_transfer > BENCH_MAX_TRANSFER)) {
+        printf("The transfer size must be between 1 and %d bytes\n", BENCH_MAX_TRANSFER);
+        return 1;
+    }
+
+    bench_buffer = malloc(bench_transfer);
+    if (bench_buffer == 0) {
+        printf("Unable to allocate the transfer buffer\n");
+        return 1;
+    }
+
+    if (bench_setup() == 0) {
+        result = bench_sequential();
+        if (result == 0) {
+            result = bench_seek();
+        }
+        if (result == 0) {
+            result = bench_copy();
+        }
+        if (result == 0) {
+            result = bench_async();
+        }
+        if (result == 0) {
+            result = bench_bytes();
+        }
+        if (result == 0) {
+            result = bench_directory();
+        }
+        if (result == 0) {
+            result = bench_free();
+        }
+        if ((result == 0) && bench_fixed_ram) {
+            result = bench_load();
+        }
+        if ((result == 0) && bench_fixed_ram) {
+            result = bench_load_pgz();
+        }
+        if ((result == 0) && bench_fixed_ram && bench_binary) {
+            result = bench_load_file();
+        }
+    } else {
+        result = ERR_GENERAL;
+    }
+
+    bdev_flush(bench_dev);
+    imgdisk_close();
+    free(bench_buffer);
+
+    return (result == 0) ? 0 : 1;
+}
@@ -0,0 +1,43 @@
+/**
+ * Definitions for running the portable kernel core as a Linux process
+ *
+ * The host build compiles the file system, block layer, channel layer and
+ * variables unchanged, and this module stands in for the parts of the kernel
+ * that touch hardware: logging, interrupt masking, the jiffy timer, system RAM,
+ * and the handful of system calls the portable code makes on itself.
+ */
+
+#ifndef __HOST_H
+#define __HOST_H
+
+//
+// System RAM for the hosted kernel
+//
+// The binary loaders write to the absolute addresses given in their files, so
+// the host maps its RAM at the same addresses the A2560U uses. The kernel's
+// reservations (block cache, RAM disk) come off the top, as on the target.
+//
+
+#define HOST_RAM_BASE       0x00010000      // First byte of the hosted system RAM
+#define HOST_RAM_TOP        0x003d0000      // Initial top of system RAM (as in foenixmcp.c)
+
+//
+// Set up the hosted kernel: logging, system RAM and the jiffy timer
+//
+// Returns:
+//  1 if system RAM sits at its target addresses, 0 if it had to be placed elsewhere
+//  (the binary loaders cannot be used in that case)
+//
+extern short host_init();
+
+//
+// Return the address of the first byte of the hosted system RAM
+//
+extern unsigned long host_ram_base();
+
+//
+// Return the number of microseconds since host_init
+//
+extern unsigned long long host_microseconds();
+
+#endif
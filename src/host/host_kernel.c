@@ -0,0 +1,210 @@
+/**
+ * Stand-ins for the hardware-bound parts of the kernel when running on Linux
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "log.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "timers.h"
+#include "syscalls.h"
+#include "dev/block.h"
+#include "dev/channel.h"
+#include "fatfs/ff.h"
+#include "host/host.h"
+
+//
+// Variables
+//
+
+short log_level;
+char logbuf[LOGBUF_SIZE];
+void (*do_log)(const char* message);
+
+const char* VolumeStr[FF_VOLUMES] = { "sd", "fd", "hd", "ram" };   // Volume names for FatFs (as in foenixmcp.c)
+
+static unsigned long mem_top_of_ram = 0;    // Current top of the hosted system RAM
+static unsigned long mem_end_of_ram = 0;    // End of the hosted system RAM
+static unsigned long host_ram = 0;          // First byte of the hosted system RAM
+static struct timespec host_epoch;          // When the hosted kernel was started
+
+//
+// Logging goes to stderr
+//
+
+static void log_to_stderr(const char * message) {
+    fprintf(stderr, "%s\n", message);
+}
+
+void log_init(void) {
+    log_setlevel(DEFAULT_LOG_LEVEL);
+    do_log = log_to_stderr;
+}
+
+void log_setlevel(short level) {
+    log_level = level;
+}
+
+void logmsg(short level, const char * message, ...) {
+    va_list args;
+
+    if (level > log_level)
+        return;
+
+    va_start(args, message);
+    vsnprintf(logbuf, LOGBUF_SIZE, message, args);
+    va_end(args);
+
+    do_log(logbuf);
+}
+
+void log2(short level, const char * message1, const char * message2) {
+    if (level <= log_level) {
+        logmsg(level, "%s%s", message1, message2);
+    }
+}
+
+void log3(short level, const char * message1, const char * message2, const char * message3) {
+    if (level <= log_level) {
+        logmsg(level, "%s%s%s", message1, message2, message3);
+    }
+}
+
+void log_num(short level, char * message, int n) {
+    if (level <= log_level) {
+        logmsg(level, "%s%08X", message, n);
+    }
+}
+
+void log_c(short level, char c) {
+    logmsg(level, "%c", c);
+}
+
+//
+// The message table lives with the hardware logging code in log.c... report the number instead
+//
+
+const char * err_message(short err_number) {
+    static char message[24];
+
+    sprintf(message, "error #%d", err_number);
+    return message;
+}
+
+//
+// A Linux process has no interrupts to mask... the queue code only needs a mask to hand back
+//
+
+short int_disable_all() {
+    return 0;
+}
+
+void int_restore(short int_mask) {
+}
+
+//
+// The jiffy timer runs at 60Hz off the monotonic clock
+//
+
+unsigned long long host_microseconds() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)(now.tv_sec - host_epoch.tv_sec) * 1000000ULL + (now.tv_nsec - host_epoch.tv_nsec) / 1000;
+}
+
+long timers_jiffies() {
+    return (long)(host_microseconds() * 60 / 1000000);
+}
+
+//
+// System RAM: reservations come off the top, as in memory.c
+//
+
+void mem_init(unsigned long top_of_ram) {
+    mem_top_of_ram = top_of_ram;
+    mem_end_of_ram = top_of_ram;
+}
+
+unsigned long mem_get_ramtop() {
+    return mem_top_of_ram;
+}
+
+unsigned long mem_get_ramend() {
+    return mem_end_of_ram;
+}
+
+unsigned long mem_get_free() {
+    // The floor sits as far above the start of the hosted RAM as it does above HOST_RAM_BASE
+    unsigned long floor = host_ram + (MEM_RESERVE_FLOOR - HOST_RAM_BASE);
+    return (mem_top_of_ram > floor) ? mem_top_of_ram - floor : 0;
+}
+
+unsigned long mem_reserve(unsigned long bytes) {
+    mem_top_of_ram -= bytes;
+    return mem_top_of_ram;
+}
+
+unsigned long host_ram_base() {
+    return host_ram;
+}
+
+//
+// The few system calls the portable core makes go straight to the kernel functions
+//
+
+short sys_chan_read(short channel, unsigned char * buffer, short size) {
+    return chan_read(channel, buffer, size);
+}
+
+short sys_bdev_status(short dev) {
+    return bdev_status(dev);
+}
+
+short sys_bdev_ioctrl(short dev, short command, unsigned char * buffer, short size) {
+    return bdev_ioctrl(dev, command, buffer, size);
+}
+
+//
+// Set up the hosted kernel
+//
+// Returns:
+//  1 if system RAM sits at its target addresses, 0 if it had to be placed elsewhere
+//
+short host_init() {
+    size_t size = HOST_RAM_TOP - HOST_RAM_BASE;
+    void * ram;
+
+    clock_gettime(CLOCK_MONOTONIC, &host_epoch);
+    log_init();
+
+    ram = mmap((void *)HOST_RAM_BASE, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (ram == (void *)HOST_RAM_BASE) {
+        host_ram = HOST_RAM_BASE;
+        mem_init(HOST_RAM_TOP);
+        return 1;
+    }
+
+    // The addresses are taken... the file system still works from RAM placed anywhere
+    if (ram != MAP_FAILED) {
+        munmap(ram, size);
+    }
+
+    ram = malloc(size);
+    if (ram == 0) {
+        fprintf(stderr, "host_init: unable to allocate system RAM\n");
+        exit(1);
+    }
+
+    host_ram = (unsigned long)ram;
+    mem_init(host_ram + size);
+    return 0;
+}
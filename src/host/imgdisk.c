@@ -0,0 +1,227 @@
+/**
+ * Implementation of the disk image block device driver for the host build
+ *
+ * Sectors are read and written with pread/pwrite, so every transfer reaches the
+ * block layer the same way it would on the target: one call per sector or per
+ * run of sectors.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "errors.h"
+#include "dev/block.h"
+#include "host/imgdisk.h"
+
+//
+// Variables
+//
+
+static int imgdisk_fd = -1;                 // Host file descriptor for the image
+static unsigned long imgdisk_sectors = 0;   // Number of sectors in the image
+
+//
+// Check that a run of sectors lies in the image
+//
+// Returns:
+//  0 if the sectors are all in the image, any negative number is an error code
+//
+static short imgdisk_check(long lba, short count) {
+    if (imgdisk_fd < 0) {
+        return DEV_NOMEDIA;
+    }
+
+    if ((lba < 0) || (count < 0) || ((unsigned long)lba + (unsigned long)count > imgdisk_sectors)) {
+        return DEV_BOUNDS_ERR;
+    }
+
+    return 0;
+}
+
+//
+// Initialize the image disk
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+static short imgdisk_init() {
+    return (imgdisk_fd < 0) ? DEV_NOMEDIA : 0;
+}
+
+//
+// Read consecutive blocks from the image
+//
+// Returns:
+//  number of blocks read, any negative number is an error code
+//
+static short imgdisk_read_multi(long lba, unsigned char * buffer, short count) {
+    size_t size = (size_t)count * IMGDISK_SECTOR_SIZE;
+    short result = imgdisk_check(lba, count);
+
+    if (result < 0) {
+        return result;
+    }
+
+    if (pread(imgdisk_fd, buffer, size, (off_t)lba * IMGDISK_SECTOR_SIZE) != (ssize_t)size) {
+        return DEV_CANNOT_READ;
+    }
+
+    return count;
+}
+
+//
+// Write consecutive blocks to the image
+//
+// Returns:
+//  number of blocks written, any negative number is an error code
+//
+static short imgdisk_write_multi(long lba, const unsigned char * buffer, short count) {
+    size_t size = (size_t)count * IMGDISK_SECTOR_SIZE;
+    short result = imgdisk_check(lba, count);
+
+    if (result < 0) {
+        return result;
+    }
+
+    if (pwrite(imgdisk_fd, buffer, size, (off_t)lba * IMGDISK_SECTOR_SIZE) != (ssize_t)size) {
+        return DEV_CANNOT_WRITE;
+    }
+
+    return count;
+}
+
+//
+// Read a block from the image
+//
+// Returns:
+//  number of bytes read, any negative number is an error code
+//
+static short imgdisk_read(long lba, unsigned char * buffer, short size) {
+    short result;
+
+    if (size < IMGDISK_SECTOR_SIZE) {
+        return DEV_BOUNDS_ERR;
+    }
+
+    result = imgdisk_read_multi(lba, buffer, 1);
+    return (result < 0) ? result : IMGDISK_SECTOR_SIZE;
+}
+
+//
+// Write a block to the image
+//
+// Returns:
+//  number of bytes written, any negative number is an error code
+//
+static short imgdisk_write(long lba, const unsigned char * buffer, short size) {
+    short result;
+
+    if (size < IMGDISK_SECTOR_SIZE) {
+        return DEV_BOUNDS_ERR;
+    }
+
+    result = imgdisk_write_multi(lba, buffer, 1);
+    return (result < 0) ? result : IMGDISK_SECTOR_SIZE;
+}
+
+//
+// Return the status of the image disk
+//
+static short imgdisk_status() {
+    return (imgdisk_fd < 0) ? IMGDISK_STAT_NOINIT : 0;
+}
+
+//
+// Ensure that any pending writes have been completed
+//
+// Writes are left in the host's page cache: the benchmarks measure the kernel, not the host's disk.
+//
+static short imgdisk_flush() {
+    return 0;
+}
+
+//
+// Issue a control command to the image disk
+//
+// FatFs hands over a DWORD, which is 32 bits on the host as well as the target.
+//
+static short imgdisk_ioctrl(short command, unsigned char * buffer, short size) {
+    switch (command) {
+        case IMGDISK_GET_SECTOR_COUNT:
+            *(uint32_t *)buffer = (uint32_t)imgdisk_sectors;
+            break;
+
+        case IMGDISK_GET_SECTOR_SIZE:
+            *(uint16_t *)buffer = IMGDISK_SECTOR_SIZE;
+            break;
+
+        case IMGDISK_GET_BLOCK_SIZE:
+            *(uint32_t *)buffer = 1;
+            break;
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+//
+// Install the image disk driver
+//
+short imgdisk_install(short number, const char * path, unsigned long sectors) {
+    t_dev_block dev;                    // bdev_register copies the data, so we'll allocate this on the stack
+    struct stat info;
+
+    imgdisk_close();
+
+    imgdisk_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (imgdisk_fd < 0) {
+        return DEV_CANNOT_INIT;
+    }
+
+    if (fstat(imgdisk_fd, &info) < 0) {
+        imgdisk_close();
+        return DEV_CANNOT_INIT;
+    }
+
+    if ((unsigned long)info.st_size < sectors * IMGDISK_SECTOR_SIZE) {
+        if (ftruncate(imgdisk_fd, (off_t)sectors * IMGDISK_SECTOR_SIZE) < 0) {
+            imgdisk_close();
+            return DEV_CANNOT_INIT;
+        }
+        imgdisk_sectors = sectors;
+    } else {
+        imgdisk_sectors = (unsigned long)info.st_size / IMGDISK_SECTOR_SIZE;
+    }
+
+    dev.number = number;
+    dev.name = "IMG";
+    dev.init = imgdisk_init;
+    dev.read = imgdisk_read;
+    dev.write = imgdisk_write;
+    dev.flush = imgdisk_flush;
+    dev.status = imgdisk_status;
+    dev.ioctrl = imgdisk_ioctrl;
+    dev.read_multi = imgdisk_read_multi;
+    dev.write_multi = imgdisk_write_multi;
+    dev.start = 0;
+    dev.poll = 0;
+
+    return bdev_register(&dev);
+}
+
+//
+// Close the image file
+//
+void imgdisk_close() {
+    if (imgdisk_fd >= 0) {
+        close(imgdisk_fd);
+        imgdisk_fd = -1;
+    }
+    imgdisk_sectors = 0;
+}
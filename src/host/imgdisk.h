@@ -0,0 +1,43 @@
+/**
+ * Definitions support the disk image block device driver for the host build
+ */
+
+#ifndef __IMGDISK_H
+#define __IMGDISK_H
+
+#include "types.h"
+
+#define IMGDISK_SECTOR_SIZE     512         // Size of a block in the image
+
+#define IMGDISK_STAT_NOINIT     0x01        // No image has been opened
+
+//
+// Control commands for the image disk (the FatFs ioctl numbers)
+//
+
+#define IMGDISK_GET_SECTOR_COUNT    1
+#define IMGDISK_GET_SECTOR_SIZE     2
+#define IMGDISK_GET_BLOCK_SIZE      3
+
+//
+// Install the image disk driver
+//
+// The image file is created if it does not exist, and extended if it is smaller than
+// the requested size. A larger image keeps its size.
+//
+// Inputs:
+//  number = the block device number the image should appear as (e.g. BDEV_SDC)
+//  path = the path to the image file on the host
+//  sectors = the minimum number of 512 byte sectors in the image
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+extern short imgdisk_install(short number, const char * path, unsigned long sectors);
+
+//
+// Close the image file
+//
+extern void imgdisk_close();
+
+#endif
@@ -49,5 +49,7 @@
 #define ERR_NOT_SUPPORTED               -37 /* Device does not support the file or operation */
 #define ERR_BAD_ARGUMENT                -38 /* An invalid argument was provided */
 #define ERR_MEDIA_CHANGE                -39 /* Removable media has changed */
+#define DEV_BUSY                        -40 /* The device is busy with another request */
+#define FSYS_ERR_COPY_SELF              -41 /* A file cannot be copied onto itself */
 
 #endif
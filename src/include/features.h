@@ -1,5 +1,5 @@
-#ifndef _FEATURES_H
-#define _FEATURES_H
+#ifndef __FEATURES_H
+#define __FEATURES_H
 
 #include "sys_general.h"
 
@@ -44,6 +44,9 @@
 #define PATA_CMD_INIT           0x00
 #define PATA_CMD_READ_SECTOR    0x20
 #define PATA_CMD_WRITE_SECTOR   0x30
+#define PATA_CMD_READ_MULTIPLE  0xC4
+#define PATA_CMD_WRITE_MULTIPLE 0xC5
+#define PATA_CMD_SET_MULTIPLE   0xC6
 #define PATA_CMD_IDENTITY       0xEC
 
 /*
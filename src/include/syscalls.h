@@ -62,6 +62,7 @@
 #define KFN_CHAN_CLOSE          0x1B    /* Close an open channel (not for files) */
 #define KFN_CHAN_SWAP           0x1C    /* Swap the channel ID assignment of two channels */
 #define KFN_CHAN_DEVICE         0x1D    /* Get the number of the device associated with the channel */
+#define KFN_POLL                0x1E    /* Check on an asynchronous file transfer */
 
 
 /* Block device system calls */
@@ -72,6 +73,15 @@
 #define KFN_BDEV_STATUS         0x23    /* Get the status of a block device */
 #define KFN_BDEV_IOCTRL         0x24    /* Send a command to a block device (device dependent functionality) */
 #define KFN_BDEV_REGISTER       0x25    /* Register a block device driver */
+#define KFN_BDEV_READ_MULTI     0x26    /* Read several consecutive blocks from a block device */
+#define KFN_BDEV_WRITE_MULTI    0x27    /* Write several consecutive blocks to a block device */
+#define KFN_BDEV_STATS          0x28    /* Get the I/O statistics for a block device */
+#define KFN_READ_ASYNC          0x29    /* Start reading a file in the background */
+#define KFN_WRITE_ASYNC         0x2A    /* Start writing a file in the background */
+#define KFN_GET_FREE            0x2B    /* Get the free space on a volume */
+#define KFN_COPY                0x2C    /* Copy a file */
+#define KFN_READDIR_BATCH       0x2D    /* Read many entries from an open directory at once */
+#define KFN_PREALLOCATE         0x2E    /* Reserve space for a file being written */
 #define KFN_STAT                0x2F    /* Check for file existance and return file information */
 
 /* File/Directory system calls */
@@ -463,6 +473,46 @@ extern SYSTEMCALL short sys_bdev_flush(short dev);
 //
 extern SYSTEMCALL short sys_bdev_ioctrl(short dev, short command, unsigned char * buffer, short size);
 
+//
+// Read several consecutive sectors from the device
+//
+// Inputs:
+//  dev = the number of the device
+//  lba = the logical block address of the first sector to read
+//  buffer = the buffer into which to copy the sector data (must hold count sectors)
+//  count = the number of sectors to read
+//
+// Returns:
+//  number of sectors read, any negative number is an error code
+//
+extern SYSTEMCALL short sys_bdev_read_multi(short dev, long lba, unsigned char * buffer, short count);
+
+//
+// Write several consecutive sectors to the device
+//
+// Inputs:
+//  dev = the number of the device
+//  lba = the logical block address of the first sector to write
+//  buffer = the buffer containing the sector data to write (must hold count sectors)
+//  count = the number of sectors to write
+//
+// Returns:
+//  number of sectors written, any negative number is an error code
+//
+extern SYSTEMCALL short sys_bdev_write_multi(short dev, long lba, const unsigned char * buffer, short count);
+
+//
+// Get the I/O statistics for a device
+//
+// Inputs:
+//  dev = the number of the device
+//  stats = pointer to the t_bdev_stats to fill in
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+extern SYSTEMCALL short sys_bdev_stats(short dev, p_bdev_stats stats);
+
 
 /*
  * File System Calls
@@ -691,6 +741,107 @@ extern SYSTEMCALL short sys_fsys_register_loader(const char * extension, p_file_
  */
 extern SYSTEMCALL short sys_fsys_stat(const char * path, p_file_info file);
 
+/**
+ * Read as many entries from an open directory as fit in a buffer, in one call.
+ *
+ * The entries are stored as an array of t_dir_batch_entry at the front of the
+ * buffer, with their names packed in from the back. The buffer must have room for
+ * at least one entry with a name of the longest length. Sorting applies within
+ * the batch.
+ *
+ * @param dir the handle of the open directory (from sys_fsys_opendir or sys_fsys_findfirst)
+ * @param buffer the buffer to fill
+ * @param size the number of bytes in the buffer
+ * @param pattern file name pattern the entries must match for this call (0 for all entries, or the pattern given to sys_fsys_findfirst)
+ * @param sort the FSYS_SORT_ order to put the entries of the batch in
+ * @return the number of entries stored (0 at the end of the directory), negative number on error
+ */
+extern SYSTEMCALL short sys_fsys_readdir_batch(short dir, p_dir_batch_entry buffer, unsigned long size, const char * pattern, short sort);
+
+/**
+ * Reserve space for a file opened for writing, so that writing it does not have
+ * to grow its FAT chain one cluster at a time.
+ *
+ * The file's size becomes the requested size, and the file position is left where
+ * it was. A file that ends up shorter than its reservation should be truncated.
+ *
+ * @param fd the channel ID for the file
+ * @param size the number of bytes to reserve
+ * @param contiguous if non-zero, the space must be one run of clusters (the file must be empty)
+ * @return 0 on success, negative number on error
+ */
+extern SYSTEMCALL short sys_fsys_preallocate(short fd, long size, short contiguous);
+
+/**
+ * Copy a file.
+ *
+ * The data moves through a buffer of whole clusters with multi-sector transfers,
+ * and the destination's clusters are reserved before anything is written. A copy
+ * that fails leaves no destination file behind. Copying a file onto itself fails
+ * with FSYS_ERR_COPY_SELF.
+ *
+ * @param src_path the path of the file to copy
+ * @param dst_path the path of the copy (replaced if it exists, unless FSYS_COPY_NO_OVERWRITE is given)
+ * @param flags FSYS_COPY_ flags
+ * @param progress function to call with the bytes copied so far and the file's size after each block (0 for none); returning a negative number stops the copy
+ * @return 0 on success, negative number on error
+ */
+extern SYSTEMCALL short sys_fsys_copy(const char * src_path, const char * dst_path, short flags, p_copy_progress progress);
+
+/**
+ * Get the free space on the volume holding a path.
+ *
+ * Once the volume's free cluster map is built, this does not read the disk.
+ *
+ * @param path the path to the volume (or to anything on it)
+ * @param free pointer to the number of KB free on the volume
+ * @param total pointer to the number of KB the volume can hold (0 if not wanted)
+ * @return 0 on success, negative number on error
+ */
+extern SYSTEMCALL short sys_fsys_get_free(const char * path, unsigned long * free, unsigned long * total);
+
+/**
+ * Start reading an open file in the background.
+ *
+ * The call returns at once. Where the drive can work on its own (the IDE drive in
+ * interrupt mode), whole runs of sectors are read in the background; otherwise the
+ * read moves a slice at a time, each time it is polled and whenever the kernel is
+ * idle. Either way, a program can keep its main loop running and poll once a pass. Until the read is finished, the buffer belongs to
+ * the kernel, and any other use of the file fails with DEV_BUSY.
+ *
+ * @param fd the channel ID for the file
+ * @param buffer the memory to fill
+ * @param size the number of bytes to read
+ * @param token pointer to the token to poll the read with
+ * @return 0 on success, negative number on error (DEV_BUSY if the file already has a transfer running)
+ */
+extern SYSTEMCALL short sys_fsys_read_async(short fd, unsigned char * buffer, unsigned long size, short * token);
+
+/**
+ * Start writing an open file in the background.
+ *
+ * Works like sys_fsys_read_async.
+ *
+ * @param fd the channel ID for the file
+ * @param buffer the bytes to write
+ * @param size the number of bytes to write
+ * @param token pointer to the token to poll the write with
+ * @return 0 on success, negative number on error (DEV_BUSY if the file already has a transfer running)
+ */
+extern SYSTEMCALL short sys_fsys_write_async(short fd, const unsigned char * buffer, unsigned long size, short * token);
+
+/**
+ * Check on a background read or write, moving it along if it is still running.
+ *
+ * Once the transfer is reported finished (or failed), its token is no longer valid.
+ * Closing the file drops any transfer on it.
+ *
+ * @param token the token of the transfer
+ * @param count pointer to the number of bytes moved so far (0 if not wanted)
+ * @return FSYS_ASYNC_PENDING if the transfer is still running, 0 if it is finished, negative number on error
+ */
+extern SYSTEMCALL short sys_fsys_poll(short token, unsigned long * count);
+
 /**
  * Memory
  */
@@ -131,7 +131,9 @@ const char * err_messages[] = {
     "file system invalid parameter",
     "not supported",
     "bad argument",
-    "media changed"
+    "media changed",
+    "device is busy",
+    "cannot copy a file onto itself"
 };
 
 /*
@@ -140,7 +142,7 @@ const char * err_messages[] = {
 const char * err_message(short err_number) {
     short index = 0 - err_number;
 
-    if (index < 40) {
+    if (index < sizeof(err_messages) / sizeof(err_messages[0])) {
         return err_messages[index];
     } else {
         return "unknown error";
@@ -158,7 +160,7 @@ const char * err_message(short err_number) {
 void err_print(short channel, const char * message, short err_number) {
     char buffer[80];
 
-    if ((err_number < 0) && (err_number > -40)) {
+    if ((err_number < 0) && (0 - err_number < sizeof(err_messages) / sizeof(err_messages[0]))) {
         sprintf(buffer, "%s: %s\n", message, err_message(err_number));
     } else {
         sprintf(buffer, "%s: #%d\n", message, err_number);
@@ -0,0 +1,121 @@
+/**
+ * @file lz4.c
+ *
+ * Decompressor for LZ4 compressed blocks
+ *
+ * An LZ4 block is a series of sequences. Each sequence is a token byte (literal
+ * count in the upper nibble, match length - 4 in the lower), any extra literal
+ * count bytes, the literals, a two byte little-endian match offset, and any extra
+ * match length bytes. The last sequence has literals only.
+ *
+ * The loops are written for the compilers we have: all counts are unsigned longs,
+ * there is no 64-bit math, and literals and non-overlapping matches are moved with
+ * memcpy, which the C libraries implement with long moves (68K) or block moves
+ * (65816) rather than a byte loop. Only overlapping matches (runs) are copied a
+ * byte at a time.
+ */
+
+#include <string.h>
+#include "lz4.h"
+
+/**
+ * Read an extended length: bytes are added to the length until one is not 255
+ *
+ * @param ip pointer to the pointer to the next byte of the block
+ * @param iend pointer to the byte after the end of the block
+ * @param length pointer to the length to extend
+ * @return 0 on success, -1 if the block ends in the middle of the length
+ */
+static short lz4_length(const unsigned char ** ip, const unsigned char * iend, unsigned long * length) {
+    const unsigned char * p = *ip;
+    unsigned char b;
+
+    do {
+        if (p >= iend) {
+            return -1;
+        }
+        b = *p++;
+        *length += b;
+    } while (b == 255);
+
+    *ip = p;
+    return 0;
+}
+
+/**
+ * Decompress an LZ4 block
+ *
+ * @param source the compressed block
+ * @param source_size the number of bytes in the compressed block
+ * @param dest the first byte to write
+ * @param dest_size the number of bytes the block must decompress to
+ * @param window the first byte a match is allowed to copy from (at or before dest)
+ * @return the number of bytes written, -1 if the block is corrupt
+ */
+long lz4_decompress(const unsigned char * source, unsigned long source_size, unsigned char * dest, unsigned long dest_size, const unsigned char * window) {
+    const unsigned char * ip = source;
+    const unsigned char * iend = source + source_size;
+    unsigned char * op = dest;
+    unsigned char * oend = dest + dest_size;
+    const unsigned char * match;
+    unsigned long length;
+    unsigned long offset;
+    unsigned char token;
+
+    while (ip < iend) {
+        token = *ip++;
+
+        /* Literals */
+        length = token >> 4;
+        if ((length == 15) && lz4_length(&ip, iend, &length)) {
+            return -1;
+        }
+
+        if ((length > (unsigned long)(iend - ip)) || (length > (unsigned long)(oend - op))) {
+            return -1;
+        }
+
+        memcpy(op, ip, length);
+        op += length;
+        ip += length;
+
+        if (ip == iend) {
+            /* The last sequence has no match */
+            break;
+        }
+
+        /* Match */
+        if (iend - ip < 2) {
+            return -1;
+        }
+
+        offset = (unsigned long)ip[0] | ((unsigned long)ip[1] << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > (unsigned long)(op - window))) {
+            return -1;
+        }
+
+        length = token & 0x0f;
+        if ((length == 15) && lz4_length(&ip, iend, &length)) {
+            return -1;
+        }
+        length += LZ4_MIN_MATCH;
+
+        if (length > (unsigned long)(oend - op)) {
+            return -1;
+        }
+
+        match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            /* The match overlaps what it writes (a run), so it must go a byte at a time */
+            while (length-- > 0) {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return (long)(op - dest);
+}
@@ -0,0 +1,37 @@
+/**
+ * @file lz4.h
+ *
+ * Decompressor for LZ4 compressed blocks
+ *
+ * Only the block format is supported (no frames, checksums, or dictionaries beyond
+ * the memory just in front of the output). Blocks are decoded straight into their
+ * final location, so the decoder never needs a buffer of its own.
+ */
+
+#ifndef __LZ4_H
+#define __LZ4_H
+
+/** The shortest match an LZ4 sequence can encode */
+#define LZ4_MIN_MATCH       4
+
+/** The furthest back an LZ4 match can reach */
+#define LZ4_MAX_OFFSET      65535
+
+/**
+ * Decompress an LZ4 block
+ *
+ * Matches may reach back past the start of the output into the memory in front of
+ * it, as far back as the window. This lets a long run of data be compressed as a
+ * series of blocks that share their history. Every read and write is checked, so a
+ * corrupt block cannot write outside of the output.
+ *
+ * @param source the compressed block
+ * @param source_size the number of bytes in the compressed block
+ * @param dest the first byte to write
+ * @param dest_size the number of bytes the block must decompress to
+ * @param window the first byte a match is allowed to copy from (at or before dest)
+ * @return the number of bytes written, -1 if the block is corrupt
+ */
+extern long lz4_decompress(const unsigned char * source, unsigned long source_size, unsigned char * dest, unsigned long dest_size, const unsigned char * window);
+
+#endif
@@ -268,7 +268,7 @@ _int_disable_all:   move.w SR,d0        ; Save the old level for return
 ; Restore interrupt priority
 ;
 _int_restore:       move.w (4,sp),d0    ; Get the priority into d0
-                    andi.w #3,d0
+                    andi.w #7,d0
                     lsl.w #8,d0
 
                     move.w sr,d1        ; Get the current SR into d1
@@ -123,6 +123,9 @@ unsigned long syscall_dispatch(int32_t function, int32_t param0, int32_t param1,
                 case KFN_CHAN_DEVICE:
                     return chan_device((short)param0);
 
+                case KFN_POLL:
+                    return fsys_poll((short)param0, (unsigned long *)param1);
+
                 default:
                     return ERR_GENERAL;
             }
@@ -149,9 +152,36 @@ unsigned long syscall_dispatch(int32_t function, int32_t param0, int32_t param1,
                 case KFN_BDEV_REGISTER:
                     return bdev_register((p_dev_block)param0);
 
+                case KFN_BDEV_READ_MULTI:
+                    return bdev_read_multi((short)param0, (long)param1, (unsigned char *)param2, (short)param3);
+
+                case KFN_BDEV_WRITE_MULTI:
+                    return bdev_write_multi((short)param0, (long)param1, (const unsigned char *)param2, (short)param3);
+
+                case KFN_BDEV_STATS:
+                    return bdev_stats((short)param0, (p_bdev_stats)param1);
+
                 case KFN_STAT:
                     return fsys_stat((const char *)param0, (p_file_info)param1);
 
+                case KFN_READDIR_BATCH:
+                    return fsys_readdir_batch((short)param0, (p_dir_batch_entry)param1, (unsigned long)param2, (const char *)param3, (short)param4);
+
+                case KFN_PREALLOCATE:
+                    return fsys_preallocate((short)param0, (long)param1, (short)param2);
+
+                case KFN_COPY:
+                    return fsys_copy((const char *)param0, (const char *)param1, (short)param2, (p_copy_progress)param3);
+
+                case KFN_GET_FREE:
+                    return fsys_get_free((const char *)param0, (unsigned long *)param1, (unsigned long *)param2);
+
+                case KFN_READ_ASYNC:
+                    return fsys_read_async((short)param0, (unsigned char *)param1, (unsigned long)param2, (short *)param3);
+
+                case KFN_WRITE_ASYNC:
+                    return fsys_write_async((short)param0, (const unsigned char *)param1, (unsigned long)param2, (short *)param3);
+
                 default:
                     return ERR_GENERAL;
             }
@@ -16,6 +16,7 @@
 #include "memory.h"
 
 uint32_t mem_top_of_ram = 0;
+uint32_t mem_end_of_ram = 0;
 
 /*
  * Initialize the memory management system
@@ -24,6 +25,7 @@ uint32_t mem_top_of_ram = 0;
  */
 void mem_init(uint32_t top_of_ram) {
     mem_top_of_ram = top_of_ram;
+    mem_end_of_ram = top_of_ram;
 }
 
 /**
@@ -36,6 +38,28 @@ uint32_t mem_get_ramtop() {
     return mem_top_of_ram;
 }
 
+/**
+ * Return the end of system RAM... the top of system RAM before anything was reserved.
+ * Memory from the top of system RAM up to this address belongs to the kernel.
+ *
+ * @return the address one above the last byte of reserved system RAM
+ */
+uint32_t mem_get_ramend() {
+    return mem_end_of_ram;
+}
+
+/**
+ * Return the number of bytes that can still be reserved.
+ *
+ * mem_reserve does not check the size it is given, so callers that take a size from the
+ * user should check it against this first.
+ *
+ * @return the number of bytes between MEM_RESERVE_FLOOR and the top of system RAM
+ */
+uint32_t mem_get_free() {
+    return (mem_top_of_ram > MEM_RESERVE_FLOOR) ? mem_top_of_ram - MEM_RESERVE_FLOOR : 0;
+}
+
 /**
  * Reserve a block of memory at the top of system RAM.
  *
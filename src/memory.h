@@ -15,6 +15,14 @@
 #ifndef __MEMORY_H
 #define __MEMORY_H
 
+/*
+ * Reservations may not bring the top of system RAM below this address, so the kernel's
+ * own RAM and the lowest part of the user program area are never handed out.
+ */
+#ifndef MEM_RESERVE_FLOOR
+#define MEM_RESERVE_FLOOR   0x00020000
+#endif
+
 /*
  * Initialize the memory management system
  *
@@ -30,6 +38,24 @@ extern void mem_init(unsigned long top_of_ram);
  */
 extern unsigned long mem_get_ramtop();
 
+/**
+ * Return the end of system RAM... the top of system RAM before anything was reserved.
+ * Memory from the top of system RAM up to this address belongs to the kernel.
+ *
+ * @return the address one above the last byte of reserved system RAM
+ */
+extern unsigned long mem_get_ramend();
+
+/**
+ * Return the number of bytes that can still be reserved.
+ *
+ * mem_reserve does not check the size it is given, so callers that take a size from the
+ * user should check it against this first.
+ *
+ * @return the number of bytes between MEM_RESERVE_FLOOR and the top of system RAM
+ */
+extern unsigned long mem_get_free();
+
 /**
  * Reserve a block of memory at the top of system RAM.
  *
@@ -380,6 +380,52 @@ short sys_bdev_ioctrl(short dev, short command, unsigned char * buffer, short si
     return syscall(KFN_BDEV_IOCTRL, dev, command, buffer, size);
 }
 
+//
+// Read several consecutive sectors from the device
+//
+// Inputs:
+//  dev = the number of the device
+//  lba = the logical block address of the first sector to read
+//  buffer = the buffer into which to copy the sector data (must hold count sectors)
+//  count = the number of sectors to read
+//
+// Returns:
+//  number of sectors read, any negative number is an error code
+//
+short sys_bdev_read_multi(short dev, long lba, unsigned char * buffer, short count) {
+    return syscall(KFN_BDEV_READ_MULTI, dev, lba, buffer, count);
+}
+
+//
+// Write several consecutive sectors to the device
+//
+// Inputs:
+//  dev = the number of the device
+//  lba = the logical block address of the first sector to write
+//  buffer = the buffer containing the sector data to write (must hold count sectors)
+//  count = the number of sectors to write
+//
+// Returns:
+//  number of sectors written, any negative number is an error code
+//
+short sys_bdev_write_multi(short dev, long lba, const unsigned char * buffer, short count) {
+    return syscall(KFN_BDEV_WRITE_MULTI, dev, lba, buffer, count);
+}
+
+//
+// Get the I/O statistics for a device
+//
+// Inputs:
+//  dev = the number of the device
+//  stats = pointer to the t_bdev_stats to fill in
+//
+// Returns:
+//  0 on success, any negative number is an error code
+//
+short sys_bdev_stats(short dev, p_bdev_stats stats) {
+    return syscall(KFN_BDEV_STATS, dev, stats);
+}
+
 /*
  * File System Calls
  */
@@ -619,6 +665,121 @@ short sys_fsys_stat(const char * path, p_file_info file) {
     return (short)syscall(KFN_STAT, path, file);
 }
 
+/**
+ * Read as many entries from an open directory as fit in a buffer, in one call.
+ *
+ * The entries are stored as an array of t_dir_batch_entry at the front of the
+ * buffer, with their names packed in from the back. The buffer must have room for
+ * at least one entry with a name of the longest length. Sorting applies within
+ * the batch.
+ *
+ * @param dir the handle of the open directory (from sys_fsys_opendir or sys_fsys_findfirst)
+ * @param buffer the buffer to fill
+ * @param size the number of bytes in the buffer
+ * @param pattern file name pattern the entries must match for this call (0 for all entries, or the pattern given to sys_fsys_findfirst)
+ * @param sort the FSYS_SORT_ order to put the entries of the batch in
+ * @return the number of entries stored (0 at the end of the directory), negative number on error
+ */
+short sys_fsys_readdir_batch(short dir, p_dir_batch_entry buffer, unsigned long size, const char * pattern, short sort) {
+    return (short)syscall(KFN_READDIR_BATCH, dir, buffer, size, pattern, sort);
+}
+
+/**
+ * Reserve space for a file opened for writing, so that writing it does not have
+ * to grow its FAT chain one cluster at a time.
+ *
+ * The file's size becomes the requested size, and the file position is left where
+ * it was. A file that ends up shorter than its reservation should be truncated.
+ *
+ * @param fd the channel ID for the file
+ * @param size the number of bytes to reserve
+ * @param contiguous if non-zero, the space must be one run of clusters (the file must be empty)
+ * @return 0 on success, negative number on error
+ */
+short sys_fsys_preallocate(short fd, long size, short contiguous) {
+    return (short)syscall(KFN_PREALLOCATE, fd, size, contiguous);
+}
+
+/**
+ * Copy a file.
+ *
+ * The data moves through a buffer of whole clusters with multi-sector transfers,
+ * and the destination's clusters are reserved before anything is written. A copy
+ * that fails leaves no destination file behind. Copying a file onto itself fails
+ * with FSYS_ERR_COPY_SELF.
+ *
+ * @param src_path the path of the file to copy
+ * @param dst_path the path of the copy (replaced if it exists, unless FSYS_COPY_NO_OVERWRITE is given)
+ * @param flags FSYS_COPY_ flags
+ * @param progress function to call with the bytes copied so far and the file's size after each block (0 for none); returning a negative number stops the copy
+ * @return 0 on success, negative number on error
+ */
+short sys_fsys_copy(const char * src_path, const char * dst_path, short flags, p_copy_progress progress) {
+    return (short)syscall(KFN_COPY, src_path, dst_path, flags, progress);
+}
+
+/**
+ * Get the free space on the volume holding a path.
+ *
+ * Once the volume's free cluster map is built, this does not read the disk.
+ *
+ * @param path the path to the volume (or to anything on it)
+ * @param free pointer to the number of KB free on the volume
+ * @param total pointer to the number of KB the volume can hold (0 if not wanted)
+ * @return 0 on success, negative number on error
+ */
+short sys_fsys_get_free(const char * path, unsigned long * free, unsigned long * total) {
+    return (short)syscall(KFN_GET_FREE, path, free, total);
+}
+
+/**
+ * Start reading an open file in the background.
+ *
+ * The call returns at once. Where the drive can work on its own (the IDE drive in
+ * interrupt mode), whole runs of sectors are read in the background; otherwise the
+ * read moves a slice at a time, each time it is polled and whenever the kernel is
+ * idle. Either way, a program can keep its main loop running and poll once a pass. Until the read is finished, the buffer belongs to
+ * the kernel, and any other use of the file fails with DEV_BUSY.
+ *
+ * @param fd the channel ID for the file
+ * @param buffer the memory to fill
+ * @param size the number of bytes to read
+ * @param token pointer to the token to poll the read with
+ * @return 0 on success, negative number on error (DEV_BUSY if the file already has a transfer running)
+ */
+short sys_fsys_read_async(short fd, unsigned char * buffer, unsigned long size, short * token) {
+    return (short)syscall(KFN_READ_ASYNC, fd, buffer, size, token);
+}
+
+/**
+ * Start writing an open file in the background.
+ *
+ * Works like sys_fsys_read_async.
+ *
+ * @param fd the channel ID for the file
+ * @param buffer the bytes to write
+ * @param size the number of bytes to write
+ * @param token pointer to the token to poll the write with
+ * @return 0 on success, negative number on error (DEV_BUSY if the file already has a transfer running)
+ */
+short sys_fsys_write_async(short fd, const unsigned char * buffer, unsigned long size, short * token) {
+    return (short)syscall(KFN_WRITE_ASYNC, fd, buffer, size, token);
+}
+
+/**
+ * Check on a background read or write, moving it along if it is still running.
+ *
+ * Once the transfer is reported finished (or failed), its token is no longer valid.
+ * Closing the file drops any transfer on it.
+ *
+ * @param token the token of the transfer
+ * @param count pointer to the number of bytes moved so far (0 if not wanted)
+ * @return FSYS_ASYNC_PENDING if the transfer is still running, 0 if it is finished, negative number on error
+ */
+short sys_fsys_poll(short token, unsigned long * count) {
+    return (short)syscall(KFN_POLL, token, count);
+}
+
 /**
  * Return the top of system RAM... the user program must not use any
  * system memory from this address and above.
@@ -1,5 +1,9 @@
 /*
  * A simple utility to convert Motorola SREC to the Foenix PGZ file format
+ *
+ * With --compress, the output is the compressed PGZ format (PGC): contiguous records
+ * are gathered into segments, long runs of zeros become zero-fill segments, and the
+ * rest of the data is LZ4 compressed in blocks the kernel decompresses in place.
  */
 
 #include <ctype.h>
@@ -11,6 +15,16 @@
 
 #define MAX_BUFFER 128
 
+#define PGC_BLOCK_SIZE  16384   /* Bytes each block of a compressed segment decompresses to (must match the kernel) */
+#define PGC_BLOCK_RAW   0x8000  /* Block header flag: the block is stored uncompressed */
+#define PGC_ZERO_RUN    256     /* Shortest run of zeros worth turning into a zero-fill segment */
+
+#define LZ4_MIN_MATCH       4       /* Shortest match a sequence can encode */
+#define LZ4_MAX_OFFSET      65535   /* Furthest back a match can reach */
+#define LZ4_LAST_LITERALS   5       /* A block must end with at least this many literals */
+#define LZ4_MF_LIMIT        12      /* The last match must start at least this far from the end of a block */
+#define LZ4_HASH_BITS       12      /* Size of the match finder's hash table (log 2) */
+
 enum {
     STAT_ADDRESS_OVERFLOW = -3, /* The address field was too big for 24-bit format */
     STAT_COUNT_OVERFLOW = -2,   /* The count field was too big for 24-bit format */
@@ -37,9 +51,28 @@ typedef struct s_srecord {
     short checksum;
 } t_srecord, *p_srecord;
 
+/*
+ * A run of contiguous data gathered from the SREC file (for the compressed format)
+ */
+typedef struct s_segment {
+    long address;
+    unsigned long size;
+    unsigned long capacity;
+    unsigned char * data;
+} t_segment, *p_segment;
+
 /* Size of the address and count fields: 0 = 24-bit, 1 = 32-bit */
 short use_32bits = 0;
 
+/* Write the compressed format: 0 = PGZ, 1 = PGC */
+short use_compression = 0;
+
+/* Segments gathered for the compressed format */
+p_segment segments = 0;
+int segment_count = 0;
+long start_address = 0;
+short has_start = 0;
+
 /*
  * Convert a hex digit to a binary number
  */
@@ -252,6 +285,305 @@ short write_record(FILE * out, p_srecord r) {
     return 0;
 }
 
+/*
+ * Add a data record to the segments for the compressed format
+ *
+ * A record that carries on from the end of the last segment is added to it,
+ * anything else starts a new segment.
+ *
+ * Inputs:
+ * r = the record to add
+ *
+ * Returns:
+ * 0 on success, -1 if out of memory
+ */
+short gather_record(p_srecord r) {
+    p_segment segment = (segment_count > 0) ? &segments[segment_count - 1] : 0;
+
+    if (r->binary_count == 0) {
+        /* Start address record */
+        start_address = r->address;
+        has_start = 1;
+        return 0;
+    }
+
+    if ((segment == 0) || (segment->address + segment->size != r->address)) {
+        segments = realloc(segments, (segment_count + 1) * sizeof(t_segment));
+        if (segments == 0) {
+            return -1;
+        }
+        segment = &segments[segment_count++];
+        segment->address = r->address;
+        segment->size = 0;
+        segment->capacity = 0;
+        segment->data = 0;
+    }
+
+    if (segment->size + r->binary_count > segment->capacity) {
+        segment->capacity = (segment->capacity == 0) ? 4096 : segment->capacity * 2;
+        segment->data = realloc(segment->data, segment->capacity);
+        if (segment->data == 0) {
+            return -1;
+        }
+    }
+
+    memcpy(segment->data + segment->size, r->data, r->binary_count);
+    segment->size += r->binary_count;
+    return 0;
+}
+
+/*
+ * Write a little-endian long to a buffer
+ */
+void put_long(unsigned char * buffer, unsigned long value) {
+    buffer[0] = (unsigned char)(value & 0xff);
+    buffer[1] = (unsigned char)((value >> 8) & 0xff);
+    buffer[2] = (unsigned char)((value >> 16) & 0xff);
+    buffer[3] = (unsigned char)((value >> 24) & 0xff);
+}
+
+/*
+ * Write the header of a compressed format segment
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+short write_segment_header(FILE * out, unsigned long address, unsigned long size, unsigned long stored) {
+    unsigned char buffer[12];
+
+    fprintf(stderr, "{addr=%08lx, size=%08lx, stored=%08lx}\n", address, size, stored);
+
+    put_long(&buffer[0], address);
+    put_long(&buffer[4], size);
+    put_long(&buffer[8], stored);
+    if (write(fileno(out), buffer, sizeof(buffer)) == -1) {
+        perror("Error writing file");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Write the extra bytes of an LZ4 literal or match length
+ */
+unsigned char * put_length(unsigned char * op, unsigned long length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+/*
+ * Write an LZ4 sequence: the literals from anchor up to ip, then the match (if any)
+ */
+unsigned char * put_sequence(unsigned char * op, const unsigned char * anchor, const unsigned char * ip, unsigned long offset, unsigned long match_length) {
+    unsigned long literals = ip - anchor;
+    unsigned char * token = op++;
+
+    *token = (unsigned char)(((literals < 15) ? literals : 15) << 4);
+    if (literals >= 15) {
+        op = put_length(op, literals - 15);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    if (match_length > 0) {
+        *op++ = (unsigned char)(offset & 0xff);
+        *op++ = (unsigned char)((offset >> 8) & 0xff);
+
+        match_length -= LZ4_MIN_MATCH;
+        *token |= (unsigned char)((match_length < 15) ? match_length : 15);
+        if (match_length >= 15) {
+            op = put_length(op, match_length - 15);
+        }
+    }
+
+    return op;
+}
+
+/*
+ * Hash the four bytes at p for the match finder
+ */
+unsigned long lz4_hash(const unsigned char * p) {
+    unsigned long sequence = (unsigned long)p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+    return ((sequence * 2654435761UL) & 0xffffffffUL) >> (32 - LZ4_HASH_BITS);
+}
+
+/*
+ * Compress one block of a segment as an LZ4 block
+ *
+ * Matches may reach back into the earlier blocks of the segment, which the kernel
+ * will already have decompressed in front of the block.
+ *
+ * Inputs:
+ * base = the start of the segment's data
+ * start = offset of the first byte of the block
+ * end = offset of the byte after the block
+ * table = the match finder's hash table (offsets into the segment, -1 if empty)
+ * out = the buffer to fill (at least twice the size of the block)
+ *
+ * Returns:
+ * the number of bytes in the compressed block
+ */
+unsigned long compress_block(const unsigned char * base, unsigned long start, unsigned long end, long * table, unsigned char * out) {
+    const unsigned char * ip = base + start;
+    const unsigned char * anchor = ip;
+    const unsigned char * iend = base + end;
+    unsigned char * op = out;
+
+    if (end - start > LZ4_MF_LIMIT) {
+        const unsigned char * mflimit = iend - LZ4_MF_LIMIT;
+        const unsigned char * matchlimit = iend - LZ4_LAST_LITERALS;
+
+        while (ip <= mflimit) {
+            unsigned long h = lz4_hash(ip);
+            long candidate = table[h];
+            table[h] = ip - base;
+
+            if ((candidate >= 0) && ((ip - base) - candidate <= LZ4_MAX_OFFSET) && (memcmp(base + candidate, ip, LZ4_MIN_MATCH) == 0)) {
+                const unsigned char * match = base + candidate;
+                unsigned long length = LZ4_MIN_MATCH;
+
+                while ((ip + length < matchlimit) && (match[length] == ip[length])) {
+                    length++;
+                }
+
+                op = put_sequence(op, anchor, ip, ip - match, length);
+
+                /* Remember the positions inside the match too, so later data can refer to them */
+                for (ip++, length--; length > 0; ip++, length--) {
+                    if (ip <= mflimit) {
+                        table[lz4_hash(ip)] = ip - base;
+                    }
+                }
+                anchor = ip;
+
+            } else {
+                ip++;
+            }
+        }
+    }
+
+    /* The rest of the block is literals */
+    op = put_sequence(op, anchor, iend, 0, 0);
+    return op - out;
+}
+
+/*
+ * Write a data segment in the compressed format
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+short write_data_segment(FILE * out, unsigned long address, const unsigned char * data, unsigned long size) {
+    long table[1 << LZ4_HASH_BITS];
+    unsigned char * payload = malloc(size + 2 * (size / PGC_BLOCK_SIZE + 1));
+    unsigned char * block = malloc(2 * PGC_BLOCK_SIZE + 64);
+    unsigned long stored = 0;
+    unsigned long start, end, packed;
+    int i;
+
+    if ((payload == 0) || (block == 0)) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    for (i = 0; i < (1 << LZ4_HASH_BITS); i++) {
+        table[i] = -1;
+    }
+
+    for (start = 0; start < size; start = end) {
+        end = (size - start < PGC_BLOCK_SIZE) ? size : start + PGC_BLOCK_SIZE;
+
+        packed = compress_block(data, start, end, table, block);
+        if (packed < end - start) {
+            /* Compressed block */
+            payload[stored++] = (unsigned char)(packed & 0xff);
+            payload[stored++] = (unsigned char)((packed >> 8) & 0xff);
+            memcpy(payload + stored, block, packed);
+            stored += packed;
+
+        } else {
+            /* Incompressible block: store it as it is */
+            packed = (end - start) | PGC_BLOCK_RAW;
+            payload[stored++] = (unsigned char)(packed & 0xff);
+            payload[stored++] = (unsigned char)((packed >> 8) & 0xff);
+            memcpy(payload + stored, data + start, end - start);
+            stored += end - start;
+        }
+    }
+
+    if ((write_segment_header(out, address, size, stored) == -1) || (write(fileno(out), payload, stored) == -1)) {
+        perror("Error writing file");
+        return -1;
+    }
+
+    free(block);
+    free(payload);
+    return 0;
+}
+
+/*
+ * Write the gathered segments in the compressed format
+ *
+ * Runs of at least PGC_ZERO_RUN zeros are split out into zero-fill segments, which
+ * take no space in the file.
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+short write_compressed(FILE * out) {
+    int i;
+
+    for (i = 0; i < segment_count; i++) {
+        p_segment segment = &segments[i];
+        unsigned long data_start = 0;
+        unsigned long position = 0;
+
+        while (position < segment->size) {
+            unsigned long run = 0;
+
+            while ((position + run < segment->size) && (segment->data[position + run] == 0)) {
+                run++;
+            }
+
+            if (run >= PGC_ZERO_RUN) {
+                /* Flush any data in front of the run, then write the run as a zero-fill segment */
+                if (position > data_start) {
+                    if (write_data_segment(out, segment->address + data_start, segment->data + data_start, position - data_start) == -1) {
+                        return -1;
+                    }
+                }
+
+                if (write_segment_header(out, segment->address + position, run, 0) == -1) {
+                    return -1;
+                }
+
+                position += run;
+                data_start = position;
+
+            } else {
+                position += (run > 0) ? run : 1;
+            }
+        }
+
+        if (segment->size > data_start) {
+            if (write_data_segment(out, segment->address + data_start, segment->data + data_start, segment->size - data_start) == -1) {
+                return -1;
+            }
+        }
+    }
+
+    if (has_start) {
+        return write_segment_header(out, start_address, 0, 0);
+    }
+
+    return 0;
+}
+
 int main(int argc, char * argv[]) {
     FILE * in_file;
     FILE * out_file;
@@ -275,14 +607,19 @@ int main(int argc, char * argv[]) {
                 in_file_arg = 2;
                 out_file_arg = 3;
                 use_32bits = 1;
+            } else if (strcmp(argv[1], "--compress") == 0) {
+                in_file_arg = 2;
+                out_file_arg = 3;
+                use_32bits = 1;
+                use_compression = 1;
             } else {
-                fprintf(stderr, "Usage: srecpgx [--large] <inputfile> <outputfile>\n");
+                fprintf(stderr, "Usage: srecpgx [--large | --compress] <inputfile> <outputfile>\n");
                 exit(5);
             }
             break;
 
         default:
-            fprintf(stderr, "Usage: srecpgx [--large] <inputfile> <outputfile>\n");
+            fprintf(stderr, "Usage: srecpgx [--large | --compress] <inputfile> <outputfile>\n");
             exit(5);
     }
 
@@ -298,8 +635,10 @@ int main(int argc, char * argv[]) {
         exit(7);
     }
 
-    /* Write the signature... use a lower case 'z' to distinguish */
-    if (use_32bits) {
+    /* Write the signature... use a lower case 'z' to distinguish, and 'c' for compressed */
+    if (use_compression) {
+        signature[0] = 'c';
+    } else if (use_32bits) {
         signature[0] = 'z';
     } else {
         signature[0] = 'Z';
@@ -314,6 +653,15 @@ int main(int argc, char * argv[]) {
         line_number++;
         switch (r.status) {
             case STAT_GOOD:
+                if (use_compression) {
+                    /* Compressed segments are written once the whole file has been read */
+                    if (gather_record(&r) == -1) {
+                        fprintf(stderr, "Out of memory on line %d", line_number);
+                        exit(13);
+                    }
+                    break;
+                }
+
                 n = write_record(out_file, &r);
                 if (n == -1) {
                     fprintf(stderr, "Error writing the output file on line %d", line_number);
@@ -359,6 +707,11 @@ int main(int argc, char * argv[]) {
         }
     }
 
+    if (use_compression && (write_compressed(out_file) == -1)) {
+        fprintf(stderr, "Error writing the output file");
+        exit(10);
+    }
+
     fclose(in_file);
     fclose(out_file);
     return 0;